@@ -372,6 +372,10 @@ int CControlSocket::CheckOverwriteFile()
 	auto & data = static_cast<CFileTransferOpData &>(*operations_.back());
 
 	if (data.download_) {
+		// Segments get written into the file prepared for them
+		if (data.transferSettings_.segment) {
+			return FZ_REPLY_OK;
+		}
 		if (fz::local_filesys::get_file_type(fz::to_native(data.localFile_), true) != fz::local_filesys::file) {
 			return FZ_REPLY_OK;
 		}
@@ -1316,6 +1320,11 @@ void CControlSocket::List(CServerPath const&, std::wstring const&, int)
 	Push(std::make_unique<CNotSupportedOpData>());
 }
 
+void CControlSocket::BatchTransfer(CBatchTransferCommand const&)
+{
+	Push(std::make_unique<CNotSupportedOpData>());
+}
+
 void CControlSocket::RawCommand(std::wstring const&)
 {
 	Push(std::make_unique<CNotSupportedOpData>());
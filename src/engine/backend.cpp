@@ -2,6 +2,7 @@
 
 #include "backend.h"
 #include "socket.h"
+#include "zerocopy.h"
 #include <errno.h>
 
 CBackend::CBackend(fz::event_handler* pEvtHandler)
@@ -71,6 +72,48 @@ int CSocketBackend::Read(void *buffer, unsigned int len, int& error)
 	return read;
 }
 
+int CSocketBackend::SendFile(CZeroCopyFile& file, unsigned int len, int& error)
+{
+	int64_t max = GetAvailableBytes(CRateLimiter::outbound);
+	if (max == 0) {
+		Wait(CRateLimiter::outbound);
+		error = EAGAIN;
+		return -1;
+	}
+	else if (max > 0 && max < len) {
+		len = static_cast<unsigned int>(max);
+	}
+
+	int written = file.Send(socket_, len, error);
+
+	if (written > 0 && max != -1) {
+		UpdateUsage(CRateLimiter::outbound, written);
+	}
+
+	return written;
+}
+
+int CSocketBackend::ReceiveFile(CZeroCopyFile& file, unsigned int len, int& error)
+{
+	int64_t max = GetAvailableBytes(CRateLimiter::inbound);
+	if (max == 0) {
+		Wait(CRateLimiter::inbound);
+		error = EAGAIN;
+		return -1;
+	}
+	else if (max > 0 && max < len) {
+		len = static_cast<unsigned int>(max);
+	}
+
+	int read = file.Receive(socket_, len, error);
+
+	if (read > 0 && max != -1) {
+		UpdateUsage(CRateLimiter::inbound, read);
+	}
+
+	return read;
+}
+
 int CSocketBackend::Peek(void *buffer, unsigned int len, int& error)
 {
 	return socket_.peek(buffer, len, error);
@@ -27,6 +27,8 @@ namespace fz {
 class CSocket;
 }
 
+class CZeroCopyFile;
+
 class CSocketBackend final : public CBackend
 {
 public:
@@ -37,6 +39,10 @@ public:
 	virtual int Peek(void *buffer, unsigned int size, int& error) override;
 	virtual int Write(const void *buffer, unsigned int size, int& error) override;
 
+	// Like Write and Read, but the data goes directly from or to the file
+	int SendFile(CZeroCopyFile& file, unsigned int size, int& error);
+	int ReceiveFile(CZeroCopyFile& file, unsigned int size, int& error);
+
 protected:
 	virtual void OnRateAvailable(CRateLimiter::rate_direction direction) override;
 
@@ -80,6 +80,29 @@ bool CFileTransferCommand::Download() const
 	return m_download;
 }
 
+CBatchTransferCommand::CBatchTransferCommand(std::vector<CFileTransferCommand> && files)
+	: m_files(std::move(files))
+{
+}
+
+bool CBatchTransferCommand::valid() const
+{
+	if (m_files.empty()) {
+		return false;
+	}
+
+	for (auto const& file : m_files) {
+		if (file.GetLocalFile().empty() || file.GetRemoteFile().empty() || file.GetRemotePath().empty()) {
+			return false;
+		}
+		if (file.GetTransferSettings().segment) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 CRawCommand::CRawCommand(std::wstring const& command)
 {
 	m_command = command;
@@ -2088,6 +2088,26 @@ bool CDirectoryListingParser::AddLine(std::wstring && line, std::wstring && name
 	return true;
 }
 
+void CDirectoryListingParser::AddEntry(CDirentry && entry, std::wstring const& permissions, std::wstring const& ownerGroup)
+{
+	if (entry.name == L"." || entry.name == L"..") {
+		return;
+	}
+
+	fz::shared_value<CDirentry> refEntry;
+	CDirentry & e = refEntry.get();
+	e = std::move(entry);
+	e.permissions = objcache.get(permissions);
+	e.ownerGroup = objcache.get(ownerGroup);
+
+	auto const timezoneOffset = m_server.GetTimezoneOffset();
+	if (timezoneOffset && !e.time.empty()) {
+		e.time += fz::duration::from_minutes(timezoneOffset);
+	}
+
+	entries_.emplace_back(std::move(refEntry));
+}
+
 CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 {
 	while (!m_DataList.empty()) {
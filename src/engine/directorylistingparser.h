@@ -61,6 +61,10 @@ public:
 	bool AddData(char *pData, int len);
 	bool AddLine(std::wstring && line, std::wstring && name, fz::datetime const& time);
 
+	// For entries whose fields are known already, e.g. from SFTP attributes.
+	// Skips all parsing, only the server's timezone offset gets applied.
+	void AddEntry(CDirentry && entry, std::wstring const& permissions, std::wstring const& ownerGroup);
+
 	void Reset();
 
 	void SetTimezoneOffset(fz::duration const& span) { m_timezoneOffset = span; }
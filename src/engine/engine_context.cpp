@@ -2,9 +2,11 @@
 #include "engine_context.h"
 
 #include "directorycache.h"
+#include "iouring.h"
 #include "logging_private.h"
 #include "pathcache.h"
 #include "ratelimiter.h"
+#include "tlssessioncache.h"
 
 #include <libfilezilla/event_loop.hpp>
 #include <libfilezilla/thread_pool.hpp>
@@ -52,18 +54,34 @@ public:
 		CLogging::UpdateLogLevel(options);
 
 		directory_cache_.SetTtl(fz::duration::from_seconds(options.GetOptionVal(OPTION_CACHE_TTL)));
+
+		if (options.GetOptionVal(OPTION_IO_URING)) {
+			uring_ = CIOUring::Create(pool_);
+		}
+
+		tls_session_cache_file_ = fz::to_native(options.GetOption(OPTION_TLS_SESSION_CACHE_FILE));
+		if (!tls_session_cache_file_.empty()) {
+			tls_session_cache_.Load(tls_session_cache_file_);
+		}
 	}
 
 	~Impl()
 	{
 		optionChangeHandler_.remove_handler();
+
+		if (!tls_session_cache_file_.empty()) {
+			tls_session_cache_.Save(tls_session_cache_file_);
+		}
 	}
 
 	fz::thread_pool pool_;
+	std::unique_ptr<CIOUring> uring_;
 	fz::event_loop loop_;
 	CRateLimiter limiter_;
 	CDirectoryCache directory_cache_;
 	CPathCache path_cache_;
+	CTlsSessionCache tls_session_cache_;
+	fz::native_string tls_session_cache_file_;
 	CLoggingOptionsChanged optionChangeHandler_;
 };
 
@@ -102,3 +120,13 @@ CPathCache& CFileZillaEngineContext::GetPathCache()
 {
 	return impl_->path_cache_;
 }
+
+CTlsSessionCache& CFileZillaEngineContext::GetTlsSessionCache()
+{
+	return impl_->tls_session_cache_;
+}
+
+CIOUring* CFileZillaEngineContext::GetIOUring()
+{
+	return impl_->uring_.get();
+}
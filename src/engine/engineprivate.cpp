@@ -38,8 +38,10 @@ CFileZillaEnginePrivate::CFileZillaEnginePrivate(CFileZillaEngineContext& contex
 	, m_rateLimiter(context.GetRateLimiter())
 	, directory_cache_(context.GetDirectoryCache())
 	, path_cache_(context.GetPathCache())
+	, tls_session_cache_(context.GetTlsSessionCache())
 	, parent_(parent)
 	, thread_pool_(context.GetThreadPool())
+	, uring_(context.GetIOUring())
 	, encoding_converter_(context.GetCustomEncodingConverter())
 {
 	m_engineList.push_back(this);
@@ -372,10 +374,29 @@ int CFileZillaEnginePrivate::List(CListCommand const& command)
 
 int CFileZillaEnginePrivate::FileTransfer(CFileTransferCommand const& command)
 {
+	if (command.GetTransferSettings().segment) {
+		// Line ending conversion would shift the offsets
+		if (!command.Download() || !command.GetTransferSettings().binary ||
+			!CServer::ProtocolHasFeature(controlSocket_->GetCurrentServer().GetProtocol(), ProtocolFeature::SegmentedDownload))
+		{
+			return FZ_REPLY_CRITICALERROR | FZ_REPLY_NOTSUPPORTED;
+		}
+	}
+
 	controlSocket_->FileTransfer(command.GetLocalFile(), command.GetRemotePath(), command.GetRemoteFile(), command.Download(), command.GetTransferSettings());
 	return FZ_REPLY_CONTINUE;
 }
 
+int CFileZillaEnginePrivate::BatchTransfer(CBatchTransferCommand const& command)
+{
+	if (!CServer::ProtocolHasFeature(controlSocket_->GetCurrentServer().GetProtocol(), ProtocolFeature::BatchTransfer)) {
+		return FZ_REPLY_CRITICALERROR | FZ_REPLY_NOTSUPPORTED;
+	}
+
+	controlSocket_->BatchTransfer(command);
+	return FZ_REPLY_CONTINUE;
+}
+
 int CFileZillaEnginePrivate::RawCommand(CRawCommand const& command)
 {
 	{
@@ -628,6 +649,9 @@ void CFileZillaEnginePrivate::OnCommandEvent()
 			case Command::transfer:
 				res = FileTransfer(static_cast<CFileTransferCommand const&>(command));
 				break;
+			case Command::batchtransfer:
+				res = BatchTransfer(static_cast<CBatchTransferCommand const&>(command));
+				break;
 			case Command::raw:
 				res = RawCommand(static_cast<CRawCommand const&>(command));
 				break;
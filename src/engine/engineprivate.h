@@ -13,6 +13,7 @@
 #include <atomic>
 
 class CControlSocket;
+class CIOUring;
 class CLogging;
 class CRateLimiter;
 
@@ -89,7 +90,9 @@ public:
 	CRateLimiter& GetRateLimiter() { return m_rateLimiter; }
 	CDirectoryCache& GetDirectoryCache() { return directory_cache_; }
 	CPathCache& GetPathCache() { return path_cache_; }
+	CTlsSessionCache& GetTlsSessionCache() { return tls_session_cache_; }
 	fz::thread_pool& GetThreadPool() { return thread_pool_; }
+	CIOUring* GetIOUring() { return uring_; }
 
 	// If deleting or renaming a directory, it could be possible that another
 	// engine's CControlSocket instance still has that directory as
@@ -124,6 +127,7 @@ protected:
 	int Disconnect(CDisconnectCommand const& command);
 	int List(CListCommand const&command);
 	int FileTransfer(CFileTransferCommand const& command);
+	int BatchTransfer(CBatchTransferCommand const& command);
 	int RawCommand(CRawCommand const& command);
 	int Delete(CDeleteCommand& command);
 	int RemoveDir(CRemoveDirCommand const& command);
@@ -195,6 +199,7 @@ protected:
 	CRateLimiter& m_rateLimiter;
 	CDirectoryCache& directory_cache_;
 	CPathCache& path_cache_;
+	CTlsSessionCache& tls_session_cache_;
 
 	CFileZillaEngine& parent_;
 
@@ -202,6 +207,7 @@ protected:
 	std::vector<CLogmsgNotification*> queued_logs_;
 
 	fz::thread_pool & thread_pool_;
+	CIOUring* const uring_;
 
 	CustomEncodingConverterBase const& encoding_converter_;
 };
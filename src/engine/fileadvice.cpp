@@ -0,0 +1,140 @@
+#include <filezilla.h>
+
+#include "fileadvice.h"
+
+#include <errno.h>
+
+#if HAVE_FALLOCATE || HAVE_POSIX_FALLOCATE || HAVE_POSIX_FADVISE
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// Amount of recently transferred data which is kept in the page cache.
+// Advice is given at most once per this much data.
+int64_t const cached_window = 16 * 1024 * 1024;
+}
+
+bool ReserveFileSpace(fz::native_string const& path, int64_t size, int& error)
+{
+	error = 0;
+
+#if HAVE_FALLOCATE || HAVE_POSIX_FALLOCATE
+	int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd == -1) {
+		error = errno;
+		return false;
+	}
+
+#if HAVE_FALLOCATE
+	// Unlike posix_fallocate, never falls back to writing out the whole file
+	int res = fallocate(fd, 0, 0, size) ? errno : 0;
+#else
+	int res = posix_fallocate(fd, 0, size);
+#endif
+	close(fd);
+
+	if (res == EOPNOTSUPP || res == ENOSYS || res == EINVAL) {
+		// Not supported by the file system
+		return false;
+	}
+	error = res;
+	return !res;
+#else
+	(void)path;
+	(void)size;
+	return false;
+#endif
+}
+
+CFileAdvice::~CFileAdvice()
+{
+	Close();
+}
+
+void CFileAdvice::Attach(int fd, bool read, int64_t offset)
+{
+	Close();
+
+#if HAVE_POSIX_FADVISE
+	fd_ = fd;
+	owned_ = false;
+	read_ = read;
+	offset_ = offset;
+	dropped_ = offset;
+	advised_ = offset;
+
+	if (read) {
+		posix_fadvise(fd_, offset, 0, POSIX_FADV_SEQUENTIAL);
+	}
+#else
+	(void)fd;
+	(void)read;
+	(void)offset;
+#endif
+}
+
+bool CFileAdvice::Open(fz::native_string const& path, bool read, int64_t offset)
+{
+	Close();
+
+#if HAVE_POSIX_FADVISE
+	int fd = open(path.c_str(), (read ? O_RDONLY : O_WRONLY) | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+
+	// Readahead is tracked per descriptor, announcing sequential reads
+	// here would have no effect on the one doing the actual reading.
+	Attach(fd, false, offset);
+	owned_ = true;
+	read_ = read;
+
+	return true;
+#else
+	(void)path;
+	(void)read;
+	(void)offset;
+	return false;
+#endif
+}
+
+void CFileAdvice::Transferred(int64_t len)
+{
+#if HAVE_POSIX_FADVISE
+	if (fd_ == -1 || len <= 0) {
+		return;
+	}
+
+	offset_ += len;
+
+	int64_t const end = offset_ - cached_window;
+	if (end - advised_ < cached_window) {
+		return;
+	}
+
+	posix_fadvise(fd_, dropped_, end - dropped_, POSIX_FADV_DONTNEED);
+	if (read_) {
+		dropped_ = end;
+	}
+	else {
+		// Dirty pages cannot be dropped, the advice merely starts writing
+		// them back. Cover them again next time, by then they are clean.
+		dropped_ = advised_;
+	}
+	advised_ = end;
+#else
+	(void)len;
+#endif
+}
+
+void CFileAdvice::Close()
+{
+#if HAVE_POSIX_FADVISE
+	if (fd_ != -1 && owned_) {
+		close(fd_);
+	}
+#endif
+	fd_ = -1;
+	owned_ = false;
+}
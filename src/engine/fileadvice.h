@@ -0,0 +1,56 @@
+#ifndef FILEZILLA_ENGINE_FILEADVICE_HEADER
+#define FILEZILLA_ENGINE_FILEADVICE_HEADER
+
+#include <libfilezilla/libfilezilla.hpp>
+
+// Allocates disk space for the file to grow to the given size, extending
+// it if needed. Unlike merely setting the size, this gives the file system
+// the chance to lay out the file in one go. Returns false if not supported
+// by the platform or the file system, in which case error is 0, or on
+// failure.
+//
+// Whoever writes to the file is responsible for truncating it to the
+// amount of data actually written, see CIOThread::Close.
+bool ReserveFileSpace(fz::native_string const& path, int64_t size, int& error);
+
+// Keeps large sequential transfers from evicting the page cache.
+//
+// As the transfer progresses, data which has been transferred gets dropped
+// from the page cache, except for the most recent few megabytes. Small
+// files are not affected. All of this is advisory, errors are ignored.
+class CFileAdvice final
+{
+public:
+	CFileAdvice() = default;
+	~CFileAdvice();
+
+	CFileAdvice(CFileAdvice const&) = delete;
+	CFileAdvice& operator=(CFileAdvice const&) = delete;
+
+	// Uses the descriptor the file is accessed through, it needs to stay
+	// open until Close is called. Reads also get announced as sequential.
+	void Attach(int fd, bool read, int64_t offset);
+
+	// Opens a separate descriptor, for files accessed through fz::file.
+	bool Open(fz::native_string const& path, bool read, int64_t offset);
+
+	// To be called with the amount of data read from or written to the
+	// file, in whichever order it completes.
+	void Transferred(int64_t len);
+
+	void Close();
+
+private:
+	int fd_{-1};
+	bool owned_{};
+	bool read_{};
+
+	int64_t offset_{};
+
+	// Data before dropped_ is out of the page cache, advised_ is the end
+	// of the range covered by the most recent advice.
+	int64_t dropped_{};
+	int64_t advised_{};
+};
+
+#endif
@@ -20,21 +20,32 @@ int CFtpDeleteOpData::Send()
 		return FZ_REPLY_CONTINUE;
 	}
 	else if (opState == del_del) {
-		std::wstring const& file = files_.front();
-		if (file.empty()) {
-			LogMessage(MessageType::Debug_Info, L"Empty filename");
-			return FZ_REPLY_INTERNALERROR;
-		}
-
-		std::wstring filename = path_.FormatFilename(file, omitPath_);
-		if (filename.empty()) {
-			LogMessage(MessageType::Error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
-			return FZ_REPLY_ERROR;
+		// Files are independent of each other, keep several commands in flight
+		size_t const depth = controlSocket_.PipelineDepth();
+		while (sent_ < files_.size() && sent_ < depth) {
+			std::wstring const& file = files_[sent_];
+			if (file.empty()) {
+				LogMessage(MessageType::Debug_Info, L"Empty filename");
+				return FZ_REPLY_INTERNALERROR;
+			}
+
+			std::wstring filename = path_.FormatFilename(file, omitPath_);
+			if (filename.empty()) {
+				LogMessage(MessageType::Error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
+				return FZ_REPLY_ERROR;
+			}
+
+			engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
+
+			// Only the first command in flight gives a meaningful round-trip time
+			int res = controlSocket_.SendCommand(L"DELE " + filename, false, !sent_);
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				return res;
+			}
+			++sent_;
 		}
 
-		engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
-
-		return controlSocket_.SendCommand(L"DELE " + filename);
+		return FZ_REPLY_WOULDBLOCK;
 	}
 
 	LogMessage(MessageType::Debug_Warning, L"Unkown op state %d", opState);
@@ -46,6 +57,19 @@ int CFtpDeleteOpData::ParseResponse()
 	LogMessage(MessageType::Debug_Verbose, L"CFtpDeleteOpData::ParseResponse() in state %d", opState);
 
 	int code = controlSocket_.GetReplyCode();
+	if (code == 1) {
+		// Preliminary reply, the actual one still follows. Servers sending
+		// these for DELE cannot be trusted with several commands in flight.
+		if (sent_ > 1) {
+			controlSocket_.DisablePipelining();
+		}
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	if (sent_) {
+		--sent_;
+	}
+
 	if (code != 2 && code != 3) {
 		deleteFailed_ = true;
 	}
@@ -67,11 +91,16 @@ int CFtpDeleteOpData::ParseResponse()
 
 	files_.pop_front();
 
-	if (!files_.empty()) {
+	if (files_.empty()) {
+		return deleteFailed_ ? FZ_REPLY_ERROR : FZ_REPLY_OK;
+	}
+
+	if (sent_ < files_.size()) {
 		return FZ_REPLY_CONTINUE;
 	}
 
-	return deleteFailed_ ? FZ_REPLY_ERROR : FZ_REPLY_OK;
+	// Commands for all remaining files have been sent already
+	return FZ_REPLY_WOULDBLOCK;
 }
 
 int CFtpDeleteOpData::SubcommandResult(int prevResult, COpData const&)
@@ -97,6 +126,12 @@ int CFtpDeleteOpData::Reset(int result)
 {
 	LogMessage(MessageType::Debug_Verbose, L"CFtpDeleteOpData::Reset(%d) in state %d", result, opState);
 
+	if ((result & FZ_REPLY_TIMEOUT) == FZ_REPLY_TIMEOUT && sent_ > 1) {
+		// Some servers silently drop commands received while still busy
+		// with a previous one.
+		controlSocket_.DisablePipelining();
+	}
+
 	if (needSendListing_ && !(result & FZ_REPLY_DISCONNECTED)) {
 		controlSocket_.SendDirectoryListingNotification(path_, false, false);
 	}
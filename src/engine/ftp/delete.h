@@ -22,6 +22,10 @@ public:
 	std::deque<std::wstring> files_;
 	bool omitPath_{};
 
+	// Number of DELE commands sent and still awaiting their reply. They
+	// are for the first files in files_, replies arrive in the same order.
+	size_t sent_{};
+
 	// Set to fz::monotonic_clock::now initially and after
 	// sending an updated listing to the UI.
 	fz::monotonic_clock time_;
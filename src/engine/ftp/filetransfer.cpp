@@ -1,13 +1,33 @@
 #include <filezilla.h>
 
 #include "directorycache.h"
+#include "fileadvice.h"
 #include "filetransfer.h"
 #include "servercapabilities.h"
 #include "transfersocket.h"
+#include "zerocopy.h"
 
 #include <libfilezilla/file.hpp>
 #include <libfilezilla/local_filesys.hpp>
 
+namespace {
+bool zero_copy_allowed(COptionsBase & options, bool download)
+{
+	if (!options.GetOptionVal(OPTION_FTP_ZEROCOPY) || !CZeroCopyFile::Supported()) {
+		return false;
+	}
+
+	// Rate limiting hands out data in small slices, leaving little to gain
+	if (options.GetOptionVal(OPTION_SPEEDLIMIT_ENABLE) != 0 &&
+		options.GetOptionVal(download ? OPTION_SPEEDLIMIT_INBOUND : OPTION_SPEEDLIMIT_OUTBOUND) != 0)
+	{
+		return false;
+	}
+
+	return true;
+}
+}
+
 CFtpFileTransferOpData::CFtpFileTransferOpData(CFtpControlSocket& controlSocket, bool is_download, std::wstring const& local_file, std::wstring const& remote_file, CServerPath const& remote_path, CFileTransferCommand::t_transferSettings const& settings)
 	: CFileTransferOpData(is_download, local_file, remote_file, remote_path, settings)
 	, CFtpOpData(controlSocket)
@@ -69,8 +89,15 @@ int CFtpFileTransferOpData::Send()
 		}
 
 		{
+			int64_t expectedSize = -1;
 			auto pFile = std::make_unique<fz::file>();
-			if (download_) {
+			if (download_ && transferSettings_.segment) {
+				int res = OpenSegment(*pFile, expectedSize);
+				if (res != FZ_REPLY_CONTINUE) {
+					return res;
+				}
+			}
+			else if (download_) {
 				int64_t startOffset = 0;
 
 				// Potentially racy
@@ -116,21 +143,37 @@ int CFtpFileTransferOpData::Send()
 
 				engine_.transfer_status_.Init(remoteFileSize_, startOffset, false);
 
-				if (engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE)) {
-					// Try to preallocate the file in order to reduce fragmentation
-					int64_t sizeToPreallocate = remoteFileSize_ - startOffset;
-					if (sizeToPreallocate > 0) {
-						LogMessage(MessageType::Debug_Info, L"Preallocating %d bytes for the file \"%s\"", sizeToPreallocate, localFile_);
-						auto oldPos = pFile->seek(0, fz::file::current);
-						if (oldPos >= 0) {
-							if (pFile->seek(sizeToPreallocate, fz::file::end) == remoteFileSize_) {
-								if (!pFile->truncate()) {
-									LogMessage(MessageType::Debug_Warning, L"Could not preallocate the file");
+				if (remoteFileSize_ >= startOffset) {
+					expectedSize = remoteFileSize_ - startOffset;
+				}
+
+				// Try to preallocate the file in order to reduce fragmentation
+				int64_t sizeToPreallocate = remoteFileSize_ - startOffset;
+				if (sizeToPreallocate > 0) {
+					// Where the file system supports reserving space, doing so is
+					// cheap, unlike writing out the whole file.
+					int error{};
+					if (ReserveFileSpace(fz::to_native(localFile_), remoteFileSize_, error)) {
+						LogMessage(MessageType::Debug_Info, L"Reserved %d bytes for the file \"%s\"", sizeToPreallocate, localFile_);
+					}
+					else {
+						if (error) {
+							LogMessage(MessageType::Debug_Warning, L"Could not reserve disk space: %s", fz::to_wstring(GetSystemErrorDescription(error)));
+						}
+
+						if (engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE)) {
+							LogMessage(MessageType::Debug_Info, L"Preallocating %d bytes for the file \"%s\"", sizeToPreallocate, localFile_);
+							auto oldPos = pFile->seek(0, fz::file::current);
+							if (oldPos >= 0) {
+								if (pFile->seek(sizeToPreallocate, fz::file::end) == remoteFileSize_) {
+									if (!pFile->truncate()) {
+										LogMessage(MessageType::Debug_Warning, L"Could not preallocate the file");
+									}
+								}
+								if (pFile->seek(oldPos, fz::file::begin) != oldPos) {
+									LogMessage(MessageType::Error, _("Could not seek to offset %d within file"), oldPos);
+									return FZ_REPLY_ERROR;
 								}
-							}
-							if (pFile->seek(oldPos, fz::file::begin) != oldPos) {
-								LogMessage(MessageType::Error, _("Could not seek to offset %d within file"), oldPos);
-								return FZ_REPLY_ERROR;
 							}
 						}
 					}
@@ -194,19 +237,66 @@ int CFtpFileTransferOpData::Send()
 
 				auto len = pFile->size();
 				engine_.transfer_status_.Init(len, startOffset, false);
+
+				if (len >= startOffset) {
+					expectedSize = len - startOffset;
+				}
+			}
+
+			bool const synthetic = engine_.GetOptions().GetOptionVal(OPTION_IO_SYNTHETIC) != 0;
+			if (synthetic) {
+				LogMessage(MessageType::Debug_Warning, L"Synthetic I/O enabled, not accessing local file contents");
+			}
+
+			// Compressing the data connection gains more than avoiding copies
+			zeroCopyFile_.reset();
+			if (!synthetic && binary && !controlSocket_.m_protectDataChannel && !controlSocket_.UseModeZ() && zero_copy_allowed(engine_.GetOptions(), download_)) {
+				int64_t const offset = pFile->seek(0, fz::file::current);
+				auto zeroCopyFile = std::make_unique<CZeroCopyFile>();
+				if (offset >= 0 && zeroCopyFile->Open(fz::to_native(localFile_), !download_, offset)) {
+					LogMessage(MessageType::Debug_Info, L"Using zero-copy transfer");
+					if (transferSettings_.segment && transferSettings_.segmentLength >= 0) {
+						zeroCopyFile->KeepSize();
+					}
+					zeroCopyFile_ = std::move(zeroCopyFile);
+				}
+				else {
+					LogMessage(MessageType::Debug_Warning, L"Could not set up zero-copy transfer: %s", zeroCopyFile->GetError());
+				}
 			}
-			ioThread_ = std::make_unique<CIOThread>();
-			if (!ioThread_->Create(engine_.GetThreadPool(), std::move(pFile), !download_, binary)) {
-				// CIOThread will delete pFile
+
+			if (zeroCopyFile_) {
 				ioThread_.reset();
-				LogMessage(MessageType::Error, _("Could not spawn IO thread"));
-				return FZ_REPLY_ERROR;
+			}
+			else {
+				ioThread_ = std::make_unique<CIOThread>();
+				if (synthetic) {
+					ioThread_->UseSynthetic();
+				}
+				else {
+					ioThread_->UseUring(engine_.GetIOUring(), fz::to_native(localFile_));
+					ioThread_->UseFileAdvice(fz::to_native(localFile_));
+				}
+				if (transferSettings_.segment && transferSettings_.segmentLength >= 0) {
+					// Other segments may be written past the end of this one
+					ioThread_->KeepSize();
+				}
+				if (!ioThread_->Create(engine_.GetThreadPool(), std::move(pFile), !download_, binary, CIOBufferLimits(engine_.GetOptions()), expectedSize)) {
+					// CIOThread will delete pFile
+					ioThread_.reset();
+					LogMessage(MessageType::Error, _("Could not spawn IO thread"));
+					return FZ_REPLY_ERROR;
+				}
 			}
 		}
 
 		controlSocket_.m_pTransferSocket = std::make_unique<CTransferSocket>(engine_, controlSocket_, download_ ? TransferMode::download : TransferMode::upload);
 		controlSocket_.m_pTransferSocket->m_binaryMode = transferSettings_.binary;
 		controlSocket_.m_pTransferSocket->SetIOThread(ioThread_.get());
+		controlSocket_.m_pTransferSocket->SetZeroCopyFile(zeroCopyFile_.get());
+		if (download_ && transferSettings_.segment && transferSettings_.segmentLength >= 0) {
+			controlSocket_.m_pTransferSocket->SetRangeLimit(transferSettings_.segmentLength);
+		}
 
 		if (download_) {
 			cmd = L"RETR ";
@@ -299,6 +389,59 @@ int CFtpFileTransferOpData::TestResumeCapability()
 	return FZ_REPLY_CONTINUE;
 }
 
+int CFtpFileTransferOpData::OpenSegment(fz::file & file, int64_t & expectedSize)
+{
+	int64_t const offset = transferSettings_.segmentOffset;
+	if (offset < 0) {
+		return FZ_REPLY_SYNTAXERROR;
+	}
+
+	int64_t end = remoteFileSize_;
+	if (transferSettings_.segmentLength >= 0) {
+		end = offset + transferSettings_.segmentLength;
+		if (remoteFileSize_ >= 0 && end > remoteFileSize_) {
+			LogMessage(MessageType::Error, _("Segment exceeds the size of the remote file, it may have changed"));
+			return FZ_REPLY_CRITICALERROR;
+		}
+	}
+
+	// Segments rely on REST just like resuming does
+	for (int i = 0; i < 2; ++i) {
+		if (offset >= (1ll << (i ? 31 : 32)) && CServerCapabilities::GetCapability(currentServer_, i ? resume2GBbug : resume4GBbug) == yes) {
+			LogMessage(MessageType::Error, _("Server does not support resume of files > %d GB."), i ? 2 : 4);
+			return FZ_REPLY_CRITICALERROR;
+		}
+	}
+
+	if (!file.open(fz::to_native(localFile_), fz::file::writing, fz::file::existing)) {
+		LogMessage(MessageType::Error, _("Failed to open \"%s\" for writing"), localFile_);
+		return FZ_REPLY_ERROR;
+	}
+
+	if (file.seek(offset, fz::file::begin) != offset) {
+		LogMessage(MessageType::Error, _("Could not seek to offset %d within file"), offset);
+		return FZ_REPLY_ERROR;
+	}
+
+	LogMessage(MessageType::Debug_Info, L"Downloading segment at offset %d with length %d", offset, transferSettings_.segmentLength);
+
+	resumeOffset = offset;
+	engine_.transfer_status_.Init(end, offset, false);
+	if (end >= offset) {
+		expectedSize = end - offset;
+	}
+
+	// Reserving space is cheap for the parts already reserved by other segments
+	if (end > 0) {
+		int error{};
+		if (!ReserveFileSpace(fz::to_native(localFile_), end, error) && error) {
+			LogMessage(MessageType::Debug_Warning, L"Could not reserve disk space: %s", fz::to_wstring(GetSystemErrorDescription(error)));
+		}
+	}
+
+	return FZ_REPLY_CONTINUE;
+}
+
 int CFtpFileTransferOpData::ParseResponse()
 {
 	LogMessage(MessageType::Debug_Verbose, L"CFtpFileTransferOpData::ParseResponse() in state %d", opState);
@@ -510,6 +653,7 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			}
 			else if (download_ && !fileTime_.empty()) {
 				ioThread_.reset();
+				zeroCopyFile_.reset();
 				if (!fz::local_filesys::set_modification_time(fz::to_native(localFile_), fileTime_)) {
 					LogMessage(MessageType::Debug_Warning, L"Could not set modification time");
 				}
@@ -4,6 +4,7 @@
 #include "ftpcontrolsocket.h"
 
 #include "iothread.h"
+#include "zerocopy.h"
 
 enum filetransferStates
 {
@@ -30,7 +31,12 @@ public:
 
 	int TestResumeCapability();
 
+	// Opens the local file for a segmented download, positioned at the
+	// start of the segment.
+	int OpenSegment(fz::file & file, int64_t & expectedSize);
+
 	std::unique_ptr<CIOThread> ioThread_;
+	std::unique_ptr<CZeroCopyFile> zeroCopyFile_;
 	bool fileDidExist_{true};
 };
 
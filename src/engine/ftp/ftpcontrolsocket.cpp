@@ -177,6 +177,7 @@ void CFtpControlSocket::ParseLine(std::wstring line)
 void CFtpControlSocket::OnConnect()
 {
 	m_lastTypeBinary = -1;
+	m_lastModeZ = 0;
 
 	SetAlive();
 
@@ -231,6 +232,9 @@ void CFtpControlSocket::ParseResponse()
 		}
 		else {
 			LogMessage(MessageType::Debug_Warning, L"Unexpected reply, no reply was pending.");
+
+			// Replies can no longer be matched to pipelined commands reliably
+			DisablePipelining();
 			return;
 		}
 	}
@@ -367,6 +371,7 @@ int CFtpControlSocket::ResetOperation(int nErrorCode)
 		}
 		if (nErrorCode != FZ_REPLY_OK && data.download_ && !data.fileDidExist_) {
 			data.ioThread_.reset();
+			data.zeroCopyFile_.reset();
 			int64_t size;
 			bool isLink;
 			if (fz::local_filesys::get_file_info(fz::to_native(data.localFile_), isLink, &size, nullptr, nullptr) == fz::local_filesys::file && size == 0) {
@@ -714,6 +719,12 @@ void CFtpControlSocket::Transfer(std::wstring const& cmd, CFtpTransferOpData* ol
 	pData->pOldData = oldData;
 	pData->pOldData->transferEndReason = TransferEndReason::successful;
 
+	// Servers differ in whether REST refers to the compressed or the
+	// uncompressed data, don't compress restarted transfers.
+	if (m_pTransferSocket) {
+		m_pTransferSocket->SetModeZ(UseModeZ() && m_pTransferSocket->CanUseModeZ() && oldData->resumeOffset <= 0);
+	}
+
 	if (m_pProxyBackend) {
 		// Only passive suported
 		// Theoretically could use reverse proxy ability in SOCKS5, but
@@ -741,7 +752,7 @@ void CFtpControlSocket::Transfer(std::wstring const& cmd, CFtpTransferOpData* ol
 	if ((pData->pOldData->binary && m_lastTypeBinary == 1) ||
 		(!pData->pOldData->binary && m_lastTypeBinary == 0))
 	{
-		pData->opState = rawtransfer_port_pasv;
+		pData->opState = pData->ModeCommandNeeded() ? rawtransfer_mode : rawtransfer_port_pasv;
 	}
 	else {
 		pData->opState = rawtransfer_type;
@@ -750,6 +761,34 @@ void CFtpControlSocket::Transfer(std::wstring const& cmd, CFtpTransferOpData* ol
 	Push(std::move(pData));
 }
 
+bool CFtpControlSocket::UseModeZ() const
+{
+	if (!engine_.GetOptions().GetOptionVal(OPTION_FTP_MODEZ)) {
+		return false;
+	}
+
+	return CServerCapabilities::GetCapability(currentServer_, mode_z_support) == yes;
+}
+
+size_t CFtpControlSocket::PipelineDepth() const
+{
+	if (CServerCapabilities::GetCapability(currentServer_, command_pipelining) == no) {
+		return 1;
+	}
+
+	return static_cast<size_t>(engine_.GetOptions().GetOptionVal(OPTION_FTP_PIPELINE_DEPTH));
+}
+
+void CFtpControlSocket::DisablePipelining()
+{
+	if (CServerCapabilities::GetCapability(currentServer_, command_pipelining) == no) {
+		return;
+	}
+
+	LogMessage(MessageType::Debug_Warning, L"Server cannot handle pipelined commands, sending them one at a time from now on.");
+	CServerCapabilities::SetCapability(currentServer_, command_pipelining, no);
+}
+
 void CFtpControlSocket::Connect(CServer const& server, Credentials const& credentials)
 {
 	if (!operations_.empty()) {
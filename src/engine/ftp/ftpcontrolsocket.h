@@ -98,6 +98,18 @@ protected:
 
 	int m_lastTypeBinary{-1};
 
+	// Transmission mode, 1 for MODE Z, 0 for MODE S, -1 if unknown.
+	// New connections start out in MODE S.
+	int m_lastModeZ{};
+
+	// Whether data connections should be compressed using MODE Z
+	bool UseModeZ() const;
+
+	// Number of independent commands bulk operations may have in flight
+	// at the same time, 1 if they need to be sent one at a time.
+	size_t PipelineDepth() const;
+	void DisablePipelining();
+
 	// Used by keepalive code so that we're not using keep alive
 	// till the end of time. Stop after a couple of minutes.
 	fz::monotonic_clock m_lastCommandCompletionTime;
@@ -9,9 +9,28 @@ enum mkdStates
 	mkd_findparent,
 	mkd_mkdsub,
 	mkd_cwdsub,
-	mkd_tryfull
+	mkd_tryfull,
+	mkd_mkdpipe
 };
 
+namespace {
+bool IsAlreadyExistsReply(std::wstring const& reply, CServerPath const& path)
+{
+	// Case 1: Full response a known "already exists" message.
+	// Case 2: Substrng of response contains "already exists". path may not
+	//         contain this substring as the path might be returned in the reply.
+	// Case 3: Substrng of response contains "file exists". path may not
+	//         contain this substring as the path might be returned in the reply.
+	std::wstring const response = fz::str_tolower_ascii(reply.substr(4));
+	std::wstring const p = fz::str_tolower_ascii(path.GetPath());
+	return response == L"directory already exists" ||
+		(p.find(L"already exists") == std::wstring::npos &&
+			response.find(L"already exists") != std::wstring::npos) ||
+		(p.find(L"file exists") == std::wstring::npos &&
+			response.find(L"file exists") != std::wstring::npos);
+}
+}
+
 int CFtpMkdirOpData::Send()
 {
 	LogMessage(MessageType::Debug_Verbose, L"CFtpMkdirOpData::Send() in state %d", opState);
@@ -59,7 +78,36 @@ int CFtpMkdirOpData::Send()
 		currentPath_.clear();
 		return controlSocket_.SendCommand(L"CWD " + currentMkdPath_.GetPath());
 	case mkd_mkdsub:
+		if (segments_.size() > 1 && !lockstep_ && controlSocket_.PipelineDepth() > 1) {
+			// Each subdirectory only depends on its parent having been created
+			// before, which the server does in order. Use full paths so that
+			// there is no need to change into each new subdirectory.
+			opState = mkd_mkdpipe;
+			return FZ_REPLY_CONTINUE;
+		}
 		return controlSocket_.SendCommand(L"MKD " + segments_.back());
+	case mkd_mkdpipe:
+		{
+			size_t const depth = controlSocket_.PipelineDepth();
+			CServerPath path = currentMkdPath_;
+			for (size_t i = 0; i < segments_.size() && i < depth; ++i) {
+				if (!path.AddSegment(segments_[segments_.size() - 1 - i])) {
+					LogMessage(MessageType::Debug_Warning, L"Could not append segment to %s", path.GetPath());
+					return FZ_REPLY_INTERNALERROR;
+				}
+				if (i < sent_) {
+					continue;
+				}
+
+				// Only the first command in flight gives a meaningful round-trip time
+				int res = controlSocket_.SendCommand(L"MKD " + path.GetPath(), false, !sent_);
+				if (res != FZ_REPLY_WOULDBLOCK) {
+					return res;
+				}
+				++sent_;
+			}
+		}
+		return FZ_REPLY_WOULDBLOCK;
 	case mkd_tryfull:
 		return controlSocket_.SendCommand(L"MKD " + path_.GetPath());
 	default:
@@ -94,23 +142,34 @@ int CFtpMkdirOpData::ParseResponse()
 		}
 		return FZ_REPLY_CONTINUE;
 	case mkd_mkdsub:
+	case mkd_mkdpipe:
+		if (opState == mkd_mkdpipe) {
+			if (code == 1) {
+				// Preliminary reply, the actual one still follows
+				if (sent_ > 1) {
+					controlSocket_.DisablePipelining();
+				}
+				return FZ_REPLY_WOULDBLOCK;
+			}
+			if (sent_) {
+				--sent_;
+			}
+		}
+
 		if (code != 2 && code != 3) {
 			// Don't fall back to using the full path if the error message
 			// is "already exists".
-			// Case 1: Full response a known "already exists" message.
-			// Case 2: Substrng of response contains "already exists". path may not
-			//         contain this substring as the path might be returned in the reply.
-			// Case 3: Substrng of response contains "file exists". path may not
-			//         contain this substring as the path might be returned in the reply.
-			std::wstring const response = fz::str_tolower_ascii(controlSocket_.m_Response.substr(4));
-			std::wstring const p = fz::str_tolower_ascii(path_.GetPath());
-			if (response != L"directory already exists" &&
-				(p.find(L"already exists") != std::wstring::npos ||
-					response.find(L"already exists") == std::wstring::npos) &&
-					(p.find(L"file exists") != std::wstring::npos ||
-						response.find(L"file exists") == std::wstring::npos)
-				)
-			{
+			if (!IsAlreadyExistsReply(controlSocket_.m_Response, path_)) {
+				if (opState == mkd_mkdpipe) {
+					// The subdirectories below cannot have been created either.
+					// Ignore the replies still outstanding and continue one
+					// directory at a time.
+					controlSocket_.m_repliesToSkip += static_cast<int>(sent_);
+					sent_ = 0;
+					lockstep_ = true;
+					opState = mkd_cwdsub;
+					return FZ_REPLY_CONTINUE;
+				}
 				opState = mkd_tryfull;
 				break;
 			}
@@ -141,6 +200,12 @@ int CFtpMkdirOpData::ParseResponse()
 			if (segments_.empty() || result != FZ_REPLY_OK) {
 				return result;
 			}
+			else if (opState == mkd_mkdpipe) {
+				if (sent_ >= segments_.size()) {
+					// Commands for all remaining subdirectories have been sent already
+					return FZ_REPLY_WOULDBLOCK;
+				}
+			}
 			else {
 				opState = mkd_cwdsub;
 			}
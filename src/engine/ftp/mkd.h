@@ -12,6 +12,14 @@ public:
 
 	virtual int Send() override;
 	virtual int ParseResponse() override;
+
+	// Number of MKD commands for the subdirectories at the end of segments_
+	// still awaiting their reply while pipelining.
+	size_t sent_{};
+
+	// Set once pipelining failed, remaining subdirectories get created one
+	// at a time.
+	bool lockstep_{};
 };
 
 #endif
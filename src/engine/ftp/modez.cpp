@@ -0,0 +1,175 @@
+#include <filezilla.h>
+
+#include "logging_private.h"
+#include "modez.h"
+
+#include <algorithm>
+
+#include <errno.h>
+
+namespace {
+unsigned int const chunk_size = 64 * 1024;
+}
+
+CModeZBackend::CModeZBackend(fz::event_handler* pEvtHandler, CBackend & next, CLogging & logger, bool compress, int level)
+	: CBackend(pEvtHandler)
+	, next_(next)
+	, logger_(logger)
+	, compress_(compress)
+	, level_(level)
+{
+}
+
+CModeZBackend::~CModeZBackend()
+{
+	if (initialized_) {
+		if (compress_) {
+			deflateEnd(&stream_);
+		}
+		else {
+			inflateEnd(&stream_);
+		}
+	}
+}
+
+bool CModeZBackend::Init()
+{
+	int res = compress_ ? deflateInit(&stream_, level_) : inflateInit(&stream_);
+	if (res != Z_OK) {
+		logger_.LogMessage(MessageType::Debug_Warning, L"Could not initialize zlib: %d", res);
+		return false;
+	}
+	initialized_ = true;
+
+	return true;
+}
+
+int CModeZBackend::Read(void *buffer, unsigned int size, int& error)
+{
+	for (;;) {
+		if (!streamEnd_) {
+			stream_.next_in = buffer_.get();
+			stream_.avail_in = static_cast<uInt>(buffer_.size());
+			stream_.next_out = static_cast<Bytef*>(buffer);
+			stream_.avail_out = size;
+
+			int res = inflate(&stream_, Z_NO_FLUSH);
+			buffer_.consume(buffer_.size() - stream_.avail_in);
+			if (res == Z_STREAM_END) {
+				streamEnd_ = true;
+			}
+			else if (res != Z_OK && res != Z_BUF_ERROR) {
+				logger_.LogMessage(MessageType::Error, _("Could not decompress data received in MODE Z: %s"), fz::to_wstring(stream_.msg ? stream_.msg : ""));
+				error = EIO;
+				return -1;
+			}
+
+			outputPending_ = !stream_.avail_out;
+			unsigned int const inflated = size - stream_.avail_out;
+			if (inflated) {
+				return static_cast<int>(inflated);
+			}
+		}
+		else {
+			// Nothing may follow the end of the stream, ignore it if it does
+			buffer_.clear();
+		}
+
+		if (eof_) {
+			if (!streamEnd_) {
+				logger_.LogMessage(MessageType::Debug_Warning, L"Data connection closed before the end of the compressed stream");
+			}
+			return 0;
+		}
+
+		int read = next_.Read(buffer_.get(chunk_size), chunk_size, error);
+		if (read < 0) {
+			return read;
+		}
+		if (!read) {
+			eof_ = true;
+		}
+		else {
+			buffer_.add(static_cast<size_t>(read));
+		}
+	}
+}
+
+int CModeZBackend::Peek(void *buffer, unsigned int size, int& error)
+{
+	if (!streamEnd_ && (!buffer_.empty() || outputPending_)) {
+		error = 0;
+		return size ? 1 : 0;
+	}
+
+	return next_.Peek(buffer, size, error);
+}
+
+bool CModeZBackend::Flush(int& error)
+{
+	while (!buffer_.empty()) {
+		unsigned int const len = static_cast<unsigned int>(std::min(buffer_.size(), static_cast<size_t>(chunk_size)));
+		int written = next_.Write(buffer_.get(), len, error);
+		if (written < 0) {
+			return false;
+		}
+		buffer_.consume(static_cast<size_t>(written));
+	}
+
+	return true;
+}
+
+int CModeZBackend::Write(const void *buffer, unsigned int size, int& error)
+{
+	// Only take new data once the previous data has been sent
+	if (!Flush(error)) {
+		return -1;
+	}
+
+	stream_.next_in = static_cast<Bytef*>(const_cast<void*>(buffer));
+	stream_.avail_in = size;
+	while (stream_.avail_in) {
+		stream_.next_out = buffer_.get(chunk_size);
+		stream_.avail_out = chunk_size;
+
+		int res = deflate(&stream_, Z_NO_FLUSH);
+		buffer_.add(chunk_size - stream_.avail_out);
+		if (res != Z_OK && res != Z_BUF_ERROR) {
+			logger_.LogMessage(MessageType::Error, _("Could not compress data for MODE Z: %s"), fz::to_wstring(stream_.msg ? stream_.msg : ""));
+			error = EIO;
+			return -1;
+		}
+	}
+
+	// Whatever cannot be sent right away goes out with the next call
+	int flushError;
+	Flush(flushError);
+
+	return static_cast<int>(size);
+}
+
+int CModeZBackend::Finish(int& error)
+{
+	if (!streamEnd_) {
+		stream_.next_in = nullptr;
+		stream_.avail_in = 0;
+
+		int res;
+		do {
+			stream_.next_out = buffer_.get(chunk_size);
+			stream_.avail_out = chunk_size;
+
+			res = deflate(&stream_, Z_FINISH);
+			buffer_.add(chunk_size - stream_.avail_out);
+		} while (res == Z_OK);
+
+		if (res != Z_STREAM_END) {
+			logger_.LogMessage(MessageType::Error, _("Could not compress data for MODE Z: %s"), fz::to_wstring(stream_.msg ? stream_.msg : ""));
+			error = EIO;
+			return -1;
+		}
+		streamEnd_ = true;
+	}
+
+	return Flush(error) ? 0 : -1;
+}
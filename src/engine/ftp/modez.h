@@ -0,0 +1,64 @@
+#ifndef FILEZILLA_ENGINE_FTP_MODEZ_HEADER
+#define FILEZILLA_ENGINE_FTP_MODEZ_HEADER
+
+#include "backend.h"
+
+#include <libfilezilla/buffer.hpp>
+
+#include <zlib.h>
+
+class CLogging;
+
+// Deflate transmission mode of the data connection, MODE Z.
+//
+// Sits on top of the backend of the data connection, be it a plain socket or
+// TLS. Data written gets compressed before being passed on, data read gets
+// decompressed. Each data connection carries a single zlib stream.
+class CModeZBackend final : public CBackend
+{
+public:
+	// Compresses if compress is set, decompresses otherwise
+	CModeZBackend(fz::event_handler* pEvtHandler, CBackend & next, CLogging & logger, bool compress, int level);
+	virtual ~CModeZBackend();
+
+	bool Init();
+
+	virtual int Read(void *buffer, unsigned int size, int& error) override;
+	virtual int Write(const void *buffer, unsigned int size, int& error) override;
+
+	// Compressed data cannot be looked at without consuming it. Only tells
+	// whether there is any data left, the contents of the buffer are
+	// meaningless.
+	virtual int Peek(void *buffer, unsigned int size, int& error) override;
+
+	// Once all data has been written, ends the stream and sends whatever is
+	// left. Returns 0 once done, -1 on error. If error is EAGAIN, needs to
+	// be called again on the next write event.
+	int Finish(int& error);
+
+protected:
+	virtual void OnRateAvailable(CRateLimiter::rate_direction) override {}
+
+private:
+	bool Flush(int& error);
+
+	CBackend & next_;
+	CLogging & logger_;
+
+	bool const compress_;
+	int const level_;
+
+	z_stream stream_{};
+	bool initialized_{};
+
+	// Compressed data received but not yet inflated or deflated but not yet sent
+	fz::buffer buffer_;
+
+	// Set if zlib might have output left even without further input
+	bool outputPending_{};
+
+	bool eof_{};
+	bool streamEnd_{};
+};
+
+#endif
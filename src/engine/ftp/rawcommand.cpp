@@ -13,6 +13,7 @@ int CFtpRawCommandOpData::Send()
 	currentPath_.clear();
 
 	controlSocket_.m_lastTypeBinary = -1;
+	controlSocket_.m_lastModeZ = -1;
 
 	return controlSocket_.SendCommand(command_, false, false);
 }
@@ -24,10 +24,28 @@ int CFtpRawTransferOpData::ParseResponse()
 			error = true;
 		}
 		else {
-			opState = rawtransfer_port_pasv;
+			opState = ModeCommandNeeded() ? rawtransfer_mode : rawtransfer_port_pasv;
 			controlSocket_.m_lastTypeBinary = pOldData->binary ? 1 : 0;
 		}
 		break;
+	case rawtransfer_mode:
+		if (code == 2 || code == 3) {
+			controlSocket_.m_lastModeZ = controlSocket_.m_pTransferSocket->ModeZ() ? 1 : 0;
+		}
+		else if (controlSocket_.m_pTransferSocket->ModeZ()) {
+			LogMessage(MessageType::Debug_Warning, L"Server does not accept MODE Z after all, transferring uncompressed data");
+			CServerCapabilities::SetCapability(currentServer_, mode_z_support, no);
+			controlSocket_.m_pTransferSocket->SetModeZ(false);
+			if (ModeCommandNeeded()) {
+				break;
+			}
+		}
+		else {
+			error = true;
+			break;
+		}
+		opState = rawtransfer_port_pasv;
+		break;
 	case rawtransfer_port_pasv:
 		if (code != 2 && code != 3) {
 			if (!engine_.GetOptions().GetOptionVal(OPTION_ALLOW_TRANSFERMODEFALLBACK)) {
@@ -137,6 +155,13 @@ int CFtpRawTransferOpData::ParseResponse()
 		break;
 	case rawtransfer_waittransfer:
 		if (code != 2 && code != 3) {
+			if (pOldData->transferEndReason == TransferEndReason::successful &&
+				controlSocket_.m_pTransferSocket && controlSocket_.m_pTransferSocket->RangeReceived())
+			{
+				// We closed the data connection once the requested range was
+				// received, servers report this as aborted transfer.
+				return FZ_REPLY_OK;
+			}
 			if (pOldData->transferEndReason == TransferEndReason::successful) {
 				pOldData->transferEndReason = TransferEndReason::transfer_command_failure;
 			}
@@ -189,6 +214,16 @@ int CFtpRawTransferOpData::Send()
 		}
 		measureRTT = true;
 		break;
+	case rawtransfer_mode:
+		controlSocket_.m_lastModeZ = -1;
+		if (controlSocket_.m_pTransferSocket->ModeZ()) {
+			cmd = L"MODE Z";
+		}
+		else {
+			cmd = L"MODE S";
+		}
+		measureRTT = true;
+		break;
 	case rawtransfer_port_pasv:
 		if (bPasv) {
 			cmd = GetPassiveCommand();
@@ -260,6 +295,12 @@ int CFtpRawTransferOpData::Send()
 	return FZ_REPLY_WOULDBLOCK;
 }
 
+bool CFtpRawTransferOpData::ModeCommandNeeded() const
+{
+	int const modeZ = controlSocket_.m_pTransferSocket->ModeZ() ? 1 : 0;
+	return modeZ != controlSocket_.m_lastModeZ;
+}
+
 bool CFtpRawTransferOpData::ParseEpsvResponse()
 {
 	size_t pos = controlSocket_.m_Response.find(L"(|||");
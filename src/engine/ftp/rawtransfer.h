@@ -7,6 +7,7 @@ enum rawtransferStates
 {
 	rawtransfer_init = 0,
 	rawtransfer_type,
+	rawtransfer_mode,
 	rawtransfer_port_pasv,
 	rawtransfer_rest,
 	rawtransfer_transfer,
@@ -29,6 +30,7 @@ public:
 	virtual int ParseResponse() override;
 
 	std::wstring GetPassiveCommand();
+	bool ModeCommandNeeded() const;
 	bool ParsePasvResponse();
 	bool ParseEpsvResponse();
 
@@ -3,14 +3,21 @@
 #include "engineprivate.h"
 #include "ftp/ftpcontrolsocket.h"
 #include "iothread.h"
+#include "modez.h"
 #include "optionsbase.h"
 #include "tlssocket.h"
 #include "transfersocket.h"
 #include "proxy.h"
 #include "servercapabilities.h"
+#include "zerocopy.h"
 
 #include <libfilezilla/util.hpp>
 
+namespace {
+// Upper limit of data passed to the kernel in a single zero-copy call
+unsigned int const zero_copy_chunk_size = 1024 * 1024;
+}
+
 CTransferSocket::CTransferSocket(CFileZillaEnginePrivate & engine, CFtpControlSocket & controlSocket, TransferMode transferMode)
 : fz::event_handler(controlSocket.event_loop_)
 , engine_(engine)
@@ -28,17 +35,22 @@ CTransferSocket::~CTransferSocket()
 	ResetSocket();
 
 	if (m_transferMode == TransferMode::upload || m_transferMode == TransferMode::download) {
-		if (ioThread_) {
+		if (ioThread_ || zeroCopyFile_) {
 			if (m_transferMode == TransferMode::download) {
 				FinalizeWrite();
 			}
-			ioThread_->SetEventHandler(nullptr);
+			if (ioThread_) {
+				ioThread_->SetEventHandler(nullptr);
+			}
 		}
 	}
 }
 
 void CTransferSocket::ResetSocket()
 {
+	delete m_pModeZBackend;
+	m_pModeZBackend = nullptr;
+
 	delete m_pProxyBackend;
 	if (m_pBackend == m_pTlsSocket) {
 		m_pBackend = nullptr;
@@ -235,7 +247,7 @@ void CTransferSocket::OnReceive()
 		for (;;) {
 			char *pBuffer = new char[4096];
 			int error;
-			int numread = m_pBackend->Read(pBuffer, 4096, error);
+			int numread = DataBackend().Read(pBuffer, 4096, error);
 			if (numread < 0) {
 				delete [] pBuffer;
 				if (error != EAGAIN) {
@@ -269,6 +281,11 @@ void CTransferSocket::OnReceive()
 		}
 	}
 	else if (m_transferMode == TransferMode::download) {
+		if (zeroCopyFile_) {
+			OnZeroCopyReceive();
+			return;
+		}
+
 		int error;
 		int numread;
 
@@ -280,7 +297,12 @@ void CTransferSocket::OnReceive()
 				return;
 			}
 
-			numread = m_pBackend->Read(m_pTransferBuffer, m_transferBufferLen, error);
+			int len = m_transferBufferLen;
+			if (rangeLeft_ >= 0 && rangeLeft_ < len) {
+				len = static_cast<int>(rangeLeft_);
+			}
+
+			numread = DataBackend().Read(m_pTransferBuffer, len, error);
 			if (numread <= 0) {
 				break;
 			}
@@ -294,6 +316,14 @@ void CTransferSocket::OnReceive()
 
 			m_pTransferBuffer += numread;
 			m_transferBufferLen -= numread;
+
+			if (rangeLeft_ > 0) {
+				rangeLeft_ -= numread;
+				if (!rangeLeft_) {
+					OnRangeReceived();
+					return;
+				}
+			}
 		}
 
 		if (numread < 0) {
@@ -372,6 +402,11 @@ void CTransferSocket::OnSend()
 		return;
 	}
 
+	if (zeroCopyFile_) {
+		OnZeroCopySend();
+		return;
+	}
+
 	int error;
 	int written;
 
@@ -383,7 +418,7 @@ void CTransferSocket::OnSend()
 			return;
 		}
 
-		written = m_pBackend->Write(m_pTransferBuffer, m_transferBufferLen, error);
+		written = DataBackend().Write(m_pTransferBuffer, m_transferBufferLen, error);
 		if (written <= 0) {
 			break;
 		}
@@ -418,6 +453,123 @@ void CTransferSocket::OnSend()
 	}
 }
 
+void CTransferSocket::OnZeroCopyReceive()
+{
+	// Only used with unencrypted data connections, see CFtpFileTransferOpData
+	assert(!m_pTlsSocket);
+	auto & backend = static_cast<CSocketBackend&>(*m_pBackend);
+
+	int error;
+	int numread;
+
+	// Same limit as in OnReceive
+	for (int i = 0; i < 100; ++i) {
+		unsigned int len = zero_copy_chunk_size;
+		if (rangeLeft_ >= 0 && rangeLeft_ < len) {
+			len = static_cast<unsigned int>(rangeLeft_);
+		}
+
+		numread = backend.ReceiveFile(*zeroCopyFile_, len, error);
+		if (numread <= 0) {
+			break;
+		}
+
+		controlSocket_.SetActive(CFileZillaEngine::recv);
+		if (!m_madeProgress) {
+			m_madeProgress = 2;
+			engine_.transfer_status_.SetMadeProgress();
+		}
+		engine_.transfer_status_.Update(numread);
+
+		if (rangeLeft_ > 0) {
+			rangeLeft_ -= numread;
+			if (!rangeLeft_) {
+				OnRangeReceived();
+				return;
+			}
+		}
+	}
+
+	if (numread < 0) {
+		if (error != EAGAIN) {
+			std::wstring const& fileError = zeroCopyFile_->GetError();
+			if (!fileError.empty()) {
+				controlSocket_.LogMessage(MessageType::Error, _("Can't write data to file: %s"), fileError);
+				TransferEnd(TransferEndReason::transfer_failure_critical);
+			}
+			else {
+				controlSocket_.LogMessage(MessageType::Error, L"Could not read from transfer socket: %s", fz::socket::error_description(error));
+				TransferEnd(TransferEndReason::transfer_failure);
+			}
+		}
+		else if (m_onCloseCalled && !m_pBackend->IsWaiting(CRateLimiter::inbound)) {
+			FinalizeWrite();
+		}
+	}
+	else if (!numread) {
+		FinalizeWrite();
+	}
+	else {
+		send_event<fz::socket_event>(m_pBackend, fz::socket_event_flag::read, 0);
+	}
+}
+
+void CTransferSocket::OnRangeReceived()
+{
+	controlSocket_.LogMessage(MessageType::Debug_Info, L"Received the requested range, closing data connection");
+	rangeReceived_ = true;
+	FinalizeWrite();
+}
+
+void CTransferSocket::OnZeroCopySend()
+{
+	assert(!m_pTlsSocket);
+	auto & backend = static_cast<CSocketBackend&>(*m_pBackend);
+
+	int error;
+	int written;
+
+	// Same limit as in OnSend
+	for (int i = 0; i < 100; ++i) {
+		written = backend.SendFile(*zeroCopyFile_, zero_copy_chunk_size, error);
+		if (written <= 0) {
+			break;
+		}
+
+		controlSocket_.SetActive(CFileZillaEngine::send);
+		if (m_madeProgress == 1) {
+			controlSocket_.LogMessage(MessageType::Debug_Debug, L"Made progress in CTransferSocket::OnZeroCopySend()");
+			m_madeProgress = 2;
+			engine_.transfer_status_.SetMadeProgress();
+		}
+		engine_.transfer_status_.Update(written);
+	}
+
+	if (written < 0) {
+		if (error == EAGAIN) {
+			if (!m_madeProgress) {
+				controlSocket_.LogMessage(MessageType::Debug_Debug, L"First EAGAIN in CTransferSocket::OnZeroCopySend()");
+				m_madeProgress = 1;
+				engine_.transfer_status_.SetMadeProgress();
+			}
+		}
+		else if (!zeroCopyFile_->GetError().empty()) {
+			controlSocket_.LogMessage(MessageType::Error, _("Can't read from file"));
+			TransferEnd(TransferEndReason::transfer_failure);
+		}
+		else {
+			controlSocket_.LogMessage(MessageType::Error, L"Could not write to transfer socket: %s", fz::socket::error_description(error));
+			TransferEnd(TransferEndReason::transfer_failure);
+		}
+	}
+	else if (!written) {
+		TransferEnd(TransferEndReason::successful);
+	}
+	else {
+		send_event<fz::socket_event>(m_pBackend, fz::socket_event_flag::write, 0);
+	}
+}
+
 void CTransferSocket::OnClose(int error)
 {
 	controlSocket_.LogMessage(MessageType::Debug_Verbose, L"CTransferSocket::OnClose(%d)", error);
@@ -456,7 +608,7 @@ void CTransferSocket::OnClose(int error)
 	}
 
 	char buffer[100];
-	int numread = m_pBackend->Peek(&buffer, 100, error);
+	int numread = DataBackend().Peek(&buffer, 100, error);
 	if (numread > 0) {
 #ifndef FZ_WINDOWS
 		controlSocket_.LogMessage(MessageType::Debug_Warning, L"Peek isn't supposed to return data after close notification");
@@ -673,7 +825,8 @@ bool CTransferSocket::CheckGetNextWriteBuffer()
 			return false;
 		}
 
-		m_transferBufferLen = BUFFERSIZE;
+		m_transferBufferSize = res;
+		m_transferBufferLen = res;
 	}
 
 	return true;
@@ -692,6 +845,16 @@ bool CTransferSocket::CheckGetNextReadBuffer()
 			return false;
 		}
 		else if (res == IO_Success) {
+			if (m_pModeZBackend) {
+				int error;
+				if (m_pModeZBackend->Finish(error)) {
+					if (error != EAGAIN) {
+						controlSocket_.LogMessage(MessageType::Error, L"Could not write to transfer socket: %s", fz::socket::error_description(error));
+						TransferEnd(TransferEndReason::transfer_failure);
+					}
+					return false;
+				}
+			}
 			if (m_pTlsSocket) {
 				m_shutdown = true;
 
@@ -728,18 +891,28 @@ void CTransferSocket::OnIOThreadEvent()
 
 void CTransferSocket::FinalizeWrite()
 {
-	bool res = ioThread_->Finalize(BUFFERSIZE - m_transferBufferLen);
-	m_transferBufferLen = BUFFERSIZE;
+	bool res;
+	if (zeroCopyFile_) {
+		res = zeroCopyFile_->Finalize();
+	}
+	else {
+		res = ioThread_->Finalize(m_transferBufferSize - m_transferBufferLen);
+		m_transferBufferLen = m_transferBufferSize;
+	}
 
 	if (m_transferEndReason != TransferEndReason::none) {
 		return;
 	}
 
-	if (res) {
+	if (res && rangeLeft_ > 0) {
+		controlSocket_.LogMessage(MessageType::Error, _("Connection closed by server before the whole segment was received"));
+		TransferEnd(TransferEndReason::transfer_failure);
+	}
+	else if (res) {
 		TransferEnd(TransferEndReason::successful);
 	}
 	else {
-		std::wstring error = ioThread_->GetError();
+		std::wstring error = zeroCopyFile_ ? zeroCopyFile_->GetError() : ioThread_->GetError();
 		if (error.empty()) {
 			controlSocket_.LogMessage(MessageType::Error, _("Can't write data to file."));
 		}
@@ -764,6 +937,10 @@ bool CTransferSocket::InitTls(const CTlsSocket* pPrimaryTlsSocket)
 		return false;
 	}
 
+	if ((m_transferMode == TransferMode::upload || m_transferMode == TransferMode::download) && engine_.GetOptions().GetOptionVal(OPTION_FTP_KTLS)) {
+		m_pTlsSocket->RequestKernelOffload(m_transferMode == TransferMode::upload);
+	}
+
 	bool try_resume = CServerCapabilities::GetCapability(controlSocket_.currentServer_, tls_resume) != no;
 
 	int res = m_pTlsSocket->Handshake(pPrimaryTlsSocket, try_resume);
@@ -823,9 +1000,25 @@ bool CTransferSocket::InitBackend()
 		m_pBackend = new CSocketBackend(this, *socket_, engine_.GetRateLimiter());
 	}
 
+	if (modeZ_) {
+		int const level = static_cast<int>(engine_.GetOptions().GetOptionVal(OPTION_FTP_MODEZ_LEVEL));
+		m_pModeZBackend = new CModeZBackend(this, *m_pBackend, controlSocket_, m_transferMode == TransferMode::upload, level);
+		if (!m_pModeZBackend->Init()) {
+			return false;
+		}
+	}
+
 	return true;
 }
 
+CBackend& CTransferSocket::DataBackend()
+{
+	if (m_pModeZBackend) {
+		return *m_pModeZBackend;
+	}
+	return *m_pBackend;
+}
+
 void CTransferSocket::SetSocketBufferSizes(fz::socket& socket)
 {
 	const int size_read = engine_.GetOptions().GetOptionVal(OPTION_SOCKET_BUFFERSIZE_RECV);
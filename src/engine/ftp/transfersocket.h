@@ -18,7 +18,9 @@ enum class TransferMode
 };
 
 class CIOThread;
+class CModeZBackend;
 class CTlsSocket;
+class CZeroCopyFile;
 class CTransferSocket final : public fz::event_handler
 {
 public:
@@ -38,6 +40,25 @@ public:
 
 	void SetIOThread(CIOThread* ioThread) { ioThread_ = ioThread; }
 
+	// Replaces the IO thread on unencrypted data connections
+	void SetZeroCopyFile(CZeroCopyFile* file) { zeroCopyFile_ = file; }
+
+	// Downloads only: Once this much data has been received, the data
+	// connection gets closed instead of waiting for the server to close it.
+	// Used for segmented downloads.
+	void SetRangeLimit(int64_t limit) { rangeLeft_ = limit; }
+
+	// Whether the transfer ended due to the range limit
+	bool RangeReceived() const { return rangeReceived_; }
+
+	// Whether the data can be compressed using MODE Z. Ranges and
+	// zero-copy transfers depend on the data being sent as-is.
+	bool CanUseModeZ() const { return m_transferMode != TransferMode::resumetest && !zeroCopyFile_ && rangeLeft_ < 0; }
+
+	// Needs to match the transmission mode sent to the server
+	void SetModeZ(bool modeZ) { modeZ_ = modeZ; }
+	bool ModeZ() const { return modeZ_; }
+
 protected:
 	bool CheckGetNextWriteBuffer();
 	bool CheckGetNextReadBuffer();
@@ -56,6 +77,9 @@ protected:
 	void OnReceive();
 	void OnSend();
 	void OnClose(int error);
+	void OnZeroCopyReceive();
+	void OnZeroCopySend();
+	void OnRangeReceived();
 	void OnTimer(fz::timer_id);
 
 	// Create a socket server
@@ -83,6 +107,9 @@ protected:
 	char *m_pTransferBuffer{};
 	int m_transferBufferLen{};
 
+	// Total size of the current buffer obtained from the IO thread when downloading
+	int m_transferBufferSize{};
+
 	// Set to true if OnClose got called
 	// We now have to read all available data in the socket, ignoring any
 	// speed limits
@@ -94,6 +121,13 @@ protected:
 
 	CBackend* m_pBackend{};
 
+	// The backend data gets read from or written to. Same as m_pBackend
+	// unless MODE Z is used.
+	CBackend& DataBackend();
+
+	bool modeZ_{};
+	CModeZBackend* m_pModeZBackend{};
+
 	CProxySocket* m_pProxyBackend{};
 
 	CTlsSocket* m_pTlsSocket{};
@@ -105,6 +139,11 @@ protected:
 	int m_madeProgress{};
 
 	CIOThread* ioThread_{};
+	CZeroCopyFile* zeroCopyFile_{};
+
+	// Data left to receive of the range, negative if there is no limit
+	int64_t rangeLeft_{-1};
+	bool rangeReceived_{};
 };
 
 #endif
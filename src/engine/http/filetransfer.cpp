@@ -1,9 +1,13 @@
 #include <filezilla.h>
 
+#include "fileadvice.h"
 #include "filetransfer.h"
+#include "proxy.h"
 
 #include <libfilezilla/local_filesys.hpp>
 
+#include <algorithm>
+
 #include <string.h>
 
 enum filetransferStates
@@ -11,9 +15,18 @@ enum filetransferStates
 	filetransfer_init = 0,
 	filetransfer_waitfileexists,
 	filetransfer_transfer,
-	filetransfer_waittransfer
+	filetransfer_waittransfer,
+	filetransfer_waitranges
 };
 
+namespace {
+// Size of the range requested by the first request of a parallel download
+int64_t const probe_size = 1024 * 1024;
+
+// Ranges handed to additional connections are at least this large
+int64_t const min_range_size = 4 * 1024 * 1024;
+}
+
 int CHttpFileTransferOpData::Send()
 {
 	LogMessage(MessageType::Debug_Verbose, L"CHttpFileTransferOpData::Send() in state %d", opState);
@@ -53,9 +66,30 @@ int CHttpFileTransferOpData::Send()
 		opState = filetransfer_transfer;
 		return FZ_REPLY_CONTINUE;
 	case filetransfer_transfer:
+		rr_.request_.headers_.erase("Range");
+		rr_.request_.headers_.erase("Connection");
+		rangeReceived_ = 0;
 		if (resume_) {
 			rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-", localFileSize_);
 		}
+		else if (rangeOffset_ >= 0) {
+			if (file_.seek(rangeOffset_, fz::file::begin) != rangeOffset_) {
+				LogMessage(MessageType::Error, _("Could not seek to offset %d within file"), rangeOffset_);
+				return FZ_REPLY_ERROR;
+			}
+			rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-%d", rangeOffset_, rangeOffset_ + rangeLength_ - 1);
+
+			// The range connections resume the TLS session of this connection
+			rr_.request_.headers_["Connection"] = "keep-alive";
+		}
+		else if (CanProbeRanges()) {
+			probed_ = true;
+			probing_ = true;
+			rangeOffset_ = 0;
+			rangeLength_ = probe_size;
+			rr_.request_.headers_["Range"] = fz::sprintf("bytes=0-%d", probe_size - 1);
+			rr_.request_.headers_["Connection"] = "keep-alive";
+		}
 
 		rr_.response_ = HttpResponse();
 		rr_.response_.on_header_ = [this](auto const&) { return this->OnHeader(); };
@@ -126,6 +160,15 @@ int CHttpFileTransferOpData::OnHeader()
 		return FZ_REPLY_ERROR;
 	}
 
+	if (rr_.response_.code_ == 416 && probing_) {
+		// Happens with empty files, try again without range
+		probing_ = false;
+		rangeOffset_ = -1;
+
+		opState = filetransfer_transfer;
+		return FZ_REPLY_ERROR;
+	}
+
 	if (rr_.response_.code_ < 200 || rr_.response_.code_ >= 400) {
 		return FZ_REPLY_ERROR;
 	}
@@ -168,10 +211,35 @@ int CHttpFileTransferOpData::OnHeader()
 
 		rr_.request_.uri_ = location;
 
+		if (probing_) {
+			// Probe the new location instead
+			probing_ = false;
+			probed_ = false;
+			rangeOffset_ = -1;
+		}
+
 		opState = filetransfer_transfer;
 		return FZ_REPLY_OK;
 	}
 
+	if (probing_) {
+		probing_ = false;
+		if (rr_.response_.code_ == 206) {
+			return OnProbeHeader();
+		}
+
+		LogMessage(MessageType::Debug_Info, L"Server does not support range requests, downloading over a single connection. Accept-Ranges: %s", rr_.response_.get_header("Accept-Ranges"));
+		rangeOffset_ = -1;
+	}
+	else if (rangeOffset_ >= 0) {
+		std::string const expected = fz::sprintf("bytes %d-%d/", rangeOffset_, rangeOffset_ + rangeLength_ - 1);
+		if (rr_.response_.code_ != 206 || rr_.response_.get_header("Content-Range").compare(0, expected.size(), expected)) {
+			LogMessage(MessageType::Error, _("Server did not honor the range request"));
+			return FZ_REPLY_ERROR;
+		}
+		return FZ_REPLY_CONTINUE;
+	}
+
 	// Check if the server disallowed resume
 	if (resume_ && rr_.response_.code_ != 206) {
 		assert(file_.opened());
@@ -197,6 +265,145 @@ int CHttpFileTransferOpData::OnHeader()
 	return FZ_REPLY_CONTINUE;
 }
 
+bool CHttpFileTransferOpData::CanProbeRanges() const
+{
+	if (localFile_.empty() || resume_ || probed_ || localFileSize_ > 0) {
+		return false;
+	}
+
+	if (engine_.GetOptions().GetOptionVal(OPTION_HTTP_DOWNLOAD_CONNECTIONS) < 2) {
+		return false;
+	}
+
+	// Range connections do not go through the proxy
+	int const proxy_type = engine_.GetOptions().GetOptionVal(OPTION_PROXY_TYPE);
+	if (proxy_type > CProxySocket::unknown && proxy_type < CProxySocket::proxytype_count && !currentServer_.GetBypassProxy()) {
+		return false;
+	}
+
+	return true;
+}
+
+int CHttpFileTransferOpData::OnProbeHeader()
+{
+	// Expecting bytes 0-end/total
+	std::string const range = rr_.response_.get_header("Content-Range");
+	int64_t end = -1;
+	int64_t total = -1;
+	if (!range.compare(0, 8, "bytes 0-")) {
+		auto const slash = range.find('/', 8);
+		if (slash != std::string::npos) {
+			end = fz::to_integral<int64_t>(range.substr(8, slash - 8), -1);
+			total = fz::to_integral<int64_t>(range.substr(slash + 1), -1);
+		}
+	}
+	if (end < 0 || end >= rangeLength_ || total <= end) {
+		LogMessage(MessageType::Debug_Warning, L"Unusable Content-Range in response to range request: %s", range);
+
+		// Try again without range
+		rangeOffset_ = -1;
+		opState = filetransfer_transfer;
+		return FZ_REPLY_ERROR;
+	}
+
+	totalSize_ = total;
+	rangeLength_ = end + 1;
+
+	if (engine_.transfer_status_.empty()) {
+		engine_.transfer_status_.Init(totalSize_, 0, false);
+		engine_.transfer_status_.SetStartTime();
+	}
+
+	if (totalSize_ > rangeLength_) {
+		int error{};
+		if (!ReserveFileSpace(fz::to_native(localFile_), totalSize_, error) && error) {
+			LogMessage(MessageType::Debug_Warning, L"Could not reserve disk space: %s", fz::to_wstring(GetSystemErrorDescription(error)));
+		}
+
+		StartRanges(rangeLength_);
+	}
+
+	return FZ_REPLY_CONTINUE;
+}
+
+void CHttpFileTransferOpData::StartRanges(int64_t offset)
+{
+	int64_t const remaining = totalSize_ - offset;
+	int64_t parts = std::min(static_cast<int64_t>(engine_.GetOptions().GetOptionVal(OPTION_HTTP_DOWNLOAD_CONNECTIONS)), remaining / min_range_size);
+	if (parts < 1) {
+		parts = 1;
+	}
+	int64_t const partSize = remaining / parts;
+
+	LogMessage(MessageType::Debug_Info, L"Downloading remaining %d bytes in %d ranges", remaining, parts);
+
+	// The first range is for this connection, additional connections fetch the others
+	pendingRanges_.emplace_back(offset, partSize);
+	for (int64_t i = 1; i < parts; ++i) {
+		int64_t const rangeOffset = offset + i * partSize;
+		int64_t const rangeLength = (i + 1 == parts) ? (totalSize_ - rangeOffset) : partSize;
+
+		auto socket = std::make_unique<CHttpRangeSocket>(engine_, controlSocket_, rr_.request_.uri_, rr_.request_.headers_, localFile_, rangeOffset, rangeLength);
+		if (socket->Start()) {
+			rangeSockets_.push_back(std::move(socket));
+		}
+		else {
+			pendingRanges_.emplace_back(rangeOffset, rangeLength);
+		}
+	}
+}
+
+int CHttpFileTransferOpData::NextRange()
+{
+	for (auto it = rangeSockets_.begin(); it != rangeSockets_.end(); ) {
+		auto const& socket = **it;
+		if (!socket.Done()) {
+			++it;
+			continue;
+		}
+
+		writtenRanges_.emplace_back(socket.Offset(), socket.Received());
+		if (!socket.Succeeded()) {
+			// Fetch the remainder over this connection
+			LogMessage(MessageType::Debug_Info, L"Range connection failed after %d of %d bytes", socket.Received(), socket.Length());
+			pendingRanges_.emplace_back(socket.Offset() + socket.Received(), socket.Length() - socket.Received());
+		}
+		it = rangeSockets_.erase(it);
+	}
+
+	if (!pendingRanges_.empty()) {
+		rangeOffset_ = pendingRanges_.front().first;
+		rangeLength_ = pendingRanges_.front().second;
+		pendingRanges_.pop_front();
+		rangeReceived_ = 0;
+
+		opState = filetransfer_transfer;
+		return FZ_REPLY_CONTINUE;
+	}
+
+	if (!rangeSockets_.empty()) {
+		opState = filetransfer_waitranges;
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	if (transferSettings_.fsync) {
+		file_.fsync();
+	}
+	return FZ_REPLY_OK;
+}
+
+int CHttpFileTransferOpData::OnRangeEnd()
+{
+	LogMessage(MessageType::Debug_Verbose, L"CHttpFileTransferOpData::OnRangeEnd() in state %d", opState);
+
+	if (opState != filetransfer_waitranges) {
+		// Still busy with a range of its own, looks at the others once done
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	return NextRange();
+}
+
 int CHttpFileTransferOpData::OnData(unsigned char const* data, unsigned int len)
 {
 	if (opState != filetransfer_waittransfer) {
@@ -212,10 +419,17 @@ int CHttpFileTransferOpData::OnData(unsigned char const* data, unsigned int len)
 		assert(file_.opened());
 
 		auto write = static_cast<int64_t>(len);
+		if (rangeOffset_ >= 0 && write > rangeLength_ - rangeReceived_) {
+			LogMessage(MessageType::Debug_Warning, L"Server sent more data than requested");
+			return FZ_REPLY_ERROR;
+		}
 		if (file_.write(data, write) != write) {
 			LogMessage(MessageType::Error, _("Failed to write to file %s"), localFile_);
 			return FZ_REPLY_ERROR;
 		}
+		if (rangeOffset_ >= 0) {
+			rangeReceived_ += write;
+		}
 	}
 
 	engine_.transfer_status_.Update(len);
@@ -231,6 +445,17 @@ int CHttpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 		return FZ_REPLY_CONTINUE;
 	}
 
+	if (opState == filetransfer_waittransfer && totalSize_ >= 0) {
+		writtenRanges_.emplace_back(rangeOffset_, rangeReceived_);
+		if (prevResult != FZ_REPLY_OK || rangeReceived_ != rangeLength_) {
+			rangeOffset_ = -1;
+			return (prevResult == FZ_REPLY_OK) ? FZ_REPLY_ERROR : prevResult;
+		}
+		rangeOffset_ = -1;
+
+		return NextRange();
+	}
+
 	if (opState == filetransfer_waittransfer) {
 		if (file_.opened()) {
 			if (transferSettings_.fsync) {
@@ -241,3 +466,33 @@ int CHttpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 
 	return prevResult;
 }
+
+int CHttpFileTransferOpData::Reset(int result)
+{
+	if (result != FZ_REPLY_OK && totalSize_ >= 0 && file_.opened()) {
+		for (auto const& socket : rangeSockets_) {
+			writtenRanges_.emplace_back(socket->Offset(), socket->Received());
+		}
+		rangeSockets_.clear();
+		if (rangeOffset_ >= 0) {
+			writtenRanges_.emplace_back(rangeOffset_, rangeReceived_);
+		}
+
+		// Only keep what has been received contiguously from the start, so
+		// that the download can later be resumed.
+		std::sort(writtenRanges_.begin(), writtenRanges_.end());
+		int64_t end = 0;
+		for (auto const& range : writtenRanges_) {
+			if (range.first > end) {
+				break;
+			}
+			end = std::max(end, range.first + range.second);
+		}
+		LogMessage(MessageType::Debug_Info, L"Truncating file to the %d bytes received contiguously", end);
+		if (file_.seek(end, fz::file::begin) != end || !file_.truncate()) {
+			LogMessage(MessageType::Debug_Warning, L"Could not truncate the file");
+		}
+	}
+
+	return result;
+}
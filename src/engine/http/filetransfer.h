@@ -2,6 +2,10 @@
 #define FILEZILLA_ENGINE_HTTP_FILETRANSFER_HEADER
 
 #include "httpcontrolsocket.h"
+#include "rangesocket.h"
+
+#include <deque>
+#include <vector>
 
 class CServerPath;
 
@@ -16,6 +20,10 @@ public:
 	virtual int Send() override;
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
+	virtual int Reset(int result) override;
+
+	// Called whenever one of the additional range connections has finished
+	int OnRangeEnd();
 
 private:
 	int OpenFile();
@@ -23,10 +31,37 @@ private:
 	int OnHeader();
 	int OnData(unsigned char const* data, unsigned int len);
 
+	bool CanProbeRanges() const;
+	int OnProbeHeader();
+	void StartRanges(int64_t offset);
+	int NextRange();
+
 	HttpRequestResponse rr_;
 	fz::file file_;
 
 	int redirectCount_{};
+
+	// Parallel downloads: The first request asks for a small range to find
+	// out whether the server supports range requests and how large the file
+	// is. The remainder is then split between this connection and additional
+	// range connections.
+	bool probed_{};
+	bool probing_{};
+	int64_t totalSize_{-1};
+
+	// The range currently fetched by this connection, offset is -1 if the
+	// request is not a range request.
+	int64_t rangeOffset_{-1};
+	int64_t rangeLength_{};
+	int64_t rangeReceived_{};
+
+	// Offset and length of ranges yet to be fetched
+	std::deque<std::pair<int64_t, int64_t>> pendingRanges_;
+
+	// Offset and length of the data written by completed ranges
+	std::vector<std::pair<int64_t, int64_t>> writtenRanges_;
+
+	std::vector<std::unique_ptr<CHttpRangeSocket>> rangeSockets_;
 };
 
 #endif
@@ -6,6 +6,7 @@
 #include "filetransfer.h"
 #include "httpcontrolsocket.h"
 #include "internalconnect.h"
+#include "rangesocket.h"
 #include "request.h"
 #include "tlssocket.h"
 
@@ -316,6 +317,33 @@ void CHttpControlSocket::OnClose(int error)
 	}
 }
 
+void CHttpControlSocket::operator()(fz::event_base const& ev)
+{
+	if (fz::dispatch<HttpRangeEndEvent>(ev, this, &CHttpControlSocket::OnRangeEnd)) {
+		return;
+	}
+
+	CRealControlSocket::operator()(ev);
+}
+
+void CHttpControlSocket::OnRangeEnd()
+{
+	// While the transfer waits for a request of its own, it looks at
+	// the range connections once that request is done.
+	if (operations_.empty() || operations_.back()->opId != Command::transfer) {
+		LogMessage(MessageType::Debug_Verbose, L"Range connection finished while not waiting for it");
+		return;
+	}
+
+	int res = static_cast<CHttpFileTransferOpData&>(*operations_.back()).OnRangeEnd();
+	if (res == FZ_REPLY_CONTINUE) {
+		SendNextCommand();
+	}
+	else if (res != FZ_REPLY_WOULDBLOCK) {
+		ResetOperation(res);
+	}
+}
+
 void CHttpControlSocket::ResetSocket()
 {
 	LogMessage(MessageType::Debug_Verbose, L"CHttpControlSocket::ResetSocket()");
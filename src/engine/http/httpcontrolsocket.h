@@ -262,10 +262,14 @@ protected:
 	virtual int OnSend() override;
 	
 	virtual void ResetSocket() override;
+
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnRangeEnd();
 	
 	friend class CProtocolOpData<CHttpControlSocket>;
 	friend class CHttpFileTransferOpData;
 	friend class CHttpInternalConnectOpData;
+	friend class CHttpRangeSocket;
 	friend class CHttpRequestOpData;
 private:
 	std::wstring	connected_host_;
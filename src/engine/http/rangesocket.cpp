@@ -0,0 +1,349 @@
+#include <filezilla.h>
+
+#include "engineprivate.h"
+#include "optionsbase.h"
+#include "rangesocket.h"
+#include "tlssocket.h"
+
+#include <algorithm>
+
+namespace {
+unsigned int const recv_chunk_size = 64 * 1024;
+}
+
+CHttpRangeSocket::CHttpRangeSocket(CFileZillaEnginePrivate & engine, CHttpControlSocket & controlSocket, fz::uri const& uri, HttpHeaders const& headers,
+	std::wstring const& localFile, int64_t offset, int64_t length)
+	: fz::event_handler(controlSocket.event_loop_)
+	, engine_(engine)
+	, controlSocket_(controlSocket)
+	, uri_(uri)
+	, headers_(headers)
+	, localFile_(localFile)
+	, offset_(offset)
+	, length_(length)
+{
+}
+
+CHttpRangeSocket::~CHttpRangeSocket()
+{
+	remove_handler();
+	ResetSocket();
+}
+
+void CHttpRangeSocket::ResetSocket()
+{
+	if (backend_ == tlsSocket_) {
+		backend_ = nullptr;
+	}
+	delete tlsSocket_;
+	delete backend_;
+	tlsSocket_ = nullptr;
+	backend_ = nullptr;
+	socket_.reset();
+}
+
+bool CHttpRangeSocket::Start()
+{
+	controlSocket_.LogMessage(MessageType::Debug_Verbose, L"CHttpRangeSocket::Start() for range %d-%d", offset_, offset_ + length_ - 1);
+
+	if (length_ <= 0) {
+		return false;
+	}
+
+	if (!file_.open(fz::to_native(localFile_), fz::file::writing, fz::file::existing)) {
+		controlSocket_.LogMessage(MessageType::Debug_Warning, L"Could not open \"%s\" for writing", localFile_);
+		return false;
+	}
+	if (file_.seek(offset_, fz::file::begin) != offset_) {
+		controlSocket_.LogMessage(MessageType::Debug_Warning, L"Could not seek to offset %d within file", offset_);
+		return false;
+	}
+
+	headers_["Host"] = uri_.port_ ? (uri_.host_ + ":" + fz::to_string(uri_.port_)) : uri_.host_;
+	headers_["User-Agent"] = fz::replaced_substrings(PACKAGE_STRING, " ", "/");
+	headers_["Range"] = fz::sprintf("bytes=%d-%d", offset_, offset_ + length_ - 1);
+	headers_["Connection"] = "close";
+	headers_.erase("Content-Length");
+
+	std::string request = fz::sprintf("GET %s HTTP/1.1\r\n", uri_.get_request());
+	for (auto const& header : headers_) {
+		request += header.first + ": " + header.second + "\r\n";
+	}
+	request += "\r\n";
+	sendBuffer_.append(request);
+
+	bool const tls = uri_.scheme_ == "https";
+	unsigned int port = uri_.port_;
+	if (!port) {
+		port = tls ? 443 : 80;
+	}
+
+	socket_ = std::make_unique<fz::socket>(engine_.GetThreadPool(), this);
+	socket_->set_buffer_sizes(engine_.GetOptions().GetOptionVal(OPTION_SOCKET_BUFFERSIZE_RECV), -1);
+
+	std::wstring const host = controlSocket_.ConvertDomainName(fz::to_wstring_from_utf8(uri_.host_));
+	int res = socket_->connect(fz::to_native(host), port);
+	if (res && res != EINPROGRESS) {
+		controlSocket_.LogMessage(MessageType::Debug_Warning, L"Could not connect to %s: %s", host, fz::socket::error_description(res));
+		ResetSocket();
+		return false;
+	}
+
+	return true;
+}
+
+void CHttpRangeSocket::End(bool success)
+{
+	if (done_) {
+		return;
+	}
+	controlSocket_.LogMessage(MessageType::Debug_Verbose, L"CHttpRangeSocket::End(%d) after %d of %d bytes", success, received_, length_);
+
+	done_ = true;
+	ResetSocket();
+	file_.close();
+
+	controlSocket_.send_event<HttpRangeEndEvent>();
+}
+
+void CHttpRangeSocket::operator()(fz::event_base const& ev)
+{
+	fz::dispatch<fz::socket_event>(ev, this, &CHttpRangeSocket::OnSocketEvent);
+}
+
+void CHttpRangeSocket::OnSocketEvent(fz::socket_event_source*, fz::socket_event_flag t, int error)
+{
+	if (done_ || !socket_) {
+		return;
+	}
+
+	switch (t)
+	{
+	case fz::socket_event_flag::connection:
+		if (error) {
+			controlSocket_.LogMessage(MessageType::Debug_Warning, L"Range connection could not be established: %s", fz::socket::error_description(error));
+			End(false);
+		}
+		else {
+			OnConnect();
+		}
+		break;
+	case fz::socket_event_flag::read:
+		OnReceive();
+		break;
+	case fz::socket_event_flag::write:
+		OnSend();
+		break;
+	case fz::socket_event_flag::close:
+		if (error) {
+			controlSocket_.LogMessage(MessageType::Debug_Warning, L"Range connection closed: %s", fz::socket::error_description(error));
+			End(false);
+		}
+		else {
+			// Read whatever is left, possibly subject to the rate limit
+			onCloseCalled_ = true;
+			OnReceive();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void CHttpRangeSocket::OnConnect()
+{
+	controlSocket_.SetAlive();
+
+	if (!backend_) {
+		if (uri_.scheme_ == "https") {
+			if (!controlSocket_.m_pTlsSocket) {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Primary connection is gone, cannot resume its TLS session");
+				End(false);
+				return;
+			}
+
+			tlsSocket_ = new CTlsSocket(this, *socket_, &controlSocket_);
+			if (!tlsSocket_->Init()) {
+				End(false);
+				return;
+			}
+			backend_ = tlsSocket_;
+
+			// Completion is signalled through another connection event
+			int res = tlsSocket_->Handshake(controlSocket_.m_pTlsSocket, true);
+			if (res && res != FZ_REPLY_WOULDBLOCK) {
+				End(false);
+			}
+			return;
+		}
+
+		backend_ = new CSocketBackend(this, *socket_, engine_.GetRateLimiter());
+	}
+
+	OnSend();
+}
+
+void CHttpRangeSocket::OnSend()
+{
+	if (!backend_ || (tlsSocket_ && tlsSocket_->GetState() != CTlsSocket::TlsState::conn)) {
+		return;
+	}
+
+	while (!sendBuffer_.empty()) {
+		int error;
+		int written = backend_->Write(sendBuffer_.get(), static_cast<unsigned int>(sendBuffer_.size()), error);
+		if (written < 0) {
+			if (error != EAGAIN) {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Could not send range request: %s", fz::socket::error_description(error));
+				End(false);
+			}
+			return;
+		}
+		sendBuffer_.consume(static_cast<size_t>(written));
+	}
+}
+
+void CHttpRangeSocket::OnReceive()
+{
+	if (!backend_ || !sendBuffer_.empty()) {
+		return;
+	}
+
+	// Only do a certain number of iterations in one go to keep the event loop going.
+	for (int i = 0; i < 100 && !done_; ++i) {
+		unsigned int len = recv_chunk_size;
+		if (gotHeader_) {
+			// Nothing past the end of the range is of interest
+			len = static_cast<unsigned int>(std::min(static_cast<int64_t>(len), length_ - received_));
+		}
+
+		int error;
+		int read = backend_->Read(recvBuffer_.get(len), len, error);
+		if (read < 0) {
+			if (error != EAGAIN) {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Could not read from range connection: %s", fz::socket::error_description(error));
+				End(false);
+			}
+			else if (onCloseCalled_ && !backend_->IsWaiting(CRateLimiter::inbound)) {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Range connection closed before all data was received");
+				End(false);
+			}
+			return;
+		}
+		if (!read) {
+			if (received_ != length_) {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Range connection closed before all data was received");
+			}
+			End(received_ == length_);
+			return;
+		}
+		recvBuffer_.add(static_cast<size_t>(read));
+		controlSocket_.SetAlive();
+
+		if (!gotHeader_) {
+			int res = ParseHeader();
+			if (res == FZ_REPLY_ERROR) {
+				End(false);
+				return;
+			}
+			if (res == FZ_REPLY_WOULDBLOCK) {
+				continue;
+			}
+		}
+
+		if (recvBuffer_.empty()) {
+			continue;
+		}
+
+		int64_t const write = std::min(static_cast<int64_t>(recvBuffer_.size()), length_ - received_);
+		if (file_.write(recvBuffer_.get(), write) != write) {
+			controlSocket_.LogMessage(MessageType::Error, _("Failed to write to file %s"), localFile_);
+			End(false);
+			return;
+		}
+		recvBuffer_.clear();
+
+		received_ += write;
+		controlSocket_.SetActive(CFileZillaEngine::recv);
+		engine_.transfer_status_.Update(write);
+
+		if (received_ == length_) {
+			End(true);
+		}
+	}
+
+	if (!done_) {
+		// Yield, but come back for the rest
+		send_event<fz::socket_event>(backend_, fz::socket_event_flag::read, 0);
+	}
+}
+
+int CHttpRangeSocket::ParseHeader()
+{
+	for (;;) {
+		size_t i = 0;
+		for (i = 0; (i + 1) < recvBuffer_.size(); ++i) {
+			if (recvBuffer_[i] == '\r' && recvBuffer_[i + 1] == '\n') {
+				break;
+			}
+		}
+		if ((i + 1) >= recvBuffer_.size()) {
+			if (recvBuffer_.size() >= 8192) {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Range response header line too long");
+				return FZ_REPLY_ERROR;
+			}
+			return FZ_REPLY_WOULDBLOCK;
+		}
+
+		std::string line(recvBuffer_.get(), recvBuffer_.get() + i);
+		recvBuffer_.consume(i + 2);
+
+		if (!code_) {
+			if (line.size() < 12 || line.substr(0, 5) != "HTTP/" || line[8] != ' ') {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Malformed range response status line");
+				return FZ_REPLY_ERROR;
+			}
+			code_ = fz::to_integral<unsigned int>(line.substr(9, 3));
+		}
+		else if (line.empty()) {
+			if (code_ == 100) {
+				// Interim response, the actual one follows
+				code_ = 0;
+				responseHeaders_.clear();
+				continue;
+			}
+			gotHeader_ = true;
+			return ProcessCompleteHeader() ? FZ_REPLY_OK : FZ_REPLY_ERROR;
+		}
+		else {
+			auto const delim = line.find(':');
+			if (delim == std::string::npos || !delim) {
+				controlSocket_.LogMessage(MessageType::Debug_Warning, L"Malformed range response header");
+				return FZ_REPLY_ERROR;
+			}
+			responseHeaders_[line.substr(0, delim)] = fz::trimmed(line.substr(delim + 1));
+		}
+	}
+}
+
+bool CHttpRangeSocket::ProcessCompleteHeader()
+{
+	if (code_ != 206) {
+		controlSocket_.LogMessage(MessageType::Debug_Warning, L"Range request got answered with code %d", code_);
+		return false;
+	}
+
+	auto const te = fz::str_tolower_ascii(responseHeaders_["Transfer-Encoding"]);
+	if (!te.empty() && te != "identity") {
+		controlSocket_.LogMessage(MessageType::Debug_Warning, L"Unsupported transfer encoding for range response: %s", te);
+		return false;
+	}
+
+	std::string const expected = fz::sprintf("bytes %d-%d/", offset_, offset_ + length_ - 1);
+	if (responseHeaders_["Content-Range"].compare(0, expected.size(), expected)) {
+		controlSocket_.LogMessage(MessageType::Debug_Warning, L"Unexpected Content-Range in range response: %s", responseHeaders_["Content-Range"]);
+		return false;
+	}
+
+	return true;
+}
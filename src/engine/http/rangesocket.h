@@ -0,0 +1,85 @@
+#ifndef FILEZILLA_ENGINE_HTTP_RANGESOCKET_HEADER
+#define FILEZILLA_ENGINE_HTTP_RANGESOCKET_HEADER
+
+#include "httpcontrolsocket.h"
+
+#include <libfilezilla/buffer.hpp>
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/socket.hpp>
+#include <libfilezilla/uri.hpp>
+
+struct filezilla_engine_http_range_end_event;
+typedef fz::simple_event<filezilla_engine_http_range_end_event> HttpRangeEndEvent;
+
+class CBackend;
+class CTlsSocket;
+
+// Additional connection used by parallel downloads. Fetches a single byte
+// range of the resource using a Range request and writes it into the local
+// file at its offset.
+//
+// Once done, successfully or not, sends a HttpRangeEndEvent to the control
+// socket. TLS connections resume the session of the control socket and
+// require the same certificate, so the control socket needs to be connected
+// at the time this connection gets established.
+class CHttpRangeSocket final : public fz::event_handler
+{
+public:
+	CHttpRangeSocket(CFileZillaEnginePrivate & engine, CHttpControlSocket & controlSocket, fz::uri const& uri, HttpHeaders const& headers,
+		std::wstring const& localFile, int64_t offset, int64_t length);
+	virtual ~CHttpRangeSocket();
+
+	bool Start();
+
+	bool Done() const { return done_; }
+	bool Succeeded() const { return done_ && received_ == length_; }
+
+	int64_t Offset() const { return offset_; }
+	int64_t Length() const { return length_; }
+
+	// Amount of data written into the file
+	int64_t Received() const { return received_; }
+
+private:
+	void End(bool success);
+	void ResetSocket();
+
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnSocketEvent(fz::socket_event_source* source, fz::socket_event_flag t, int error);
+
+	void OnConnect();
+	void OnReceive();
+	void OnSend();
+
+	int ParseHeader();
+	bool ProcessCompleteHeader();
+
+	CFileZillaEnginePrivate & engine_;
+	CHttpControlSocket & controlSocket_;
+
+	fz::uri const uri_;
+	HttpHeaders headers_;
+	std::wstring const localFile_;
+
+	int64_t const offset_;
+	int64_t const length_;
+	int64_t received_{};
+
+	fz::file file_;
+
+	std::unique_ptr<fz::socket> socket_;
+	CBackend* backend_{};
+	CTlsSocket* tlsSocket_{};
+
+	fz::buffer sendBuffer_;
+	fz::buffer recvBuffer_;
+
+	unsigned int code_{};
+	HttpHeaders responseHeaders_;
+	bool gotHeader_{};
+
+	bool onCloseCalled_{};
+	bool done_{};
+};
+
+#endif
@@ -1,18 +1,46 @@
 #include <filezilla.h>
 
 #include "iothread.h"
+#include "lineendings.h"
 
 #include <libfilezilla/file.hpp>
 
+#include <algorithm>
+
 #include <assert.h>
 
-CIOThread::CIOThread()
+#ifndef FZ_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+size_t round_to_power_of_two(size_t v)
 {
-	m_buffers[0] = new char[BUFFERSIZE*BUFFERCOUNT];
-	for (unsigned int i = 0; i < BUFFERCOUNT; ++i) {
-		m_buffers[i] = m_buffers[0] + BUFFERSIZE * i;
-		m_bufferLens[i] = 0;
+	size_t r = 1;
+	while (r <= v / 2) {
+		r *= 2;
 	}
+	return r;
+}
+
+// Targeted amount of time it takes to transfer a single buffer
+int const buffer_duration_divisor = 64;
+}
+
+CIOBufferLimits::CIOBufferLimits(COptionsBase & options)
+	: min_count(static_cast<size_t>(options.GetOptionVal(OPTION_IO_BUFFERCOUNT_MIN)))
+	, max_count(static_cast<size_t>(options.GetOptionVal(OPTION_IO_BUFFERCOUNT_MAX)))
+	, min_size(static_cast<size_t>(options.GetOptionVal(OPTION_IO_BUFFERSIZE_MIN)))
+	, max_size(static_cast<size_t>(options.GetOptionVal(OPTION_IO_BUFFERSIZE_MAX)))
+{
+	min_count = std::max(min_count, size_t(2));
+	max_count = std::max(max_count, min_count);
+	max_size = std::max(max_size, min_size);
+}
+
+CIOThread::CIOThread()
+{
 }
 
 CIOThread::~CIOThread()
@@ -20,16 +48,16 @@ CIOThread::~CIOThread()
 	Destroy();
 
 	Close();
-
-	delete [] m_buffers[0];
 }
 
 void CIOThread::Close()
 {
+	advice_.Close();
+
 	if (m_pFile) {
 		// The file might have been preallocated and the transfer stopped before being completed
 		// so always truncate the file to the actually written size before closing it.
-		if (!m_read) {
+		if (!m_read && !keepSize_) {
 			m_pFile->truncate();
 		}
 
@@ -37,7 +65,7 @@ void CIOThread::Close()
 	}
 }
 
-bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary)
+bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary, CIOBufferLimits const& limits, int64_t expected_size)
 {
 	assert(pFile);
 
@@ -47,8 +75,25 @@ bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile
 	m_read = read;
 	m_binary = binary;
 
+	limits_ = limits;
+
+	// Start out with the old defaults of 8 buffers with 256 KiB each, but do
+	// not use more buffer space than needed for small files.
+	size_t count = std::min(std::max(size_t(8), limits_.min_count), limits_.max_count);
+	bufferSize_ = 256 * 1024;
+	if (expected_size >= 0 && static_cast<uint64_t>(expected_size) < bufferSize_ * count) {
+		bufferSize_ = round_to_power_of_two(static_cast<size_t>(expected_size / count)) * 2;
+	}
+	bufferSize_ = std::min(std::max(bufferSize_, limits_.min_size), limits_.max_size);
+
+	m_buffers.clear();
+	m_buffers.resize(count);
+	for (auto & b : m_buffers) {
+		PrepareBuffer(b);
+	}
+
 	if (read) {
-		m_curAppBuf = BUFFERCOUNT - 1;
+		m_curAppBuf = static_cast<int>(count) - 1;
 		m_curThreadBuf = 0;
 	}
 	else {
@@ -56,9 +101,35 @@ bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile
 		m_curThreadBuf = 0;
 	}
 
-#ifdef SIMULATE_IO
-	size_ = m_pFile->size();
-#endif
+	windowStart_ = fz::monotonic_clock::now();
+	windowBuffers_ = 0;
+	windowBytes_ = 0;
+	producerStalls_ = 0;
+	consumerStalls_ = 0;
+
+	if (synthetic_) {
+		syntheticLeft_ = read ? m_pFile->size() : 0;
+	}
+
+	if (uring_ && m_binary && !synthetic_ && OpenUring()) {
+		if (advise_) {
+			advice_.Attach(uringFd_, read, static_cast<int64_t>(uringOffset_));
+		}
+
+		fz::scoped_lock l(m_mutex);
+		m_running = true;
+		if (read) {
+			SubmitReads(l);
+		}
+		return true;
+	}
+
+	if (advise_ && !synthetic_) {
+		auto const pos = m_pFile->seek(0, fz::file::current);
+		if (pos >= 0) {
+			advice_.Open(advicePath_, read, pos);
+		}
+	}
 
 	m_running = true;
 
@@ -71,14 +142,273 @@ bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile
 	return true;
 }
 
+void CIOThread::UseUring(CIOUring* uring, fz::native_string const& path)
+{
+	uring_ = uring;
+	uringPath_ = path;
+}
+
+bool CIOThread::OpenUring()
+{
+#ifndef FZ_WINDOWS
+	if (uringPath_.empty()) {
+		return false;
+	}
+
+	auto const pos = m_pFile->seek(0, fz::file::current);
+	if (pos < 0) {
+		return false;
+	}
+
+	uringFd_ = open(uringPath_.c_str(), (m_read ? O_RDONLY : O_WRONLY) | O_CLOEXEC);
+	if (uringFd_ == -1) {
+		return false;
+	}
+
+	uringOffset_ = static_cast<uint64_t>(pos);
+	uringPending_ = 0;
+	uringEof_ = false;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CIOThread::CloseUring(fz::scoped_lock & l)
+{
+	// There is no worker thread to join, wait for the outstanding requests instead.
+	while (uringPending_) {
+		m_threadWaiting = true;
+		m_condition.wait(l);
+	}
+
+	if (!m_read) {
+		// Leave the file positioned at the end of the written data, both Finalize
+		// and the truncation in Close rely on it.
+		m_pFile->seek(static_cast<int64_t>(uringOffset_), fz::file::begin);
+	}
+
+	advice_.Close();
+
+#ifndef FZ_WINDOWS
+	close(uringFd_);
+#endif
+	uringFd_ = -1;
+}
+
+void CIOThread::SubmitReads(fz::scoped_lock &)
+{
+	while (m_running && !uringEof_ && !m_error) {
+		if (m_curThreadBuf == m_curAppBuf) {
+			++producerStalls_;
+			break;
+		}
+
+		auto & b = m_buffers[m_curThreadBuf];
+		PrepareBuffer(b);
+		b.offset = uringOffset_;
+		if (!uring_->Read(uringFd_, b.data.get(), static_cast<unsigned int>(b.capacity), b.offset, *this)) {
+			m_error = true;
+			break;
+		}
+		b.pending = true;
+		++uringPending_;
+		uringOffset_ += b.capacity;
+
+		Adapt(m_curThreadBuf, b.capacity);
+
+		++m_curThreadBuf %= m_buffers.size();
+	}
+}
+
+bool CIOThread::SubmitWrite(fz::scoped_lock &, buffer & b)
+{
+	b.offset = uringOffset_;
+	b.len = 0;
+	if (!uring_->Write(uringFd_, b.data.get(), static_cast<unsigned int>(b.capacity), b.offset, *this)) {
+		m_error = true;
+		return false;
+	}
+	b.pending = true;
+	++uringPending_;
+	uringOffset_ += b.capacity;
+
+	return true;
+}
+
+void CIOThread::OnIOCompletion(char* data, int res)
+{
+	fz::scoped_lock l(m_mutex);
+
+	--uringPending_;
+
+	// Short reads and writes get resubmitted for the remainder, so the data
+	// pointer need not be the start of the buffer.
+	auto it = std::find_if(m_buffers.begin(), m_buffers.end(), [data](buffer const& b) {
+		return data >= b.data.get() && data < b.data.get() + b.capacity;
+	});
+	assert(it != m_buffers.end());
+	auto & b = *it;
+
+	if (res > 0) {
+		advice_.Transferred(res);
+	}
+
+	if (res < 0) {
+		m_error = true;
+		m_error_description = fz::to_wstring(GetSystemErrorDescription(-res));
+		b.pending = false;
+	}
+	else if (m_read) {
+		b.len += static_cast<size_t>(res);
+		if (res && b.len < b.capacity && m_running) {
+			if (uring_->Read(uringFd_, b.data.get() + b.len, static_cast<unsigned int>(b.capacity - b.len), b.offset + b.len, *this)) {
+				++uringPending_;
+			}
+			else {
+				m_error = true;
+				b.pending = false;
+			}
+		}
+		else {
+			if (!res) {
+				uringEof_ = true;
+			}
+			b.pending = false;
+		}
+	}
+	else {
+		b.len += static_cast<size_t>(res);
+		if (!res) {
+			m_error = true;
+			b.pending = false;
+		}
+		else if (b.len < b.capacity) {
+			if (uring_->Write(uringFd_, b.data.get() + b.len, static_cast<unsigned int>(b.capacity - b.len), b.offset + b.len, *this)) {
+				++uringPending_;
+			}
+			else {
+				m_error = true;
+				b.pending = false;
+			}
+		}
+		else {
+			b.pending = false;
+		}
+
+		while (m_curThreadBuf != m_curAppBuf && !m_buffers[m_curThreadBuf].pending) {
+			++m_curThreadBuf %= m_buffers.size();
+		}
+	}
+
+	if (m_appWaiting && m_evtHandler) {
+		int const next = (m_curAppBuf + 1) % m_buffers.size();
+		bool available;
+		if (m_read) {
+			available = next != m_curThreadBuf && !m_buffers[next].pending;
+		}
+		else {
+			available = next != m_curThreadBuf;
+		}
+		if (available || m_error) {
+			m_appWaiting = false;
+			m_evtHandler->send_event<CIOThreadEvent>();
+		}
+	}
+
+	if (!uringPending_ && m_threadWaiting) {
+		m_threadWaiting = false;
+		m_condition.signal(l);
+	}
+}
+
+void CIOThread::PrepareBuffer(buffer & b)
+{
+	if (b.capacity != bufferSize_) {
+		if (synthetic_) {
+			// Zero-initialized, the synthetic reads never touch the contents
+			b.data.reset(new char[bufferSize_]());
+		}
+		else {
+			b.data.reset(new char[bufferSize_]);
+		}
+		b.capacity = bufferSize_;
+	}
+	b.len = 0;
+}
+
+void CIOThread::Adapt(int producerBuf, size_t len)
+{
+	++windowBuffers_;
+	windowBytes_ += len;
+	if (windowBuffers_ < m_buffers.size()) {
+		return;
+	}
+
+	// Size the buffers such that each holds a fraction of a second worth of data
+	auto const now = fz::monotonic_clock::now();
+	int64_t const ms = (now - windowStart_).get_milliseconds();
+	if (ms > 0) {
+		uint64_t const target = static_cast<uint64_t>(windowBytes_) * 1000 / ms / buffer_duration_divisor;
+		size_t size = round_to_power_of_two(static_cast<size_t>(std::min(target, static_cast<uint64_t>(limits_.max_size))));
+		bufferSize_ = std::min(std::max(size, limits_.min_size), limits_.max_size);
+	}
+
+	// The slots following the producer are free up to the one the consumer
+	// currently holds. Only free slots can be added or removed.
+	int const consumerBuf = m_read ? m_curAppBuf : m_curThreadBuf;
+	int const count = static_cast<int>(m_buffers.size());
+	if (consumerStalls_ && producerStalls_) {
+		// Both sides had to wait, so the ring alternated between being full
+		// and being empty. Add another slot to absorb the jitter.
+		if (m_buffers.size() < limits_.max_count) {
+			int const pos = producerBuf + 1;
+			m_buffers.emplace(m_buffers.begin() + pos);
+			PrepareBuffer(m_buffers[pos]);
+			if (m_curAppBuf >= pos) {
+				++m_curAppBuf;
+			}
+			if (m_curThreadBuf >= pos) {
+				++m_curThreadBuf;
+			}
+		}
+	}
+	else if (consumerStalls_ || producerStalls_) {
+		// One side is the bottleneck. The ring is either always full or
+		// always empty, the depth does not matter and is just wasted memory.
+		// Keep a free slot for the producer to advance into.
+		int const pos = (producerBuf + 1) % count;
+		if (m_buffers.size() > limits_.min_count && pos != consumerBuf && (pos + 1) % count != consumerBuf) {
+			m_buffers.erase(m_buffers.begin() + pos);
+			if (m_curAppBuf > pos) {
+				--m_curAppBuf;
+			}
+			if (m_curThreadBuf > pos) {
+				--m_curThreadBuf;
+			}
+		}
+	}
+
+	windowStart_ = now;
+	windowBuffers_ = 0;
+	windowBytes_ = 0;
+	producerStalls_ = 0;
+	consumerStalls_ = 0;
+}
+
 void CIOThread::entry()
 {
 	if (m_read) {
 		fz::scoped_lock l(m_mutex);
 		while (m_running) {
+			auto & b = m_buffers[m_curThreadBuf];
+			PrepareBuffer(b);
+			char* const data = b.data.get();
+			size_t const capacity = b.capacity;
 
 			l.unlock();
-			auto len = ReadFromFile(m_buffers[m_curThreadBuf], BUFFERSIZE);
+			auto len = ReadFromFile(data, capacity);
 			l.lock();
 
 			if (m_appWaiting) {
@@ -96,19 +426,22 @@ void CIOThread::entry()
 				break;
 			}
 
-			m_bufferLens[m_curThreadBuf] = static_cast<unsigned int>(len);
+			m_buffers[m_curThreadBuf].len = static_cast<size_t>(len);
 
 			if (!len) {
 				m_running = false;
 				break;
 			}
 
-			++m_curThreadBuf %= BUFFERCOUNT;
+			Adapt(m_curThreadBuf, static_cast<size_t>(len));
+
+			++m_curThreadBuf %= m_buffers.size();
 			if (m_curThreadBuf == m_curAppBuf) {
 				if (!m_running) {
 					break;
 				}
 
+				++producerStalls_;
 				m_threadWaiting = true;
 				if (m_running) {
 					m_condition.wait(l);
@@ -133,12 +466,17 @@ void CIOThread::entry()
 				if (!m_running) {
 					return;
 				}
+				++consumerStalls_;
 				m_threadWaiting = true;
 				m_condition.wait(l);
 			}
 
+			auto const& b = m_buffers[m_curThreadBuf];
+			char* const data = b.data.get();
+			size_t const len = b.capacity;
+
 			l.unlock();
-			bool writeSuccessful = WriteToFile(m_buffers[m_curThreadBuf], BUFFERSIZE);
+			bool writeSuccessful = WriteToFile(data, len);
 			l.lock();
 
 			if (!writeSuccessful) {
@@ -159,7 +497,7 @@ void CIOThread::entry()
 				break;
 			}
 
-			++m_curThreadBuf %= BUFFERCOUNT;
+			++m_curThreadBuf %= m_buffers.size();
 		}
 	}
 }
@@ -174,25 +512,35 @@ int CIOThread::GetNextWriteBuffer(char** pBuffer)
 
 	if (m_curAppBuf == -1) {
 		m_curAppBuf = 0;
-		*pBuffer = m_buffers[0];
-		return IO_Success;
+		*pBuffer = m_buffers[0].data.get();
+		return static_cast<int>(m_buffers[0].capacity);
 	}
 
-	int newBuf = (m_curAppBuf + 1) % BUFFERCOUNT;
+	int newBuf = (m_curAppBuf + 1) % m_buffers.size();
 	if (newBuf == m_curThreadBuf) {
+		++producerStalls_;
 		m_appWaiting = true;
 		return IO_Again;
 	}
 
-	if (m_threadWaiting) {
+	if (uringFd_ != -1) {
+		if (!SubmitWrite(l, m_buffers[m_curAppBuf])) {
+			return IO_Error;
+		}
+	}
+	else if (m_threadWaiting) {
 		m_condition.signal(l);
 		m_threadWaiting = false;
 	}
 
-	m_curAppBuf = newBuf;
-	*pBuffer = m_buffers[newBuf];
+	Adapt(m_curAppBuf, m_buffers[m_curAppBuf].capacity);
+
+	m_curAppBuf = (m_curAppBuf + 1) % m_buffers.size();
+	auto & b = m_buffers[m_curAppBuf];
+	PrepareBuffer(b);
+	*pBuffer = b.data.get();
 
-	return IO_Success;
+	return static_cast<int>(b.capacity);
 }
 
 bool CIOThread::Finalize(int len)
@@ -213,7 +561,7 @@ bool CIOThread::Finalize(int len)
 		return true;
 	}
 
-	if (!WriteToFile(m_buffers[m_curAppBuf], len)) {
+	if (!WriteToFile(m_buffers[m_curAppBuf].data.get(), len)) {
 		return false;
 	}
 
@@ -235,10 +583,36 @@ int CIOThread::GetNextReadBuffer(char** pBuffer)
 {
 	assert(m_read);
 
-	int newBuf = (m_curAppBuf + 1) % BUFFERCOUNT;
-
 	fz::scoped_lock l(m_mutex);
 
+	int newBuf = (m_curAppBuf + 1) % m_buffers.size();
+	if (uringFd_ != -1) {
+		if (m_error) {
+			return IO_Error;
+		}
+
+		// Requests complete out of order, the next buffer might still be pending.
+		// A completed empty buffer marks the end of the file.
+		auto const& b = m_buffers[newBuf];
+		if (newBuf == m_curThreadBuf || b.pending) {
+			if (uringEof_ && newBuf == m_curThreadBuf) {
+				return IO_Success;
+			}
+			++consumerStalls_;
+			m_appWaiting = true;
+			return IO_Again;
+		}
+		if (!b.len) {
+			return IO_Success;
+		}
+
+		*pBuffer = b.data.get();
+		m_curAppBuf = newBuf;
+		SubmitReads(l);
+
+		return static_cast<int>(m_buffers[m_curAppBuf].len);
+	}
+
 	if (newBuf == m_curThreadBuf) {
 		if (m_error) {
 			return IO_Error;
@@ -247,6 +621,7 @@ int CIOThread::GetNextReadBuffer(char** pBuffer)
 			return IO_Success;
 		}
 		else {
+			++consumerStalls_;
 			m_appWaiting = true;
 			return IO_Again;
 		}
@@ -257,10 +632,10 @@ int CIOThread::GetNextReadBuffer(char** pBuffer)
 		m_threadWaiting = false;
 	}
 
-	*pBuffer = m_buffers[newBuf];
+	*pBuffer = m_buffers[newBuf].data.get();
 	m_curAppBuf = newBuf;
 
-	return m_bufferLens[newBuf];
+	return static_cast<int>(m_buffers[newBuf].len);
 }
 
 void CIOThread::Destroy()
@@ -274,6 +649,9 @@ void CIOThread::Destroy()
 				m_condition.signal(l);
 			}
 		}
+		if (uringFd_ != -1) {
+			CloseUring(l);
+		}
 	}
 
 	thread_.join();
@@ -281,13 +659,14 @@ void CIOThread::Destroy()
 
 int64_t CIOThread::ReadFromFile(char* pBuffer, int64_t maxLen)
 {
-#ifdef SIMULATE_IO
-	if (size_ < 0) {
+	if (synthetic_) {
+		int64_t const len = std::min(maxLen, syntheticLeft_);
+		if (len > 0) {
+			syntheticLeft_ -= len;
+			return len;
+		}
 		return 0;
 	}
-	size_ -= maxLen;
-	return maxLen;
-#endif
 
 	// In binary mode, no conversion has to be done.
 	// Also, under Windows the native newline format is already identical
@@ -296,7 +675,9 @@ int64_t CIOThread::ReadFromFile(char* pBuffer, int64_t maxLen)
 	if (m_binary)
 #endif
 	{
-		return m_pFile->read(pBuffer, maxLen);
+		auto const len = m_pFile->read(pBuffer, maxLen);
+		advice_.Transferred(len);
+		return len;
 	}
 
 #ifndef FZ_WINDOWS
@@ -310,38 +691,19 @@ int64_t CIOThread::ReadFromFile(char* pBuffer, int64_t maxLen)
 	if (!len || len <= -1) {
 		return len;
 	}
-
-	const char* const end = r + len;
-	char* w = pBuffer;
+	advice_.Transferred(len);
 
 	// Convert all stand-alone LFs into CRLF pairs.
-	while (r != end) {
-		char c = *r++;
-		if (c == '\n') {
-			if (!m_wasCarriageReturn) {
-				*w++ = '\r';
-			}
-			m_wasCarriageReturn = false;
-		}
-		else if (c == '\r') {
-			m_wasCarriageReturn = true;
-		}
-		else {
-			m_wasCarriageReturn = false;
-		}
-
-		*w++ = c;
-	}
-
-	return w - pBuffer;
+	return static_cast<int64_t>(ConvertLFToCRLF(r, static_cast<size_t>(len), pBuffer, m_wasCarriageReturn));
 #endif
 }
 
 bool CIOThread::WriteToFile(char* pBuffer, int64_t len)
 {
-#ifdef SIMULATE_IO
-	return true;
-#endif
+	if (synthetic_) {
+		return true;
+	}
+
 	// In binary mode, no conversion has to be done.
 	// Also, under Windows the native newline format is already identical
 	// to the newline format of the FTP protocol
@@ -364,36 +726,7 @@ bool CIOThread::WriteToFile(char* pBuffer, int64_t len)
 			}
 		}
 
-		// Skip forward to end of buffer or first CR
-		const char* r = pBuffer;
-		const char* const end = pBuffer + len;
-		while (r != end && *r != '\r') {
-			++r;
-		}
-
-		if (r != end) {
-			// Now we gotta move data and also handle additional CRs.
-			m_wasCarriageReturn = true;
-
-			char* w = const_cast<char*>(r++);
-			for (; r != end; ++r) {
-				if (*r == '\r') {
-					m_wasCarriageReturn = true;
-				}
-				else if (*r == '\n') {
-					m_wasCarriageReturn = false;
-					*(w++) = *r;
-				}
-				else {
-					if (m_wasCarriageReturn) {
-						m_wasCarriageReturn = false;
-						*(w++) = '\r';
-					}
-					*(w++) = *r;
-				}
-			}
-			len = w - pBuffer;
-		}
+		len = static_cast<int64_t>(ConvertCRLFToLF(pBuffer, static_cast<size_t>(len), m_wasCarriageReturn));
 		return DoWrite(pBuffer, len);
 	}
 #endif
@@ -403,6 +736,7 @@ bool CIOThread::DoWrite(const char* pBuffer, int64_t len)
 {
 	auto written = m_pFile->write(pBuffer, len);
 	if (written == len) {
+		advice_.Transferred(written);
 		return true;
 	}
 
@@ -3,14 +3,13 @@
 
 #include <libfilezilla/event.hpp>
 #include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
 
-#define BUFFERCOUNT 8
-#define BUFFERSIZE 256*1024
+#include "fileadvice.h"
+#include "iouring.h"
 
-// Does not actually read from or write to file
-// Useful for benchmarks to avoid IO bottleneck
-// skewing results
-//#define SIMULATE_IO
+#include <memory>
+#include <vector>
 
 struct io_thread_event_type{};
 typedef fz::simple_event<io_thread_event_type> CIOThreadEvent;
@@ -26,13 +25,60 @@ namespace fz {
 class file;
 }
 
-class CIOThread final
+class COptionsBase;
+
+// Bounds for the buffer ring of CIOThread.
+//
+// The ring starts out with a depth and buffer size suitable for the
+// expected transfer size. During the transfer, the buffer size follows
+// the measured throughput. The ring depth grows if both the producer and
+// the consumer stall, and shrinks if only one side does.
+struct CIOBufferLimits final
+{
+	CIOBufferLimits() = default;
+	explicit CIOBufferLimits(COptionsBase & options);
+
+	size_t min_count{4};
+	size_t max_count{32};
+	size_t min_size{64 * 1024};
+	size_t max_size{4 * 1024 * 1024};
+};
+
+class CIOThread final : private CIOUringHandler
 {
 public:
 	CIOThread();
 	~CIOThread();
 
-	bool Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary);
+	// Optional, call before Create. Uses io_uring for binary transfers instead
+	// of blocking a worker thread. The file is accessed through a separate
+	// descriptor opened on the given path. If that is not possible, the
+	// regular worker thread is used.
+	void UseUring(CIOUring* uring, fz::native_string const& path);
+
+	// Optional, call before Create. Does not actually read from or write to
+	// the file: Reading yields as much data as the file is large, written
+	// data gets discarded. Useful for benchmarks to avoid the disk skewing
+	// the results. Takes precedence over io_uring.
+	void UseSynthetic() { synthetic_ = true; }
+
+	// Optional, call before Create. Keeps large transfers from evicting the
+	// page cache, see CFileAdvice. Unless io_uring is used, the file is
+	// advised through a separate descriptor opened on the given path.
+	void UseFileAdvice(fz::native_string const& path)
+	{
+		advise_ = true;
+		advicePath_ = path;
+	}
+
+	// Optional, call before Create. When writing, the file does not get
+	// truncated to the written data on close. For segmented downloads,
+	// which write into the middle of an already allocated file.
+	void KeepSize() { keepSize_ = true; }
+
+	// If known, expected_size is the amount of data that is going to be
+	// transferred, it is used to pick the initial buffer sizes.
+	bool Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary, CIOBufferLimits const& limits = CIOBufferLimits(), int64_t expected_size = -1);
 	void Destroy(); // Only call that might be blocking
 
 	// Call before first call to one of the GetNext*Buffer functions
@@ -51,7 +97,7 @@ public:
 	// Gets next write buffer
 	// Return value: IO_Again if it would block
 	//               IO_Error on error
-	//               IO_Success else
+	//               size of the buffer else
 	int GetNextWriteBuffer(char** pBuffer);
 
 	bool Finalize(int len);
@@ -67,14 +113,46 @@ private:
 	bool WriteToFile(char* pBuffer, int64_t len);
 	bool DoWrite(const char* pBuffer, int64_t len);
 
+	struct buffer final
+	{
+		std::unique_ptr<char[]> data;
+		size_t capacity{};
+		size_t len{};
+
+		// Only used with io_uring
+		uint64_t offset{};
+		bool pending{};
+	};
+
+	// Both must be called with the mutex held and only by the producer,
+	// i.e. the worker thread when reading and the application when
+	// writing.
+	void PrepareBuffer(buffer & b);
+	void Adapt(int producerBuf, size_t len);
+
+	bool OpenUring();
+	void CloseUring(fz::scoped_lock & l);
+	void SubmitReads(fz::scoped_lock & l);
+	bool SubmitWrite(fz::scoped_lock & l, buffer & b);
+	virtual void OnIOCompletion(char* data, int res) override;
+
 	fz::event_handler* m_evtHandler{};
 
 	bool m_read{};
 	bool m_binary{};
 	std::unique_ptr<fz::file> m_pFile;
 
-	char* m_buffers[BUFFERCOUNT];
-	unsigned int m_bufferLens[BUFFERCOUNT];
+	std::vector<buffer> m_buffers;
+
+	CIOBufferLimits limits_;
+	size_t bufferSize_{};
+
+	// Statistics for the adaptation, reset once per revolution of the ring
+	fz::monotonic_clock windowStart_;
+	size_t windowBuffers_{};
+	int64_t windowBytes_{};
+	int producerStalls_{};
+	int consumerStalls_{};
 
 	fz::mutex m_mutex{false};
 	fz::condition m_condition;
@@ -91,9 +169,23 @@ private:
 
 	std::wstring m_error_description;
 
-#ifdef SIMULATE_IO
-	int64_t size_{};
-#endif
+	// In io_uring mode m_curThreadBuf is the next buffer to read into when
+	// reading and the oldest buffer with a pending write when writing.
+	CIOUring* uring_{};
+	fz::native_string uringPath_;
+	int uringFd_{-1};
+	uint64_t uringOffset_{};
+	int uringPending_{};
+	bool uringEof_{};
+
+	bool synthetic_{};
+	int64_t syntheticLeft_{};
+
+	bool advise_{};
+	fz::native_string advicePath_;
+	CFileAdvice advice_;
+
+	bool keepSize_{};
 
 	fz::async_task thread_;
 };
@@ -0,0 +1,317 @@
+#include <filezilla.h>
+
+#include "iouring.h"
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#if HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <string.h>
+
+namespace {
+// Number of rings and thus completion threads shared by all transfers
+size_t const ring_count = 2;
+
+unsigned int const ring_entries = 256;
+
+struct request final
+{
+	CIOUringHandler* handler{};
+	char* buffer{};
+	iovec iov{};
+};
+
+int io_uring_setup(unsigned int entries, io_uring_params* p)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+template<typename T>
+T load_acquire(T const* p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<typename T>
+void store_release(T* p, T v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+}
+
+class CIOUring::ring final
+{
+public:
+	~ring();
+
+	bool init(fz::thread_pool& pool);
+
+	bool submit(uint8_t opcode, int fd, request* req, uint64_t offset);
+
+private:
+	void entry();
+	void flush(fz::scoped_lock &);
+
+	int fd_{-1};
+
+	void* sq_ptr_{MAP_FAILED};
+	size_t sq_size_{};
+	void* cq_ptr_{MAP_FAILED};
+	size_t cq_size_{};
+	io_uring_sqe* sqes_{static_cast<io_uring_sqe*>(MAP_FAILED)};
+	size_t sqes_size_{};
+
+	unsigned int* sq_head_{};
+	unsigned int* sq_tail_{};
+	unsigned int sq_mask_{};
+	unsigned int sq_entries_{};
+	unsigned int* sq_array_{};
+
+	unsigned int* cq_head_{};
+	unsigned int* cq_tail_{};
+	unsigned int cq_mask_{};
+	io_uring_cqe* cqes_{};
+
+	// Serializes access to the submission queue
+	fz::mutex mutex_{false};
+
+	fz::async_task thread_;
+};
+
+CIOUring::ring::~ring()
+{
+	if (thread_) {
+		// A no-op without request wakes up and terminates the completion thread
+		submit(IORING_OP_NOP, -1, nullptr, 0);
+		thread_.join();
+	}
+
+	if (sqes_ != MAP_FAILED) {
+		munmap(sqes_, sqes_size_);
+	}
+	if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+		munmap(cq_ptr_, cq_size_);
+	}
+	if (sq_ptr_ != MAP_FAILED) {
+		munmap(sq_ptr_, sq_size_);
+	}
+	if (fd_ != -1) {
+		close(fd_);
+	}
+}
+
+bool CIOUring::ring::init(fz::thread_pool& pool)
+{
+	io_uring_params p{};
+	fd_ = io_uring_setup(ring_entries, &p);
+	if (fd_ < 0) {
+		fd_ = -1;
+		return false;
+	}
+
+	sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+	}
+
+	sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+	if (sq_ptr_ == MAP_FAILED) {
+		return false;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ptr_ = sq_ptr_;
+	}
+	else {
+		cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+		if (cq_ptr_ == MAP_FAILED) {
+			return false;
+		}
+	}
+
+	sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+	sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+	if (sqes_ == MAP_FAILED) {
+		return false;
+	}
+
+	char* sq = static_cast<char*>(sq_ptr_);
+	sq_head_ = reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+	sq_tail_ = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+	sq_mask_ = *reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+	sq_entries_ = *reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_entries);
+	sq_array_ = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+
+	char* cq = static_cast<char*>(cq_ptr_);
+	cq_head_ = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+	cq_tail_ = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+	cq_mask_ = *reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+	cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+	thread_ = pool.spawn([this]() { entry(); });
+	return static_cast<bool>(thread_);
+}
+
+bool CIOUring::ring::submit(uint8_t opcode, int fd, request* req, uint64_t offset)
+{
+	fz::scoped_lock l(mutex_);
+
+	unsigned int const tail = *sq_tail_;
+	if (tail - load_acquire(sq_head_) >= sq_entries_) {
+		flush(l);
+		if (tail - load_acquire(sq_head_) >= sq_entries_) {
+			return false;
+		}
+	}
+
+	unsigned int const index = tail & sq_mask_;
+	io_uring_sqe & sqe = sqes_[index];
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = opcode;
+	sqe.fd = fd;
+	sqe.off = offset;
+	if (req) {
+		sqe.addr = reinterpret_cast<uint64_t>(&req->iov);
+		sqe.len = 1;
+	}
+	sqe.user_data = reinterpret_cast<uint64_t>(req);
+
+	sq_array_[index] = index;
+	store_release(sq_tail_, tail + 1);
+
+	flush(l);
+	return true;
+}
+
+void CIOUring::ring::flush(fz::scoped_lock &)
+{
+	unsigned int const pending = *sq_tail_ - load_acquire(sq_head_);
+	if (pending) {
+		// Might fail with EAGAIN or EBUSY under memory pressure, in which
+		// case the entries stay queued and get submitted with the next call.
+		io_uring_enter(fd_, pending, 0, 0);
+	}
+}
+
+void CIOUring::ring::entry()
+{
+	for (;;) {
+		unsigned int head = *cq_head_;
+		unsigned int const tail = load_acquire(cq_tail_);
+		if (head == tail) {
+			int res = io_uring_enter(fd_, 0, 1, IORING_ENTER_GETEVENTS);
+			if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				return;
+			}
+			continue;
+		}
+
+		bool quit = false;
+		for (; head != tail; ++head) {
+			io_uring_cqe const& cqe = cqes_[head & cq_mask_];
+			auto * req = reinterpret_cast<request*>(cqe.user_data);
+			int const res = cqe.res;
+
+			// Return the entry to the kernel before invoking the handler,
+			// it may submit new requests right away.
+			store_release(cq_head_, head + 1);
+
+			if (!req) {
+				quit = true;
+				continue;
+			}
+
+			req->handler->OnIOCompletion(req->buffer, res);
+			delete req;
+		}
+
+		if (quit) {
+			return;
+		}
+
+		// Entries that could not be submitted earlier
+		fz::scoped_lock l(mutex_);
+		flush(l);
+	}
+}
+
+std::unique_ptr<CIOUring> CIOUring::Create(fz::thread_pool& pool)
+{
+	std::unique_ptr<CIOUring> ret(new CIOUring);
+	for (size_t i = 0; i < ring_count; ++i) {
+		auto r = std::make_unique<ring>();
+		if (!r->init(pool)) {
+			return nullptr;
+		}
+		ret->rings_.push_back(std::move(r));
+	}
+	return ret;
+}
+
+CIOUring::~CIOUring()
+{
+}
+
+bool CIOUring::Submit(bool write, int fd, char* buffer, unsigned int len, uint64_t offset, CIOUringHandler& handler)
+{
+	auto req = new request;
+	req->handler = &handler;
+	req->buffer = buffer;
+	req->iov.iov_base = buffer;
+	req->iov.iov_len = len;
+
+	auto & r = *rings_[static_cast<size_t>(fd) % rings_.size()];
+	if (!r.submit(write ? IORING_OP_WRITEV : IORING_OP_READV, fd, req, offset)) {
+		delete req;
+		return false;
+	}
+
+	return true;
+}
+
+#else
+
+std::unique_ptr<CIOUring> CIOUring::Create(fz::thread_pool&)
+{
+	return nullptr;
+}
+
+class CIOUring::ring final
+{
+};
+
+CIOUring::~CIOUring()
+{
+}
+
+bool CIOUring::Submit(bool, int, char*, unsigned int, uint64_t, CIOUringHandler&)
+{
+	return false;
+}
+
+#endif
+
+bool CIOUring::Read(int fd, char* buffer, unsigned int len, uint64_t offset, CIOUringHandler& handler)
+{
+	return Submit(false, fd, buffer, len, offset, handler);
+}
+
+bool CIOUring::Write(int fd, char* buffer, unsigned int len, uint64_t offset, CIOUringHandler& handler)
+{
+	return Submit(true, fd, buffer, len, offset, handler);
+}
@@ -0,0 +1,53 @@
+#ifndef FILEZILLA_ENGINE_IOURING_HEADER
+#define FILEZILLA_ENGINE_IOURING_HEADER
+
+#include <memory>
+#include <vector>
+
+namespace fz {
+class thread_pool;
+}
+
+class CIOUringHandler
+{
+public:
+	virtual ~CIOUringHandler() = default;
+
+	// Called from one of the completion threads of CIOUring.
+	// res is the number of bytes transferred or a negated errno value.
+	virtual void OnIOCompletion(char* buffer, int res) = 0;
+};
+
+// Asynchronous file I/O through Linux' io_uring interface.
+//
+// A single instance is shared by all engines. It owns a small, fixed
+// number of rings, each with its own completion thread. Requests for
+// the same file descriptor always go through the same ring.
+class CIOUring final
+{
+public:
+	// Returns nullptr if FileZilla has been built without io_uring support or if
+	// the kernel does not support io_uring.
+	static std::unique_ptr<CIOUring> Create(fz::thread_pool& pool);
+
+	~CIOUring();
+
+	CIOUring(CIOUring const&) = delete;
+	CIOUring& operator=(CIOUring const&) = delete;
+
+	// Positioned read and write of the given buffer. On success, the handler
+	// gets called exactly once for the request, the buffer has to stay
+	// valid until then.
+	bool Read(int fd, char* buffer, unsigned int len, uint64_t offset, CIOUringHandler& handler);
+	bool Write(int fd, char* buffer, unsigned int len, uint64_t offset, CIOUringHandler& handler);
+
+private:
+	CIOUring() = default;
+
+	bool Submit(bool write, int fd, char* buffer, unsigned int len, uint64_t offset, CIOUringHandler& handler);
+
+	class ring;
+	std::vector<std::unique_ptr<ring>> rings_;
+};
+
+#endif
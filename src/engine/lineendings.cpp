@@ -0,0 +1,267 @@
+#include <filezilla.h>
+
+#include "lineendings.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define LINEENDINGS_X86 1
+  #define LINEENDINGS_TARGET(isa) __attribute__((target(isa)))
+  #include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+  #define LINEENDINGS_X86 1
+  #define LINEENDINGS_TARGET(isa)
+  #include <intrin.h>
+  #include <immintrin.h>
+#endif
+
+namespace {
+
+char const* find_scalar(char const* p, char const* end)
+{
+	while (p != end && *p != '\r' && *p != '\n') {
+		++p;
+	}
+	return p;
+}
+
+#if LINEENDINGS_X86
+unsigned int lowest_bit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+}
+
+LINEENDINGS_TARGET("sse2")
+char const* find_sse2(char const* p, char const* end)
+{
+	__m128i const cr = _mm_set1_epi8('\r');
+	__m128i const lf = _mm_set1_epi8('\n');
+	while (end - p >= 16) {
+		__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+		unsigned int const mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))));
+		if (mask) {
+			return p + lowest_bit(mask);
+		}
+		p += 16;
+	}
+	return find_scalar(p, end);
+}
+
+LINEENDINGS_TARGET("avx2")
+char const* find_avx2(char const* p, char const* end)
+{
+	__m256i const cr = _mm256_set1_epi8('\r');
+	__m256i const lf = _mm256_set1_epi8('\n');
+	while (end - p >= 32) {
+		__m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+		unsigned int const mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf))));
+		if (mask) {
+			return p + lowest_bit(mask);
+		}
+		p += 32;
+	}
+	return find_sse2(p, end);
+}
+
+bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	bool const osxsave = (info[2] & (1 << 27)) != 0;
+	bool const avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool cpu_has_sse2()
+{
+#if defined(_MSC_VER) || defined(__x86_64__)
+	return true;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif
+
+template<char const* (*find)(char const*, char const*)>
+size_t lf_to_crlf(char const* in, size_t len, char* out, bool& wasCR)
+{
+	char const* const end = in + len;
+	char* w = out;
+	while (in != end) {
+		char const* special = find(in, end);
+		size_t const run = static_cast<size_t>(special - in);
+		if (run) {
+			// Output may overlap the input, see ConvertLFToCRLF
+			memmove(w, in, run);
+			w += run;
+			wasCR = false;
+		}
+		if (special == end) {
+			break;
+		}
+
+		char const c = *special;
+		if (c == '\n') {
+			if (!wasCR) {
+				*w++ = '\r';
+			}
+			wasCR = false;
+		}
+		else {
+			wasCR = true;
+		}
+		*w++ = c;
+		in = special + 1;
+	}
+
+	return static_cast<size_t>(w - out);
+}
+
+template<char const* (*find)(char const*, char const*)>
+size_t crlf_to_lf(char* buffer, size_t len, bool& pendingCR)
+{
+	// Each pending CR has left a gap of one byte between the read and
+	// write positions, so writing it out later never overtakes reading.
+	char const* r = buffer;
+	char const* const end = buffer + len;
+	char* w = buffer;
+	while (r != end) {
+		char const* special = find(r, end);
+		size_t const run = static_cast<size_t>(special - r);
+		if (run) {
+			if (pendingCR) {
+				*w++ = '\r';
+				pendingCR = false;
+			}
+			if (w != r) {
+				memmove(w, r, run);
+			}
+			w += run;
+		}
+		if (special == end) {
+			break;
+		}
+
+		if (*special == '\r') {
+			pendingCR = true;
+		}
+		else {
+			pendingCR = false;
+			*w++ = '\n';
+		}
+		r = special + 1;
+	}
+
+	return static_cast<size_t>(w - buffer);
+}
+
+// Byte-at-a-time reference implementations
+size_t lf_to_crlf_scalar(char const* in, size_t len, char* out, bool& wasCR)
+{
+	char const* const end = in + len;
+	char* w = out;
+	while (in != end) {
+		char const c = *in++;
+		if (c == '\n') {
+			if (!wasCR) {
+				*w++ = '\r';
+			}
+			wasCR = false;
+		}
+		else if (c == '\r') {
+			wasCR = true;
+		}
+		else {
+			wasCR = false;
+		}
+
+		*w++ = c;
+	}
+
+	return static_cast<size_t>(w - out);
+}
+
+size_t crlf_to_lf_scalar(char* buffer, size_t len, bool& pendingCR)
+{
+	char const* r = buffer;
+	char const* const end = buffer + len;
+	char* w = buffer;
+	for (; r != end; ++r) {
+		if (*r == '\r') {
+			pendingCR = true;
+		}
+		else if (*r == '\n') {
+			pendingCR = false;
+			*w++ = *r;
+		}
+		else {
+			if (pendingCR) {
+				pendingCR = false;
+				*w++ = '\r';
+			}
+			*w++ = *r;
+		}
+	}
+
+	return static_cast<size_t>(w - buffer);
+}
+}
+
+LineEndingKernel GetLineEndingKernel()
+{
+#if LINEENDINGS_X86
+	static LineEndingKernel const kernel = cpu_has_avx2() ? LineEndingKernel::avx2 : (cpu_has_sse2() ? LineEndingKernel::sse2 : LineEndingKernel::scalar);
+	return kernel;
+#else
+	return LineEndingKernel::scalar;
+#endif
+}
+
+size_t ConvertLFToCRLF(char const* in, size_t len, char* out, bool& wasCR, LineEndingKernel kernel)
+{
+	switch (kernel) {
+#if LINEENDINGS_X86
+	case LineEndingKernel::avx2:
+		return lf_to_crlf<find_avx2>(in, len, out, wasCR);
+	case LineEndingKernel::sse2:
+		return lf_to_crlf<find_sse2>(in, len, out, wasCR);
+#endif
+	default:
+		return lf_to_crlf_scalar(in, len, out, wasCR);
+	}
+}
+
+size_t ConvertCRLFToLF(char* buffer, size_t len, bool& pendingCR, LineEndingKernel kernel)
+{
+	assert(!pendingCR || !len || *buffer == '\r' || *buffer == '\n');
+
+	switch (kernel) {
+#if LINEENDINGS_X86
+	case LineEndingKernel::avx2:
+		return crlf_to_lf<find_avx2>(buffer, len, pendingCR);
+	case LineEndingKernel::sse2:
+		return crlf_to_lf<find_sse2>(buffer, len, pendingCR);
+#endif
+	default:
+		return crlf_to_lf_scalar(buffer, len, pendingCR);
+	}
+}
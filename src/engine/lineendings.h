@@ -0,0 +1,36 @@
+#ifndef FILEZILLA_ENGINE_LINEENDINGS_HEADER
+#define FILEZILLA_ENGINE_LINEENDINGS_HEADER
+
+#include <stddef.h>
+
+// Line ending conversion for ASCII mode transfers.
+//
+// The vectorized kernels scan for CR and LF bytes a whole vector at a time
+// and copy the runs in between in bulk. The scalar kernel handles a byte
+// at a time. All kernels produce identical output.
+enum class LineEndingKernel
+{
+	scalar,
+	sse2,
+	avx2
+};
+
+// Returns the fastest kernel supported by the CPU
+LineEndingKernel GetLineEndingKernel();
+
+// Converts all stand-alone LFs into CRLF pairs. out needs to have room for
+// 2 * len bytes. It may overlap with the input if it starts at least len
+// bytes before it, as done by CIOThread. wasCR is carried over between
+// calls, it is true if the last byte processed was a CR. Returns the number
+// of bytes written to out.
+size_t ConvertLFToCRLF(char const* in, size_t len, char* out, bool& wasCR, LineEndingKernel kernel = GetLineEndingKernel());
+
+// Converts CRLF pairs into LFs in-place, leaving stand-alone CRs alone
+// except for runs of CRs, which get collapsed into a single CR.
+// pendingCR is carried over between calls, it is true if the last
+// byte processed was a CR which has not yet been written. If set on entry,
+// the buffer must start with either CR or LF, the caller has to emit the
+// pending CR first otherwise. Returns the new length of the buffer.
+size_t ConvertCRLFToLF(char* buffer, size_t len, bool& pendingCR, LineEndingKernel kernel = GetLineEndingKernel());
+
+#endif
@@ -571,6 +571,7 @@ bool CServer::ProtocolHasFeature(ServerProtocol const protocol, ProtocolFeature
 	case ProtocolFeature::TransferMode:
 	case ProtocolFeature::EnterCommand:
 	case ProtocolFeature::PostLoginCommands:
+	case ProtocolFeature::SegmentedDownload:
 		if (protocol == FTP || protocol == FTPS || protocol == FTPES || protocol == INSECURE_FTP) {
 			return true;
 		}
@@ -593,6 +594,12 @@ bool CServer::ProtocolHasFeature(ServerProtocol const protocol, ProtocolFeature
 			return true;
 		}
 		break;
+	case ProtocolFeature::BatchTransfer:
+	case ProtocolFeature::RecursiveList:
+		if (protocol == SFTP) {
+			return true;
+		}
+		break;
 	}
 	return false;
 }
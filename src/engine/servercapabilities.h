@@ -28,6 +28,7 @@ enum capabilityNames
 	list_hidden_support, // LIST -a command
 	rest_stream, // supports REST+STOR in addition to APPE
 	epsv_command,
+	command_pipelining, // set to 'no' if the server mishandled several commands in flight
 
 	// FTPS and HTTPS
 	tls_resume, // Does the server support resuming of TLS sessions?
@@ -0,0 +1,101 @@
+#include <filezilla.h>
+
+#include "batchtransfer.h"
+#include "directorycache.h"
+
+#include <libfilezilla/local_filesys.hpp>
+
+int CSftpBatchTransferOpData::Send()
+{
+	LogMessage(MessageType::Debug_Verbose, L"CSftpBatchTransferOpData::Send() in state %d", opState);
+
+	LogMessage(MessageType::Status, _("Starting transfer of %u files"), static_cast<unsigned int>(files_.size()));
+
+	// As with single files, local filenames are passed as UTF-8 whereas
+	// remote filenames need to be in server encoding.
+	std::string cmd = "transfers";
+	int64_t totalSize = 0;
+	for (auto const& file : files_) {
+		std::wstring const remoteFile = controlSocket_.QuoteFilename(file.GetRemotePath().FormatFilename(file.GetRemoteFile()));
+		std::string const remote = controlSocket_.ConvToServer(remoteFile);
+		if (remote.empty()) {
+			LogMessage(MessageType::Error, _("Could not convert command to server encoding"));
+			return FZ_REPLY_ERROR;
+		}
+		std::string const local = fz::to_utf8(controlSocket_.QuoteFilename(file.GetLocalFile()));
+
+		int64_t size = -1;
+		if (file.Download()) {
+			controlSocket_.CreateLocalDir(file.GetLocalFile());
+			cmd += " get " + remote + " " + local;
+
+			CDirentry entry;
+			bool dirDidExist;
+			bool matchedCase;
+			if (engine_.GetDirectoryCache().LookupFile(entry, currentServer_, file.GetRemotePath(), file.GetRemoteFile(), dirDidExist, matchedCase) && matchedCase && !entry.is_dir()) {
+				size = entry.size;
+			}
+		}
+		else {
+			cmd += " put " + local + " " + remote;
+
+			bool isLink;
+			fz::local_filesys::get_file_info(fz::to_native(file.GetLocalFile()), isLink, &size, nullptr, nullptr);
+		}
+
+		if (size < 0 || totalSize < 0) {
+			totalSize = -1;
+		}
+		else {
+			totalSize += size;
+		}
+	}
+
+	engine_.transfer_status_.Init(totalSize, 0, false);
+	engine_.transfer_status_.SetStartTime();
+	controlSocket_.SetWait(true);
+
+	controlSocket_.LogMessageRaw(MessageType::Command, fz::sprintf(L"transfers (%u files)", files_.size()));
+	return controlSocket_.AddToStream(cmd + "\r\n");
+}
+
+int CSftpBatchTransferOpData::ParseResponse()
+{
+	LogMessage(MessageType::Debug_Verbose, L"CSftpBatchTransferOpData::ParseResponse() in state %d", opState);
+
+	if (failed_) {
+		LogMessage(MessageType::Error, _("%u of %u files could not be transferred"), static_cast<unsigned int>(failed_), static_cast<unsigned int>(files_.size()));
+	}
+	else if (controlSocket_.result_ == FZ_REPLY_OK) {
+		LogMessage(MessageType::Status, _("Transferred %u files"), static_cast<unsigned int>(succeeded_));
+	}
+
+	return controlSocket_.result_;
+}
+
+void CSftpBatchTransferOpData::FileDone(size_t index, int result)
+{
+	if (index >= files_.size()) {
+		LogMessage(MessageType::Debug_Warning, L"Result for unknown file %u", index);
+		return;
+	}
+
+	auto const& file = files_[index];
+	if (!file.Download()) {
+		int64_t size = -1;
+		if (result == FZ_REPLY_OK) {
+			bool isLink;
+			fz::local_filesys::get_file_info(fz::to_native(file.GetLocalFile()), isLink, &size, nullptr, nullptr);
+		}
+		controlSocket_.UpdateCache(*this, file.GetRemotePath(), file.GetRemoteFile(), size);
+	}
+
+	if (result == FZ_REPLY_OK) {
+		++succeeded_;
+	}
+	else {
+		++failed_;
+	}
+
+	engine_.AddNotification(new CBatchTransferNotification(index, result));
+}
@@ -0,0 +1,30 @@
+#ifndef FILEZILLA_ENGINE_SFTP_BATCHTRANSFER_HEADER
+#define FILEZILLA_ENGINE_SFTP_BATCHTRANSFER_HEADER
+
+#include "sftpcontrolsocket.h"
+
+// Hands all files of a CBatchTransferCommand to fzsftp in a single
+// transfers command. fzsftp works on several of them at the same time and
+// reports each file once done, see sftpEvent::FileDone.
+class CSftpBatchTransferOpData final : public COpData, public CSftpOpData
+{
+public:
+	CSftpBatchTransferOpData(CSftpControlSocket & controlSocket, std::vector<CFileTransferCommand> const& files)
+		: COpData(Command::batchtransfer)
+		, CSftpOpData(controlSocket)
+		, files_(files)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+	void FileDone(size_t index, int result);
+
+	std::vector<CFileTransferCommand> const files_;
+
+private:
+	size_t succeeded_{};
+	size_t failed_{};
+};
+
+#endif
@@ -22,9 +22,28 @@ int CSftpConnectOpData::Send()
 			LogMessage(MessageType::Debug_Verbose, L"Going to execute %s", executable);
 
 			std::vector<fz::native_string> args = { fzT("-v") };
+			if (engine_.GetOptions().GetOptionVal(OPTION_HELPER_FRAMING)) {
+				args.push_back(fzT("-framed"));
+			}
 			if (engine_.GetOptions().GetOptionVal(OPTION_SFTP_COMPRESSION)) {
 				args.push_back(fzT("-C"));
 			}
+			if (engine_.GetOptions().GetOptionVal(OPTION_SFTP_CONNECTION_SHARING)) {
+				// The first fzsftp for a site becomes the upstream, later ones open
+				// their channels over its connection. The upstream goes away with
+				// its engine, downstreams then fail and reconnect.
+				args.push_back(fzT("-share"));
+			}
+			int const streams = engine_.GetOptions().GetOptionVal(OPTION_SFTP_DOWNLOAD_STREAMS);
+			if (streams > 1) {
+				args.push_back(fzT("-streams"));
+				args.push_back(fz::to_native(std::to_wstring(streams)));
+			}
+			int const batchFiles = engine_.GetOptions().GetOptionVal(OPTION_SFTP_BATCH_FILES);
+			if (batchFiles > 1) {
+				args.push_back(fzT("-transfers"));
+				args.push_back(fz::to_native(std::to_wstring(batchFiles)));
+			}
 			if (!controlSocket_.process_->spawn(executable, args)) {
 				LogMessage(MessageType::Debug_Warning, L"Could not create process");
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;;
@@ -128,7 +147,10 @@ int CSftpConnectOpData::ParseResponse()
 		}
 		break;
 	case connect_open:
-		engine_.AddNotification(new CSftpEncryptionNotification(controlSocket_.m_sftpEncryptionDetails));
+		// Downstreams of a shared connection do no key exchange of their own
+		if (!controlSocket_.m_sftpEncryptionDetails.kexAlgorithm.empty()) {
+			engine_.AddNotification(new CSftpEncryptionNotification(controlSocket_.m_sftpEncryptionDetails));
+		}
 		return FZ_REPLY_OK;
 	default:
 		LogMessage(MessageType::Debug_Warning, L"Unknown op state: %d", opState);
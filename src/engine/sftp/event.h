@@ -1,7 +1,10 @@
 #ifndef FILEZILLA_ENGINE_SFTP_EVENT_HEADER
 #define FILEZILLA_ENGINE_SFTP_EVENT_HEADER
 
-#define FZSFTP_PROTOCOL_VERSION 8
+#define FZSFTP_PROTOCOL_VERSION 12
+
+// Starts a binary frame, see src/putty/fzprintf.h
+#define FZ_FRAME_MARKER 0x01
 
 enum class sftpEvent {
 	Unknown = -1,
@@ -31,6 +34,8 @@ enum class sftpEvent {
 	MacClientToServer,
 	MacServerToClient,
 	Hostkey,
+	FileDone,
+	Listdir,
 
 	count
 };
@@ -49,6 +54,13 @@ struct sftp_list_message
 	mutable std::wstring text;
 	mutable std::wstring name;
 	uint64_t mtime;
+
+	// Attributes as sent by the server, flags tell which of them are valid
+	uint64_t flags{};
+	uint64_t size{};
+	uint64_t permissions{};
+	uint64_t uid{};
+	uint64_t gid{};
 };
 
 struct sftp_list_event_type;
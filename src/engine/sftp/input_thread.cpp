@@ -6,6 +6,8 @@
 
 #include <libfilezilla/process.hpp>
 
+#include <algorithm>
+
 CSftpInputThread::CSftpInputThread(CSftpControlSocket& owner, fz::process& proc)
 	: process_(proc)
 	, owner_(owner)
@@ -127,6 +129,138 @@ bool CSftpInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 	return true;
 }
 
+bool CSftpInputThread::readAtLeast(size_t len, std::wstring & error)
+{
+	while (recv_buffer_.size() < len) {
+		size_t const chunk = std::max(len - recv_buffer_.size(), static_cast<size_t>(16384));
+		int read = process_.read(reinterpret_cast<char *>(recv_buffer_.get(chunk)), static_cast<unsigned int>(chunk));
+		if (read > 0) {
+			recv_buffer_.add(read);
+		}
+		else {
+			if (!read) {
+				error = L"Unexpected EOF.";
+			}
+			else {
+				error = L"Unknown error reading from process";
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+namespace {
+uint64_t get_uint(unsigned char const* p, size_t len)
+{
+	uint64_t ret{};
+	for (size_t i = len; i > 0; --i) {
+		ret <<= 8;
+		ret |= p[i - 1];
+	}
+	return ret;
+}
+}
+
+void CSftpInputThread::processFrame(std::wstring & error)
+{
+	// Frame marker has already been consumed
+	if (!readAtLeast(5, error)) {
+		return;
+	}
+
+	unsigned char const readType = recv_buffer_[0];
+	size_t const len = static_cast<size_t>(get_uint(recv_buffer_.get() + 1, 4));
+	recv_buffer_.consume(5);
+
+	if (readType >= static_cast<unsigned char>(sftpEvent::count)) {
+		error = fz::sprintf(L"Unknown eventType %d", readType);
+		return;
+	}
+	if (len > 1024 * 1024) {
+		error = fz::sprintf(L"Frame too large: %u bytes", len);
+		return;
+	}
+	if (!readAtLeast(len, error)) {
+		return;
+	}
+
+	unsigned char const* p = recv_buffer_.get();
+	unsigned char const* const end = p + len;
+
+	auto text = [&]() {
+		if (end - p < 4) {
+			error = L"Truncated frame";
+			return std::wstring();
+		}
+		size_t const textLen = static_cast<size_t>(get_uint(p, 4));
+		p += 4;
+		if (static_cast<size_t>(end - p) < textLen) {
+			error = L"Truncated frame";
+			return std::wstring();
+		}
+		std::wstring ret = owner_.ConvToLocal(reinterpret_cast<char const*>(p), textLen);
+		if (textLen && ret.empty()) {
+			error = L"Failed to convert reply to local character set.";
+		}
+		p += textLen;
+		return ret;
+	};
+	auto integer = [&]() -> uint64_t {
+		if (end - p < 8) {
+			error = L"Truncated frame";
+			return 0;
+		}
+		uint64_t ret = get_uint(p, 8);
+		p += 8;
+		return ret;
+	};
+
+	sftpEvent const eventType = static_cast<sftpEvent>(readType);
+	if (eventType == sftpEvent::Listentry) {
+		auto msg = new CSftpListEvent;
+		auto & message = std::get<0>(msg->v_);
+		message.text = text();
+		message.mtime = integer();
+		message.name = text();
+		message.flags = integer();
+		message.size = integer();
+		message.permissions = integer();
+		message.uid = integer();
+		message.gid = integer();
+
+		if (error.empty()) {
+			owner_.send_event(msg);
+		}
+		else {
+			delete msg;
+		}
+	}
+	else {
+		auto msg = new CSftpEvent;
+		auto & message = std::get<0>(msg->v_);
+		message.type = eventType;
+		if (eventType == sftpEvent::Transfer) {
+			message.text[0] = std::to_wstring(integer());
+		}
+		else {
+			for (int i = 0; i < 2 && p != end && error.empty(); ++i) {
+				message.text[i] = text();
+			}
+		}
+
+		if (error.empty()) {
+			owner_.send_event(msg);
+		}
+		else {
+			delete msg;
+		}
+	}
+
+	recv_buffer_.consume(len);
+}
+
 void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
 {
 	int lines{};
@@ -159,6 +293,8 @@ void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
 	case sftpEvent::MacClientToServer:
 	case sftpEvent::MacServerToClient:
 	case sftpEvent::Hostkey:
+	case sftpEvent::FileDone:
+	case sftpEvent::Listdir:
 		lines = 1;
 		break;
 	case sftpEvent::AskHostkey:
@@ -173,6 +309,11 @@ void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
 			message.text = ReadLine(error);
 			message.mtime = ReadUInt(error);
 			message.name = ReadLine(error);
+			message.flags = ReadUInt(error);
+			message.size = ReadUInt(error);
+			message.permissions = ReadUInt(error);
+			message.uid = ReadUInt(error);
+			message.gid = ReadUInt(error);
 
 			if (error.empty()) {
 				owner_.send_event(msg);
@@ -210,6 +351,11 @@ void CSftpInputThread::entry()
 		unsigned char readType = *recv_buffer_.get();
 		recv_buffer_.consume(1);
 
+		if (readType == FZ_FRAME_MARKER) {
+			processFrame(error);
+			continue;
+		}
+
 		readType -= '0';
 
 		if (readType >= static_cast<unsigned char>(sftpEvent::count)) {
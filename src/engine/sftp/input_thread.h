@@ -24,9 +24,13 @@ protected:
 	std::wstring ReadLine(std::wstring & error);
 	uint64_t ReadUInt(std::wstring & error);
 
+	// Makes sure at least len bytes are in recv_buffer_
+	bool readAtLeast(size_t len, std::wstring & error);
+
 	void entry();
 
 	void processEvent(sftpEvent eventType, std::wstring & error);
+	void processFrame(std::wstring & error);
 
 	fz::process& process_;
 	CSftpControlSocket& owner_;
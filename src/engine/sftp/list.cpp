@@ -1,7 +1,107 @@
 #include <filezilla.h>
 
 #include "directorycache.h"
+#include "event.h"
 #include "list.h"
+#include "pathcache.h"
+
+namespace {
+// Attribute flags and file types as defined by the SFTP protocol
+uint64_t const attr_size = 0x1;
+uint64_t const attr_uidgid = 0x2;
+uint64_t const attr_permissions = 0x4;
+
+uint64_t const mode_type = 0170000;
+uint64_t const mode_fifo = 0010000;
+uint64_t const mode_chr = 0020000;
+uint64_t const mode_dir = 0040000;
+uint64_t const mode_blk = 0060000;
+uint64_t const mode_link = 0120000;
+uint64_t const mode_sock = 0140000;
+
+std::wstring FormatPermissions(uint64_t mode)
+{
+	std::wstring ret = L"----------";
+	switch (mode & mode_type) {
+	case mode_dir:
+		ret[0] = 'd';
+		break;
+	case mode_link:
+		ret[0] = 'l';
+		break;
+	case mode_fifo:
+		ret[0] = 'p';
+		break;
+	case mode_chr:
+		ret[0] = 'c';
+		break;
+	case mode_blk:
+		ret[0] = 'b';
+		break;
+	case mode_sock:
+		ret[0] = 's';
+		break;
+	default:
+		break;
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		uint64_t const bits = mode >> (6 - i * 3);
+		if (bits & 4) {
+			ret[1 + i * 3] = 'r';
+		}
+		if (bits & 2) {
+			ret[2 + i * 3] = 'w';
+		}
+		if (bits & 1) {
+			ret[3 + i * 3] = 'x';
+		}
+	}
+	if (mode & 04000) {
+		ret[3] = (mode & 0100) ? 's' : 'S';
+	}
+	if (mode & 02000) {
+		ret[6] = (mode & 010) ? 's' : 'S';
+	}
+	if (mode & 01000) {
+		ret[9] = (mode & 01) ? 't' : 'T';
+	}
+
+	return ret;
+}
+
+// SFTP version 3 only sends the names of owner and group as part of the
+// long name. Servers commonly format it like ls -l, take them from there:
+// Permissions, link count, owner, group, size and so on.
+bool ParseLongName(std::wstring const& longname, std::wstring & permissions, std::wstring & ownerGroup)
+{
+	std::wstring tokens[4];
+	size_t pos = 0;
+	for (auto & token : tokens) {
+		pos = longname.find_first_not_of(' ', pos);
+		if (pos == std::wstring::npos) {
+			return false;
+		}
+		size_t const end = longname.find(' ', pos);
+		if (end == std::wstring::npos) {
+			return false;
+		}
+		token = longname.substr(pos, end - pos);
+		pos = end;
+	}
+
+	if (tokens[0].size() < 10 || std::wstring(L"-bcdlps").find(tokens[0][0]) == std::wstring::npos) {
+		return false;
+	}
+	if (tokens[1].find_first_not_of(L"0123456789") != std::wstring::npos) {
+		return false;
+	}
+
+	permissions = std::move(tokens[0]);
+	ownerGroup = tokens[2] + L" " + tokens[3];
+	return true;
+}
+}
 
 enum listStates
 {
@@ -27,6 +127,20 @@ int CSftpListOpData::Send()
 		refresh_ = (flags_ & LIST_FLAG_REFRESH) != 0;
 		fallback_to_current_ = !path_.empty() && (flags_ & LIST_FLAG_FALLBACK_CURRENT) != 0;
 
+		if (recursive() && !refresh_ && !path_.empty()) {
+			// A recursive listing of a parent directory may have put the
+			// listing into the cache already, no need to change directory
+			CServerPath const target = engine_.GetPathCache().Lookup(currentServer_, path_, subDir_);
+			if (!target.empty()) {
+				CDirectoryListing listing;
+				bool is_outdated = false;
+				if (engine_.GetDirectoryCache().Lookup(listing, currentServer_, target, false, is_outdated) && !is_outdated) {
+					controlSocket_.SendDirectoryListingNotification(listing.path, topLevel_, false);
+					return FZ_REPLY_OK;
+				}
+			}
+		}
+
 		controlSocket_.ChangeDir(path_, subDir_, (flags_ & LIST_FLAG_LINK) != 0);
 		opState = list_waitcwd;
 		return FZ_REPLY_CONTINUE;
@@ -56,6 +170,11 @@ int CSftpListOpData::Send()
 		return FZ_REPLY_CONTINUE;
 	}
 	else if (opState == list_list) {
+		if (recursive()) {
+			// Parsers get created per directory, see StartDirectory
+			return controlSocket_.SendCommand(L"lsr");
+		}
+
 		listing_parser_ = std::make_unique<CDirectoryListingParser>(&controlSocket_, currentServer_, listingEncoding::unknown);
 		return controlSocket_.SendCommand(L"ls");
 	}
@@ -78,8 +197,13 @@ int CSftpListOpData::ParseResponse()
 			return FZ_REPLY_INTERNALERROR;
 		}
 
-		directoryListing_ = listing_parser_->Parse(currentPath_);
-		engine_.GetDirectoryCache().Store(directoryListing_, currentServer_);
+		if (recursive()) {
+			FinishDirectory();
+		}
+		else {
+			directoryListing_ = listing_parser_->Parse(currentPath_);
+			engine_.GetDirectoryCache().Store(directoryListing_, currentServer_);
+		}
 		controlSocket_.SendDirectoryListingNotification(currentPath_, topLevel_, false);
 
 		return FZ_REPLY_OK;
@@ -117,25 +241,110 @@ int CSftpListOpData::SubcommandResult(int prevResult, COpData const&)
 	return FZ_REPLY_CONTINUE;
 }
 
-int CSftpListOpData::ParseEntry(std::wstring && entry, uint64_t mtime, std::wstring && name)
+int CSftpListOpData::ParseEntry(sftp_list_message const& message)
 {
 	if (opState != list_list) {
-		controlSocket_.LogMessageRaw(MessageType::RawList, entry);
+		controlSocket_.LogMessageRaw(MessageType::RawList, message.text);
 		LogMessage(MessageType::Debug_Warning, L"ListParseResponse called at improper time: %d", opState);
 		return FZ_REPLY_INTERNALERROR;
 	}
 
 	if (!listing_parser_) {
-		controlSocket_.LogMessageRaw(MessageType::RawList, entry);
+		controlSocket_.LogMessageRaw(MessageType::RawList, message.text);
 		LogMessage(MessageType::Debug_Warning, L"listing_parser_ is null");
 		return FZ_REPLY_INTERNALERROR;
 	}
 
 	fz::datetime time;
-	if (mtime) {
-		time = fz::datetime(static_cast<time_t>(mtime), fz::datetime::seconds);
+	if (message.mtime) {
+		time = fz::datetime(static_cast<time_t>(message.mtime), fz::datetime::seconds);
+	}
+
+	if ((message.flags & (attr_size | attr_permissions)) != (attr_size | attr_permissions) || message.name.empty()) {
+		// Not enough to go by, parse the long name instead
+		listing_parser_->AddLine(std::move(message.text), std::move(message.name), time);
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	controlSocket_.LogMessageRaw(MessageType::RawList, message.text);
+
+	CDirentry entry;
+	entry.name = std::move(message.name);
+	entry.size = static_cast<int64_t>(message.size);
+	entry.time = time;
+	entry.flags = 0;
+
+	uint64_t const type = message.permissions & mode_type;
+	if (type == mode_dir) {
+		entry.flags |= CDirentry::flag_dir;
+	}
+	else if (type == mode_link) {
+		// Like for ls -l style listings, links are assumed to be directories
+		// until resolved
+		entry.flags |= CDirentry::flag_dir | CDirentry::flag_link;
+
+		std::wstring const arrow = L" " + entry.name + L" -> ";
+		size_t const pos = message.text.find(arrow);
+		if (pos != std::wstring::npos) {
+			entry.target = fz::sparse_optional<std::wstring>(message.text.substr(pos + arrow.size()));
+		}
+	}
+
+	std::wstring permissions;
+	std::wstring ownerGroup;
+	if (!ParseLongName(message.text, permissions, ownerGroup)) {
+		permissions = FormatPermissions(message.permissions);
+		if (message.flags & attr_uidgid) {
+			ownerGroup = fz::sprintf(L"%u %u", message.uid, message.gid);
+		}
 	}
-	listing_parser_->AddLine(std::move(entry), std::move(name), time);
+	listing_parser_->AddEntry(std::move(entry), permissions, ownerGroup);
 
 	return FZ_REPLY_WOULDBLOCK;
 }
+
+int CSftpListOpData::StartDirectory(std::wstring const& path)
+{
+	if (opState != list_list || !recursive()) {
+		LogMessage(MessageType::Debug_Warning, L"StartDirectory called at improper time: %d", opState);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	if (listing_parser_) {
+		FinishDirectory();
+	}
+	else if (path != currentPath_.GetPath()) {
+		// fzsftp starts with the directory it was asked to list
+		LogMessage(MessageType::Debug_Warning, L"Recursive listing of %s started with %s", currentPath_.GetPath(), path);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	walkPath_ = CServerPath(path, currentServer_.GetType());
+	if (walkPath_.empty()) {
+		LogMessage(MessageType::Debug_Warning, L"Could not parse path %s", path);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	listing_parser_ = std::make_unique<CDirectoryListingParser>(&controlSocket_, currentServer_, listingEncoding::unknown);
+
+	return FZ_REPLY_WOULDBLOCK;
+}
+
+bool CSftpListOpData::recursive() const
+{
+	return (flags_ & (LIST_FLAG_RECURSIVE | LIST_FLAG_LINK)) == LIST_FLAG_RECURSIVE;
+}
+
+void CSftpListOpData::FinishDirectory()
+{
+	CDirectoryListing listing = listing_parser_->Parse(walkPath_);
+	engine_.GetDirectoryCache().Store(listing, currentServer_);
+
+	if (walkPath_ == currentPath_) {
+		directoryListing_ = std::move(listing);
+	}
+	else if (walkPath_.HasParent()) {
+		// So that changing into the directory can be skipped later on
+		engine_.GetPathCache().Store(currentServer_, walkPath_, walkPath_.GetParent(), walkPath_.GetLastSegment());
+	}
+}
@@ -20,11 +20,21 @@ public:
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
 
-	int ParseEntry(std::wstring && entry, uint64_t mtime, std::wstring && name);
+	int ParseEntry(sftp_list_message const& message);
+
+	// During recursive listings, announces the directory the following
+	// entries belong to.
+	int StartDirectory(std::wstring const& path);
 
 private:
+	bool recursive() const;
+	void FinishDirectory();
+
 	std::unique_ptr<CDirectoryListingParser> listing_parser_;
 
+	// Directory listing_parser_ is for during recursive listings
+	CServerPath walkPath_;
+
 	CServerPath path_;
 	std::wstring subDir_; 
 	
@@ -1,5 +1,6 @@
 #include <filezilla.h>
 
+#include "batchtransfer.h"
 #include "chmod.h"
 #include "connect.h"
 #include "cwd.h"
@@ -276,6 +277,44 @@ void CSftpControlSocket::OnSftpEvent(sftp_message const& message)
 			}
 		}
 		break;
+	case sftpEvent::FileDone:
+		{
+			if (operations_.empty() || operations_.back()->opId != Command::batchtransfer) {
+				LogMessage(MessageType::Debug_Warning, L"sftpEvent::FileDone outside batch transfer, ignoring.");
+				break;
+			}
+
+			auto tokens = fz::strtok(message.text[0], ' ');
+			if (tokens.size() != 2) {
+				LogMessage(MessageType::Debug_Warning, L"Malformed file result: %s", message.text[0]);
+				break;
+			}
+
+			int result;
+			if (tokens[1] == L"1") {
+				result = FZ_REPLY_OK;
+			}
+			else if (tokens[1] == L"2") {
+				result = FZ_REPLY_CRITICALERROR;
+			}
+			else {
+				result = FZ_REPLY_ERROR;
+			}
+			static_cast<CSftpBatchTransferOpData&>(*operations_.back()).FileDone(fz::to_integral<size_t>(tokens[0], static_cast<size_t>(-1)), result);
+		}
+		break;
+	case sftpEvent::Listdir:
+		if (operations_.empty() || operations_.back()->opId != Command::list) {
+			LogMessage(MessageType::Debug_Warning, L"sftpEvent::Listdir outside list operation, ignoring.");
+			break;
+		}
+		else {
+			int res = static_cast<CSftpListOpData&>(*operations_.back()).StartDirectory(message.text[0]);
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				ResetOperation(res);
+			}
+		}
+		break;
 	default:
 		LogMessage(MessageType::Debug_Warning, L"Message type %d not handled", message.type);
 		break;
@@ -297,7 +336,7 @@ void CSftpControlSocket::OnSftpListEvent(sftp_list_message const& message)
 		return;
 	}
 	else {
-		int res = static_cast<CSftpListOpData&>(*operations_.back()).ParseEntry(std::move(message.text), message.mtime, std::move(message.name));
+		int res = static_cast<CSftpListOpData&>(*operations_.back()).ParseEntry(message);
 		if (res != FZ_REPLY_WOULDBLOCK) {
 			ResetOperation(res);
 		}
@@ -515,6 +554,12 @@ void CSftpControlSocket::FileTransfer(std::wstring const& localFile, CServerPath
 	Push(std::move(pData));
 }
 
+void CSftpControlSocket::BatchTransfer(CBatchTransferCommand const& command)
+{
+	auto pData = std::make_unique<CSftpBatchTransferOpData>(*this, command.GetFiles());
+	Push(std::move(pData));
+}
+
 int CSftpControlSocket::DoClose(int nErrorCode)
 {
 	engine_.GetRateLimiter().RemoveObject(this);
@@ -25,6 +25,7 @@ public:
 	virtual void FileTransfer(std::wstring const& localFile, CServerPath const& remotePath,
 		std::wstring const& remoteFile, bool download,
 		CFileTransferCommand::t_transferSettings const& transferSettings) override;
+	virtual void BatchTransfer(CBatchTransferCommand const& command) override;
 	virtual void Delete(CServerPath const& path, std::deque<std::wstring>&& files) override;
 	virtual void RemoveDir(CServerPath const& path = CServerPath(), std::wstring const& subDir = std::wstring()) override;
 	virtual void Mkdir(CServerPath const& path) override;
@@ -72,6 +73,7 @@ protected:
 	std::wstring response_;
 
 	friend class CProtocolOpData<CSftpControlSocket>;
+	friend class CSftpBatchTransferOpData;
 	friend class CSftpChangeDirOpData;
 	friend class CSftpChmodOpData;
 	friend class CSftpConnectOpData;
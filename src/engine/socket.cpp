@@ -23,6 +23,21 @@
   #if !defined(MSG_NOSIGNAL) && !defined(SO_NOSIGPIPE)
     #include <signal.h>
   #endif
+  #if HAVE_SYS_SENDFILE_H
+    #include <pthread.h>
+    #include <signal.h>
+    #include <sys/sendfile.h>
+  #endif
+  #if HAVE_LINUX_TLS_H
+    #include <linux/tls.h>
+    // Older C libraries lack these
+    #ifndef SOL_TLS
+      #define SOL_TLS 282
+    #endif
+    #ifndef TCP_ULP
+      #define TCP_ULP 31
+    #endif
+  #endif
   #undef mutex
 #endif
 
@@ -1287,6 +1302,208 @@ int socket::write(const void* buffer, unsigned int size, int& error)
 	return res;
 }
 
+int socket::send_file(int fd, int64_t& offset, unsigned int size, int& error)
+{
+#if HAVE_SYS_SENDFILE_H
+	// There is no equivalent to MSG_NOSIGNAL for sendfile, block SIGPIPE
+	// in this thread for the duration of the call instead.
+	sigset_t pipe_set;
+	sigset_t old_set;
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+
+	off_t off = static_cast<off_t>(offset);
+	int res = static_cast<int>(::sendfile(fd_, fd, &off, size));
+	if (res == -1) {
+		error = errno;
+		if (error == EPIPE && !sigismember(&old_set, SIGPIPE)) {
+			// Discard the signal that got raised
+			timespec const timeout{};
+			sigtimedwait(&pipe_set, nullptr, &timeout);
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+
+	if (res == -1) {
+		if (error == EAGAIN) {
+			if (socket_thread_) {
+				scoped_lock l(socket_thread_->mutex_);
+				if (!(socket_thread_->waiting_ & WAIT_WRITE)) {
+					socket_thread_->waiting_ |= WAIT_WRITE;
+					socket_thread_->wakeup_thread(l);
+				}
+			}
+		}
+	}
+	else {
+		offset = off;
+		error = 0;
+	}
+
+	return res;
+#else
+	(void)fd;
+	(void)offset;
+	(void)size;
+	error = ENOSYS;
+	return -1;
+#endif
+}
+
+int socket::splice_read(int pipe_fd, unsigned int size, int& error)
+{
+#if HAVE_SPLICE
+	int res = static_cast<int>(::splice(fd_, nullptr, pipe_fd, nullptr, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+
+	if (res == -1) {
+		error = errno;
+		if (error == EAGAIN) {
+			if (socket_thread_) {
+				scoped_lock l(socket_thread_->mutex_);
+				if (!(socket_thread_->waiting_ & WAIT_READ)) {
+					socket_thread_->waiting_ |= WAIT_READ;
+					socket_thread_->wakeup_thread(l);
+				}
+			}
+		}
+	}
+	else {
+		error = 0;
+	}
+
+	return res;
+#else
+	(void)pipe_fd;
+	(void)size;
+	error = ENOSYS;
+	return -1;
+#endif
+}
+
+int socket::enable_ktls(bool send, void const* crypto_info, unsigned int len)
+{
+#if HAVE_LINUX_TLS_H
+	if (fd_ == -1) {
+		return ENOTCONN;
+	}
+
+	// Attaching the protocol a second time for the other direction fails with EEXIST
+	int res = setsockopt(fd_, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"));
+	if (res && errno != EEXIST) {
+		return errno;
+	}
+
+	res = setsockopt(fd_, SOL_TLS, send ? TLS_TX : TLS_RX, crypto_info, len);
+	if (res) {
+		return errno;
+	}
+
+	return 0;
+#else
+	(void)send;
+	(void)crypto_info;
+	(void)len;
+	return ENOSYS;
+#endif
+}
+
+int socket::read_record(void* buffer, unsigned int size, unsigned char& type, int& error)
+{
+#if HAVE_LINUX_TLS_H
+	char control[CMSG_SPACE(sizeof(unsigned char))];
+
+	iovec iov{};
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	int res = static_cast<int>(recvmsg(fd_, &msg, 0));
+	if (res == -1) {
+		error = errno;
+		if (error == EAGAIN) {
+			if (socket_thread_) {
+				scoped_lock l(socket_thread_->mutex_);
+				if (!(socket_thread_->waiting_ & WAIT_READ)) {
+					socket_thread_->waiting_ |= WAIT_READ;
+					socket_thread_->wakeup_thread(l);
+				}
+			}
+		}
+		return res;
+	}
+
+	// Without control message it is application data
+	type = 23;
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE) {
+		type = *reinterpret_cast<unsigned char*>(CMSG_DATA(cmsg));
+	}
+
+	error = 0;
+	return res;
+#else
+	(void)buffer;
+	(void)size;
+	(void)type;
+	error = ENOSYS;
+	return -1;
+#endif
+}
+
+int socket::write_record(unsigned char type, void const* buffer, unsigned int size, int& error)
+{
+#if HAVE_LINUX_TLS_H
+	char control[CMSG_SPACE(sizeof(unsigned char))]{};
+
+	iovec iov{};
+	iov.iov_base = const_cast<void*>(buffer);
+	iov.iov_len = size;
+
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*reinterpret_cast<unsigned char*>(CMSG_DATA(cmsg)) = type;
+
+	int res = static_cast<int>(sendmsg(fd_, &msg, MSG_NOSIGNAL));
+	if (res == -1) {
+		error = errno;
+		if (error == EAGAIN) {
+			if (socket_thread_) {
+				scoped_lock l(socket_thread_->mutex_);
+				if (!(socket_thread_->waiting_ & WAIT_WRITE)) {
+					socket_thread_->waiting_ |= WAIT_WRITE;
+					socket_thread_->wakeup_thread(l);
+				}
+			}
+		}
+	}
+	else {
+		error = 0;
+	}
+
+	return res;
+#else
+	(void)type;
+	(void)buffer;
+	(void)size;
+	error = ENOSYS;
+	return -1;
+#endif
+}
+
 std::string socket::address_to_string(sockaddr const* addr, int addr_len, bool with_port, bool strip_zone_index)
 {
 	char hostbuf[NI_MAXHOST];
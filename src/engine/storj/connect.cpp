@@ -23,6 +23,9 @@ int CStorjConnectOpData::Send()
 			LogMessage(MessageType::Debug_Verbose, L"Going to execute %s", executable);
 
 			std::vector<fz::native_string> args;
+			if (engine_.GetOptions().GetOptionVal(OPTION_HELPER_FRAMING)) {
+				args.push_back(fzT("-framed"));
+			}
 			if (!controlSocket_.process_->spawn(executable, args)) {
 				LogMessage(MessageType::Debug_Warning, L"Could not create process");
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;;
@@ -6,6 +6,8 @@
 
 #include <libfilezilla/process.hpp>
 
+#include <algorithm>
+
 CStorjInputThread::CStorjInputThread(CStorjControlSocket& owner, fz::process& proc)
 	: process_(proc)
 	, owner_(owner)
@@ -92,6 +94,107 @@ bool CStorjInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 	return true;
 }
 
+bool CStorjInputThread::readAtLeast(size_t len, std::wstring & error)
+{
+	while (recv_buffer_.size() < len) {
+		size_t const chunk = std::max(len - recv_buffer_.size(), static_cast<size_t>(16384));
+		int read = process_.read(reinterpret_cast<char *>(recv_buffer_.get(chunk)), static_cast<unsigned int>(chunk));
+		if (read > 0) {
+			recv_buffer_.add(read);
+		}
+		else {
+			if (!read) {
+				error = L"Unexpected EOF.";
+			}
+			else {
+				error = L"Unknown error reading from process";
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+namespace {
+uint64_t get_uint(unsigned char const* p, size_t len)
+{
+	uint64_t ret{};
+	for (size_t i = len; i > 0; --i) {
+		ret <<= 8;
+		ret |= p[i - 1];
+	}
+	return ret;
+}
+}
+
+void CStorjInputThread::processFrame(std::wstring & error)
+{
+	// Frame marker has already been consumed
+	if (!readAtLeast(5, error)) {
+		return;
+	}
+
+	unsigned char const readType = recv_buffer_[0];
+	size_t const len = static_cast<size_t>(get_uint(recv_buffer_.get() + 1, 4));
+	recv_buffer_.consume(5);
+
+	if (readType >= static_cast<unsigned char>(storjEvent::count)) {
+		error = fz::sprintf(L"Unknown eventType %d", readType);
+		return;
+	}
+	if (len > 1024 * 1024) {
+		error = fz::sprintf(L"Frame too large: %u bytes", len);
+		return;
+	}
+	if (!readAtLeast(len, error)) {
+		return;
+	}
+
+	unsigned char const* p = recv_buffer_.get();
+	unsigned char const* const end = p + len;
+
+	auto msg = new CStorjEvent;
+	auto & message = std::get<0>(msg->v_);
+	message.type = static_cast<storjEvent>(readType);
+	if (message.type == storjEvent::Transfer) {
+		if (len < 8) {
+			error = L"Truncated frame";
+		}
+		else {
+			message.text[0] = std::to_wstring(get_uint(p, 8));
+		}
+	}
+	else {
+		for (int i = 0; i < 4 && p != end && error.empty(); ++i) {
+			if (end - p < 4) {
+				error = L"Truncated frame";
+				break;
+			}
+			size_t const textLen = static_cast<size_t>(get_uint(p, 4));
+			p += 4;
+			if (static_cast<size_t>(end - p) < textLen) {
+				error = L"Truncated frame";
+				break;
+			}
+			message.text[i] = owner_.ConvToLocal(reinterpret_cast<char const*>(p), textLen);
+			if (textLen && message.text[i].empty()) {
+				error = L"Failed to convert reply to local character set.";
+			}
+			p += textLen;
+		}
+	}
+
+	recv_buffer_.consume(len);
+
+	if (!error.empty()) {
+		delete msg;
+		return;
+	}
+
+	owner_.send_event(msg);
+}
+
 void CStorjInputThread::processEvent(storjEvent eventType, std::wstring &error)
 {
 	int lines{};
@@ -147,6 +250,11 @@ void CStorjInputThread::entry()
 		unsigned char readType = *recv_buffer_.get();
 		recv_buffer_.consume(1);
 
+		if (readType == FZSTORJ_FRAME_MARKER) {
+			processFrame(error);
+			continue;
+		}
+
 		readType -= '0';
 
 		if (readType >= static_cast<unsigned char>(storjEvent::count) ) {
@@ -23,9 +23,13 @@ protected:
 	bool readFromProcess(std::wstring & error, bool eof_is_error);
 	std::wstring ReadLine(std::wstring &error);
 
+	// Makes sure at least len bytes are in recv_buffer_
+	bool readAtLeast(size_t len, std::wstring & error);
+
 	void entry();
 
 	void processEvent(storjEvent eventType, std::wstring & error);
+	void processFrame(std::wstring & error);
 
 	fz::process& process_;
 	CStorjControlSocket& owner_;
@@ -0,0 +1,192 @@
+#include <filezilla.h>
+
+#include "tlssessioncache.h"
+
+#include <libfilezilla/file.hpp>
+
+#ifndef FZ_WINDOWS
+#include <sys/stat.h>
+#endif
+
+namespace {
+// Servers do not accept sessions for longer than this anyhow
+fz::duration const max_age = fz::duration::from_hours(24);
+
+size_t const max_sessions = 100;
+
+char const magic[] = "FZTLSSESSIONS1";
+
+void append_uint(std::string & out, uint64_t v, int bytes)
+{
+	for (int i = 0; i < bytes; ++i) {
+		out += static_cast<char>((v >> (i * 8)) & 0xff);
+	}
+}
+
+bool read_uint(std::string const& in, size_t & pos, uint64_t & v, int bytes)
+{
+	if (in.size() - pos < static_cast<size_t>(bytes)) {
+		return false;
+	}
+	v = 0;
+	for (int i = 0; i < bytes; ++i) {
+		v |= static_cast<uint64_t>(static_cast<unsigned char>(in[pos + i])) << (i * 8);
+	}
+	pos += bytes;
+	return true;
+}
+}
+
+void CTlsSessionCache::Store(std::string const& key, std::vector<uint8_t> && data)
+{
+	if (key.empty() || data.empty()) {
+		return;
+	}
+
+	fz::scoped_lock lock(mutex_);
+
+	auto const now = fz::datetime::now();
+	auto & e = sessions_[key];
+	e.data = std::move(data);
+	e.stored = now;
+
+	if (sessions_.size() > max_sessions) {
+		Expire(now);
+	}
+	while (sessions_.size() > max_sessions) {
+		auto oldest = sessions_.begin();
+		for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+			if (it->second.stored < oldest->second.stored) {
+				oldest = it;
+			}
+		}
+		sessions_.erase(oldest);
+	}
+}
+
+std::vector<uint8_t> CTlsSessionCache::Lookup(std::string const& key)
+{
+	fz::scoped_lock lock(mutex_);
+
+	auto it = sessions_.find(key);
+	if (it == sessions_.end()) {
+		return std::vector<uint8_t>();
+	}
+	if (fz::datetime::now() - it->second.stored > max_age) {
+		sessions_.erase(it);
+		return std::vector<uint8_t>();
+	}
+
+	return it->second.data;
+}
+
+void CTlsSessionCache::Remove(std::string const& key)
+{
+	fz::scoped_lock lock(mutex_);
+	sessions_.erase(key);
+}
+
+std::pair<int, int> CTlsSessionCache::RecordResult(bool resumed)
+{
+	fz::scoped_lock lock(mutex_);
+
+	++attempts_;
+	if (resumed) {
+		++resumed_;
+	}
+	return std::make_pair(resumed_, attempts_);
+}
+
+void CTlsSessionCache::Expire(fz::datetime const& now)
+{
+	for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+		if (now - it->second.stored > max_age) {
+			it = sessions_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+// File format: The magic, followed by the sessions. Each consists of the
+// length of the key as 32-bit integer, the key, the time it got stored as
+// 64-bit integer in seconds since the epoch, the length of the session
+// data as 32-bit integer and the data. All integers are little-endian.
+bool CTlsSessionCache::Load(fz::native_string const& file)
+{
+	fz::file f(file, fz::file::reading, fz::file::existing);
+	if (!f.opened()) {
+		return false;
+	}
+
+	int64_t const size = f.size();
+	if (size <= 0 || size > 16 * 1024 * 1024) {
+		return false;
+	}
+
+	std::string in;
+	in.resize(static_cast<size_t>(size));
+	if (f.read(&in[0], size) != size) {
+		return false;
+	}
+
+	size_t pos = sizeof(magic) - 1;
+	if (in.compare(0, pos, magic)) {
+		return false;
+	}
+
+	auto const now = fz::datetime::now();
+
+	fz::scoped_lock lock(mutex_);
+	while (pos < in.size()) {
+		uint64_t len;
+		if (!read_uint(in, pos, len, 4) || in.size() - pos < len) {
+			return false;
+		}
+		std::string key = in.substr(pos, static_cast<size_t>(len));
+		pos += static_cast<size_t>(len);
+
+		uint64_t t;
+		if (!read_uint(in, pos, t, 8) || !read_uint(in, pos, len, 4) || in.size() - pos < len) {
+			return false;
+		}
+
+		entry e;
+		e.stored = fz::datetime(static_cast<time_t>(t), fz::datetime::seconds);
+		e.data.assign(in.begin() + pos, in.begin() + pos + static_cast<size_t>(len));
+		pos += static_cast<size_t>(len);
+
+		if (!key.empty() && !e.data.empty() && !e.stored.empty() && now - e.stored <= max_age) {
+			sessions_[key] = std::move(e);
+		}
+	}
+
+	return true;
+}
+
+bool CTlsSessionCache::Save(fz::native_string const& file)
+{
+	std::string out = magic;
+	{
+		fz::scoped_lock lock(mutex_);
+		Expire(fz::datetime::now());
+		for (auto const& session : sessions_) {
+			append_uint(out, session.first.size(), 4);
+			out += session.first;
+			append_uint(out, static_cast<uint64_t>(session.second.stored.get_time_t()), 8);
+			append_uint(out, session.second.data.size(), 4);
+			out.append(session.second.data.begin(), session.second.data.end());
+		}
+	}
+
+	fz::file f(file, fz::file::writing, fz::file::empty);
+	if (!f.opened()) {
+		return false;
+	}
+#ifndef FZ_WINDOWS
+	chmod(file.c_str(), S_IRUSR | S_IWUSR);
+#endif
+
+	return f.write(out.c_str(), static_cast<int64_t>(out.size())) == static_cast<int64_t>(out.size());
+}
@@ -0,0 +1,59 @@
+#ifndef FILEZILLA_ENGINE_TLSSESSIONCACHE_HEADER
+#define FILEZILLA_ENGINE_TLSSESSIONCACHE_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Process-wide cache of TLS session data, shared by all engines.
+//
+// Control connections look up the session stored for the host and port
+// they connect to and try to resume it. Once established, they store
+// their own session. This way parallel connections and reconnects to the
+// same server need no full handshake. Data connections keep resuming the
+// session of their control connection, they do not use the cache.
+class CTlsSessionCache final
+{
+public:
+	CTlsSessionCache() = default;
+
+	CTlsSessionCache(CTlsSessionCache const&) = delete;
+	CTlsSessionCache& operator=(CTlsSessionCache const&) = delete;
+
+	void Store(std::string const& key, std::vector<uint8_t> && data);
+
+	// Returns an empty vector if nothing usable is stored
+	std::vector<uint8_t> Lookup(std::string const& key);
+
+	void Remove(std::string const& key);
+
+	// Records the outcome of a handshake which tried to resume a cached
+	// session. Returns the number of resumed handshakes and the number of
+	// attempts so far.
+	std::pair<int, int> RecordResult(bool resumed);
+
+	// The file contains the secrets of the sessions. On systems supporting
+	// it, it only is accessible by the current user.
+	bool Load(fz::native_string const& file);
+	bool Save(fz::native_string const& file);
+
+private:
+	void Expire(fz::datetime const& now);
+
+	struct entry
+	{
+		std::vector<uint8_t> data;
+		fz::datetime stored;
+	};
+
+	fz::mutex mutex_;
+	std::map<std::string, entry> sessions_;
+
+	int attempts_{};
+	int resumed_{};
+};
+
+#endif
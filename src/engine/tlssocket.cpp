@@ -31,6 +31,11 @@ int CTlsSocket::Handshake(CTlsSocket const* pPrimarySocket, bool try_resume)
 	return impl_->Handshake(pPrimarySocket ? pPrimarySocket->impl_.get() : nullptr, try_resume);
 }
 
+void CTlsSocket::RequestKernelOffload(bool send)
+{
+	impl_->RequestKernelOffload(send);
+}
+
 int CTlsSocket::Read(void *buffer, unsigned int size, int& error)
 {
 	return impl_->Read(buffer, size, error);
@@ -26,6 +26,11 @@ public:
 
 	int Handshake(const CTlsSocket* pPrimarySocket = nullptr, bool try_resume = 0);
 
+	// Once the connection is established, moves encryption of the given
+	// direction into the kernel if it supports the negotiated cipher.
+	// Otherwise it stays in user space.
+	void RequestKernelOffload(bool send);
+
 	virtual int Read(void *buffer, unsigned int size, int& error) override;
 	virtual int Peek(void *buffer, unsigned int size, int& error) override;
 	virtual int Write(const void *buffer, unsigned int size, int& error) override;
@@ -2,6 +2,7 @@
 #include "engineprivate.h"
 #include "tlssocket.h"
 #include "tlssocket_impl.h"
+#include "tlssessioncache.h"
 #include "ControlSocket.h"
 
 #include <libfilezilla/iputils.hpp>
@@ -12,6 +13,10 @@
 
 #include <string.h>
 
+#if HAVE_LINUX_TLS_H
+#include <linux/tls.h>
+#endif
+
 #if FZ_USE_GNUTLS_SYSTEM_CIPHERS
 char const ciphers[] = "@SYSTEM";
 #else
@@ -126,6 +131,56 @@ void clone_cert(gnutls_x509_crt_t in, gnutls_x509_crt_t &out)
 		}
 	}
 }
+
+#if HAVE_LINUX_TLS_H
+// TLS record content types
+unsigned char const record_alert = 21;
+unsigned char const record_handshake = 22;
+
+template<typename Info>
+bool fill_crypto_info(Info & info, unsigned short cipher_type, gnutls_protocol_t version, gnutls_datum_t const& key, gnutls_datum_t const& iv, unsigned char const* seq)
+{
+	if (key.size != sizeof(info.key) || iv.size < sizeof(info.salt)) {
+		return false;
+	}
+
+	info.info.cipher_type = cipher_type;
+	memcpy(info.key, key.data, sizeof(info.key));
+	memcpy(info.salt, iv.data, sizeof(info.salt));
+	memcpy(info.rec_seq, seq, sizeof(info.rec_seq));
+
+	if (version == GNUTLS_TLS1_2) {
+		info.info.version = TLS_1_2_VERSION;
+		// The explicit part of the nonce, by convention the sequence number
+		memcpy(info.iv, seq, sizeof(info.iv));
+		return true;
+	}
+#if defined(TLS_1_3_VERSION) && GNUTLS_VERSION_NUMBER >= 0x030603
+	else if (version == GNUTLS_TLS1_3 && iv.size == sizeof(info.salt) + sizeof(info.iv)) {
+		info.info.version = TLS_1_3_VERSION;
+		memcpy(info.iv, iv.data + sizeof(info.salt), sizeof(info.iv));
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+// Whether the record consists of nothing but session tickets, which data
+// connections have no use for.
+bool only_session_tickets(unsigned char const* p, int size)
+{
+	while (size >= 4) {
+		size_t const len = (static_cast<size_t>(p[1]) << 16) + (static_cast<size_t>(p[2]) << 8) + p[3];
+		if (p[0] != 4 || len > static_cast<size_t>(size - 4)) {
+			return false;
+		}
+		p += 4 + len;
+		size -= static_cast<int>(4 + len);
+	}
+	return !size;
+}
+#endif
 }
 
 CTlsSocketImpl::CTlsSocketImpl(CTlsSocket& tlsSocket, fz::socket& socket, CControlSocket* pOwner)
@@ -273,6 +328,10 @@ void CTlsSocketImpl::Uninit()
 void CTlsSocketImpl::UninitSession()
 {
 	if (m_session) {
+		if (m_tlsState == CTlsSocket::TlsState::conn) {
+			// With TLS 1.3 the tickets only arrive after the handshake
+			StoreSession();
+		}
 		gnutls_deinit(m_session);
 		m_session = nullptr;
 	}
@@ -483,7 +542,7 @@ void CTlsSocketImpl::OnRead()
 	}
 
 	const int direction = gnutls_record_get_direction(m_session);
-	if (direction && !m_lastReadFailed) {
+	if (direction && !m_lastReadFailed && !ktlsReceive_) {
 		m_pOwner->LogMessage(MessageType::Debug_Debug, L"CTlsSocketImpl::Postponing read");
 		return;
 	}
@@ -511,7 +570,7 @@ void CTlsSocketImpl::OnSend()
 	}
 
 	const int direction = gnutls_record_get_direction(m_session);
-	if (!direction && !m_lastWriteFailed) {
+	if (!direction && !m_lastWriteFailed && !ktlsSend_) {
 		return;
 	}
 
@@ -552,6 +611,50 @@ bool CTlsSocketImpl::CopySessionData(const CTlsSocketImpl* pPrimarySocket)
 	return true;
 }
 
+bool CTlsSocketImpl::ResumeCachedSession()
+{
+	auto & cache = m_pOwner->GetEngine().GetTlsSessionCache();
+
+	auto const data = cache.Lookup(sessionCacheKey_);
+	if (data.empty()) {
+		return true;
+	}
+
+	int res = gnutls_session_set_data(m_session, data.data(), data.size());
+	if (res) {
+		m_pOwner->LogMessage(MessageType::Debug_Info, L"gnutls_session_set_data with cached session failed: %d. Going to reinitialize session.", res);
+		cache.Remove(sessionCacheKey_);
+		UninitSession();
+		return InitSession();
+	}
+
+	m_pOwner->LogMessage(MessageType::Debug_Info, L"Trying to resume cached TLS session.");
+	sessionCacheAttempt_ = true;
+
+	return true;
+}
+
+void CTlsSocketImpl::StoreSession()
+{
+	if (sessionCacheKey_.empty()) {
+		return;
+	}
+
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	if (gnutls_protocol_get_version(m_session) == GNUTLS_TLS1_3 && !(gnutls_session_get_flags(m_session) & GNUTLS_SFLAGS_SESSION_TICKET)) {
+		// No ticket received yet, nothing that could be resumed
+		return;
+	}
+#endif
+
+	datum_holder d;
+	if (gnutls_session_get_data2(m_session, &d) || !d.data || !d.size) {
+		return;
+	}
+
+	m_pOwner->GetEngine().GetTlsSessionCache().Store(sessionCacheKey_, std::vector<uint8_t>(d.data, d.data + d.size));
+}
+
 bool CTlsSocketImpl::ResumedSession() const
 {
 	return gnutls_session_is_resumed(m_session) != 0;
@@ -607,6 +710,12 @@ int CTlsSocketImpl::Handshake(const CTlsSocketImpl* pPrimarySocket, bool try_res
 			return FZ_REPLY_ERROR;
 		}
 		port_ = port;
+
+		// Control connections share their sessions through the engine context
+		sessionCacheKey_ = fz::to_utf8(hostname_) + ":" + fz::to_string(port_);
+		if (!ResumeCachedSession()) {
+			return FZ_REPLY_ERROR;
+		}
 	}
 
 	if (!hostname_.empty() && fz::get_address_type(hostname_) == fz::address_type::unknown) {
@@ -645,6 +754,10 @@ int CTlsSocketImpl::ContinueHandshake()
 		if (ResumedSession()) {
 			m_pOwner->LogMessage(MessageType::Debug_Info, L"TLS Session resumed");
 		}
+		if (sessionCacheAttempt_) {
+			auto const stats = m_pOwner->GetEngine().GetTlsSessionCache().RecordResult(ResumedSession());
+			m_pOwner->LogMessage(MessageType::Debug_Info, L"TLS session cache: %d of %d resumption attempts successful", stats.first, stats.second);
+		}
 
 		std::wstring const protocol = GetProtocolName();
 		std::wstring const keyExchange = GetKeyExchange();
@@ -702,11 +815,18 @@ int CTlsSocketImpl::Read(void *buffer, unsigned int len, int& error)
 		return min;
 	}
 
+	if (ktlsReceive_) {
+		return KtlsRead(buffer, len, error);
+	}
+
 	int res = DoCallGnutlsRecordRecv(buffer, len);
 	if (res >= 0) {
 		if (res > 0) {
 			TriggerEvents();
 		}
+		else if (ktlsSend_) {
+			KtlsSendCloseNotify();
+		}
 		else {
 			// Peer did already initiate a shutdown, reply to it
 			gnutls_bye(m_session, GNUTLS_SHUT_WR);
@@ -756,6 +876,10 @@ int CTlsSocketImpl::Write(const void *buffer, unsigned int len, int& error)
 	len -= m_writeSkip;
 	buffer = (char*)buffer + m_writeSkip;
 
+	if (ktlsSend_) {
+		return KtlsWrite(buffer, len, error);
+	}
+
 	int res = gnutls_record_send(m_session, buffer, len);
 
 	while ((res == GNUTLS_E_INTERRUPTED || res == GNUTLS_E_AGAIN) && m_canWriteToSocket)
@@ -808,7 +932,12 @@ void CTlsSocketImpl::TriggerEvents()
 
 void CTlsSocketImpl::CheckResumeFailedReadWrite()
 {
-	if (m_lastWriteFailed) {
+	if (m_lastWriteFailed && ktlsSend_) {
+		// Nothing is left over in GnuTLS, simply retry
+		m_lastWriteFailed = false;
+		m_canTriggerWrite = true;
+	}
+	else if (m_lastWriteFailed) {
 		int res = GNUTLS_E_AGAIN;
 		while ((res == GNUTLS_E_INTERRUPTED || res == GNUTLS_E_AGAIN) && m_canWriteToSocket) {
 			res = gnutls_record_send(m_session, nullptr, 0);
@@ -827,7 +956,11 @@ void CTlsSocketImpl::CheckResumeFailedReadWrite()
 		m_lastWriteFailed = false;
 		m_canTriggerWrite = true;
 	}
-	if (m_lastReadFailed) {
+	if (m_lastReadFailed && ktlsReceive_) {
+		m_lastReadFailed = false;
+		m_canTriggerRead = true;
+	}
+	else if (m_lastReadFailed) {
 		int res = DoCallGnutlsRecordRecv(peekBuffer_.get(65536), 65536);
 		if (res < 0) {
 			if (res != GNUTLS_E_INTERRUPTED && res != GNUTLS_E_AGAIN) {
@@ -908,6 +1041,18 @@ int CTlsSocketImpl::Shutdown()
 
 	m_tlsState = CTlsSocket::TlsState::closing;
 
+	if (ktlsSend_) {
+		int error = KtlsSendCloseNotify();
+		if (!error) {
+			m_tlsState = CTlsSocket::TlsState::closed;
+		}
+		else if (error != EAGAIN) {
+			m_socket_error = error;
+			Failure(0, false);
+		}
+		return error;
+	}
+
 	int res = gnutls_bye(m_session, GNUTLS_SHUT_WR);
 	while ((res == GNUTLS_E_INTERRUPTED || res == GNUTLS_E_AGAIN) && m_canWriteToSocket) {
 		res = gnutls_bye(m_session, GNUTLS_SHUT_WR);
@@ -929,6 +1074,19 @@ void CTlsSocketImpl::ContinueShutdown()
 {
 	m_pOwner->LogMessage(MessageType::Debug_Verbose, L"CTlsSocketImpl::ContinueShutdown()");
 
+	if (ktlsSend_) {
+		int error = KtlsSendCloseNotify();
+		if (!error) {
+			m_tlsState = CTlsSocket::TlsState::closed;
+			tlsSocket_.m_pEvtHandler->send_event<fz::socket_event>(&tlsSocket_, fz::socket_event_flag::close, 0);
+		}
+		else if (error != EAGAIN) {
+			m_socket_error = error;
+			Failure(0, true);
+		}
+		return;
+	}
+
 	int res = gnutls_bye(m_session, GNUTLS_SHUT_WR);
 	while ((res == GNUTLS_E_INTERRUPTED || res == GNUTLS_E_AGAIN) && m_canWriteToSocket) {
 		res = gnutls_bye(m_session, GNUTLS_SHUT_WR);
@@ -955,6 +1113,11 @@ void CTlsSocketImpl::TrustCurrentCert(bool trusted)
 
 	if (trusted) {
 		m_tlsState = CTlsSocket::TlsState::conn;
+		StoreSession();
+
+		if (offloadRequested_) {
+			EnableKernelOffload();
+		}
 
 		if (m_lastWriteFailed)
 			m_lastWriteFailed = false;
@@ -1549,6 +1712,195 @@ std::string CTlsSocketImpl::ListTlsCiphers(std::string priority)
 	return list;
 }
 
+void CTlsSocketImpl::RequestKernelOffload(bool send)
+{
+	offloadRequested_ = true;
+	offloadSend_ = send;
+}
+
+void CTlsSocketImpl::EnableKernelOffload()
+{
+#if HAVE_LINUX_TLS_H
+	gnutls_protocol_t const version = gnutls_protocol_get_version(m_session);
+	gnutls_cipher_algorithm_t const cipher = gnutls_cipher_get(m_session);
+
+	if (!offloadSend_ && (gnutls_record_check_pending(m_session) || !peekBuffer_.empty())) {
+		m_pOwner->LogMessage(MessageType::Debug_Info, L"Not using kernel TLS, data has already been received");
+		return;
+	}
+
+	gnutls_datum_t macKey;
+	gnutls_datum_t iv;
+	gnutls_datum_t cipherKey;
+	unsigned char seq[8];
+	int res = gnutls_record_get_state(m_session, offloadSend_ ? 0 : 1, &macKey, &iv, &cipherKey, seq);
+	if (res) {
+		LogError(res, L"gnutls_record_get_state", MessageType::Debug_Warning);
+		return;
+	}
+
+	union {
+		tls12_crypto_info_aes_gcm_128 aes128;
+#ifdef TLS_CIPHER_AES_GCM_256
+		tls12_crypto_info_aes_gcm_256 aes256;
+#endif
+	} info{};
+	unsigned int infoSize{};
+	if (cipher == GNUTLS_CIPHER_AES_128_GCM && fill_crypto_info(info.aes128, TLS_CIPHER_AES_GCM_128, version, cipherKey, iv, seq)) {
+		infoSize = sizeof(info.aes128);
+	}
+#ifdef TLS_CIPHER_AES_GCM_256
+	else if (cipher == GNUTLS_CIPHER_AES_256_GCM && fill_crypto_info(info.aes256, TLS_CIPHER_AES_GCM_256, version, cipherKey, iv, seq)) {
+		infoSize = sizeof(info.aes256);
+	}
+#endif
+	else {
+		m_pOwner->LogMessage(MessageType::Debug_Info, L"Not using kernel TLS, no support for %s with %s", GetCipherName(), GetProtocolName());
+		return;
+	}
+
+	res = m_socket.enable_ktls(offloadSend_, &info, infoSize);
+
+	// Do not leave the keys lying around
+	memset(&info, 0, sizeof(info));
+
+	if (res) {
+		m_pOwner->LogMessage(MessageType::Debug_Info, L"Not using kernel TLS: %s", fz::socket::error_description(res));
+		return;
+	}
+
+	if (offloadSend_) {
+		ktlsSend_ = true;
+		m_pOwner->LogMessage(MessageType::Debug_Info, L"Using kernel TLS for sending");
+	}
+	else {
+		ktlsReceive_ = true;
+		m_pOwner->LogMessage(MessageType::Debug_Info, L"Using kernel TLS for receiving");
+	}
+#else
+	m_pOwner->LogMessage(MessageType::Debug_Info, L"Not using kernel TLS, not supported on this platform");
+#endif
+}
+
+int CTlsSocketImpl::KtlsRead(void *buffer, unsigned int len, int& error)
+{
+#if HAVE_LINUX_TLS_H
+	for (;;) {
+		int read = socketBackend_->Read(buffer, len, error);
+		if (read > 0) {
+			TriggerEvents();
+			return read;
+		}
+		else if (!read) {
+			m_socket_eof = true;
+			m_pOwner->LogMessage(MessageType::Status, _("Server did not properly shut down TLS connection"));
+			Failure(0, false);
+			error = m_socket_error;
+			return -1;
+		}
+		else if (error == EAGAIN) {
+			m_lastReadFailed = true;
+			return -1;
+		}
+		else if (error != EIO) {
+			m_socket_error = error;
+			Failure(0, false);
+			error = m_socket_error;
+			return -1;
+		}
+
+		// The next record is not application data, have a look at it
+		unsigned char record[16384];
+		unsigned char type{};
+		int size = m_socket.read_record(record, sizeof(record), type, error);
+		if (size < 0) {
+			if (error == EAGAIN) {
+				m_lastReadFailed = true;
+				return -1;
+			}
+			m_socket_error = error;
+			Failure(0, false);
+			error = m_socket_error;
+			return -1;
+		}
+
+		if (type == record_alert && size >= 2) {
+			if (!record[1]) {
+				// close_notify, reply to it as in Read
+				if (ktlsSend_) {
+					KtlsSendCloseNotify();
+				}
+				else {
+					gnutls_bye(m_session, GNUTLS_SHUT_WR);
+				}
+				error = 0;
+				return 0;
+			}
+
+			auto const alert = static_cast<gnutls_alert_description_t>(record[1]);
+			char const* name = gnutls_alert_get_name(alert);
+			if (name) {
+				m_pOwner->LogMessage(MessageType::Error, _("Received TLS alert from the server: %s (%d)"), name, alert);
+			}
+			else {
+				m_pOwner->LogMessage(MessageType::Error, _("Received unknown TLS alert %d from the server"), alert);
+			}
+			if (record[0] == GNUTLS_AL_WARNING) {
+				continue;
+			}
+		}
+		else if (type == record_handshake && only_session_tickets(record, size)) {
+			continue;
+		}
+		else {
+			m_pOwner->LogMessage(MessageType::Debug_Warning, L"Cannot handle TLS record of type %d with kernel TLS", type);
+		}
+
+		Failure(0, false);
+		error = m_socket_error;
+		return -1;
+	}
+#else
+	(void)buffer;
+	(void)len;
+	error = ENOSYS;
+	return -1;
+#endif
+}
+
+int CTlsSocketImpl::KtlsWrite(const void *buffer, unsigned int len, int& error)
+{
+	int written = socketBackend_->Write(buffer, len, error);
+	if (written >= 0) {
+		TriggerEvents();
+	}
+	else if (error == EAGAIN) {
+		m_lastWriteFailed = true;
+	}
+	else {
+		m_socket_error = error;
+		Failure(0, false);
+		error = m_socket_error;
+	}
+
+	return written;
+}
+
+int CTlsSocketImpl::KtlsSendCloseNotify()
+{
+#if HAVE_LINUX_TLS_H
+	unsigned char const alert[2] = { GNUTLS_AL_WARNING, GNUTLS_A_CLOSE_NOTIFY };
+
+	int error;
+	if (m_socket.write_record(record_alert, alert, sizeof(alert), error) < 0) {
+		return error;
+	}
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
+
 int CTlsSocketImpl::DoCallGnutlsRecordRecv(void* data, size_t len)
 {
 	int res = gnutls_record_recv(m_session, data, len);
@@ -24,6 +24,8 @@ public:
 
 	int Handshake(const CTlsSocketImpl* pPrimarySocket = nullptr, bool try_resume = 0);
 
+	void RequestKernelOffload(bool send);
+
 	int Read(void *buffer, unsigned int size, int& error);
 	int Peek(void *buffer, unsigned int size, int& error);
 	int Write(const void *buffer, unsigned int size, int& error);
@@ -51,7 +53,17 @@ public:
 protected:
 
 	bool InitSession();
+
+	// Cache of sessions shared with other control connections
+	bool ResumeCachedSession();
+	void StoreSession();
 	void UninitSession();
+
+	// Kernel TLS
+	void EnableKernelOffload();
+	int KtlsRead(void *buffer, unsigned int size, int& error);
+	int KtlsWrite(const void *buffer, unsigned int size, int& error);
+	int KtlsSendCloseNotify();
 	bool CopySessionData(CTlsSocketImpl const* pPrimarySocket);
 
 	void OnRateAvailable(CRateLimiter::rate_direction direction);
@@ -139,6 +151,17 @@ protected:
 	fz::native_string hostname_;
 	unsigned int port_{};
 
+	// Only set for control connections
+	std::string sessionCacheKey_;
+	bool sessionCacheAttempt_{};
+
+	bool offloadRequested_{};
+	bool offloadSend_{};
+
+	// Set once records of the respective direction are handled by the kernel
+	bool ktlsSend_{};
+	bool ktlsReceive_{};
+
 };
 
 #endif
@@ -0,0 +1,262 @@
+#include <filezilla.h>
+
+#include "socket.h"
+#include "zerocopy.h"
+
+#include <algorithm>
+
+#include <errno.h>
+
+#if HAVE_SYS_SENDFILE_H && HAVE_SPLICE
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+// Capacity requested for the pipe used by downloads. The kernel refuses
+// sizes above /proc/sys/fs/pipe-max-size, the default capacity is kept then.
+int const pipe_size = 1024 * 1024;
+
+// Used if the file system does not support sendfile or splice
+unsigned int const fallback_buffer_size = 256 * 1024;
+
+std::wstring error_string(int err)
+{
+	return fz::to_wstring(GetSystemErrorDescription(err));
+}
+}
+
+CZeroCopyFile::~CZeroCopyFile()
+{
+	if (fd_ != -1 && !read_ && !keepSize_) {
+		// The file might have been preallocated, see CIOThread::Close
+		if (ftruncate(fd_, offset_)) {
+			// Nothing we can do about it
+		}
+	}
+	Close();
+}
+
+bool CZeroCopyFile::Supported()
+{
+	return true;
+}
+
+void CZeroCopyFile::Close()
+{
+	advice_.Close();
+	if (fd_ != -1) {
+		close(fd_);
+		fd_ = -1;
+	}
+	for (auto & fd : pipe_) {
+		if (fd != -1) {
+			close(fd);
+			fd = -1;
+		}
+	}
+}
+
+bool CZeroCopyFile::Open(fz::native_string const& path, bool read, int64_t offset)
+{
+	Close();
+
+	read_ = read;
+	fallback_ = false;
+	offset_ = offset;
+	error_.clear();
+
+	fd_ = open(path.c_str(), (read ? O_RDONLY : O_WRONLY) | O_CLOEXEC);
+	if (fd_ == -1) {
+		error_ = error_string(errno);
+		return false;
+	}
+
+	advice_.Attach(fd_, read, offset);
+
+	if (!read) {
+		if (pipe2(pipe_, O_CLOEXEC)) {
+			pipe_[0] = -1;
+			pipe_[1] = -1;
+			error_ = error_string(errno);
+			Close();
+			return false;
+		}
+#ifdef F_SETPIPE_SZ
+		fcntl(pipe_[1], F_SETPIPE_SZ, pipe_size);
+#endif
+	}
+
+	return true;
+}
+
+int CZeroCopyFile::Send(fz::socket& socket, unsigned int len, int& error)
+{
+	if (!fallback_) {
+		int res = socket.send_file(fd_, offset_, len, error);
+		if (res != -1 || (error != EINVAL && error != ENOSYS)) {
+			advice_.Transferred(res);
+			return res;
+		}
+
+		// File system does not support sendfile
+		fallback_ = true;
+	}
+
+	if (!buffer_) {
+		buffer_ = std::make_unique<char[]>(fallback_buffer_size);
+	}
+
+	ssize_t read = pread(fd_, buffer_.get(), std::min(len, fallback_buffer_size), offset_);
+	if (read <= 0) {
+		if (read < 0) {
+			error = errno;
+			error_ = error_string(error);
+			return -1;
+		}
+		error = 0;
+		return 0;
+	}
+
+	// Whatever does not get sent is read again on the next call
+	int written = socket.write(buffer_.get(), static_cast<unsigned int>(read), error);
+	if (written > 0) {
+		offset_ += written;
+		advice_.Transferred(written);
+	}
+	return written;
+}
+
+int CZeroCopyFile::Receive(fz::socket& socket, unsigned int len, int& error)
+{
+	int res = socket.splice_read(pipe_[1], len, error);
+	if (res <= 0) {
+		return res;
+	}
+
+	// Move the data on into the file. Unlike CIOThread this blocks the
+	// calling thread on file I/O, though for at most a pipe's worth of data.
+	int left = res;
+	while (left > 0 && !fallback_) {
+		loff_t off = offset_;
+		ssize_t written = splice(pipe_[0], nullptr, fd_, &off, static_cast<size_t>(left), SPLICE_F_MOVE);
+		if (written > 0) {
+			offset_ += written;
+			left -= static_cast<int>(written);
+		}
+		else if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		else if (written < 0 && (errno == EINVAL || errno == ENOSYS)) {
+			// File system does not support splice
+			fallback_ = true;
+		}
+		else {
+			error = written ? errno : EIO;
+			error_ = error_string(error);
+			return -1;
+		}
+	}
+
+	if (left > 0 && !DrainPipe(left, error)) {
+		return -1;
+	}
+
+	advice_.Transferred(res);
+	return res;
+}
+
+bool CZeroCopyFile::DrainPipe(int len, int& error)
+{
+	if (!buffer_) {
+		buffer_ = std::make_unique<char[]>(fallback_buffer_size);
+	}
+
+	while (len > 0) {
+		ssize_t read = ::read(pipe_[0], buffer_.get(), std::min(static_cast<unsigned int>(len), fallback_buffer_size));
+		if (read < 0 && errno == EINTR) {
+			continue;
+		}
+		if (read <= 0) {
+			error = read ? errno : EIO;
+			error_ = error_string(error);
+			return false;
+		}
+		len -= static_cast<int>(read);
+
+		char const* p = buffer_.get();
+		while (read > 0) {
+			ssize_t written = pwrite(fd_, p, static_cast<size_t>(read), offset_);
+			if (written < 0 && errno == EINTR) {
+				continue;
+			}
+			if (written <= 0) {
+				error = written ? errno : EIO;
+				error_ = error_string(error);
+				return false;
+			}
+			offset_ += written;
+			p += written;
+			read -= written;
+		}
+	}
+
+	return true;
+}
+
+bool CZeroCopyFile::Finalize()
+{
+	if (keepSize_) {
+		return true;
+	}
+	if (ftruncate(fd_, offset_)) {
+		error_ = error_string(errno);
+		return false;
+	}
+	return true;
+}
+
+#else
+
+CZeroCopyFile::~CZeroCopyFile()
+{
+}
+
+bool CZeroCopyFile::Supported()
+{
+	return false;
+}
+
+void CZeroCopyFile::Close()
+{
+}
+
+bool CZeroCopyFile::Open(fz::native_string const&, bool, int64_t)
+{
+	return false;
+}
+
+int CZeroCopyFile::Send(fz::socket&, unsigned int, int& error)
+{
+	error = ENOSYS;
+	return -1;
+}
+
+int CZeroCopyFile::Receive(fz::socket&, unsigned int, int& error)
+{
+	error = ENOSYS;
+	return -1;
+}
+
+bool CZeroCopyFile::DrainPipe(int, int& error)
+{
+	error = ENOSYS;
+	return false;
+}
+
+bool CZeroCopyFile::Finalize()
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef FILEZILLA_ENGINE_ZEROCOPY_HEADER
+#define FILEZILLA_ENGINE_ZEROCOPY_HEADER
+
+#include <libfilezilla/libfilezilla.hpp>
+
+#include "fileadvice.h"
+
+#include <memory>
+#include <string>
+
+namespace fz {
+class socket;
+}
+
+// Moves file data between a local file and a plain TCP socket without
+// copying it through userspace buffers.
+//
+// Uploads use sendfile, downloads splice from the socket into a pipe and
+// from the pipe into the file. Used instead of CIOThread for binary
+// transfers over unprotected data connections.
+class CZeroCopyFile final
+{
+public:
+	CZeroCopyFile() = default;
+	~CZeroCopyFile();
+
+	CZeroCopyFile(CZeroCopyFile const&) = delete;
+	CZeroCopyFile& operator=(CZeroCopyFile const&) = delete;
+
+	// Whether FileZilla has been built with zero-copy support on this platform
+	static bool Supported();
+
+	// Opens an existing file for reading or writing, with transfers
+	// starting at the given offset.
+	bool Open(fz::native_string const& path, bool read, int64_t offset);
+
+	// Sends up to len bytes from the file. Returns the number of bytes sent,
+	// 0 at end of file or -1 on error. error is EAGAIN if the socket would block.
+	int Send(fz::socket& socket, unsigned int len, int& error);
+
+	// Receives up to len bytes into the file. Returns the number of bytes
+	// written to the file, 0 at end of stream or -1 on error.
+	int Receive(fz::socket& socket, unsigned int len, int& error);
+
+	// Truncates the file to the amount of data written to it.
+	bool Finalize();
+
+	// Writing stops short of the end of the file, leave its size alone.
+	// See CIOThread::KeepSize
+	void KeepSize() { keepSize_ = true; }
+
+	std::wstring const& GetError() const { return error_; }
+
+private:
+	void Close();
+
+	// Copies data left in the pipe to the file through userspace
+	bool DrainPipe(int len, int& error);
+
+	int fd_{-1};
+	int pipe_[2]{-1, -1};
+
+	bool read_{};
+	bool fallback_{};
+	bool keepSize_{};
+
+	int64_t offset_{};
+
+	std::unique_ptr<char[]> buffer_;
+
+	CFileAdvice advice_;
+
+	std::wstring error_;
+};
+
+#endif
@@ -18,6 +18,7 @@ enum class Command
 	rename,
 	chmod,
 	raw,
+	batchtransfer,
 
 	// Only used internally
 	cwd,
@@ -113,6 +114,7 @@ typedef CBasicCommand<Command::disconnect> CDisconnectCommand;
 #define LIST_FLAG_AVOID 2
 #define LIST_FLAG_FALLBACK_CURRENT 4
 #define LIST_FLAG_LINK 8
+#define LIST_FLAG_RECURSIVE 16
 class CListCommand final : public CCommandHelper<CListCommand, Command::list>
 {
 	// Without a given directory, the current directory will be listed.
@@ -132,6 +134,12 @@ class CListCommand final : public CCommandHelper<CListCommand, Command::list>
 	// LIST_FLAG_LINK is used for symlink discovery. There's unfortunately
 	// no sane way to distinguish between symlinks to files and symlinks to
 	// directories.
+	//
+	// LIST_FLAG_RECURSIVE is a hint that the directories below will get
+	// listed as well. Protocols supporting ProtocolFeature::RecursiveList
+	// then list the whole tree in one go and put it into the directory
+	// cache. Listings of directories below are then served from the cache
+	// if passing the flag as well.
 public:
 	explicit CListCommand(int flags = 0);
 	explicit CListCommand(CServerPath path, std::wstring const& subDir = std::wstring(), int flags = 0);
@@ -157,6 +165,14 @@ public:
 	public:
 		bool binary{true};
 		bool fsync{};
+
+		// Segmented downloads: Only the part of the remote file starting at
+		// segmentOffset gets downloaded, it is written at the same offset into
+		// the existing local file. A negative segmentLength transfers up to
+		// the end of the file. Requires ProtocolFeature::SegmentedDownload.
+		bool segment{};
+		int64_t segmentOffset{};
+		int64_t segmentLength{-1};
 	};
 
 	// For uploads, set download to false.
@@ -179,6 +195,25 @@ protected:
 	t_transferSettings const m_transferSettings;
 };
 
+// Transfers several files in one operation, with as many of them in progress
+// at the same time as the protocol sees fit. Existing target files get
+// overwritten, there are no nId_file_exists notifications. The outcome of
+// each file is reported through a CBatchTransferNotification, the command
+// itself only succeeds if all files got transferred.
+// Requires ProtocolFeature::BatchTransfer.
+class CBatchTransferCommand final : public CCommandHelper<CBatchTransferCommand, Command::batchtransfer>
+{
+public:
+	explicit CBatchTransferCommand(std::vector<CFileTransferCommand> && files);
+
+	std::vector<CFileTransferCommand> const& GetFiles() const { return m_files; }
+
+	bool valid() const;
+
+protected:
+	std::vector<CFileTransferCommand> const m_files;
+};
+
 class CRawCommand final : public CCommandHelper<CRawCommand, Command::raw>
 {
 public:
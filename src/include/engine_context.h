@@ -4,9 +4,11 @@
 #include <memory>
 
 class CDirectoryCache;
+class CIOUring;
 class COptionsBase;
 class CPathCache;
 class CRateLimiter;
+class CTlsSessionCache;
 
 namespace fz {
 class event_loop;
@@ -36,6 +38,10 @@ public:
 	CRateLimiter& GetRateLimiter();
 	CDirectoryCache& GetDirectoryCache();
 	CPathCache& GetPathCache();
+	CTlsSessionCache& GetTlsSessionCache();
+
+	// Might be null if io_uring is not available or disabled
+	CIOUring* GetIOUring();
 	CustomEncodingConverterBase const& GetCustomEncodingConverter() { return customEncodingConverter_; }
 
 protected:
@@ -43,7 +43,8 @@ enum NotificationId
 	nId_active,				// sent if data gets either received or sent
 	nId_data,				// for memory downloads, indicates that new data is available.
 	nId_sftp_encryption,	// information about key exchange, encryption algorithms and so on for SFTP
-	nId_local_dir_created	// local directory has been created
+	nId_local_dir_created,	// local directory has been created
+	nId_transfer_result		// outcome of a single file of a batch transfer
 };
 
 // Async request IDs
@@ -463,4 +464,19 @@ public:
 	CLocalPath dir;
 };
 
+// Sent for each file of a CBatchTransferCommand once it is done.
+// index is the position of the file within the command, result is one of
+// FZ_REPLY_OK, FZ_REPLY_ERROR or FZ_REPLY_CRITICALERROR.
+class CBatchTransferNotification final : public CNotificationHelper<nId_transfer_result>
+{
+public:
+	CBatchTransferNotification(size_t index, int result)
+		: index_(index)
+		, result_(result)
+	{}
+
+	size_t const index_;
+	int const result_;
+};
+
 #endif
@@ -83,6 +83,24 @@ enum engineOptions
 
 	OPTION_CACHE_TTL,
 
+	OPTION_IO_BUFFERCOUNT_MIN,	// Bounds for the adaptive buffer ring used for
+	OPTION_IO_BUFFERCOUNT_MAX,	// reading and writing local files during transfers
+	OPTION_IO_BUFFERSIZE_MIN,
+	OPTION_IO_BUFFERSIZE_MAX,
+	OPTION_IO_URING,			// Use io_uring for file I/O if available
+	OPTION_FTP_ZEROCOPY,		// Use sendfile/splice for unencrypted binary FTP transfers
+	OPTION_FTP_KTLS,			// Hand encryption of TLS data connections over to the kernel, Linux only
+	OPTION_IO_SYNTHETIC,		// Generate and discard file data instead of accessing the disk, for benchmarks
+	OPTION_SFTP_DOWNLOAD_STREAMS,	// Number of offset windows fzsftp keeps in flight per download
+	OPTION_HTTP_DOWNLOAD_CONNECTIONS,	// Number of connections fetching byte ranges of a single HTTP download
+	OPTION_FTP_MODEZ,			// Compress data connections if the server supports MODE Z
+	OPTION_FTP_MODEZ_LEVEL,		// zlib compression level used for MODE Z uploads
+	OPTION_FTP_PIPELINE_DEPTH,	// Maximum number of DELE or MKD commands in flight during bulk operations, 1 disables pipelining
+	OPTION_SFTP_BATCH_FILES,	// Number of files fzsftp works on at the same time during a batch transfer
+	OPTION_HELPER_FRAMING,		// Have fzsftp and fzstorj send binary frames instead of text lines
+	OPTION_TLS_SESSION_CACHE_FILE,	// If set, the shared TLS session cache gets loaded from and saved to this file
+	OPTION_SFTP_CONNECTION_SHARING,	// Let fzsftp instances connected to the same site share one SSH connection
+
 	OPTIONS_ENGINE_NUM
 };
 
@@ -79,7 +79,10 @@ enum class ProtocolFeature
 	ServerType,
 	EnterCommand,
 	DirectoryRename,
-	PostLoginCommands
+	PostLoginCommands,
+	SegmentedDownload,		// Downloading parts of a file, see CFileTransferCommand::t_transferSettings
+	BatchTransfer,			// CBatchTransferCommand
+	RecursiveList			// LIST_FLAG_RECURSIVE
 };
 
 class Credentials;
@@ -131,6 +131,25 @@ public:
 	int peek(void *buffer, unsigned int size, int& error);
 	int write(const void *buffer, unsigned int size, int& error);
 
+	// Zero-copy variants of write and read. send_file sends data from the
+	// file descriptor fd starting at offset and advances offset accordingly.
+	// splice_read moves received data into the write end of a pipe.
+	// Both fail with ENOSYS on platforms that do not support them.
+	int send_file(int fd, int64_t& offset, unsigned int size, int& error);
+	int splice_read(int pipe_fd, unsigned int size, int& error);
+
+	// Kernel TLS. enable_ktls attaches the TLS upper layer protocol to the
+	// connected socket and installs the keys for one direction, crypto_info
+	// being one of the tls12_crypto_info_* structures from linux/tls.h.
+	// Returns 0 on success, an error code otherwise.
+	// Once receiving is offloaded, read fails with EIO if the next record is
+	// not application data. read_record then returns that record along with
+	// its content type. write_record sends a record of the given type.
+	// All of them fail with ENOSYS on platforms without kernel TLS.
+	int enable_ktls(bool send, void const* crypto_info, unsigned int len);
+	int read_record(void* buffer, unsigned int size, unsigned char& type, int& error);
+	int write_record(unsigned char type, void const* buffer, unsigned int size, int& error);
+
 	int close();
 
 	/**
@@ -111,6 +111,23 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "Size decimal places", number, _T("1"), normal },
 	{ "TCP Keepalive Interval", number, _T("15"), normal },
 	{ "Cache TTL", number, _T("600"), normal },
+	{ "IO buffer count min", number, _T("4"), normal },
+	{ "IO buffer count max", number, _T("32"), normal },
+	{ "IO buffer size min", number, _T("65536"), normal },
+	{ "IO buffer size max", number, _T("4194304"), normal },
+	{ "IO use io_uring", number, _T("1"), normal },
+	{ "FTP zero-copy transfers", number, _T("1"), normal },
+	{ "FTP kernel TLS", number, _T("0"), normal },
+	{ "IO synthetic", number, _T("0"), internal },
+	{ "SFTP download streams", number, _T("4"), normal },
+	{ "HTTP download connections", number, _T("4"), normal },
+	{ "FTP MODE Z", number, _T("1"), normal },
+	{ "FTP MODE Z level", number, _T("6"), normal },
+	{ "FTP pipeline depth", number, _T("8"), normal },
+	{ "SFTP batch files", number, _T("4"), normal },
+	{ "Helper framing", number, _T("1"), normal },
+	{ "TLS session cache file", string, _T(""), normal },
+	{ "SFTP connection sharing", number, _T("0"), normal },
 
 	// Interface settings
 	{ "Number of Transfers", number, _T("2"), normal },
@@ -201,6 +218,9 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "Drag and Drop disabled", number, _T("0"), normal },
 	{ "Disable update footer", number, _T("0"), normal },
 	{ "Master password encryptor", string, _T(""), normal },
+	{ "Segmented downloads", number, _T("0"), normal },
+	{ "Segmented downloads minimum size", number, _T("64"), normal },
+	{ "Queue warm connections", number, _T("2"), normal },
 
 	// Default/internal options
 	{ "Config Location", string, _T(""), default_only },
@@ -607,6 +627,87 @@ int COptions::Validate(unsigned int nID, int value)
 			value = 60 * 60 * 24;
 		}
 		break;
+	case OPTION_IO_BUFFERCOUNT_MIN:
+		if (value < 2 || value > 1024) {
+			value = 4;
+		}
+		break;
+	case OPTION_IO_BUFFERCOUNT_MAX:
+		if (value < 2 || value > 1024) {
+			value = 32;
+		}
+		break;
+	case OPTION_IO_BUFFERSIZE_MIN:
+		if (value < 4096 || value > 64 * 1024 * 1024) {
+			value = 65536;
+		}
+		break;
+	case OPTION_IO_BUFFERSIZE_MAX:
+		if (value < 4096 || value > 64 * 1024 * 1024) {
+			value = 4194304;
+		}
+		break;
+	case OPTION_SFTP_DOWNLOAD_STREAMS:
+		if (value < 1) {
+			value = 1;
+		}
+		else if (value > 8) {
+			value = 8;
+		}
+		break;
+	case OPTION_SFTP_BATCH_FILES:
+		if (value < 1) {
+			value = 1;
+		}
+		else if (value > 16) {
+			value = 16;
+		}
+		break;
+	case OPTION_FTP_MODEZ_LEVEL:
+		if (value < 1) {
+			value = 1;
+		}
+		else if (value > 9) {
+			value = 9;
+		}
+		break;
+	case OPTION_FTP_PIPELINE_DEPTH:
+		if (value < 1) {
+			value = 1;
+		}
+		else if (value > 32) {
+			value = 32;
+		}
+		break;
+	case OPTION_HTTP_DOWNLOAD_CONNECTIONS:
+		if (value < 1) {
+			value = 1;
+		}
+		else if (value > 10) {
+			value = 10;
+		}
+		break;
+	case OPTION_SEGMENTED_DOWNLOADS:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 10) {
+			value = 10;
+		}
+		break;
+	case OPTION_SEGMENTED_DOWNLOADS_MINSIZE:
+		if (value < 1) {
+			value = 1;
+		}
+		break;
+	case OPTION_QUEUE_WARM_CONNECTIONS:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 10) {
+			value = 10;
+		}
+		break;
 	}
 	return value;
 }
@@ -101,6 +101,9 @@ enum interfaceOptions
 	OPTION_DND_DISABLED,
 	OPTION_DISABLE_UPDATE_FOOTER,
 	OPTION_MASTERPASSWORDENCRYPTOR,
+	OPTION_SEGMENTED_DOWNLOADS,
+	OPTION_SEGMENTED_DOWNLOADS_MINSIZE,
+	OPTION_QUEUE_WARM_CONNECTIONS,
 
 	// Default/internal options
 	OPTION_DEFAULT_SETTINGSDIR, // guaranteed to be (back)slash-terminated
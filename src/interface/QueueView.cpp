@@ -26,6 +26,8 @@
 #include "auto_ascii_files.h"
 #include "dragdropmanager.h"
 #include "drop_target_ex.h"
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
 #if WITH_LIBDBUS
 #include "../dbus/desktop_notification.h"
 #elif defined(__WXGTK__) || defined(__WXMSW__)
@@ -458,7 +460,7 @@ void CQueueView::ProcessNotification(t_EngineData* pEngineData, std::unique_ptr<
 				m_pAsyncRequestQueue->AddRequest(pEngineData->pEngine, std::move(asyncRequestNotification));
 			}
 			else {
-				if (pEngineData->active && asyncRequestNotification->GetRequestID() != reqId_fileexists) {
+				if ((pEngineData->active || pEngineData->state == t_EngineData::warmup) && asyncRequestNotification->GetRequestID() != reqId_fileexists) {
 					m_pAsyncRequestQueue->AddRequest(pEngineData->pEngine, std::move(asyncRequestNotification));
 				}
 			}			
@@ -672,6 +674,8 @@ bool CQueueView::TryStartNextTransfer()
 		}
 	}
 
+	SplitIntoSegments(*bestMatch.serverItem, *bestMatch.fileItem);
+
 	// Now we have both inactive engine and file.
 	// Assign the file to the engine.
 
@@ -682,6 +686,7 @@ bool CQueueView::TryStartNextTransfer()
 	pEngineData->active = true;
 	delete pEngineData->m_idleDisconnectTimer;
 	pEngineData->m_idleDisconnectTimer = 0;
+	pEngineData->pooled = false;
 	bestMatch.serverItem->m_activeCount++;
 	m_activeCount++;
 	if (bestMatch.fileItem->Download()) {
@@ -746,6 +751,93 @@ bool CQueueView::TryStartNextTransfer()
 	return true;
 }
 
+void CQueueView::SplitIntoSegments(CServerItem& serverItem, CFileItem& fileItem)
+{
+	if (fileItem.GetType() != QueueItemType::File || !fileItem.Download() || fileItem.Ascii() ||
+		fileItem.m_edit != CEditHandler::none || fileItem.GetSegment())
+	{
+		return;
+	}
+
+	if (!CServer::ProtocolHasFeature(serverItem.GetServer().server.GetProtocol(), ProtocolFeature::SegmentedDownload)) {
+		return;
+	}
+
+	int64_t const size = fileItem.GetSize();
+	int64_t const minSize = static_cast<int64_t>(COptions::Get()->GetOptionVal(OPTION_SEGMENTED_DOWNLOADS_MINSIZE)) * 1024 * 1024;
+	if (size <= 0) {
+		return;
+	}
+
+	int const count = static_cast<int>(std::min(static_cast<int64_t>(COptions::Get()->GetOptionVal(OPTION_SEGMENTED_DOWNLOADS)), size / minSize));
+	if (count < 2) {
+		return;
+	}
+
+	// The segments get written into a file already having its final size.
+	// Only do this for new files, existing ones need to be dealt with first.
+	std::wstring const localFile = fileItem.GetLocalPath().GetPath() + fileItem.GetLocalFile();
+	if (fz::local_filesys::get_file_type(fz::to_native(localFile), true) != fz::local_filesys::unknown) {
+		return;
+	}
+
+	wxFileName::Mkdir(fileItem.GetLocalPath().GetPath(), 0777, wxPATH_MKDIR_FULL);
+	{
+		fz::file file(fz::to_native(localFile), fz::file::writing, fz::file::empty);
+		if (!file.opened()) {
+			return;
+		}
+		if (file.seek(size, fz::file::begin) != size || !file.truncate()) {
+			file.close();
+			wxRemoveFile(localFile);
+			return;
+		}
+	}
+
+	int64_t const segmentSize = size / count;
+
+	CFileSegment segment;
+	segment.length = segmentSize;
+	segment.count = count;
+	fileItem.SetSegment(segment);
+	fileItem.SetSize(segmentSize);
+
+	auto const& targetFile = fileItem.GetTargetFile();
+
+	wxASSERT(m_insertionStart == -1);
+	m_insertionStart = GetItemIndex(&fileItem) + 1;
+
+	CQueueItem* previous = &fileItem;
+	for (int i = 1; i < count; ++i) {
+		segment.index = i;
+		segment.offset = segmentSize * i;
+
+		// The last segment takes the remainder, up to wherever the remote file ends
+		int64_t itemSize = segmentSize;
+		if (i + 1 == count) {
+			segment.length = -1;
+			itemSize = size - segment.offset;
+		}
+
+		CFileItem* item = new CFileItem(&serverItem, fileItem.queued(), true, fileItem.GetSourceFile(), targetFile ? *targetFile : std::wstring(),
+			fileItem.GetLocalPath(), fileItem.GetRemotePath(), itemSize);
+		item->SetPriorityRaw(fileItem.GetPriority());
+		item->SetSegment(segment);
+
+		serverItem.InsertChildAfter(previous, item);
+		previous = item;
+
+		++m_itemCount;
+		++m_insertionCount;
+		++m_fileCount;
+	}
+	m_fileCountChanged = true;
+
+	// The total queue size does not change, the segments add up to the size of the file
+	CommitChanges();
+	UpdateStatusLinePositions();
+}
+
 void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification const& notification)
 {
 	if (notification.nReplyCode & FZ_REPLY_DISCONNECTED &&
@@ -762,6 +854,19 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 	// Process reply from the engine
 	int replyCode = notification.nReplyCode;
 
+	if (pEngineData->state == t_EngineData::warmup) {
+		pEngineData->state = t_EngineData::none;
+		if (replyCode != FZ_REPLY_OK) {
+			for (auto & serverItem : m_serverList) {
+				if (serverItem->GetServer() == pEngineData->lastServer) {
+					serverItem->m_warmupFailed = true;
+				}
+			}
+		}
+		AdvanceQueue(false);
+		return;
+	}
+
 	if ((replyCode & FZ_REPLY_CANCELED) == FZ_REPLY_CANCELED) {
 		ResetReason reason;
 		if (pEngineData->pItem) {
@@ -1252,6 +1357,20 @@ void CQueueView::SendNextCommand(t_EngineData& engineData)
 
 			CFileTransferCommand::t_transferSettings transferSettings;
 			transferSettings.binary = !fileItem->Ascii();
+			if (fileItem->GetSegment()) {
+				auto const& segment = *fileItem->GetSegment();
+
+				// Received data may still have been buffered when the previous
+				// attempt ended, do not rely on the last buffers worth of it.
+				int64_t const margin = static_cast<int64_t>(COptions::Get()->GetOptionVal(OPTION_IO_BUFFERCOUNT_MAX)) * COptions::Get()->GetOptionVal(OPTION_IO_BUFFERSIZE_MAX);
+				int64_t const resume = std::max(int64_t(0), segment.done - margin);
+
+				transferSettings.segment = true;
+				transferSettings.segmentOffset = segment.offset + resume;
+				if (segment.length >= 0) {
+					transferSettings.segmentLength = segment.length - resume;
+				}
+			}
 			int res = engineData.pEngine->Execute(CFileTransferCommand(fileItem->GetLocalPath().GetPath() + fileItem->GetLocalFile(), fileItem->GetRemotePath(),
 												fileItem->GetRemoteFile(), fileItem->Download(), transferSettings));
 			wxASSERT((res & FZ_REPLY_BUSY) != FZ_REPLY_BUSY);
@@ -1730,6 +1849,19 @@ void CQueueView::ImportQueue(pugi::xml_node element, bool updateSelections)
 					if (overwrite_action > 0 && overwrite_action < CFileExistsNotification::ACTION_COUNT) {
 						fileItem->m_defaultFileExistsAction = (CFileExistsNotification::OverwriteAction)overwrite_action;
 					}
+
+					int const segmentCount = static_cast<int>(GetTextElementInt(file, "SegmentCount"));
+					if (segmentCount > 0 && download && binary) {
+						CFileSegment segment;
+						segment.offset = GetTextElementInt(file, "SegmentOffset");
+						segment.length = GetTextElementInt(file, "SegmentLength", -1);
+						segment.done = GetTextElementInt(file, "SegmentDone");
+						segment.index = static_cast<int>(GetTextElementInt(file, "SegmentIndex"));
+						segment.count = segmentCount;
+						if (segment.offset >= 0 && segment.done >= 0) {
+							fileItem->SetSegment(segment);
+						}
+					}
 				}
 			}
 			for (auto folder = xServer.child("Folder"); folder; folder = folder.next_sibling("Folder")) {
@@ -2229,7 +2361,7 @@ t_EngineData* CQueueView::GetIdleEngine(ServerWithCredentials const& server, boo
 
 	int transient = 0;
 	for (unsigned int i = 0; i < m_engineData.size(); ++i) {
-		if (m_engineData[i]->active) {
+		if (m_engineData[i]->active || m_engineData[i]->state == t_EngineData::warmup) {
 			continue;
 		}
 
@@ -2248,7 +2380,8 @@ t_EngineData* CQueueView::GetIdleEngine(ServerWithCredentials const& server, boo
 			return m_engineData[i];
 		}
 
-		if (!pFirstIdle) {
+		// Rather not take away connections from other servers
+		if (!pFirstIdle || (pFirstIdle->pEngine->IsConnected() && !m_engineData[i]->pEngine->IsConnected())) {
 			pFirstIdle = m_engineData[i];
 		}
 	}
@@ -2268,6 +2401,76 @@ t_EngineData* CQueueView::GetIdleEngine(ServerWithCredentials const& server, boo
 }
 
 
+void CQueueView::WarmUpEngines()
+{
+	int const warm = COptions::Get()->GetOptionVal(OPTION_QUEUE_WARM_CONNECTIONS);
+	if (!warm || m_quit || !m_activeMode) {
+		return;
+	}
+
+	for (auto const& serverItem : m_serverList) {
+		if (serverItem->m_warmupFailed) {
+			continue;
+		}
+
+		ServerWithCredentials const& server = serverItem->GetServer();
+
+		int wanted = std::min(warm, static_cast<int>(serverItem->GetChildrenCount(true)) - serverItem->m_activeCount);
+		int const max_count = server.server.MaximumMultipleConnections();
+		if (max_count) {
+			wanted = std::min(wanted, max_count - serverItem->m_activeCount);
+		}
+
+		int have = 0;
+		for (auto const& engineData : m_engineData) {
+			if (!engineData->active && !engineData->transient && engineData->lastServer == server &&
+				(engineData->state == t_EngineData::warmup || engineData->pEngine->IsConnected()))
+			{
+				++have;
+			}
+		}
+
+		while (have < wanted) {
+			if (!CLoginManager::Get().GetPassword(server, true)) {
+				break;
+			}
+
+			// Only use engines which are of no use to anyone else right now
+			t_EngineData* pEngineData = 0;
+			int transient = 0;
+			for (auto & engineData : m_engineData) {
+				if (engineData->transient) {
+					++transient;
+				}
+				else if (!engineData->active && engineData->state == t_EngineData::none && !engineData->pEngine->IsConnected()) {
+					pEngineData = engineData;
+					break;
+				}
+			}
+			if (!pEngineData) {
+				if (COptions::Get()->GetOptionVal(OPTION_NUMTRANSFERS) <= static_cast<int>(m_engineData.size()) - transient) {
+					return;
+				}
+				pEngineData = new t_EngineData;
+				pEngineData->pEngine = new CFileZillaEngine(m_pMainFrame->GetEngineContext(), *this);
+				m_engineData.push_back(pEngineData);
+			}
+
+			pEngineData->lastServer = server;
+			pEngineData->state = t_EngineData::warmup;
+			int res = pEngineData->pEngine->Execute(CConnectCommand(server.server, server.credentials, false));
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				pEngineData->state = t_EngineData::none;
+				if (res != FZ_REPLY_OK) {
+					serverItem->m_warmupFailed = true;
+				}
+				break;
+			}
+			++have;
+		}
+	}
+}
+
 t_EngineData* CQueueView::GetEngineData(CFileZillaEngine const* pEngine)
 {
 	for (unsigned int i = 0; i < m_engineData.size(); ++i) {
@@ -2429,7 +2632,18 @@ void CQueueView::AdvanceQueue(bool refresh)
 	while (TryStartNextTransfer()) {
 	}
 
-	// Set timer for connected, idle engines
+	WarmUpEngines();
+
+	// Set timer for connected, idle engines. Up to the number of warm
+	// connections per server are kept around for longer.
+	int const warm = COptions::Get()->GetOptionVal(OPTION_QUEUE_WARM_CONNECTIONS);
+	std::vector<ServerWithCredentials> pooled;
+	for (auto const& engineData : m_engineData) {
+		if (engineData->pooled && engineData->m_idleDisconnectTimer) {
+			pooled.push_back(engineData->lastServer);
+		}
+	}
+
 	for (unsigned int i = 0; i < m_engineData.size(); ++i) {
 		if (m_engineData[i]->active || m_engineData[i]->transient) {
 			continue;
@@ -2442,6 +2656,7 @@ void CQueueView::AdvanceQueue(bool refresh)
 
 			delete m_engineData[i]->m_idleDisconnectTimer;
 			m_engineData[i]->m_idleDisconnectTimer = 0;
+			m_engineData[i]->pooled = false;
 		}
 		else {
 			if (!m_engineData[i]->pEngine->IsConnected()) {
@@ -2449,7 +2664,14 @@ void CQueueView::AdvanceQueue(bool refresh)
 			}
 
 			m_engineData[i]->m_idleDisconnectTimer = new wxTimer(this);
-			m_engineData[i]->m_idleDisconnectTimer->Start(60000, true);
+			if (std::count(pooled.begin(), pooled.end(), m_engineData[i]->lastServer) < warm) {
+				pooled.push_back(m_engineData[i]->lastServer);
+				m_engineData[i]->pooled = true;
+				m_engineData[i]->m_idleDisconnectTimer->Start(300000, true);
+			}
+			else {
+				m_engineData[i]->m_idleDisconnectTimer->Start(60000, true);
+			}
 		}
 	}
 
@@ -2508,6 +2730,7 @@ void CQueueView::OnTimer(wxTimerEvent& event)
 		if (pData->m_idleDisconnectTimer && !pData->m_idleDisconnectTimer->IsRunning()) {
 			delete pData->m_idleDisconnectTimer;
 			pData->m_idleDisconnectTimer = 0;
+			pData->pooled = false;
 
 			if (pData->pEngine->IsConnected()) {
 				pData->pEngine->Execute(CDisconnectCommand());
@@ -2847,7 +3070,7 @@ bool CQueueView::SwitchEngine(t_EngineData** ppEngineData)
 			continue;
 		}
 
-		if (pNewEngineData->active || pNewEngineData->transient) {
+		if (pNewEngineData->active || pNewEngineData->transient || pNewEngineData->state == t_EngineData::warmup) {
 			continue;
 		}
 
@@ -2869,6 +3092,7 @@ bool CQueueView::SwitchEngine(t_EngineData** ppEngineData)
 
 		delete pNewEngineData->m_idleDisconnectTimer;
 		pNewEngineData->m_idleDisconnectTimer = 0;
+		pNewEngineData->pooled = false;
 
 		// Swap status line
 		CStatusLineCtrl* pOldStatusLineCtrl = pNewEngineData->pStatusLineCtrl;
@@ -46,6 +46,7 @@ struct t_EngineData final
 		, pItem()
 		, pStatusLineCtrl()
 		, m_idleDisconnectTimer()
+		, pooled()
 	{
 	}
 
@@ -71,13 +72,17 @@ struct t_EngineData final
 		list,
 		mkdir,
 		askpassword,
-		waitprimary
+		waitprimary,
+		warmup // Connecting ahead of time, without an item
 	} state;
 
 	CFileItem* pItem;
 	ServerWithCredentials lastServer;
 	CStatusLineCtrl* pStatusLineCtrl;
 	wxTimer* m_idleDisconnectTimer;
+
+	// Whether the idle disconnect timer is the longer one of warm connections
+	bool pooled;
 };
 
 class CMainFrame;
@@ -177,6 +182,11 @@ protected:
 	// whether it is allowed to start another transfer on that server item
 	bool CanStartTransfer(const CServerItem& server_item, t_EngineData *&pEngineData);
 
+	// Called from TryStartNextTransfer(), splits large downloads into
+	// segments, each downloaded on a connection of its own into the same
+	// local file. The item itself becomes the first segment.
+	void SplitIntoSegments(CServerItem& serverItem, CFileItem& fileItem);
+
 	void ProcessReply(t_EngineData* pEngineData, COperationNotification const& notification);
 	void SendNextCommand(t_EngineData& engineData);
 
@@ -230,6 +240,10 @@ protected:
 	bool IsOtherEngineConnected(t_EngineData* pEngineData);
 
 	t_EngineData* GetIdleEngine(ServerWithCredentials const& server = ServerWithCredentials(), bool allowTransient = false);
+
+	// Connects idle engines to servers with queued items ahead of time,
+	// up to OPTION_QUEUE_WARM_CONNECTIONS per server.
+	void WarmUpEngines();
 	t_EngineData* GetEngineData(const CFileZillaEngine* pEngine);
 
 	std::vector<t_EngineData*> m_engineData;
@@ -315,6 +315,13 @@ void CFileItem::SaveItem(pugi::xml_node& element) const
 	if (m_defaultFileExistsAction != CFileExistsNotification::unknown) {
 		AddTextElement(file, "OverwriteAction", m_defaultFileExistsAction);
 	}
+	if (m_segment) {
+		AddTextElement(file, "SegmentOffset", m_segment->offset);
+		AddTextElement(file, "SegmentLength", m_segment->length);
+		AddTextElement(file, "SegmentDone", m_segment->done);
+		AddTextElement(file, "SegmentIndex", m_segment->index);
+		AddTextElement(file, "SegmentCount", m_segment->count);
+	}
 }
 
 bool CFileItem::TryRemoveAll()
@@ -654,6 +661,33 @@ CFileItem* CServerItem::GetIdleChild(bool immediateOnly, TransferDirection direc
 	return item;
 }
 
+void CServerItem::InsertChildAfter(CQueueItem* sibling, CQueueItem* pItem)
+{
+	if (m_removed_at_front) {
+		m_children.erase(m_children.begin(), m_children.begin() + m_removed_at_front);
+		m_removed_at_front = 0;
+	}
+
+	auto iter = std::find(m_children.begin(), m_children.end(), sibling);
+	if (iter != m_children.end()) {
+		++iter;
+	}
+	m_children.insert(iter, pItem);
+
+	m_maxCachedIndex = -1;
+	m_visibleOffspring += 1 + pItem->GetChildrenCount(true);
+
+	if (pItem->GetType() == QueueItemType::File || pItem->GetType() == QueueItemType::Folder) {
+		CFileItem* pFileItem = static_cast<CFileItem*>(pItem);
+		std::deque<CFileItem*>& fileList = m_fileList[pFileItem->queued() ? 0 : 1][static_cast<int>(pFileItem->GetPriority())];
+		auto pos = std::find(fileList.begin(), fileList.end(), sibling);
+		if (pos != fileList.end()) {
+			++pos;
+		}
+		fileList.insert(pos, pFileItem);
+	}
+}
+
 bool CServerItem::RemoveChild(CQueueItem* pItem, bool destroy, bool forward)
 {
 	if (!pItem) {
@@ -977,6 +1011,10 @@ wxString CQueueViewBase::OnGetItemText(CQueueItem* pItem, ColumnId column) const
 				}
 				break;
 			case colRemoteName:
+				if (pFileItem->GetSegment()) {
+					auto const& segment = *pFileItem->GetSegment();
+					return wxString::Format(_("%s (part %d of %d)"), pFileItem->GetRemotePath().FormatFilename(pFileItem->GetRemoteFile()), segment.index + 1, segment.count);
+				}
 				return pFileItem->GetRemotePath().FormatFilename(pFileItem->GetRemoteFile());
 			case colSize:
 				{
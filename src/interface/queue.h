@@ -95,6 +95,10 @@ public:
 
 	CFileItem* GetIdleChild(bool immadiateOnly, TransferDirection direction);
 
+	// Inserts the item right after the given direct child, both in the
+	// list of children and in the scheduling order.
+	void InsertChildAfter(CQueueItem* sibling, CQueueItem* pItem);
+
 	virtual bool RemoveChild(CQueueItem* pItem, bool destroy = true, bool forward = true); // Removes a child item with is somewhere in the tree of children
 	virtual bool TryRemoveAll();
 
@@ -115,6 +119,9 @@ public:
 
 	int m_activeCount;
 
+	// Set if connecting ahead of time failed, no further attempts are made
+	bool m_warmupFailed{};
+
 	const std::vector<CQueueItem*>& GetChildren() const { return m_children; }
 
 	void Sort(int col, bool reverse);
@@ -145,6 +152,18 @@ protected:
 
 struct t_EngineData;
 
+// A part of a file which gets downloaded on a connection of its own, see
+// CQueueView::SplitIntoSegments
+struct CFileSegment final
+{
+	int64_t offset{};
+	int64_t length{-1}; // Negative if up to the end of the file
+	int64_t done{}; // Amount of data received so far, for resuming
+
+	int index{};
+	int count{};
+};
+
 class CFileItem : public CQueueItem
 {
 public:
@@ -166,6 +185,10 @@ public:
 	CServerPath const& GetRemotePath() const { return m_remotePath; }
 	int64_t GetSize() const { return m_size; }
 	void SetSize(int64_t size) { m_size = size; }
+
+	fz::sparse_optional<CFileSegment> const& GetSegment() const { return m_segment; }
+	fz::sparse_optional<CFileSegment>& GetSegment() { return m_segment; }
+	void SetSegment(CFileSegment const& segment) { m_segment = fz::sparse_optional<CFileSegment>(segment); }
 	inline bool Download() const { return flags & flag_download; }
 
 	inline bool queued() const { return (flags & flag_queued) != 0; }
@@ -274,6 +297,7 @@ protected:
 	CLocalPath const m_localPath;
 	CServerPath const m_remotePath;
 	int64_t m_size{};
+	fz::sparse_optional<CFileSegment> m_segment;
 };
 
 class CFolderItem final : public CFileItem
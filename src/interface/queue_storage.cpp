@@ -91,7 +91,12 @@ namespace file_table_column_names
 		error_count,
 		priority,
 		ascii_file,
-		default_exists_action
+		default_exists_action,
+		segment_offset,
+		segment_length,
+		segment_done,
+		segment_index,
+		segment_count
 	};
 }
 
@@ -107,7 +112,12 @@ _column file_table_columns[] = {
 	{ "error_count", Column_type::integer, 0 },
 	{ "priority", Column_type::integer, 0 },
 	{ "ascii_file", Column_type::integer, 0 },
-	{ "default_exists_action", Column_type::integer, 0 }
+	{ "default_exists_action", Column_type::integer, 0 },
+	{ "segment_offset", Column_type::integer, 0 },
+	{ "segment_length", Column_type::integer, 0 },
+	{ "segment_done", Column_type::integer, 0 },
+	{ "segment_index", Column_type::integer, 0 },
+	{ "segment_count", Column_type::integer, 0 }
 };
 
 namespace path_table_column_names
@@ -292,7 +302,7 @@ bool CQueueStorage::Impl::MigrateSchema()
 	bool ret = sqlite3_exec(db_, "PRAGMA user_version", int_callback, &version, 0) == SQLITE_OK;
 
 	if (ret) {
-		if (version > 4) {
+		if (version > 5) {
 			ret = false;
 		}
 		else if (version > 0) {
@@ -303,9 +313,16 @@ bool CQueueStorage::Impl::MigrateSchema()
 			if (ret && version < 4) {
 				ret = sqlite3_exec(db_, "ALTER TABLE servers ADD COLUMN parameters TEXT", 0, 0, 0) == SQLITE_OK;
 			}
+			if (ret && version < 5) {
+				ret = sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_offset INTEGER", 0, 0, 0) == SQLITE_OK &&
+					sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_length INTEGER", 0, 0, 0) == SQLITE_OK &&
+					sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_done INTEGER", 0, 0, 0) == SQLITE_OK &&
+					sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_index INTEGER", 0, 0, 0) == SQLITE_OK &&
+					sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_count INTEGER", 0, 0, 0) == SQLITE_OK;
+			}
 		}
-		if (ret && version != 4) {
-			ret = sqlite3_exec(db_, "PRAGMA user_version = 4", 0, 0, 0) == SQLITE_OK;
+		if (ret && version != 5) {
+			ret = sqlite3_exec(db_, "PRAGMA user_version = 5", 0, 0, 0) == SQLITE_OK;
 		}
 	}
 
@@ -813,6 +830,22 @@ bool CQueueStorage::Impl::SaveFile(CFileItem const& file)
 		BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
 	}
 
+	auto const& segment = file.GetSegment();
+	if (segment) {
+		Bind(insertFileQuery_, file_table_column_names::segment_offset, segment->offset);
+		Bind(insertFileQuery_, file_table_column_names::segment_length, segment->length);
+		Bind(insertFileQuery_, file_table_column_names::segment_done, segment->done);
+		Bind(insertFileQuery_, file_table_column_names::segment_index, segment->index);
+		Bind(insertFileQuery_, file_table_column_names::segment_count, segment->count);
+	}
+	else {
+		BindNull(insertFileQuery_, file_table_column_names::segment_offset);
+		BindNull(insertFileQuery_, file_table_column_names::segment_length);
+		BindNull(insertFileQuery_, file_table_column_names::segment_done);
+		BindNull(insertFileQuery_, file_table_column_names::segment_index);
+		BindNull(insertFileQuery_, file_table_column_names::segment_count);
+	}
+
 	int res;
 	do {
 		res = sqlite3_step(insertFileQuery_);
@@ -855,6 +888,11 @@ bool CQueueStorage::Impl::SaveDirectory(CFolderItem const& directory)
 	BindNull(insertFileQuery_, file_table_column_names::ascii_file);
 
 	BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
+	BindNull(insertFileQuery_, file_table_column_names::segment_offset);
+	BindNull(insertFileQuery_, file_table_column_names::segment_length);
+	BindNull(insertFileQuery_, file_table_column_names::segment_done);
+	BindNull(insertFileQuery_, file_table_column_names::segment_index);
+	BindNull(insertFileQuery_, file_table_column_names::segment_count);
 
 	int res;
 	do {
@@ -1097,6 +1135,19 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 		if (overwrite_action > 0 && overwrite_action < CFileExistsNotification::ACTION_COUNT) {
 			fileItem->m_defaultFileExistsAction = (CFileExistsNotification::OverwriteAction)overwrite_action;
 		}
+
+		int const segmentCount = GetColumnInt(selectFilesQuery_, file_table_column_names::segment_count);
+		if (segmentCount > 0) {
+			CFileSegment segment;
+			segment.offset = GetColumnInt64(selectFilesQuery_, file_table_column_names::segment_offset);
+			segment.length = GetColumnInt64(selectFilesQuery_, file_table_column_names::segment_length, -1);
+			segment.done = GetColumnInt64(selectFilesQuery_, file_table_column_names::segment_done);
+			segment.index = GetColumnInt(selectFilesQuery_, file_table_column_names::segment_index);
+			segment.count = segmentCount;
+			if (segment.offset >= 0 && segment.done >= 0) {
+				fileItem->SetSegment(segment);
+			}
+		}
 	}
 
 	return GetColumnInt64(selectFilesQuery_, file_table_column_names::id);
@@ -125,7 +125,14 @@ bool CRemoteRecursiveOperation::NextOperation()
 				continue;
 			}
 
-			CListCommand* cmd = new CListCommand(dirToVisit.parent, dirToVisit.subdir, dirToVisit.link ? LIST_FLAG_LINK : 0);
+			int flags = dirToVisit.link ? LIST_FLAG_LINK : 0;
+			if (!dirToVisit.link && dirToVisit.recurse && !dirToVisit.restrict &&
+				CServer::ProtocolHasFeature(m_state.GetServer().server.GetProtocol(), ProtocolFeature::RecursiveList))
+			{
+				// Lets the engine fetch the whole tree at once
+				flags |= LIST_FLAG_RECURSIVE;
+			}
+			CListCommand* cmd = new CListCommand(dirToVisit.parent, dirToVisit.subdir, flags);
 			m_state.m_pCommandQueue->ProcessCommand(cmd, CCommandQueue::recursiveOperation);
 			return true;
 		}
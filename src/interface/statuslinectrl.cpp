@@ -277,7 +277,21 @@ void CStatusLineCtrl::SetTransferStatus(CTransferStatus const& status)
 	else {
 		status_ = status;
 
-		m_lastOffset = status.currentOffset;
+		// Segments show their own progress rather than the one of the whole file
+		CFileItem* pItem = m_pEngineData ? m_pEngineData->pItem : nullptr;
+		if (pItem && pItem->GetSegment() && !status.list) {
+			auto & segment = *pItem->GetSegment();
+			if (status_.totalSize >= segment.offset) {
+				status_.totalSize -= segment.offset;
+			}
+			status_.startOffset -= segment.offset;
+			status_.currentOffset -= segment.offset;
+			if (status_.currentOffset > segment.done) {
+				segment.done = status_.currentOffset;
+			}
+		}
+
+		m_lastOffset = status_.currentOffset;
 
 		if (!m_transferStatusTimer.IsRunning())
 			m_transferStatusTimer.Start(100);
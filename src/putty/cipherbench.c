@@ -0,0 +1,838 @@
+/*
+ * cipherbench: known-answer tests and measurements for the SSH-2 ciphers,
+ * MACs, key exchange methods and host key signatures of fzsftp.
+ *
+ * Usage: cipherbench [seconds per cipher]
+ *
+ * All known-answer tests run first, the exit code is non-zero if any of
+ * them fails. Throughput is then measured in CPU time on packets of 32 KiB,
+ * the size of SFTP data packets. Key exchange and host key verification,
+ * the computational part of setting up a connection, are measured in CPU
+ * time per operation.
+ *
+ * AES, SHA-1 and SHA-256 come from Nettle. A fat build of Nettle picks
+ * hardware accelerated code at runtime, such as AES-NI and the SHA
+ * extensions. Running with NETTLE_FAT_OVERRIDE=none in the environment
+ * measures its portable code for comparison.
+ *
+ * ChaCha20 picks its SIMD code itself. It is tested with every level the
+ * CPU supports, the lower ones are measured as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "putty.h"
+#include "ssh.h"
+
+#define PACKET_SIZE 32768
+
+void modalfatalbox(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+void nonfatal(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/* See cmdgen.c */
+const int buildinfo_gtk_relevant = FALSE;
+
+char *x_get_default(const char *key)
+{
+    return NULL;
+}
+
+static const struct ssh2_ciphers *const cipher_lists[] = {
+    &ssh2_aes,
+    &ssh2_ccp,
+};
+
+struct cipher_kat {
+    const char *name;		       /* SSH name of the cipher */
+    const char *key, *iv, *plaintext, *ciphertext;   /* in hex */
+};
+
+/* NIST SP 800-38A, appendix F */
+#define SP800_38A_PLAINTEXT \
+    "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51" \
+    "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710"
+#define SP800_38A_KEY128 "2b7e151628aed2a6abf7158809cf4f3c"
+#define SP800_38A_KEY192 "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b"
+#define SP800_38A_KEY256 \
+    "603deb1015ca71be2b73aef0857d7781" "1f352c073b6108d72d9810a30914dff4"
+#define SP800_38A_CBC_IV "000102030405060708090a0b0c0d0e0f"
+#define SP800_38A_CTR_IV "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"
+
+static const struct cipher_kat cipher_kats[] = {
+    { "aes128-cbc", SP800_38A_KEY128, SP800_38A_CBC_IV, SP800_38A_PLAINTEXT,
+      "7649abac8119b246cee98e9b12e9197d" "5086cb9b507219ee95db113a917678b2"
+      "73bed6b8e3c1743b7116e69e22229516" "3ff1caa1681fac09120eca307586e1a7" },
+    { "aes192-cbc", SP800_38A_KEY192, SP800_38A_CBC_IV, SP800_38A_PLAINTEXT,
+      "4f021db243bc633d7178183a9fa071e8" "b4d9ada9ad7dedf4e5e738763f69145a"
+      "571b242012fb7ae07fa9baac3df102e0" "08b0e27988598881d920a9e64f5615cd" },
+    { "aes256-cbc", SP800_38A_KEY256, SP800_38A_CBC_IV, SP800_38A_PLAINTEXT,
+      "f58c4c04d6e5f1ba779eabfb5f7bfbd6" "9cfc4e967edb808d679f777bc6702c7d"
+      "39f23369a9d9bacfa530e26304231461" "b2eb05e2c39be9fcda6c19078c6a9d1b" },
+    { "aes128-ctr", SP800_38A_KEY128, SP800_38A_CTR_IV, SP800_38A_PLAINTEXT,
+      "874d6191b620e3261bef6864990db6ce" "9806f66b7970fdff8617187bb9fffdff"
+      "5ae4df3edbd5d35e5b4f09020db03eab" "1e031dda2fbe03d1792170a0f3009cee" },
+    { "aes192-ctr", SP800_38A_KEY192, SP800_38A_CTR_IV, SP800_38A_PLAINTEXT,
+      "1abc932417521ca24f2b0459fe7e6e0b" "090339ec0aa6faefd5ccc2c6f4ce8e94"
+      "1e36b26bd1ebc670d1bd1d665620abf7" "4f78a7f6d29809585a97daec58c6b050" },
+    { "aes256-ctr", SP800_38A_KEY256, SP800_38A_CTR_IV, SP800_38A_PLAINTEXT,
+      "601ec313775789a5b7a7f504bbf3d228" "f443e3ca4d62b59aca84e990cacaf5c5"
+      "2b0930daa23de94ce87017ba2d84988d" "dfc9c58db67aada613c2dd08457941a6" },
+};
+
+/*
+ * Ciphers with their own MAC get tested on whole packets, the way ssh.c
+ * handles them. The contents of the packet are generated, only the
+ * expected MAC is given. As it covers the whole encrypted packet, it
+ * doubles as a check of the encryption.
+ */
+struct packet_kat {
+    const char *name;
+    const char *key;		       /* in hex */
+    unsigned long seq;
+    int len;			       /* of the contents, after the length */
+    const char *mac;		       /* in hex */
+};
+
+/*
+ * chacha20-poly1305@openssh.com. Computed with an independent
+ * implementation of PROTOCOL.chacha20poly1305 from OpenSSH, which in turn
+ * was checked against the ChaCha20 and Poly1305 vectors of RFC 7539. The
+ * longer packets cross ChaCha20 blocks, end in partial Poly1305 blocks and
+ * the last one is long enough for all SIMD code paths.
+ */
+#define CCP_KEY \
+    "000102030405060708090a0b0c0d0e0f" "101112131415161718191a1b1c1d1e1f" \
+    "202122232425262728292a2b2c2d2e2f" "303132333435363738393a3b3c3d3e3f"
+
+static const struct packet_kat packet_kats[] = {
+    { "chacha20-poly1305@openssh.com", CCP_KEY, 0x01020304, 8,
+      "aca15154c1bc3ca51c664f4f7b2930f7" },
+    { "chacha20-poly1305@openssh.com", CCP_KEY, 7, 135,
+      "005f3829b38abc6576373c8446899c89" },
+    { "chacha20-poly1305@openssh.com", CCP_KEY, 0xfffffffe, 1700,
+      "af4895bbb2f910ade30a129ca434a4a4" },
+};
+
+static const struct ssh_mac *const macs[] = {
+    &ssh_hmac_sha256,
+    &ssh_hmac_sha1,
+    &ssh_hmac_sha1_96,
+};
+
+struct mac_kat {
+    const struct ssh_mac *mac;
+    const char *source;
+    const char *key;		       /* in hex */
+    const char *data;
+    const char *result;		       /* in hex */
+};
+
+/*
+ * RFC 4231 and RFC 2202. The MACs always take keys of their key length,
+ * shorter keys are padded with zeros. HMAC does that anyhow, so the
+ * results stay the same.
+ */
+#define HMAC_KEY1 "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b"
+#define HMAC_DATA1 "Hi There"
+#define HMAC_KEY2 "4a656665"	       /* "Jefe" */
+#define HMAC_DATA2 "what do ya want for nothing?"
+
+static const struct mac_kat mac_kats[] = {
+    { &ssh_hmac_sha256, "RFC 4231 1", HMAC_KEY1, HMAC_DATA1,
+      "b0344c61d8db38535ca8afceaf0bf12b" "881dc200c9833da726e9376c2e32cff7" },
+    { &ssh_hmac_sha256, "RFC 4231 2", HMAC_KEY2, HMAC_DATA2,
+      "5bdcc146bf60754e6a042426089575c7" "5a003f089d2739839dec58b964ec3843" },
+    { &ssh_hmac_sha1, "RFC 2202 1", HMAC_KEY1, HMAC_DATA1,
+      "b617318655057264e28bc0b6fb378c8ef146be00" },
+    { &ssh_hmac_sha1, "RFC 2202 2", HMAC_KEY2, HMAC_DATA2,
+      "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+    { &ssh_hmac_sha1_96, "RFC 2202 2", HMAC_KEY2, HMAC_DATA2,
+      "effcdf6ae5eb2fa2d27416d5" },
+};
+
+struct hash_kat {
+    const struct ssh_hash *hash;
+    const char *data;
+    const char *result;		       /* in hex */
+};
+
+/* FIPS 180-2, appendices A and B */
+static const struct hash_kat hash_kats[] = {
+    { &ssh_sha1, "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { &ssh_sha256, "abc",
+      "ba7816bf8f01cfea414140de5dae2223" "b00361a396177a9cb410ff61f20015ad" },
+};
+
+static const struct ssh_kexes *const kex_lists[] = {
+    &ssh_ecdh_kex,
+    &ssh_diffiehellman_gex,
+    &ssh_diffiehellman_group14,
+    &ssh_diffiehellman_group1,
+};
+
+/*
+ * With group exchange the server picks the group. For AES-256 we ask for
+ * 4096 bits, so the benchmark uses the 4096 bit group of RFC 3526.
+ */
+#define GEX_PRIME \
+    "ffffffffffffffffc90fdaa22168c234" "c4c6628b80dc1cd129024e088a67cc74" \
+    "020bbea63b139b22514a08798e3404dd" "ef9519b3cd3a431b302b0a6df25f1437" \
+    "4fe1356d6d51c245e485b576625e7ec6" "f44c42e9a637ed6b0bff5cb6f406b7ed" \
+    "ee386bfb5a899fa5ae9f24117c4b1fe6" "49286651ece45b3dc2007cb8a163bf05" \
+    "98da48361c55d39a69163fa8fd24cf5f" "83655d23dca3ad961c62f356208552bb" \
+    "9ed529077096966d670c354e4abc9804" "f1746c08ca18217c32905e462e36ce3b" \
+    "e39e772c180e86039b2783a2ec07a28f" "b5c55df06f4c52c9de2bcbf695581718" \
+    "3995497cea956ae515d2261898fa0510" "15728e5a8aaac42dad33170d04507a33" \
+    "a85521abdf1cba64ecfb850458dbef0a" "8aea71575d060c7db3970f85a6e1e4c7" \
+    "abf5ae8cdb0933d71e8c94e04a25619d" "cee3d2261ad2ee6bf12ffa06d98a0864" \
+    "d87602733ec86a64521f2b18177b200c" "bbe117577a615d6c770988c0bad946e2" \
+    "08e24fa074e5ab3143db5bfce0fd108e" "4b82d120a92108011a723c12a787e6d7" \
+    "88719a10bdba5b2699c327186af4e23c" "1a946834b6150bda2583e9ca2ad44ce8" \
+    "dbbbc2db04de8ef92e8efc141fbecaa6" "287c59474e6bc05d99b2964fa090c3a2" \
+    "233ba186515be7ed1f612970cee2d7af" "b81bdd762170481cd0069127d5b05aa9" \
+    "93b4ea988d8fddc186ffb7dc90a6c08f" "4df435c934063199ffffffffffffffff"
+
+static Bignum gex_p, gex_g;
+
+/* The key size of AES-256, see the choice of nbits in ssh.c */
+#define KEX_CIPHER_BITS 256
+
+struct sig_kat {
+    const struct ssh_signkey *alg;
+    const char *source;
+    const char *pub;		       /* in hex */
+    const char *data;		       /* in hex */
+    const char *sig;		       /* in hex */
+};
+
+/* RFC 8032, section 7.1 */
+static const struct sig_kat sig_kats[] = {
+    { &ssh_ecdsa_ed25519, "RFC 8032 1",
+      "d75a980182b10ab7d54bfed3c964073a" "0ee172f3daa62325af021a68f707511a",
+      "",
+      "e5564300c360ac729086e2cc806e828a" "84877f1eb8e5d974d873e06522490155"
+      "5fb8821590a33bacc61e39701cf9b46b" "d25bf5f0595bbe24655141438e7a100b" },
+    { &ssh_ecdsa_ed25519, "RFC 8032 2",
+      "3d4017c3e843895a92b70aa74d1b7ebc" "9c982ccf2ec4968cc0cd55f12af4660c",
+      "72",
+      "92a009a9f0d4cab8720e820b5f642540" "a2b27b5416503f8fb3762223ebdb69da"
+      "085ac1e43e15996e458f3613d0f11d8c" "387b2eaeb4302aeeb00d291612bb0c00" },
+};
+
+static const struct ssh2_cipher *find_cipher(const char *name)
+{
+    int i, j;
+
+    for (i = 0; i < lenof(cipher_lists); i++) {
+	for (j = 0; j < cipher_lists[i]->nciphers; j++) {
+	    if (!strcmp(cipher_lists[i]->list[j]->name, name))
+		return cipher_lists[i]->list[j];
+	}
+    }
+    return NULL;
+}
+
+/* Returns the number of bytes decoded from the hex string */
+static int unhex(const char *hex, unsigned char *out, int maxlen)
+{
+    int len = 0;
+
+    while (hex[0] && hex[1] && len < maxlen) {
+	unsigned int byte;
+	if (sscanf(hex, "%2x", &byte) != 1)
+	    break;
+	out[len++] = (unsigned char)byte;
+	hex += 2;
+    }
+    return len;
+}
+
+static int run_cipher_kat(const struct cipher_kat *kat)
+{
+    const struct ssh2_cipher *cipher = find_cipher(kat->name);
+    unsigned char key[64], iv[32], plaintext[256], ciphertext[256];
+    unsigned char buf[256];
+    int len, ok = 1;
+    void *ctx;
+
+    if (!cipher) {
+	printf("%-32s missing\n", kat->name);
+	return 0;
+    }
+
+    unhex(kat->key, key, sizeof(key));
+    unhex(kat->iv, iv, sizeof(iv));
+    len = unhex(kat->plaintext, plaintext, sizeof(plaintext));
+    unhex(kat->ciphertext, ciphertext, sizeof(ciphertext));
+
+    /*
+     * Encrypt in two steps, the second not starting at the beginning of
+     * the data, to catch chaining and counter state getting lost between
+     * calls.
+     */
+    ctx = cipher->make_context();
+    cipher->setkey(ctx, key);
+    cipher->setiv(ctx, iv);
+    memcpy(buf, plaintext, len);
+    cipher->encrypt(ctx, buf, cipher->blksize);
+    cipher->encrypt(ctx, buf + cipher->blksize, len - cipher->blksize);
+    if (memcmp(buf, ciphertext, len))
+	ok = 0;
+    cipher->free_context(ctx);
+
+    ctx = cipher->make_context();
+    cipher->setkey(ctx, key);
+    cipher->setiv(ctx, iv);
+    memcpy(buf, ciphertext, len);
+    cipher->decrypt(ctx, buf, cipher->blksize);
+    cipher->decrypt(ctx, buf + cipher->blksize, len - cipher->blksize);
+    if (memcmp(buf, plaintext, len))
+	ok = 0;
+    cipher->free_context(ctx);
+
+    printf("%-32s %s\n", kat->name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static int run_packet_kat(const struct packet_kat *kat, const char *variant)
+{
+    const struct ssh2_cipher *cipher = find_cipher(kat->name);
+    const struct ssh_mac *mac;
+    unsigned char key[64], expected[16], len[4];
+    unsigned char *packet, *buf;
+    int i, plen, half, ok = 1;
+    void *ctx, *mac_ctx;
+
+    if (!cipher) {
+	printf("%-32s missing\n", kat->name);
+	return 0;
+    }
+    mac = cipher->required_mac;
+
+    unhex(kat->key, key, sizeof(key));
+    unhex(kat->mac, expected, sizeof(expected));
+
+    plen = 4 + kat->len;
+    packet = snewn(plen, unsigned char);
+    buf = snewn(plen + mac->len, unsigned char);
+    PUT_32BIT(packet, kat->len);
+    for (i = 0; i < kat->len; i++)
+	packet[4 + i] = (unsigned char)(i * 7 + 3);
+
+    ctx = cipher->make_context();
+    mac_ctx = mac->make_context(ctx);
+    cipher->setkey(ctx, key);
+
+    /* Encrypt, the contents in two steps */
+    half = kat->len / 2;
+    memcpy(buf, packet, plen);
+    cipher->encrypt_length(ctx, buf, 4, kat->seq);
+    cipher->encrypt(ctx, buf + 4, half);
+    cipher->encrypt(ctx, buf + 4 + half, kat->len - half);
+    mac->generate(mac_ctx, buf, plen, kat->seq);
+    if (memcmp(buf + plen, expected, mac->len))
+	ok = 0;
+
+    /* Decrypt, leaving the length in place for the MAC */
+    memcpy(len, buf, 4);
+    cipher->decrypt_length(ctx, len, 4, kat->seq);
+    if (memcmp(len, packet, 4))
+	ok = 0;
+    if (!mac->verify(mac_ctx, buf, plen, kat->seq))
+	ok = 0;
+    /* A modified packet must not pass */
+    buf[plen - 1] ^= 1;
+    if (mac->verify(mac_ctx, buf, plen, kat->seq))
+	ok = 0;
+    buf[plen - 1] ^= 1;
+    cipher->decrypt(ctx, buf + 4, half);
+    cipher->decrypt(ctx, buf + 4 + half, kat->len - half);
+    if (memcmp(buf + 4, packet + 4, kat->len))
+	ok = 0;
+
+
+    mac->free_context(mac_ctx);
+    cipher->free_context(ctx);
+    sfree(packet);
+    sfree(buf);
+
+    printf("%-32s %s %s, %d bytes\n", kat->name, ok ? "ok" : "FAILED",
+	   variant, kat->len);
+    return ok;
+}
+
+static int run_mac_kat(const struct mac_kat *kat)
+{
+    const struct ssh_mac *mac = kat->mac;
+    unsigned char key[64], result[64], out[64];
+    const unsigned char *data = (const unsigned char *)kat->data;
+    int len = strlen(kat->data), ok = 1;
+    void *ctx;
+
+    memset(key, 0, sizeof(key));
+    unhex(kat->key, key, sizeof(key));
+    unhex(kat->result, result, sizeof(result));
+
+    /* In two steps, the first not a multiple of the block size */
+    ctx = mac->make_context(NULL);
+    mac->setkey(ctx, key);
+    mac->start(ctx);
+    mac->bytes(ctx, data, 3);
+    mac->bytes(ctx, data + 3, len - 3);
+    mac->genresult(ctx, out);
+    if (memcmp(out, result, mac->len))
+	ok = 0;
+
+    /* The key has to survive computing a MAC */
+    mac->start(ctx);
+    mac->bytes(ctx, data, len);
+    if (!mac->verresult(ctx, result))
+	ok = 0;
+    mac->free_context(ctx);
+
+    printf("%-32s %s %s\n", mac->name, ok ? "ok" : "FAILED", kat->source);
+    return ok;
+}
+
+static int run_hash_kat(const struct hash_kat *kat)
+{
+    unsigned char result[64], out[64];
+    void *ctx;
+    int ok;
+
+    unhex(kat->result, result, sizeof(result));
+    ctx = kat->hash->init();
+    kat->hash->bytes(ctx, kat->data, strlen(kat->data));
+    kat->hash->final(ctx, out);
+    ok = !memcmp(out, result, kat->hash->hlen);
+
+    printf("%-32s %s\n", kat->hash->text_name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/*
+ * Montgomery exponentiation against the plain one, with random bases and
+ * exponents. The moduli are the top bits of the group exchange prime.
+ */
+static int run_modpow_check(int bits)
+{
+    Bignum mod, base, exp, small, a, b;
+    int i, ok = 1;
+
+    mod = bignum_rshift(gex_p, 4096 - bits);
+    if (!bignum_bit(mod, 0)) {
+	Bignum odd = bignum_add_long(mod, 1);
+	freebn(mod);
+	mod = odd;
+    }
+    small = bignum_from_long(65537);
+
+    for (i = 0; i < 8 && ok; i++) {
+	/* A short public exponent, a full one and the DH generator */
+	base = i % 4 == 3 ? bignum_from_long(2) :
+	    bignum_random_in_range(One, mod);
+	exp = i % 4 == 0 ? copybn(small) : bignum_random_in_range(One, mod);
+	a = modpow(base, exp, mod);
+	b = modpow_simple(base, exp, mod);
+	if (bignum_cmp(a, b))
+	    ok = 0;
+	freebn(a);
+	freebn(b);
+	freebn(base);
+	freebn(exp);
+    }
+
+    freebn(small);
+    freebn(mod);
+
+    printf("%-32s %s %d bits\n", "modpow", ok ? "ok" : "FAILED", bits);
+    return ok;
+}
+
+/* One side of a key exchange */
+struct kex_side {
+    const struct ssh_kex *kex;
+    void *ctx;
+    Bignum e;			       /* DH, owned by ctx */
+    char *point;		       /* ECDH */
+    int pointlen;
+};
+
+static void kex_start(struct kex_side *side, const struct ssh_kex *kex)
+{
+    side->kex = kex;
+    side->e = NULL;
+    side->point = NULL;
+    if (kex->main_type == KEXTYPE_ECDH) {
+	side->ctx = ssh_ecdhkex_newkey(kex);
+	if (!side->ctx)
+	    modalfatalbox("%s: could not create key", kex->name);
+	side->point = ssh_ecdhkex_getpublic(side->ctx, &side->pointlen);
+    } else {
+	int nbits = kex->hash->hlen * 8;
+	if (nbits > KEX_CIPHER_BITS)
+	    nbits = KEX_CIPHER_BITS;
+	if (dh_is_gex(kex))
+	    side->ctx = dh_setup_gex(gex_p, gex_g);
+	else
+	    side->ctx = dh_setup_group(kex);
+	side->e = dh_create_e(side->ctx, nbits * 2);
+    }
+}
+
+/* Returns the shared secret, NULL if the peer's value is rejected */
+static Bignum kex_finish(struct kex_side *side, const struct kex_side *peer)
+{
+    if (side->kex->main_type == KEXTYPE_ECDH)
+	return ssh_ecdhkex_getkey(side->ctx, peer->point, peer->pointlen);
+    if (dh_validate_f(side->ctx, peer->e))
+	return NULL;
+    return dh_find_K(side->ctx, peer->e);
+}
+
+static void kex_free(struct kex_side *side)
+{
+    if (side->kex->main_type == KEXTYPE_ECDH) {
+	ssh_ecdhkex_freekey(side->ctx);
+	sfree(side->point);
+    } else
+	dh_cleanup(side->ctx);
+}
+
+/* Both sides have to arrive at the same secret */
+static int run_kex_check(const struct ssh_kex *kex)
+{
+    struct kex_side client, server;
+    Bignum k1, k2;
+    int ok;
+
+    kex_start(&client, kex);
+    kex_start(&server, kex);
+    k1 = kex_finish(&client, &server);
+    k2 = kex_finish(&server, &client);
+    ok = k1 && k2 && !bignum_cmp(k1, k2);
+    if (k1)
+	freebn(k1);
+    if (k2)
+	freebn(k2);
+    kex_free(&client);
+    kex_free(&server);
+
+    printf("%-32s %s\n", kex->name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static unsigned char *put_string(unsigned char *p, const void *data, int len)
+{
+    PUT_32BIT(p, len);
+    memcpy(p + 4, data, len);
+    return p + 4 + len;
+}
+
+/* Fills in the public key and signature blobs of a signature test */
+static void *make_sig_kat(const struct sig_kat *kat, unsigned char *sigblob,
+			  int *siglen, unsigned char *data, int *datalen)
+{
+    const struct ssh_signkey *alg = kat->alg;
+    unsigned char pub[64], sig[128], blob[256];
+    int publen, rawlen;
+
+    publen = unhex(kat->pub, pub, sizeof(pub));
+    rawlen = unhex(kat->sig, sig, sizeof(sig));
+    *datalen = unhex(kat->data, data, 64);
+
+    *siglen = put_string(put_string(sigblob, alg->name, strlen(alg->name)),
+			 sig, rawlen) - sigblob;
+    publen = put_string(put_string(blob, alg->name, strlen(alg->name)),
+			pub, publen) - blob;
+    return alg->newkey(alg, (const char *)blob, publen);
+}
+
+static int run_sig_kat(const struct sig_kat *kat)
+{
+    unsigned char sig[256], data[64];
+    int siglen, datalen, ok;
+    void *key = make_sig_kat(kat, sig, &siglen, data, &datalen);
+
+    if (!key) {
+	printf("%-32s FAILED %s\n", kat->alg->name, kat->source);
+	return 0;
+    }
+
+    ok = kat->alg->verifysig(key, (const char *)sig, siglen,
+			     (const char *)data, datalen);
+    /* A modified signature must not pass */
+    sig[siglen - 1] ^= 1;
+    if (kat->alg->verifysig(key, (const char *)sig, siglen,
+			    (const char *)data, datalen))
+	ok = 0;
+    kat->alg->freekey(key);
+
+    printf("%-32s %s %s\n", kat->alg->name, ok ? "ok" : "FAILED",
+	   kat->source);
+    return ok;
+}
+
+/*
+ * Returns MiB per second of CPU time. Ciphers with their own MAC decrypt
+ * as part of verifying it, only encryption is measured for them.
+ */
+static double bench_direction(const struct ssh2_cipher *cipher, int encrypt,
+			      double seconds)
+{
+    unsigned char key[64], iv[32];
+    /* Room for the MAC of ciphers that come with their own */
+    unsigned char *buf = snewn(PACKET_SIZE + 64, unsigned char);
+    double elapsed;
+    unsigned long packets = 0;
+    clock_t start, limit;
+    void *ctx;
+
+    memset(key, 0x5a, sizeof(key));
+    memset(iv, 0xa5, sizeof(iv));
+    memset(buf, 0, PACKET_SIZE);
+
+    ctx = cipher->make_context();
+    cipher->setkey(ctx, key);
+    cipher->setiv(ctx, iv);
+
+    start = clock();
+    limit = start + (clock_t)(seconds * CLOCKS_PER_SEC);
+    do {
+	if (!encrypt)
+	    cipher->decrypt(ctx, buf, PACKET_SIZE);
+	else {
+	    cipher->encrypt(ctx, buf, PACKET_SIZE);
+	    if (cipher->required_mac)
+		cipher->required_mac->generate(ctx, buf, PACKET_SIZE, packets);
+	}
+	packets++;
+    } while (clock() < limit);
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    cipher->free_context(ctx);
+    sfree(buf);
+
+    return (double)packets * PACKET_SIZE / (1024 * 1024) / elapsed;
+}
+
+static void bench_cipher(const struct ssh2_cipher *cipher,
+			 const char *variant, double seconds)
+{
+    char label[64];
+
+    if (variant)
+	sprintf(label, "%.50s %s", cipher->name, variant);
+    else
+	sprintf(label, "%.50s", cipher->name);
+    printf("%-36s %8.1f", label,
+	   bench_direction(cipher, 1, seconds));
+    if (cipher->required_mac)
+	printf("         -\n");
+    else
+	printf(" %9.1f\n", bench_direction(cipher, 0, seconds));
+}
+
+/* Returns MiB per second of CPU time */
+static double bench_mac(const struct ssh_mac *mac, double seconds)
+{
+    unsigned char key[64];
+    unsigned char *buf = snewn(PACKET_SIZE + 64, unsigned char);
+    double elapsed;
+    unsigned long packets = 0;
+    clock_t start, limit;
+    void *ctx;
+
+    memset(key, 0x5a, sizeof(key));
+    memset(buf, 0, PACKET_SIZE);
+
+    ctx = mac->make_context(NULL);
+    mac->setkey(ctx, key);
+
+    start = clock();
+    limit = start + (clock_t)(seconds * CLOCKS_PER_SEC);
+    do {
+	mac->generate(ctx, buf, PACKET_SIZE, packets);
+	packets++;
+    } while (clock() < limit);
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    mac->free_context(ctx);
+    sfree(buf);
+
+    return (double)packets * PACKET_SIZE / (1024 * 1024) / elapsed;
+}
+
+/*
+ * Returns milliseconds of CPU time per key exchange. Only the client's
+ * work is measured, the server's part is done once up front.
+ */
+static double bench_kex(const struct ssh_kex *kex, double seconds)
+{
+    struct kex_side client, server;
+    double elapsed;
+    unsigned long count = 0;
+    clock_t start, limit;
+    Bignum k;
+
+    kex_start(&server, kex);
+
+    start = clock();
+    limit = start + (clock_t)(seconds * CLOCKS_PER_SEC);
+    do {
+	kex_start(&client, kex);
+	k = kex_finish(&client, &server);
+	if (k)
+	    freebn(k);
+	kex_free(&client);
+	count++;
+    } while (clock() < limit);
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    kex_free(&server);
+
+    return elapsed * 1000 / count;
+}
+
+/* Returns milliseconds of CPU time per verified signature */
+static double bench_verify(const struct sig_kat *kat, double seconds)
+{
+    unsigned char sig[256], data[64];
+    int siglen, datalen;
+    double elapsed;
+    unsigned long count = 0;
+    clock_t start, limit;
+    void *key = make_sig_kat(kat, sig, &siglen, data, &datalen);
+
+    if (!key)
+	return 0;
+
+    start = clock();
+    limit = start + (clock_t)(seconds * CLOCKS_PER_SEC);
+    do {
+	kat->alg->verifysig(key, (const char *)sig, siglen,
+			    (const char *)data, datalen);
+	count++;
+    } while (clock() < limit);
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    kat->alg->freekey(key);
+
+    return elapsed * 1000 / count;
+}
+
+static const char *const simd_names[] = { "none", "sse2", "avx2" };
+
+int main(int argc, char **argv)
+{
+    double seconds = 1;
+    int i, j, bits, level, simd, failed = 0;
+
+    if (argc > 1)
+	seconds = atof(argv[1]);
+    if (seconds <= 0) {
+	fprintf(stderr, "Usage: %s [seconds per cipher]\n", argv[0]);
+	return 2;
+    }
+
+    random_ref();
+    {
+	unsigned char p[512];
+	int plen = unhex(GEX_PRIME, p, sizeof(p));
+	gex_p = bignum_from_bytes(p, plen);
+	gex_g = bignum_from_long(2);
+    }
+
+    printf("Known-answer tests:\n");
+    for (i = 0; i < lenof(cipher_kats); i++) {
+	if (!run_cipher_kat(&cipher_kats[i]))
+	    failed++;
+    }
+    for (i = 0; i < lenof(hash_kats); i++) {
+	if (!run_hash_kat(&hash_kats[i]))
+	    failed++;
+    }
+    for (i = 0; i < lenof(mac_kats); i++) {
+	if (!run_mac_kat(&mac_kats[i]))
+	    failed++;
+    }
+    /* ChaCha20 with each level of SIMD the CPU supports */
+    simd = ccp_limit_simd(CCP_SIMD_AVX2);
+    for (level = simd; level >= CCP_SIMD_NONE; level--) {
+	ccp_limit_simd(level);
+	for (i = 0; i < lenof(packet_kats); i++) {
+	    if (!run_packet_kat(&packet_kats[i], simd_names[level]))
+		failed++;
+	}
+    }
+    ccp_limit_simd(simd);
+    for (bits = 64; bits <= 4096; bits *= 4) {
+	if (!run_modpow_check(bits))
+	    failed++;
+    }
+    for (i = 0; i < lenof(kex_lists); i++) {
+	for (j = 0; j < kex_lists[i]->nkexes; j++) {
+	    if (!run_kex_check(kex_lists[i]->list[j]))
+		failed++;
+	}
+    }
+    for (i = 0; i < lenof(sig_kats); i++) {
+	if (!run_sig_kat(&sig_kats[i]))
+	    failed++;
+    }
+
+    printf("\nThroughput in MiB/s, %d byte packets:\n", PACKET_SIZE);
+    printf("%-36s %8s %9s\n", "", "encrypt", "decrypt");
+    for (i = 0; i < lenof(cipher_lists); i++) {
+	for (j = 0; j < cipher_lists[i]->nciphers; j++)
+	    bench_cipher(cipher_lists[i]->list[j], NULL, seconds);
+    }
+    for (level = simd - 1; level >= CCP_SIMD_NONE; level--) {
+	ccp_limit_simd(level);
+	for (j = 0; j < ssh2_ccp.nciphers; j++)
+	    bench_cipher(ssh2_ccp.list[j], simd_names[level], seconds);
+    }
+    ccp_limit_simd(simd);
+
+    printf("\nMAC throughput in MiB/s, %d byte packets:\n", PACKET_SIZE);
+    printf("%-36s %8s\n", "", "generate");
+    for (i = 0; i < lenof(macs); i++)
+	printf("%-36s %8.1f\n", macs[i]->name, bench_mac(macs[i], seconds));
+
+    printf("\nKey exchange, ms of CPU time on the client:\n");
+    for (i = 0; i < lenof(kex_lists); i++) {
+	for (j = 0; j < kex_lists[i]->nkexes; j++) {
+	    const struct ssh_kex *kex = kex_lists[i]->list[j];
+	    printf("%-36s %8.3f\n", kex->name, bench_kex(kex, seconds));
+	}
+    }
+
+    printf("\nHost key verification, ms of CPU time:\n");
+    printf("%-36s %8.3f\n", sig_kats[0].alg->name,
+	   bench_verify(&sig_kats[0], seconds));
+
+    freebn(gex_p);
+    freebn(gex_g);
+    random_unref();
+
+    return failed ? 1 : 0;
+}
@@ -1,10 +1,146 @@
 #include "putty.h"
 #include "misc.h"
+#include "sftp.h"
+
+#ifdef _WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static int fz_framed = 0;
+static int fz_batch = 0;
+
+static void fz_flush(void)
+{
+    if (!fz_batch)
+	fflush(stdout);
+}
+
+void fzbatch_begin(void)
+{
+    fz_batch = 1;
+}
+
+void fzbatch_end(void)
+{
+    fz_batch = 0;
+    fflush(stdout);
+}
+
+void fz_enable_framing(void)
+{
+#ifdef _WINDOWS
+    /* Frames must not be subjected to linebreak conversion */
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    fz_framed = 1;
+}
+
+struct fzframe {
+    unsigned char *data;
+    size_t len, size;
+};
+
+static void frame_put(struct fzframe *f, const void *data, size_t len)
+{
+    if (f->len + len > f->size) {
+	f->size = f->len + len + 256;
+	f->data = sresize(f->data, f->size, unsigned char);
+    }
+    memcpy(f->data + f->len, data, len);
+    f->len += len;
+}
+
+static void frame_put_uint32(struct fzframe *f, unsigned long v)
+{
+    unsigned char buf[4];
+    buf[0] = (unsigned char)(v & 0xff);
+    buf[1] = (unsigned char)((v >> 8) & 0xff);
+    buf[2] = (unsigned char)((v >> 16) & 0xff);
+    buf[3] = (unsigned char)((v >> 24) & 0xff);
+    frame_put(f, buf, 4);
+}
+
+static void frame_init(struct fzframe *f, sftpEventTypes type)
+{
+    unsigned char header[2];
+
+    f->data = NULL;
+    f->len = f->size = 0;
+
+    header[0] = FZ_FRAME_MARKER;
+    header[1] = (unsigned char)type;
+    frame_put(f, header, 2);
+    frame_put_uint32(f, 0);	       /* length, filled in when sent */
+}
+
+static void frame_add_text(struct fzframe *f, const char *text, size_t len)
+{
+    frame_put_uint32(f, (unsigned long)len);
+    frame_put(f, text, len);
+}
+
+static void frame_add_uint(struct fzframe *f, unsigned long v)
+{
+    frame_put_uint32(f, v);
+    /* Shifting in two steps as long may only have 32 bits */
+    frame_put_uint32(f, (v >> 16) >> 16);
+}
+
+static void frame_add_uint64(struct fzframe *f, uint64 v)
+{
+    frame_put_uint32(f, v.lo);
+    frame_put_uint32(f, v.hi);
+}
+
+static void frame_send(struct fzframe *f)
+{
+    unsigned long payload = (unsigned long)(f->len - 6);
+
+    f->data[2] = (unsigned char)(payload & 0xff);
+    f->data[3] = (unsigned char)((payload >> 8) & 0xff);
+    f->data[4] = (unsigned char)((payload >> 16) & 0xff);
+    f->data[5] = (unsigned char)((payload >> 24) & 0xff);
+
+    fwrite(f->data, 1, f->len, stdout);
+    fz_flush();
+
+    sfree(f->data);
+}
+
+/*
+ * Sends a frame with one text field per line of str. A trailing
+ * linebreak does not start another line.
+ */
+static void frame_send_lines(sftpEventTypes type, const char *str)
+{
+    struct fzframe f;
+    const char *s = str, *p;
+
+    frame_init(&f, type);
+    while (*s) {
+	p = strchr(s, '\n');
+	if (!p) {
+	    frame_add_text(&f, s, strlen(s));
+	    break;
+	}
+	frame_add_text(&f, s, p - s);
+	s = p + 1;
+    }
+    frame_send(&f);
+}
 
 int fznotify(sftpEventTypes type)
 {
+    if (fz_framed) {
+	struct fzframe f;
+	frame_init(&f, type);
+	frame_send(&f);
+	return 0;
+    }
+
     fprintf(stdout, "%c", (int)type + '0');
-    fflush(stdout);
+    fz_flush();
     return 0;
 }
 
@@ -18,8 +154,16 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
 	sfree(str);
 	va_end(ap);
 
+	if (fz_framed) {
+	    struct fzframe f;
+	    frame_init(&f, type);
+	    frame_add_text(&f, "", 0);
+	    frame_send(&f);
+	    return 0;
+	}
+
 	fprintf(stdout, "%c\n", (int)type + '0');
-	fflush(stdout);
+	fz_flush();
 
 	return 0;
     }
@@ -29,7 +173,10 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
 	if (*p == '\r' || *p == '\n') {
 	    if (p != s) {
 		*p = 0;
-		fprintf(stdout, "%c%s\n", (int)type + '0', s);
+		if (fz_framed)
+		    frame_send_lines(type, s);
+		else
+		    fprintf(stdout, "%c%s\n", (int)type + '0', s);
 		s = p + 1;
 	    }
 	    else {
@@ -39,14 +186,17 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
 	else if (!*p) {
 	    if (p != s) {
 		*p = 0;
-		fprintf(stdout, "%c%s\n", (int)type + '0', s);
+		if (fz_framed)
+		    frame_send_lines(type, s);
+		else
+		    fprintf(stdout, "%c%s\n", (int)type + '0', s);
 		s = p + 1;
 	    }
 	    break;
 	}
 	p++;
     }
-    fflush(stdout);
+    fz_flush();
 
     sfree(str);
 
@@ -79,12 +229,23 @@ int fzprintf_raw_untrusted(sftpEventTypes type, const char* fmt, ...)
     }
     *s = 0;
 
+    if (fz_framed) {
+	struct fzframe f;
+	frame_init(&f, type);
+	frame_add_text(&f, str, strlen(str));
+	frame_send(&f);
+
+	sfree(str);
+	va_end(ap);
+	return 0;
+    }
+
     if (type != sftpUnknown) {
 	fputc((int)type + '0', stdout);
     }
     fputs(str, stdout);
     fputc('\n', stdout);
-    fflush(stdout);
+    fz_flush();
 
     sfree(str);
 
@@ -100,9 +261,17 @@ int fzprintf_raw(sftpEventTypes type, const char* fmt, ...)
     va_start(ap, fmt);
     str = dupvprintf(fmt, ap);
 
+    if (fz_framed) {
+	frame_send_lines(type, str);
+
+	sfree(str);
+	va_end(ap);
+	return 0;
+    }
+
     fputc((char)type + '0', stdout);
     fputs(str, stdout);
-    fflush(stdout);
+    fz_flush();
 
     sfree(str);
 
@@ -113,8 +282,70 @@ int fzprintf_raw(sftpEventTypes type, const char* fmt, ...)
 
 int fznotify1(sftpEventTypes type, int data)
 {
+    if (fz_framed) {
+	struct fzframe f;
+	char buf[20];
+	sprintf(buf, "%d", data);
+	frame_init(&f, type);
+	frame_add_text(&f, buf, strlen(buf));
+	frame_send(&f);
+	return 0;
+    }
+
     fprintf(stdout, "%c%d\n", (int)type + '0', data);
-    fflush(stdout);
+    fz_flush();
+    return 0;
+}
+
+int fztransfer(int bytes)
+{
+    if (fz_framed) {
+	struct fzframe f;
+	frame_init(&f, sftpTransfer);
+	frame_add_uint(&f, (unsigned long)bytes);
+	frame_send(&f);
+	return 0;
+    }
+
+    fprintf(stdout, "%c%d\n", (int)sftpTransfer + '0', bytes);
+    fz_flush();
+    return 0;
+}
+
+int fzlistentry(const char* longname, const char* name, const struct fxp_attrs* attrs)
+{
+    unsigned long mtime = 0;
+    char size[40];
+
+    if (attrs->flags & SSH_FILEXFER_ATTR_ACMODTIME) {
+	mtime = attrs->mtime;
+    }
+
+    if (fz_framed) {
+	struct fzframe f;
+	frame_init(&f, sftpListentry);
+	frame_add_text(&f, longname, strlen(longname));
+	frame_add_uint(&f, mtime);
+	frame_add_text(&f, name, strlen(name));
+	frame_add_uint(&f, attrs->flags);
+	frame_add_uint64(&f, attrs->size);
+	frame_add_uint(&f, attrs->permissions);
+	frame_add_uint(&f, attrs->uid);
+	frame_add_uint(&f, attrs->gid);
+	frame_send(&f);
+	return 0;
+    }
+
+    uint64_decimal(attrs->size, size);
+
+    fzprintf_raw_untrusted(sftpListentry, "%s", longname);
+    fzprintf_raw_untrusted(sftpUnknown, "%lu", mtime);
+    fzprintf_raw_untrusted(sftpUnknown, "%s", name);
+    fzprintf_raw_untrusted(sftpUnknown, "%lu", attrs->flags);
+    fzprintf_raw_untrusted(sftpUnknown, "%s", size);
+    fzprintf_raw_untrusted(sftpUnknown, "%lu", attrs->permissions);
+    fzprintf_raw_untrusted(sftpUnknown, "%lu", attrs->uid);
+    fzprintf_raw_untrusted(sftpUnknown, "%lu", attrs->gid);
     return 0;
 }
 
@@ -1,4 +1,4 @@
-#define FZSFTP_PROTOCOL_VERSION 8
+#define FZSFTP_PROTOCOL_VERSION 12
 
 typedef enum
 {
@@ -28,7 +28,9 @@ typedef enum
     sftpCipherServerToClient,
     sftpMacClientToServer,
     sftpMacServerToClient,
-    sftpHostkey
+    sftpHostkey,
+    sftpFileDone, /* payload: index of the file within a transfers command and its result */
+    sftpListdir /* payload: path of the directory the listing entries following it belong to */
 } sftpEventTypes;
 
 int fznotify(sftpEventTypes type);
@@ -42,3 +44,36 @@ int fzprintf_raw(sftpEventTypes type, const char* p, ...);
 // Format the string, then print the type (if not sftpUnknown) and the string with linebreaks replaced by spaces.
 int fzprintf_raw_untrusted(sftpEventTypes type, const char* p, ...);
 int fznotify1(sftpEventTypes type, int data);
+
+// Progress of a transfer, in bytes since the last report
+int fztransfer(int bytes);
+
+// A single directory listing entry. Next to the long name, passes on the
+// attributes sent by the server so that they need not be parsed from it.
+struct fxp_attrs;
+int fzlistentry(const char* longname, const char* name, const struct fxp_attrs* attrs);
+
+// Output in between is not flushed until the end of the batch, e.g. for
+// all entries of one directory listing reply
+void fzbatch_begin(void);
+void fzbatch_end(void);
+
+/*
+ * Framed output, enabled by -framed.
+ *
+ * Instead of a type character followed by text lines, each event is
+ * sent as a frame:
+ *   FZ_FRAME_MARKER, the event type as a byte, the payload length as
+ *   32-bit little-endian integer, the payload.
+ * The payload is a sequence of fields. A text field is its length as
+ * 32-bit little-endian integer followed by its bytes, an integer field
+ * is a 64-bit little-endian integer. Listing entries carry the long
+ * name, the modification time as integer, the filename and the
+ * attribute flags, size, permissions, uid and gid as integers, transfer
+ * progress carries a single integer, events without data an empty
+ * payload. All other events carry one text field per line of the text
+ * protocol.
+ */
+#define FZ_FRAME_MARKER 0x01
+
+void fz_enable_framing(void);
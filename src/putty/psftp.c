@@ -43,6 +43,21 @@ static void *backhandle;
 static Conf *conf;
 int sent_eof = FALSE;
 
+/* Number of offset windows kept in flight by downloads, see -streams */
+static int download_streams = 1;
+
+/* Number of files the transfers command works on at once, see -transfers */
+#define TRANSFER_MAX_FILES 16
+static int transfer_files = 1;
+
+/* Bounds of the number of READDIR requests outstanding during a listing */
+#define READDIR_START_DEPTH 4
+#define READDIR_MAX_DEPTH 256
+static int readdir_depth = 64;
+
+/* Set while a downstream of a shared connection waits for its channel */
+static int connecting_downstream = FALSE;
+
 /* ----------------------------------------------------------------------
  * Manage sending requests and waiting for replies.
  */
@@ -259,12 +274,13 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
     struct sftp_packet *pktin;
     struct sftp_request *req;
     struct fxp_xfer *xfer;
-    uint64 offset;
+    uint64 offset, resumed;
     WFile *file;
     int ret, shown_err = FALSE;
     struct fxp_attrs attrs;
     _fztimer timer;
     int winterval;
+    int streams = download_streams;
 
     /*
      * In recursive mode, see if we're dealing with a directory.
@@ -435,6 +451,15 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
     if (!fxp_stat_recv(pktin, req, &attrs))
         attrs.flags = 0;
 
+    /*
+     * Several streams only pay off for files which take more than a
+     * few round trips, and need to know the size is worth it.
+     */
+    if (!(attrs.flags & SSH_FILEXFER_ATTR_SIZE) ||
+	uint64_compare(attrs.size, uint64_make(0, XFER_RESUME_MARGIN)) < 0) {
+	streams = 1;
+    }
+
     req = fxp_open_send(fname, SSH_FXF_READ, NULL);
     pktin = sftp_wait_for_reply(req);
     fh = fxp_open_recv(pktin, req);
@@ -480,6 +505,19 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
 	offset = uint64_make(0, 0);
     }
 
+    /*
+     * A file partially downloaded by several streams may have holes
+     * towards its end. Fetch that part again, but only report
+     * progress for data past the point the engine resumes from.
+     */
+    resumed = offset;
+    if (restart && streams > 1) {
+	if (uint64_compare(offset, uint64_make(0, XFER_RESUME_MARGIN)) > 0)
+	    offset = uint64_subtract(offset, uint64_make(0, XFER_RESUME_MARGIN));
+	else
+	    offset = uint64_make(0, 0);
+    }
+
     fzprintf(sftpInfo, "remote:%s => local:%s", fname, outfname);
 
     fz_timer_init(&timer);
@@ -490,11 +528,12 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
      * thus put up a progress bar.
      */
     ret = 1;
-    xfer = xfer_download_init(fh, offset);
+    xfer = xfer_download_init(fh, offset, streams);
     while (!xfer_done(xfer)) {
 	void *vbuf;
 	int len;
 	int wpos, wlen;
+	uint64 pos;
 
 	xfer_download_queue(xfer);
 	pktin = sftp_recv();
@@ -509,12 +548,16 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
 	    ret = 0;
 	}
 
-	while (xfer_download_data(xfer, &vbuf, &len)) {
+	while (xfer_download_data(xfer, &vbuf, &len, &pos)) {
 	    unsigned char *buf = (unsigned char *)vbuf;
 
 	    wpos = 0;
 	    while (file && wpos < len) {
-		wlen = write_to_file(file, buf + wpos, len - wpos);
+		if (streams > 1)
+		    wlen = write_to_file_at(file, uint64_add32(pos, wpos),
+					    buf + wpos, len - wpos);
+		else
+		    wlen = write_to_file(file, buf + wpos, len - wpos);
 		if (wlen <= 0) {
 		    if (!shown_err) {
 			fzprintf(sftpError, "error while writing local file");
@@ -529,12 +572,17 @@ int sftp_get_file(char *fname, char *outfname, int recurse, int restart)
 	    if (wpos < len) {	       /* we had an error */
 		xfer_set_error(xfer);
 	    }
-	    winterval += wpos;
+	    if (uint64_compare(uint64_add32(pos, wpos), resumed) > 0) {
+		if (uint64_compare(pos, resumed) >= 0)
+		    winterval += wpos;
+		else
+		    winterval += uint64_subtract(uint64_add32(pos, wpos), resumed).lo;
+	    }
 	    sfree(vbuf);
 	}
 
 	if (fz_timer_check(&timer)) {
-	    fzprintf(sftpTransfer, "%d", winterval);
+	    fztransfer(winterval);
 	    winterval = 0;
 	}
 
@@ -796,6 +844,422 @@ int sftp_put_file(char *fname, char *outfname, int recurse, int restart)
     return (err == 0) ? 1 : 0;
 }
 
+/* ----------------------------------------------------------------------
+ * The `transfers' command: several files in one go.
+ *
+ * Up to transfer_files files are in progress at the same time. Their
+ * requests are interleaved on the one SFTP channel, so small files no
+ * longer pay for the round trips of opening and closing them one
+ * after the other. The outcome of each file is reported as soon as it
+ * is known, the order files complete in is unspecified.
+ */
+enum {
+    TRANSFER_QUEUED, TRANSFER_OPEN, TRANSFER_FSTAT, TRANSFER_DATA,
+    TRANSFER_CLOSE, TRANSFER_DONE
+};
+
+struct transfer_file {
+    int index;
+    int download, restart;
+    char *remote, *local;
+    int state;
+
+    /* Outstanding request other than those of the xfer */
+    struct sftp_request *req, *statreq;
+
+    struct fxp_attrs attrs;
+    struct fxp_handle *fh;
+    struct fxp_xfer *xfer;
+    WFile *wfile;
+    RFile *rfile;
+
+    /* critical is set if there is no point in retrying */
+    int err, critical, eof;
+};
+
+struct transfer_batch {
+    struct transfer_file *files;
+    int nfiles, next, active;
+
+    /* Downloaded data not yet reported */
+    int winterval;
+    _fztimer timer;
+};
+
+static void transfer_finish(struct transfer_batch *tb, struct transfer_file *tf)
+{
+    if (tf->wfile) {
+	close_wfile(tf->wfile);
+	tf->wfile = NULL;
+    }
+    if (tf->rfile) {
+	close_rfile(tf->rfile);
+	tf->rfile = NULL;
+    }
+
+    tf->state = TRANSFER_DONE;
+    tb->active--;
+
+    fzprintf(sftpFileDone, "%d %d", tf->index,
+	     tf->err ? (tf->critical ? 2 : 0) : 1);
+}
+
+static void transfer_close(struct transfer_batch *tb, struct transfer_file *tf)
+{
+    if (tf->xfer) {
+	xfer_cleanup(tf->xfer);
+	tf->xfer = NULL;
+    }
+    if (tf->wfile) {
+	close_wfile(tf->wfile);
+	tf->wfile = NULL;
+    }
+
+    if (!tf->fh) {
+	transfer_finish(tb, tf);
+	return;
+    }
+
+    sftp_register(tf->req = fxp_close_send(tf->fh));
+    tf->fh = NULL;
+    tf->state = TRANSFER_CLOSE;
+}
+
+static void transfer_start(struct transfer_batch *tb, struct transfer_file *tf)
+{
+    tb->active++;
+
+    if (tf->download) {
+	/*
+	 * The attributes are only needed once the file has been
+	 * opened, ask for both at once.
+	 */
+	sftp_register(tf->statreq = fxp_stat_send(tf->remote));
+	sftp_register(tf->req = fxp_open_send(tf->remote, SSH_FXF_READ, NULL));
+    } else {
+	long permissions;
+
+	tf->rfile = open_existing_file(tf->local, NULL, NULL, NULL, &permissions);
+	if (!tf->rfile) {
+	    fzprintf(sftpError, "local: unable to open %s", tf->local);
+	    tf->err = tf->critical = 1;
+	    transfer_finish(tb, tf);
+	    return;
+	}
+
+	tf->attrs.flags = 0;
+	PUT_PERMISSIONS(tf->attrs, permissions);
+	if (tf->restart) {
+	    tf->req = fxp_open_send(tf->remote, SSH_FXF_WRITE, &tf->attrs);
+	} else {
+	    tf->req = fxp_open_send(tf->remote,
+				    SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC,
+				    &tf->attrs);
+	}
+	sftp_register(tf->req);
+    }
+    tf->state = TRANSFER_OPEN;
+}
+
+static void transfer_start_data(struct transfer_batch *tb, struct transfer_file *tf,
+				uint64 offset)
+{
+    if (tf->download) {
+	fzprintf(sftpInfo, "remote:%s => local:%s", tf->remote, tf->local);
+	tf->xfer = xfer_download_init(tf->fh, offset, 1);
+    } else {
+	fzprintf(sftpInfo, "local:%s => remote:%s", tf->local, tf->remote);
+	tf->xfer = xfer_upload_init(tf->fh, offset);
+    }
+    tf->state = TRANSFER_DATA;
+}
+
+/*
+ * Handles the reply to a request other than those of the xfer.
+ */
+static void transfer_gotreply(struct transfer_batch *tb, struct transfer_file *tf,
+			      struct sftp_packet *pktin, struct sftp_request *rreq)
+{
+    char decbuf[30];
+    uint64 offset = uint64_make(0, 0);
+
+    switch (tf->state) {
+    case TRANSFER_OPEN:
+	if (rreq == tf->statreq) {
+	    tf->statreq = NULL;
+	    if (!fxp_stat_recv(pktin, rreq, &tf->attrs))
+		tf->attrs.flags = 0;
+	} else {
+	    tf->req = NULL;
+	    tf->fh = fxp_open_recv(pktin, rreq);
+	    if (!tf->fh) {
+		fzprintf(sftpError, "%s: open for %s: %s", tf->remote,
+			 tf->download ? "read" : "write", fxp_error());
+		tf->err = 1;
+	    }
+	}
+	if (tf->req || tf->statreq)
+	    return;
+	if (tf->err) {
+	    transfer_finish(tb, tf);
+	    return;
+	}
+
+	if (!tf->download) {
+	    if (tf->restart) {
+		sftp_register(tf->req = fxp_fstat_send(tf->fh));
+		tf->state = TRANSFER_FSTAT;
+		return;
+	    }
+	    transfer_start_data(tb, tf, offset);
+	    return;
+	}
+
+	if (tf->restart) {
+	    tf->wfile = open_existing_wfile(tf->local, NULL);
+	} else {
+	    tf->wfile = open_new_file(tf->local, GET_PERMISSIONS(tf->attrs));
+	}
+	if (!tf->wfile) {
+	    fzprintf(sftpError, "local: unable to open %s", tf->local);
+	    tf->err = tf->critical = 1;
+	    transfer_close(tb, tf);
+	    return;
+	}
+	if (tf->restart) {
+	    if (seek_file(tf->wfile, uint64_make(0, 0), FROM_END) == -1) {
+		fzprintf(sftpError, "reget: cannot restart %s - file too large",
+			 tf->local);
+		tf->err = 1;
+		transfer_close(tb, tf);
+		return;
+	    }
+	    offset = get_file_posn(tf->wfile);
+	    uint64_decimal(offset, decbuf);
+	    fzprintf(sftpInfo, "reget: restarting at file position %s", decbuf);
+	}
+	transfer_start_data(tb, tf, offset);
+	break;
+    case TRANSFER_FSTAT:
+	{
+	    struct fxp_attrs attrs;
+
+	    tf->req = NULL;
+	    if (!fxp_fstat_recv(pktin, rreq, &attrs)) {
+		fzprintf(sftpError, "read size of %s: %s", tf->remote, fxp_error());
+		tf->err = 1;
+		transfer_close(tb, tf);
+		return;
+	    }
+	    if (!(attrs.flags & SSH_FILEXFER_ATTR_SIZE)) {
+		fzprintf(sftpError, "read size of %s: size was not given", tf->remote);
+		tf->err = 1;
+		transfer_close(tb, tf);
+		return;
+	    }
+	    offset = attrs.size;
+	    uint64_decimal(offset, decbuf);
+	    fzprintf(sftpInfo, "reput: restarting at file position %s", decbuf);
+	    if (seek_file((WFile *)tf->rfile, offset, FROM_START) != 0)
+		seek_file((WFile *)tf->rfile, uint64_make(0,0), FROM_END);    /* *shrug* */
+	    transfer_start_data(tb, tf, offset);
+	}
+	break;
+    case TRANSFER_CLOSE:
+	tf->req = NULL;
+	if (!fxp_close_recv(pktin, rreq) && !tf->download && !tf->err) {
+	    fzprintf(sftpError, "error while writing: %s", fxp_error());
+	    tf->err = 1;
+	}
+	transfer_finish(tb, tf);
+	break;
+    default:
+	connection_fatal(NULL, "unexpected SFTP response packet for %s",
+			 tf->remote);
+	break;
+    }
+}
+
+static void transfer_gotdata(struct transfer_batch *tb, struct transfer_file *tf,
+			     struct sftp_packet *pktin, struct sftp_request *rreq)
+{
+    int ret;
+
+    if (!tf->download) {
+	ret = xfer_upload_gotreq(tf->xfer, pktin, rreq);
+	if (ret <= 0) {
+	    if (ret == INT_MIN)        /* pktin not even freed */
+		sfree(pktin);
+	    if (!tf->err) {
+		fzprintf(sftpError, "error while writing: %s", fxp_error());
+		tf->err = 1;
+	    }
+	}
+	if ((tf->err || tf->eof) && xfer_done(tf->xfer))
+	    transfer_close(tb, tf);
+	return;
+    }
+
+    ret = xfer_download_gotreq(tf->xfer, pktin, rreq);
+    if (ret <= 0) {
+	if (!tf->err) {
+	    fzprintf(sftpError, "error while reading: %s", fxp_error());
+	    tf->err = 1;
+	}
+	if (ret == INT_MIN)            /* pktin not even freed */
+	    sfree(pktin);
+    }
+
+    {
+	void *vbuf;
+	int len, wpos, wlen;
+	uint64 pos;
+
+	while (xfer_download_data(tf->xfer, &vbuf, &len, &pos)) {
+	    unsigned char *buf = (unsigned char *)vbuf;
+
+	    wpos = 0;
+	    while (wpos < len) {
+		wlen = write_to_file(tf->wfile, buf + wpos, len - wpos);
+		if (wlen <= 0) {
+		    if (!tf->err)
+			fzprintf(sftpError, "error while writing local file");
+		    tf->err = tf->critical = 1;
+		    break;
+		}
+		wpos += wlen;
+	    }
+	    if (wpos < len)	       /* we had an error */
+		xfer_set_error(tf->xfer);
+	    tb->winterval += wpos;
+	    sfree(vbuf);
+	}
+    }
+
+    if (xfer_done(tf->xfer))
+	transfer_close(tb, tf);
+}
+
+/*
+ * Passes some more data of each upload to the server. Returns true if
+ * any was sent.
+ */
+static int transfer_send_uploads(struct transfer_batch *tb)
+{
+    char buffer[4096*4];
+    int i, len, sent = 0;
+
+    for (i = 0; i < tb->nfiles; i++) {
+	struct transfer_file *tf = &tb->files[i];
+	if (tf->state != TRANSFER_DATA || tf->download || tf->err || tf->eof)
+	    continue;
+	if (!xfer_upload_ready(tf->xfer))
+	    continue;
+
+	len = read_from_file(tf->rfile, buffer, sizeof(buffer));
+	if (len == -1) {
+	    fzprintf(sftpError, "error while reading local file");
+	    tf->err = tf->critical = 1;
+	} else if (len == 0) {
+	    tf->eof = 1;
+	} else {
+	    xfer_upload_data(tf->xfer, buffer, len);
+	    sent = 1;
+	}
+    }
+
+    return sent;
+}
+
+static int sftp_transfer_files(struct transfer_batch *tb)
+{
+    struct sftp_packet *pktin;
+    struct sftp_request *rreq;
+    struct fxp_xfer *xfer;
+    struct transfer_file *tf;
+    int i, ret;
+
+    fz_timer_init(&tb->timer);
+
+    while (1) {
+	while (tb->active < transfer_files && tb->next < tb->nfiles)
+	    transfer_start(tb, &tb->files[tb->next++]);
+
+	for (i = 0; i < tb->nfiles; i++) {
+	    tf = &tb->files[i];
+	    if (tf->state == TRANSFER_DATA && tf->download)
+		xfer_download_queue(tf->xfer);
+	}
+
+	while (transfer_send_uploads(tb) && pending_receive() < 5)
+	    ;
+
+	/* Uploads which have handed over all of their data */
+	for (i = 0; i < tb->nfiles; i++) {
+	    tf = &tb->files[i];
+	    if (tf->state == TRANSFER_DATA && !tf->download &&
+		(tf->err || tf->eof) && xfer_done(tf->xfer)) {
+		transfer_close(tb, tf);
+	    }
+	}
+
+	if (!tb->active) {
+	    if (tb->next >= tb->nfiles)
+		break;
+	    continue;
+	}
+
+	pktin = sftp_recv();
+	if (pktin == NULL)
+	    connection_fatal(NULL, "did not receive SFTP response packet "
+			     "from server");
+	rreq = sftp_find_request(pktin);
+	if (!rreq)
+	    connection_fatal(NULL, "unable to understand SFTP response packet "
+			     "from server: %s", fxp_error());
+
+	xfer = xfer_from_request(rreq);
+	tf = NULL;
+	for (i = 0; i < tb->nfiles; i++) {
+	    struct transfer_file *candidate = &tb->files[i];
+	    if (candidate->state == TRANSFER_QUEUED ||
+		candidate->state == TRANSFER_DONE)
+		continue;
+	    if (xfer ? xfer == candidate->xfer :
+		(rreq == candidate->req || rreq == candidate->statreq)) {
+		tf = candidate;
+		break;
+	    }
+	}
+	if (!tf)
+	    connection_fatal(NULL, "SFTP response packet from server is not "
+			     "part of the current transfers");
+
+	if (xfer)
+	    transfer_gotdata(tb, tf, pktin, rreq);
+	else
+	    transfer_gotreply(tb, tf, pktin, rreq);
+
+	if (fz_timer_check(&tb->timer)) {
+	    fztransfer(tb->winterval);
+	    tb->winterval = 0;
+	}
+    }
+
+    if (tb->winterval > 0) {
+	fztransfer(tb->winterval);
+	tb->winterval = 0;
+    }
+
+    ret = 1;
+    for (i = 0; i < tb->nfiles; i++) {
+	if (tb->files[i].err)
+	    ret = 0;
+    }
+
+    return ret;
+}
+
 /* ----------------------------------------------------------------------
  * A remote wildcard matcher, providing a similar interface to the
  * local one in psftp.h.
@@ -1137,7 +1601,7 @@ int sftp_cmd_ls(struct sftp_command *cmd)
     char *cdir, *unwcdir, *wildcard;
     struct sftp_packet *pktin;
     struct sftp_request *req;
-    struct sftp_request *reqs[4];
+    struct sftp_request **reqs;
     int i;
     int ret;
 
@@ -1194,53 +1658,71 @@ int sftp_cmd_ls(struct sftp_command *cmd)
 	fzprintf(sftpError, "Unable to open %s: %s", dir, fxp_error());
 	ret = 1;
     } else {
-	reqs[0] = fxp_readdir_send(dirh);
-	reqs[1] = fxp_readdir_send(dirh);
-	reqs[2] = fxp_readdir_send(dirh);
-	reqs[3] = fxp_readdir_send(dirh);
-	int ri = 0;
-	while (1) {
+	/*
+	 * Keep several READDIR requests outstanding. Starting out with a
+	 * few, each reply which carries entries adds another request
+	 * until readdir_depth is reached, doubling the depth with each
+	 * round trip. Small directories thus need no more requests than
+	 * before, large ones are no longer bound by the round trip time.
+	 *
+	 * The requests are kept in a ring in the order they were sent,
+	 * which is the order their replies need to be processed in.
+	 */
+	int depth = READDIR_START_DEPTH < readdir_depth ? READDIR_START_DEPTH : readdir_depth;
+	int head = 0, count = 0, done = 0;
 
-            pktin = sftp_wait_for_reply(reqs[ri]);
-	    names = fxp_readdir_recv(pktin, reqs[ri]);
-	    reqs[ri] = NULL;
+	reqs = snewn(readdir_depth, struct sftp_request *);
+	while (count < depth) {
+	    reqs[count++] = fxp_readdir_send(dirh);
+	}
+
+	while (count) {
+	    pktin = sftp_wait_for_reply(reqs[head]);
+	    names = fxp_readdir_recv(pktin, reqs[head]);
+	    head = (head + 1) % readdir_depth;
+	    --count;
+
+	    if (done) {
+		/* Draining requests sent past the end of the directory */
+		if (names)
+		    fxp_free_names(names);
+		continue;
+	    }
 
 	    if (names == NULL) {
-		if (fxp_error_type() == SSH_FX_EOF)
-		    break;
-		fzprintf(sftpError, "Reading directory %s: %s", dir, fxp_error());
-		break;
+		if (fxp_error_type() != SSH_FX_EOF)
+		    fzprintf(sftpError, "Reading directory %s: %s", dir, fxp_error());
+		done = 1;
+		continue;
 	    }
 	    if (names->nnames == 0) {
 		fxp_free_names(names);
-		break;
+		done = 1;
+		continue;
 	    }
 
+	    /* Pass on each reply as a whole as soon as it arrives */
+	    fzbatch_begin();
 	    for (i = 0; i < names->nnames; i++) {
 		if (!wildcard || wc_match(wildcard, names->names[i].filename)) {
-		    unsigned long mtime = 0;
-		    if (names->names[i].attrs.flags & SSH_FILEXFER_ATTR_ACMODTIME) {
-			mtime = names->names[i].attrs.mtime;
-		    }
-		    fzprintf_raw_untrusted(sftpListentry, "%s", names->names[i].longname);
-		    fzprintf_raw_untrusted(sftpUnknown, "%lu", mtime);
-		    fzprintf_raw_untrusted(sftpUnknown, "%s", names->names[i].filename);
+		    fzlistentry(names->names[i].longname,
+				names->names[i].filename,
+				&names->names[i].attrs);
 		}
 	    }
+	    fzbatch_end();
 
 	    fxp_free_names(names);
-	    reqs[ri++] = fxp_readdir_send(dirh);
-	    ri %= 4;
-	}
-	for (i = 0; i < 4; ++i) {
-		if (reqs[ri]) {
-	            pktin = sftp_wait_for_reply(reqs[ri]);
-		    sfree(reqs[ri]);
-		    sfree(pktin);
-		}
-		++ri;
-		ri %= 4;
+
+	    if (depth < readdir_depth)
+		++depth;
+	    while (count < depth) {
+		reqs[(head + count) % readdir_depth] = fxp_readdir_send(dirh);
+		++count;
+	    }
 	}
+	sfree(reqs);
+
 	req = fxp_close_send(dirh);
         pktin = sftp_wait_for_reply(req);
 	fxp_close_recv(pktin, req);
@@ -1257,6 +1739,226 @@ int sftp_cmd_ls(struct sftp_command *cmd)
     return 1;
 }
 
+/* ----------------------------------------------------------------------
+ * The `lsr' command: list a whole directory tree.
+ *
+ * Up to WALK_MAX_DIRS directories are read at the same time, each with
+ * a few READDIR requests outstanding, so the walk is not bound by the
+ * round trip time per directory. Once a directory has been read
+ * completely, its path is sent as sftpListdir, followed by all of its
+ * entries. Subdirectories get queued for reading, symbolic links are
+ * not followed. Directories which cannot be read are skipped.
+ */
+#define WALK_MAX_DIRS 16
+#define WALK_READDIRS 4
+
+enum { WALK_OPENING, WALK_READING, WALK_CLOSING };
+
+struct walk_dir {
+    char *path;
+    int state;
+    struct fxp_handle *dirh;
+    int pending, eof;
+
+    struct fxp_names **names;
+    int nnames, namessize;
+
+    struct walk_dir *next;
+};
+
+struct walk {
+    struct walk_dir *head, *tail;	/* Directories yet to be opened */
+    int active;
+    int listed;
+};
+
+static void walk_queue(struct walk *w, char *path)
+{
+    struct walk_dir *wd = snew(struct walk_dir);
+    memset(wd, 0, sizeof(*wd));
+    wd->path = path;
+
+    if (w->tail)
+	w->tail->next = wd;
+    else
+	w->head = wd;
+    w->tail = wd;
+}
+
+static void walk_free(struct walk_dir *wd)
+{
+    int i;
+    for (i = 0; i < wd->nnames; i++)
+	fxp_free_names(wd->names[i]);
+    sfree(wd->names);
+    sfree(wd->path);
+    sfree(wd);
+}
+
+static void walk_send(struct walk_dir *wd, struct sftp_request *req)
+{
+    sftp_register(req);
+    fxp_set_userdata(req, wd);
+}
+
+static int walk_is_dir(struct fxp_name *name)
+{
+    if (!strcmp(name->filename, ".") || !strcmp(name->filename, ".."))
+	return 0;
+    if (name->attrs.flags & SSH_FILEXFER_ATTR_PERMISSIONS)
+	return (name->attrs.permissions & 0170000) == 0040000;
+    return name->longname && name->longname[0] == 'd';
+}
+
+/*
+ * Sends the entries of a completely read directory and queues its
+ * subdirectories.
+ */
+static void walk_finish_dir(struct walk *w, struct walk_dir *wd)
+{
+    int i, j;
+
+    w->listed++;
+
+    fzbatch_begin();
+    fzprintf_raw_untrusted(sftpListdir, "%s", wd->path);
+    for (i = 0; i < wd->nnames; i++) {
+	struct fxp_names *names = wd->names[i];
+	for (j = 0; j < names->nnames; j++) {
+	    fzlistentry(names->names[j].longname, names->names[j].filename,
+			&names->names[j].attrs);
+	    if (walk_is_dir(&names->names[j])) {
+		const char *sep = strcmp(wd->path, "/") ? "/" : "";
+		walk_queue(w, dupcat(wd->path, sep,
+				     names->names[j].filename, NULL));
+	    }
+	}
+    }
+    fzbatch_end();
+}
+
+static void walk_gotreply(struct walk *w, struct walk_dir *wd,
+			  struct sftp_packet *pktin, struct sftp_request *rreq)
+{
+    struct fxp_names *names;
+
+    switch (wd->state) {
+      case WALK_OPENING:
+	wd->dirh = fxp_opendir_recv(pktin, rreq);
+	if (!wd->dirh) {
+	    fzprintf(sftpVerbose, "Unable to open %s: %s", wd->path, fxp_error());
+	    walk_free(wd);
+	    w->active--;
+	    return;
+	}
+	wd->state = WALK_READING;
+	while (wd->pending < WALK_READDIRS) {
+	    walk_send(wd, fxp_readdir_send(wd->dirh));
+	    wd->pending++;
+	}
+	return;
+      case WALK_READING:
+	names = fxp_readdir_recv(pktin, rreq);
+	wd->pending--;
+	if (wd->eof) {
+	    if (names)
+		fxp_free_names(names);
+	}
+	else if (!names || !names->nnames) {
+	    if (!names && fxp_error_type() != SSH_FX_EOF)
+		fzprintf(sftpVerbose, "Reading directory %s: %s", wd->path, fxp_error());
+	    if (names)
+		fxp_free_names(names);
+	    wd->eof = 1;
+	}
+	else {
+	    if (wd->nnames >= wd->namessize) {
+		wd->namessize = wd->nnames + 16;
+		wd->names = sresize(wd->names, wd->namessize, struct fxp_names *);
+	    }
+	    wd->names[wd->nnames++] = names;
+	    walk_send(wd, fxp_readdir_send(wd->dirh));
+	    wd->pending++;
+	}
+
+	if (wd->eof && !wd->pending) {
+	    walk_finish_dir(w, wd);
+	    wd->state = WALK_CLOSING;
+	    walk_send(wd, fxp_close_send(wd->dirh));
+	}
+	return;
+      case WALK_CLOSING:
+	fxp_close_recv(pktin, rreq);
+	walk_free(wd);
+	w->active--;
+	return;
+    }
+}
+
+int sftp_cmd_lsr(struct sftp_command *cmd)
+{
+    struct walk w;
+    struct walk_dir *wd;
+    struct sftp_packet *pktin;
+    struct sftp_request *rreq;
+    char *cdir;
+
+    if (back == NULL) {
+	not_connected();
+	return 0;
+    }
+
+    cdir = canonify(cmd->nwords < 2 ? "." : cmd->words[1], 0);
+    if (!cdir) {
+	fzprintf(sftpError, "%s: canonify: %s", cmd->nwords < 2 ? "." : cmd->words[1], fxp_error());
+	return 0;
+    }
+
+    fzprintf(sftpStatus, "Listing directory tree %s", cdir);
+
+    memset(&w, 0, sizeof(w));
+    walk_queue(&w, cdir);
+
+    while (w.active || w.head) {
+	while (w.active < WALK_MAX_DIRS && w.head) {
+	    wd = w.head;
+	    w.head = wd->next;
+	    if (!w.head)
+		w.tail = NULL;
+	    wd->next = NULL;
+
+	    wd->state = WALK_OPENING;
+	    walk_send(wd, fxp_opendir_send(wd->path));
+	    w.active++;
+	}
+
+	pktin = sftp_recv();
+	if (pktin == NULL)
+	    connection_fatal(NULL, "did not receive SFTP response packet "
+			     "from server");
+	rreq = sftp_find_request(pktin);
+	if (!rreq)
+	    connection_fatal(NULL, "unable to understand SFTP response packet "
+			     "from server: %s", fxp_error());
+	wd = (struct walk_dir *)fxp_get_userdata(rreq);
+	if (!wd)
+	    connection_fatal(NULL, "SFTP response packet from server is not "
+			     "part of the directory walk");
+
+	walk_gotreply(&w, wd, pktin, rreq);
+    }
+
+    if (!w.listed) {
+	/* Not even the starting directory could be read */
+	fzprintf(sftpError, "Unable to list %s", cmd->nwords < 2 ? "." : cmd->words[1]);
+	return 0;
+    }
+
+    fznotify1(sftpDone, 1);
+
+    return 1;
+}
+
 /*
  * Change directories. We do this by canonifying the new name, then
  * trying to OPENDIR it. Only if that succeeds do we set the new pwd.
@@ -1438,6 +2140,75 @@ int sftp_cmd_reget(struct sftp_command *cmd)
     return sftp_general_get(cmd, 1, 0);
 }
 
+int sftp_cmd_transfers(struct sftp_command *cmd)
+{
+    struct transfer_batch tb;
+    int i, ret;
+
+    if (back == NULL) {
+	not_connected();
+	return 0;
+    }
+
+    if (cmd->nwords < 4 || (cmd->nwords - 1) % 3) {
+	fzprintf(sftpError, "%s: expects triples of direction, source and target",
+		 cmd->words[0]);
+	return 0;
+    }
+
+    memset(&tb, 0, sizeof(tb));
+    tb.nfiles = (cmd->nwords - 1) / 3;
+    tb.files = snewn(tb.nfiles, struct transfer_file);
+    memset(tb.files, 0, tb.nfiles * sizeof(struct transfer_file));
+
+    ret = 1;
+    for (i = 0; i < tb.nfiles && ret; i++) {
+	struct transfer_file *tf = &tb.files[i];
+	char const *dir = cmd->words[1 + i * 3];
+	char const *src = cmd->words[2 + i * 3];
+	char const *dst = cmd->words[3 + i * 3];
+	char const *remote;
+
+	tf->index = i;
+	if (!strcmp(dir, "get") || !strcmp(dir, "reget")) {
+	    tf->download = 1;
+	    remote = src;
+	    tf->local = dupstr(dst);
+	} else if (!strcmp(dir, "put") || !strcmp(dir, "reput")) {
+	    remote = dst;
+	    tf->local = dupstr(src);
+	} else {
+	    fzprintf(sftpError, "%s: unknown direction '%s'", cmd->words[0], dir);
+	    ret = 0;
+	    break;
+	}
+	tf->restart = dir[0] == 'r';
+
+	/* Absolute paths need not be looked up, saving a round trip */
+	if (remote[0] == '/')
+	    tf->remote = dupstr(remote);
+	else
+	    tf->remote = canonify(remote, 0);
+	if (!tf->remote) {
+	    fzprintf(sftpError, "%s: canonify: %s", remote, fxp_error());
+	    ret = 0;
+	}
+    }
+
+    if (ret)
+	ret = sftp_transfer_files(&tb);
+
+    for (i = 0; i < tb.nfiles; i++) {
+	sfree(tb.files[i].remote);
+	sfree(tb.files[i].local);
+    }
+    sfree(tb.files);
+
+    if (ret != 0)
+	fznotify1(sftpDone, ret);
+    return ret;
+}
+
 /*
  * Send a file and store it at the remote end. We have three very
  * similar commands here. The basic one is `put'; `reput' differs
@@ -2359,6 +3130,14 @@ END FZ UNUSED */
 	"ls", TRUE, "dir", NULL,
 	    sftp_cmd_ls
     },
+    {
+	"lsr", TRUE, "list a remote directory tree",
+	    " [ <directory-name> ]\n"
+	    "  Lists the given directory and all directories below it.\n"
+	    "  Each directory is announced before its entries. Symbolic\n"
+	    "  links are not followed.\n",
+	    sftp_cmd_lsr
+    },
     {
 	"mget", TRUE, "download multiple files at once",
 	    " [ -r ] [ -- ] <filename-or-wildcard> [ <filename-or-wildcard>... ]\n"
@@ -2470,6 +3249,14 @@ END FZ UNUSED */
 	    "  The directory will not be removed unless it is empty.\n"
 	    "  Wildcards may be used to specify multiple directories.\n",
 	    sftp_cmd_rmdir
+    },
+    {
+	"transfers", TRUE, "transfer several files at once",
+	    " <get|reget|put|reput> <source> <target> [ ... ]\n"
+	    "  Transfers all of the given files, with as many of them in\n"
+	    "  progress at the same time as set by -transfers. Completion\n"
+	    "  of each file is reported separately.\n",
+	    sftp_cmd_transfers
     }
 };
 
@@ -2838,6 +3625,14 @@ void connection_fatal(void *frontend, const char *fmt, ...)
     va_start(ap, fmt);
     str = dupvprintf(fmt, ap);
     va_end(ap);
+
+    /* FZ: psftp_connect falls back to a connection of our own */
+    if (connecting_downstream) {
+	fzprintf(sftpVerbose, "%s", str);
+	sfree(str);
+	return;
+    }
+
     fzprintf(sftpError, str);
     sfree(str);
 
@@ -3001,6 +3796,13 @@ static void usage(void)
     printf("  -1 -2     force use of particular SSH protocol version\n");
     printf("  -4 -6     force use of IPv4 or IPv6\n");
     printf("  -C        enable compression\n");
+    printf("  -streams n\n");
+    printf("            download files using n windows of requests\n");
+    printf("  -framed   send events to FileZilla as binary frames\n");
+    printf("  -transfers n\n");
+    printf("            have the transfers command work on n files at once\n");
+    printf("  -readdirs n\n");
+    printf("            keep up to n directory read requests outstanding\n");
     printf("  -i key    private key file for user authentication\n");
     printf("  -noagent  disable use of Pageant\n");
     printf("  -agent    enable use of Pageant\n");
@@ -3206,25 +4008,54 @@ static int psftp_connect(char *userhost, char *user, int portnumber)
 
     platform_psftp_pre_conn_setup();
 
-    err = back->init(NULL, &backhandle, conf,
-		     conf_get_str(conf, CONF_host),
-		     conf_get_int(conf, CONF_port),
-		     &realhost, 0,
-		     conf_get_int(conf, CONF_tcp_keepalives));
-    if (err != NULL) {
-	fzprintf(sftpError, "ssh_init: %s", err);
-	return 1;
-    }
-    back->provide_logctx(backhandle, logctx);
-    while (!back->sendok(backhandle)) {
-	if (back->exitcode(backhandle) >= 0)
-	    return 1;
-	if (ssh_sftp_loop_iteration() < 0) {
-	    fzprintf(sftpError, "ssh_init: error during SSH connection setup");
+    for (;;) {
+	err = back->init(NULL, &backhandle, conf,
+			 conf_get_str(conf, CONF_host),
+			 conf_get_int(conf, CONF_port),
+			 &realhost, 0,
+			 conf_get_int(conf, CONF_tcp_keepalives));
+	if (err != NULL) {
+	    fzprintf(sftpError, "ssh_init: %s", err);
 	    return 1;
 	}
+	back->provide_logctx(backhandle, logctx);
+
+	/*
+	 * FZ: As downstream of a shared connection we lose if the
+	 * upstream goes away before our channel is open, or if the
+	 * server refuses to open another channel on its connection
+	 * (e.g. OpenSSH's MaxSessions). Neither is a reason to give up,
+	 * connect on our own instead.
+	 */
+	connecting_downstream = back->cfg_info(backhandle) == -1;
+	while (!back->sendok(backhandle)) {
+	    if (back->exitcode(backhandle) >= 0)
+		break;
+	    if (ssh_sftp_loop_iteration() < 0) {
+		connecting_downstream = FALSE;
+		fzprintf(sftpError, "ssh_init: error during SSH connection setup");
+		return 1;
+	    }
+	}
+	if (back->sendok(backhandle))
+	    break;
+	if (!connecting_downstream)
+	    return 1;
+
+	connecting_downstream = FALSE;
+	fzprintf(sftpStatus, "Could not use shared connection, connecting separately");
+	back->free(backhandle);
+	backhandle = NULL;
+	if (realhost != NULL)
+	    sfree(realhost);
+	realhost = NULL;
+	conf_set_int(conf, CONF_ssh_connection_sharing, FALSE);
+    }
+    if (connecting_downstream) {
+	connecting_downstream = FALSE;
+	fzprintf(sftpStatus, "Reusing a shared connection to this server");
     }
-    if (verbose && realhost != NULL)
+    else if (verbose && realhost != NULL)
 	fzprintf(sftpStatus, "Connected to %s", realhost);
     if (realhost != NULL)
 	sfree(realhost);
@@ -3331,8 +4162,9 @@ int psftp_init_utf8_locale()
 }
 #endif
 
-const int share_can_be_downstream = FALSE; // FZ: We're standalone
-const int share_can_be_upstream = FALSE;
+// FZ: Sharing only happens with -share, which the engine passes if enabled
+const int share_can_be_downstream = TRUE;
+const int share_can_be_upstream = TRUE;
 
 /*
  * Main program. Parse arguments etc.
@@ -3437,6 +4269,26 @@ int psftp_main(int argc, char *argv[])
 	    modeflags = modeflags | 1;
 	} else if (strcmp(argv[i], "-be") == 0) {
 	    modeflags = modeflags | 2;
+	} else if (strcmp(argv[i], "-streams") == 0 && i + 1 < argc) {
+	    download_streams = atoi(argv[++i]);
+	    if (download_streams < 1)
+		download_streams = 1;
+	    else if (download_streams > XFER_MAX_STREAMS)
+		download_streams = XFER_MAX_STREAMS;
+	} else if (strcmp(argv[i], "-framed") == 0) {
+	    fz_enable_framing();
+	} else if (strcmp(argv[i], "-transfers") == 0 && i + 1 < argc) {
+	    transfer_files = atoi(argv[++i]);
+	    if (transfer_files < 1)
+		transfer_files = 1;
+	    else if (transfer_files > TRANSFER_MAX_FILES)
+		transfer_files = TRANSFER_MAX_FILES;
+	} else if (strcmp(argv[i], "-readdirs") == 0 && i + 1 < argc) {
+	    readdir_depth = atoi(argv[++i]);
+	    if (readdir_depth < 1)
+		readdir_depth = 1;
+	    else if (readdir_depth > READDIR_MAX_DEPTH)
+		readdir_depth = READDIR_MAX_DEPTH;
 	} else if (strcmp(argv[i], "--") == 0) {
 	    i++;
 	    break;
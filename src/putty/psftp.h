@@ -104,6 +104,8 @@ void close_rfile(RFile *f);
 WFile *open_new_file(const char *name, long perms);
 /* Returns <0 on error, 0 on eof, or number of bytes written, as usual */
 int write_to_file(WFile *f, void *buffer, int length);
+/* Same, but at the given offset, leaving the file position undefined */
+int write_to_file_at(WFile *f, uint64 offset, void *buffer, int length);
 void set_file_times(WFile *f, unsigned long mtime, unsigned long atime);
 /* Closes and frees the WFile */
 void close_wfile(WFile *f);
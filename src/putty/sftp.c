@@ -8,15 +8,13 @@
 #include <assert.h>
 #include <limits.h>
 
+#include "putty.h"
 #include "misc.h"
 #include "int64.h"
 #include "tree234.h"
 #include "ssh.h"
 #include "sftp.h"
 
-#include "fzprintf.h"
-#include "fzsftp.h"
-
 struct sftp_packet {
     char *data;
     unsigned length, maxlen;
@@ -1149,10 +1147,51 @@ void fxp_set_userdata(struct sftp_request *req, void *data)
  * the queueing of multiple read/write requests.
  */
 
+/*
+ * In multi-stream mode, a download is split into blocks of
+ * XFER_STREAM_BLOCK bytes. Each stream reads one block at a time,
+ * keeping all of it in flight, and claims the next unclaimed block
+ * once all of its requests have been answered. Completed requests
+ * are handed back in whichever order they complete, the caller
+ * writes them to their offset.
+ *
+ * No block is claimed that ends more than XFER_RESUME_MARGIN bytes
+ * past the lowest offset not yet handed back, so a partial file only
+ * ever has holes within that many bytes before its end.
+ */
+#define XFER_STREAM_BLOCK (XFER_RESUME_MARGIN / XFER_MAX_STREAMS / 2)
+
+/*
+ * The amount of data in flight, the request window, follows the
+ * bandwidth-delay product of the connection. Over each measurement
+ * period, lasting at least one round trip, the rate at which data got
+ * through is taken; multiplied by the lowest round-trip time seen
+ * this gives the amount of data the link holds. Twice that is kept in
+ * flight, so that the window keeps growing for as long as it is what
+ * limits the transfer. Shrinking happens more slowly, in case a
+ * single period was slow for other reasons.
+ *
+ * The last window is remembered for the next transfer, saving later
+ * files from having to start out small again.
+ */
+#define XFER_WINDOW_MIN 262144
+#define XFER_WINDOW_MAX (1048576*64)
+#define XFER_WINDOW_PERIOD 100	       /* ms */
+
+static int xfer_window = 1048576;
+
+struct xfer_stream {
+    uint64 offset, end;
+    int outstanding, active;
+};
+
 struct req {
     char *buffer;
     int len, retlen, complete;
     uint64 offset;
+    struct xfer_stream *stream;
+    struct fxp_xfer *xfer;
+    unsigned long sent;		       /* GETTICKCOUNT() when sent */
     struct req *next, *prev;
 };
 
@@ -1163,6 +1202,10 @@ struct fxp_xfer {
     struct req *head, *tail;
     _fztimer send_timer;
     int sent_interval;
+    int nstreams;
+    struct xfer_stream *streams;
+    unsigned long rtt_min, period_start;
+    int period_bytes;
 };
 
 static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64 offset)
@@ -1173,18 +1216,88 @@ static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64 offset)
     xfer->offset = offset;
     xfer->head = xfer->tail = NULL;
     xfer->req_totalsize = 0;
-    xfer->req_maxsize = 1048576*4;
+    xfer->req_maxsize = xfer_window;
     xfer->err = 0;
     xfer->filesize = uint64_make(ULONG_MAX, ULONG_MAX);
     xfer->furthestdata = uint64_make(0, 0);
     fz_timer_init(&xfer->send_timer);
     xfer->sent_interval = 0;
+    xfer->nstreams = 0;
+    xfer->streams = NULL;
+    xfer->rtt_min = 0;
+    xfer->period_start = GETTICKCOUNT();
+    xfer->period_bytes = 0;
 
     return xfer;
 }
 
+/*
+ * Accounts for a request having been answered, with len bytes of it
+ * having made it through. Resizes the window at the end of each
+ * measurement period.
+ */
+static void xfer_update_window(struct fxp_xfer *xfer, struct req *rr, int len)
+{
+    unsigned long now = GETTICKCOUNT();
+    unsigned long rtt = now - rr->sent;
+    unsigned long elapsed;
+    double target;
+    int window;
+
+    if (!rtt)
+	rtt = 1;
+    if (!xfer->rtt_min || rtt < xfer->rtt_min)
+	xfer->rtt_min = rtt;
+    if (len > 0)
+	xfer->period_bytes += len;
+
+    elapsed = now - xfer->period_start;
+    if (elapsed < XFER_WINDOW_PERIOD || elapsed < xfer->rtt_min)
+	return;
+
+    target = 2.0 * xfer->period_bytes * xfer->rtt_min / elapsed;
+    if (target > XFER_WINDOW_MAX)
+	window = XFER_WINDOW_MAX;
+    else if (target < XFER_WINDOW_MIN)
+	window = XFER_WINDOW_MIN;
+    else
+	window = (int)target;
+    if (window < xfer->req_maxsize)
+	window = xfer->req_maxsize - (xfer->req_maxsize - window) / 4;
+
+    if (window > xfer->req_maxsize + xfer->req_maxsize / 4 ||
+	window < xfer->req_maxsize - xfer->req_maxsize / 4) {
+	fzprintf(sftpVerbose, "Request window %d KiB, rtt %lu ms, %lu KiB/s",
+		 window / 1024, xfer->rtt_min,
+		 (unsigned long)((double)xfer->period_bytes * 1000 / 1024 / elapsed));
+    }
+
+    xfer->req_maxsize = window;
+    xfer_window = window;
+    xfer->period_start = now;
+    xfer->period_bytes = 0;
+}
+
 int xfer_done(struct fxp_xfer *xfer)
 {
+    /*
+     * In multi-stream mode, we're at EOF once all blocks up to the
+     * file size have been claimed and read.
+     */
+    if (xfer->nstreams && !xfer->eof && !xfer->head &&
+	uint64_compare(xfer->offset, xfer->filesize) >= 0) {
+	int i;
+
+	xfer->eof = TRUE;
+	for (i = 0; i < xfer->nstreams; i++) {
+	    struct xfer_stream *s = &xfer->streams[i];
+	    if (s->active && uint64_compare(s->offset, s->end) < 0 &&
+		uint64_compare(s->offset, xfer->filesize) < 0) {
+		xfer->eof = FALSE;
+	    }
+	}
+    }
+
     /*
      * We're finished if we've seen EOF _and_ there are no
      * outstanding requests.
@@ -1192,48 +1305,143 @@ int xfer_done(struct fxp_xfer *xfer)
     return (xfer->eof || xfer->err) && !xfer->head;
 }
 
+static struct req *xfer_queue_read(struct fxp_xfer *xfer, uint64 offset, int len)
+{
+    struct req *rr;
+    struct sftp_request *req;
+
+    rr = snew(struct req);
+    rr->offset = offset;
+    rr->complete = 0;
+    rr->stream = NULL;
+    rr->xfer = xfer;
+    if (xfer->tail) {
+	xfer->tail->next = rr;
+	rr->prev = xfer->tail;
+    } else {
+	xfer->head = rr;
+	rr->prev = NULL;
+    }
+    xfer->tail = rr;
+    rr->next = NULL;
+
+    rr->len = len;
+    rr->buffer = snewn(rr->len, char);
+    rr->sent = GETTICKCOUNT();
+    sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
+    fxp_set_userdata(req, rr);
+
+    xfer->req_totalsize += rr->len;
+
+#ifdef DEBUG_DOWNLOAD
+    { char buf[40]; uint64_decimal(rr->offset, buf); printf("queueing read request %p at %s\n", rr, buf); }
+#endif
+
+    return rr;
+}
+
+/*
+ * Lowest offset of any data not yet handed back to the caller.
+ */
+static uint64 xfer_stream_low(struct fxp_xfer *xfer)
+{
+    uint64 low = xfer->offset;
+    struct req *rr;
+    int i;
+
+    for (rr = xfer->head; rr; rr = rr->next) {
+	if (uint64_compare(rr->offset, low) < 0)
+	    low = rr->offset;
+    }
+    for (i = 0; i < xfer->nstreams; i++) {
+	struct xfer_stream *s = &xfer->streams[i];
+	if (s->active && uint64_compare(s->offset, low) < 0)
+	    low = s->offset;
+    }
+
+    return low;
+}
+
+static void xfer_download_queue_streams(struct fxp_xfer *xfer)
+{
+    int i;
+
+    for (i = 0; i < xfer->nstreams && !xfer->err; i++) {
+	struct xfer_stream *s = &xfer->streams[i];
+
+	if (s->active && !s->outstanding &&
+	    (uint64_compare(s->offset, s->end) >= 0 ||
+	     uint64_compare(s->offset, xfer->filesize) >= 0)) {
+	    s->active = 0;
+	}
+
+	if (!s->active) {
+	    if (uint64_compare(xfer->offset, xfer->filesize) >= 0)
+		continue;
+	    if (xfer->req_totalsize >= xfer->req_maxsize)
+		continue;
+	    if (uint64_compare(uint64_add32(xfer->offset, XFER_STREAM_BLOCK),
+			       uint64_add32(xfer_stream_low(xfer),
+					    XFER_RESUME_MARGIN)) > 0) {
+		continue;
+	    }
+	    s->offset = xfer->offset;
+	    s->end = uint64_add32(xfer->offset, XFER_STREAM_BLOCK);
+	    s->active = 1;
+	    xfer->offset = s->end;
+	}
+
+	/*
+	 * The streams share the request window. A stream running into
+	 * it carries on with its block once replies come in.
+	 */
+	while (uint64_compare(s->offset, s->end) < 0 &&
+	       uint64_compare(s->offset, xfer->filesize) < 0 &&
+	       xfer->req_totalsize < xfer->req_maxsize) {
+	    uint64 left = uint64_subtract(s->end, s->offset);
+	    int len = 32768;
+	    struct req *rr;
+
+	    if (!left.hi && left.lo < (unsigned long)len)
+		len = left.lo;
+	    rr = xfer_queue_read(xfer, s->offset, len);
+	    rr->stream = s;
+	    s->outstanding++;
+	    s->offset = uint64_add32(s->offset, len);
+	}
+    }
+}
+
 void xfer_download_queue(struct fxp_xfer *xfer)
 {
+    if (xfer->nstreams) {
+	xfer_download_queue_streams(xfer);
+	return;
+    }
+
     while (xfer->req_totalsize < xfer->req_maxsize &&
 	   !xfer->eof && !xfer->err) {
 	/*
 	 * Queue a new read request.
 	 */
-	struct req *rr;
-	struct sftp_request *req;
-
-	rr = snew(struct req);
-	rr->offset = xfer->offset;
-	rr->complete = 0;
-	if (xfer->tail) {
-	    xfer->tail->next = rr;
-	    rr->prev = xfer->tail;
-	} else {
-	    xfer->head = rr;
-	    rr->prev = NULL;
-	}
-	xfer->tail = rr;
-	rr->next = NULL;
-
-	rr->len = 32768;
-	rr->buffer = snewn(rr->len, char);
-	sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
-	fxp_set_userdata(req, rr);
-
+	struct req *rr = xfer_queue_read(xfer, xfer->offset, 32768);
 	xfer->offset = uint64_add32(xfer->offset, rr->len);
-	xfer->req_totalsize += rr->len;
-
-#ifdef DEBUG_DOWNLOAD
-	{ char buf[40]; uint64_decimal(rr->offset, buf); printf("queueing read request %p at %s\n", rr, buf); }
-#endif
     }
 }
 
-struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64 offset)
+struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64 offset,
+				    int streams)
 {
     struct fxp_xfer *xfer = xfer_init(fh, offset);
 
     xfer->eof = FALSE;
+    if (streams > 1) {
+	if (streams > XFER_MAX_STREAMS)
+	    streams = XFER_MAX_STREAMS;
+	xfer->nstreams = streams;
+	xfer->streams = snewn(streams, struct xfer_stream);
+	memset(xfer->streams, 0, streams * sizeof(struct xfer_stream));
+    }
     xfer_download_queue(xfer);
 
     return xfer;
@@ -1246,11 +1454,22 @@ struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64 offset)
 int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 {
     struct sftp_request *rreq;
-    struct req *rr;
 
     rreq = sftp_find_request(pktin);
     if (!rreq)
         return INT_MIN;            /* this packet doesn't even make sense */
+    return xfer_download_gotreq(xfer, pktin, rreq);
+}
+
+/*
+ * Like xfer_download_gotpkt, for a packet whose request has already
+ * been looked up by the caller.
+ */
+int xfer_download_gotreq(struct fxp_xfer *xfer, struct sftp_packet *pktin,
+			 struct sftp_request *rreq)
+{
+    struct req *rr;
+
     rr = (struct req *)fxp_get_userdata(rreq);
     if (!rr) {
         fxp_internal_error("request ID is not part of the current download");
@@ -1260,9 +1479,16 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 #ifdef DEBUG_DOWNLOAD
     printf("read request %p has returned [%d]\n", rr, rr->retlen);
 #endif
+    xfer_update_window(xfer, rr, rr->retlen);
 
     if ((rr->retlen < 0 && fxp_error_type()==SSH_FX_EOF) || rr->retlen == 0) {
-	xfer->eof = TRUE;
+	/*
+	 * With several streams, reads beyond the end come back
+	 * before those still in progress further down the file. The
+	 * file size determined below stops the streams instead.
+	 */
+	if (!xfer->nstreams)
+	    xfer->eof = TRUE;
         rr->retlen = 0;
 	rr->complete = -1;
 #ifdef DEBUG_DOWNLOAD
@@ -1331,10 +1557,50 @@ void xfer_set_error(struct fxp_xfer *xfer)
     xfer->err = 1;
 }
 
-int xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len)
+static void xfer_unlink(struct fxp_xfer *xfer, struct req *rr)
+{
+    if (rr->prev)
+	rr->prev->next = rr->next;
+    else
+	xfer->head = rr->next;
+    if (rr->next)
+	rr->next->prev = rr->prev;
+    else
+	xfer->tail = rr->prev;
+    xfer->req_totalsize -= rr->len;
+    if (rr->stream)
+	rr->stream->outstanding--;
+}
+
+int xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len,
+		       uint64 *offset)
 {
     void *retbuf = NULL;
     int retlen = 0;
+    uint64 retoffset = uint64_make(0, 0);
+
+    if (xfer->nstreams) {
+	/*
+	 * Return the first completed request, wherever it is in
+	 * the queue, discarding failed ones on the way.
+	 */
+	struct req *rr = xfer->head;
+	while (rr && !retbuf) {
+	    struct req *next = rr->next;
+	    if (rr->complete) {
+		if (rr->complete > 0) {
+		    retbuf = rr->buffer;
+		    retlen = rr->retlen;
+		    retoffset = rr->offset;
+		}
+		else
+		    sfree(rr->buffer);
+		xfer_unlink(xfer, rr);
+		sfree(rr);
+	    }
+	    rr = next;
+	}
+    }
 
     /*
      * Discard anything at the head of the rr queue with complete <
@@ -1346,6 +1612,7 @@ int xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len)
 	if (rr->complete > 0) {
 	    retbuf = rr->buffer;
 	    retlen = rr->retlen;
+	    retoffset = rr->offset;
 #ifdef DEBUG_DOWNLOAD
 	    printf("handing back data from read request %p\n", rr);
 #endif
@@ -1367,6 +1634,7 @@ int xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len)
     if (retbuf) {
 	*buf = retbuf;
 	*len = retlen;
+	*offset = retoffset;
 	return 1;
     } else
 	return 0;
@@ -1391,7 +1659,7 @@ struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64 offset)
 
 int xfer_upload_ready(struct fxp_xfer *xfer)
 {
-    if (sftp_sendbuffer() == 0)
+    if (sftp_sendbuffer() == 0 && xfer->req_totalsize < xfer->req_maxsize)
 	return 1;
     else
 	return 0;
@@ -1405,6 +1673,8 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
     rr = snew(struct req);
     rr->offset = xfer->offset;
     rr->complete = 0;
+    rr->stream = NULL;
+    rr->xfer = xfer;
     if (xfer->tail) {
 	xfer->tail->next = rr;
 	rr->prev = xfer->tail;
@@ -1417,6 +1687,7 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
 
     rr->len = len;
     rr->buffer = NULL;
+    rr->sent = GETTICKCOUNT();
     sftp_register(req = fxp_write_send(xfer->fh, buffer, rr->offset, len));
     fxp_set_userdata(req, rr);
 
@@ -1435,12 +1706,19 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
 int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 {
     struct sftp_request *rreq;
-    struct req *rr, *prev, *next;
-    int ret;
 
     rreq = sftp_find_request(pktin);
     if (!rreq)
         return INT_MIN;            /* this packet doesn't even make sense */
+    return xfer_upload_gotreq(xfer, pktin, rreq);
+}
+
+int xfer_upload_gotreq(struct fxp_xfer *xfer, struct sftp_packet *pktin,
+		       struct sftp_request *rreq)
+{
+    struct req *rr, *prev, *next;
+    int ret;
+
     rr = (struct req *)fxp_get_userdata(rreq);
     if (!rr) {
         fxp_internal_error("request ID is not part of the current upload");
@@ -1466,9 +1744,11 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 	xfer->tail = prev;
     xfer->req_totalsize -= rr->len;
     xfer->sent_interval += rr->len;
+    if (ret)
+	xfer_update_window(xfer, rr, rr->len);
     if (fz_timer_check(&xfer->send_timer)) {
 	/* The data we sent is the data we earlier read from file */
-	fzprintf(sftpTransfer, "%d", xfer->sent_interval);
+	fztransfer(xfer->sent_interval);
 	xfer->sent_interval = 0;
     }
     sfree(rr);
@@ -1479,10 +1759,21 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
     return 1;
 }
 
+/*
+ * Returns the transfer a request has been sent for, or NULL if it is
+ * not part of any.
+ */
+struct fxp_xfer *xfer_from_request(struct sftp_request *req)
+{
+    struct req *rr = (struct req *)fxp_get_userdata(req);
+
+    return rr ? rr->xfer : NULL;
+}
+
 void xfer_cleanup(struct fxp_xfer *xfer)
 {
     if (xfer->sent_interval > 0) {
-	fzprintf(sftpTransfer, "%d", xfer->sent_interval);
+	fztransfer(xfer->sent_interval);
     }
     struct req *rr;
     while (xfer->head) {
@@ -1491,6 +1782,7 @@ void xfer_cleanup(struct fxp_xfer *xfer)
 	sfree(rr->buffer);
 	sfree(rr);
     }
+    sfree(xfer->streams);
     sfree(xfer);
 }
 
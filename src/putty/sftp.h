@@ -254,16 +254,32 @@ struct sftp_packet *sftp_recv(void);
 
 struct fxp_xfer;
 
-struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64 offset);
+/*
+ * With more than one stream, a download keeps that many independent
+ * windows of read requests in flight at different offsets, and
+ * xfer_download_data hands back data out of order. Holes in a
+ * partial file are confined to its last XFER_RESUME_MARGIN bytes.
+ */
+#define XFER_MAX_STREAMS 8
+#define XFER_RESUME_MARGIN (2097152 * XFER_MAX_STREAMS * 2)
+
+struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64 offset,
+				    int streams);
 void xfer_download_queue(struct fxp_xfer *xfer);
 int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin);
-int xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len);
+int xfer_download_gotreq(struct fxp_xfer *xfer, struct sftp_packet *pktin,
+			 struct sftp_request *rreq);
+int xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len,
+		       uint64 *offset);
 
 struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64 offset);
 int xfer_upload_ready(struct fxp_xfer *xfer);
 void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len);
 int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin);
+int xfer_upload_gotreq(struct fxp_xfer *xfer, struct sftp_packet *pktin,
+		       struct sftp_request *rreq);
 
 int xfer_done(struct fxp_xfer *xfer);
+struct fxp_xfer *xfer_from_request(struct sftp_request *req);
 void xfer_set_error(struct fxp_xfer *xfer);
 void xfer_cleanup(struct fxp_xfer *xfer);
@@ -443,6 +443,17 @@ extern const struct ssh2_ciphers ssh2_aes;
 extern const struct ssh2_ciphers ssh2_blowfish;
 extern const struct ssh2_ciphers ssh2_arcfour;
 extern const struct ssh2_ciphers ssh2_ccp;
+
+/*
+ * ssh2_ccp picks the SIMD code for ChaCha20 at runtime, by what the CPU
+ * supports. For testing, ccp_limit_simd() restricts that choice. Returns
+ * the level actually used.
+ */
+#define CCP_SIMD_NONE 0
+#define CCP_SIMD_SSE2 1
+#define CCP_SIMD_AVX2 2
+int ccp_limit_simd(int level);
+
 extern const struct ssh_hash ssh_sha1;
 extern const struct ssh_hash ssh_sha256;
 extern const struct ssh_hash ssh_sha384;
@@ -627,6 +638,7 @@ void bn_restore_invariant(Bignum b);
 Bignum bignum_from_long(unsigned long n);
 void freebn(Bignum b);
 Bignum modpow(Bignum base, Bignum exp, Bignum mod);
+Bignum modpow_simple(Bignum base, Bignum exp, Bignum mod);
 Bignum modmul(Bignum a, Bignum b, Bignum mod);
 Bignum modsub(const Bignum a, const Bignum b, const Bignum n);
 void decbn(Bignum n);
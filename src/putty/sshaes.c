@@ -8,6 +8,8 @@
 #include "ssh.h"
 
 #include <nettle/aes.h>
+#include <nettle/cbc.h>
+#include <nettle/ctr.h>
 #include <nettle/gcm.h>
 #include <nettle/memxor.h>
 
@@ -19,6 +21,13 @@ struct AESContext {
     uint8_t iv[16];
 };
 
+/*
+ * Where the mode permits, i.e. for SDCTR and CBC decryption, it is left to
+ * Nettle as well. It gets whole packets at once that way, which lets a
+ * build with hardware AES support (AES-NI, selected at runtime in fat
+ * builds) work on several blocks in parallel. CBC encryption is serial by
+ * nature, Nettle's generic mode code would only add overhead.
+ */
 static void aes_encrypt_cbc(unsigned char *blk, int len, AESContext * ctx)
 {
     assert((len & 15) == 0);
@@ -34,18 +43,10 @@ static void aes_encrypt_cbc(unsigned char *blk, int len, AESContext * ctx)
 
 static void aes_decrypt_cbc(unsigned char *blk, int len, AESContext * ctx)
 {
-    uint8_t x[16];
-
     assert((len & 15) == 0);
 
-    while (len > 0) {
-	aes_decrypt(&ctx->dec_ctx, 16, x, blk);
-	memxor(x, ctx->iv, 16);
-	memcpy(ctx->iv, blk, 16);
-	memcpy(blk, x, 16);
-	blk += 16;
-	len -= 16;
-    }
+    cbc_decrypt(&ctx->dec_ctx, (nettle_cipher_func *)aes_decrypt,
+		16, ctx->iv, len, blk, blk);
 }
 
 static void increment_iv_step32(uint8_t *iv, int i)
@@ -62,17 +63,11 @@ static void increment_iv_step32(uint8_t *iv, int i)
 
 static void aes_sdctr(unsigned char *blk, int len, AESContext *ctx)
 {
-    uint8_t b[16];
-
     assert((len & 15) == 0);
 
-    while (len > 0) {
-	aes_encrypt(&ctx->enc_ctx, 16, b, ctx->iv);
-	memxor(blk, b, 16);
-	increment_iv_step32(ctx->iv, 4);
-	blk += 16;
-	len -= 16;
-    }
+    /* Nettle's counter is the whole block in big-endian, as in SDCTR */
+    ctr_crypt(&ctx->enc_ctx, (nettle_cipher_func *)aes_encrypt,
+	      16, ctx->iv, len, blk, blk);
 }
 
 void *aes_make_context(void)
@@ -341,161 +341,196 @@ static void internal_mul(const BignumInt *a, const BignumInt *b,
 }
 
 /*
- * Variant form of internal_mul used for the initial step of
- * Montgomery reduction. Only bothers outputting 'len' words
- * (everything above that is thrown away).
+ * Compute c = a * a. Same conventions as internal_mul.
+ *
+ * Each product of two different words occurs twice in a square, so
+ * they are only computed once and the sum is doubled afterwards.
+ * That saves almost half the multiplications of internal_mul.
  */
-static void internal_mul_low(const BignumInt *a, const BignumInt *b,
-                             BignumInt *c, int len, BignumInt *scratch)
+static void internal_sqr(const BignumInt *a, BignumInt *c, int len,
+                         BignumInt *scratch)
 {
-    if (len > KARATSUBA_THRESHOLD) {
-        int i;
-
-        /*
-         * Karatsuba-aware version of internal_mul_low. As before, we
-         * express each input value as a shifted combination of two
-         * halves:
-         *
-         *   a = a_1 D + a_0
-         *   b = b_1 D + b_0
-         *
-         * Then the full product is, as before,
-         *
-         *  ab = a_1 b_1 D^2 + (a_1 b_0 + a_0 b_1) D + a_0 b_0
-         *
-         * Provided we choose D on the large side (so that a_0 and b_0
-         * are _at least_ as long as a_1 and b_1), we don't need the
-         * topmost term at all, and we only need half of the middle
-         * term. So there's no point in doing the proper Karatsuba
-         * optimisation which computes the middle term using the top
-         * one, because we'd take as long computing the top one as
-         * just computing the middle one directly.
-         *
-         * So instead, we do a much more obvious thing: we call the
-         * fully optimised internal_mul to compute a_0 b_0, and we
-         * recursively call ourself to compute the _bottom halves_ of
-         * a_1 b_0 and a_0 b_1, each of which we add into the result
-         * in the obvious way.
-         *
-         * In other words, there's no actual Karatsuba _optimisation_
-         * in this function; the only benefit in doing it this way is
-         * that we call internal_mul proper for a large part of the
-         * work, and _that_ can optimise its operation.
-         */
-
-        int toplen = len/2, botlen = len - toplen; /* botlen is the bigger */
+    int i, j;
+    BignumInt carry, top, lo, hi;
+    BignumCarry cc;
 
-        /*
-         * Scratch space for the various bits and pieces we're going
-         * to be adding together: we need botlen*2 words for a_0 b_0
-         * (though we may end up throwing away its topmost word), and
-         * toplen words for each of a_1 b_0 and a_0 b_1. That adds up
-         * to exactly 2*len.
-         */
-
-        /* a_0 b_0 */
-        internal_mul(a + toplen, b + toplen, scratch + 2*toplen, botlen,
-                     scratch + 2*len);
-
-        /* a_1 b_0 */
-        internal_mul_low(a, b + len - toplen, scratch + toplen, toplen,
-                         scratch + 2*len);
-
-        /* a_0 b_1 */
-        internal_mul_low(a + len - toplen, b, scratch, toplen,
-                         scratch + 2*len);
+    if (len > KARATSUBA_THRESHOLD) {
+        internal_mul(a, a, c, len, scratch);
+        return;
+    }
 
-        /* Copy the bottom half of the big coefficient into place */
-        for (i = 0; i < botlen; i++)
-            c[toplen + i] = scratch[2*toplen + botlen + i];
+    for (i = 0; i < 2 * len; i++)
+        c[i] = 0;
 
-        /* Add the two small coefficients, throwing away the returned carry */
-        internal_add(scratch, scratch + toplen, scratch, toplen);
+    /*
+     * The products a_i a_j with i < j. Indices here count from the
+     * least significant word, which is at the end of the arrays.
+     */
+    for (i = 0; i < len - 1; i++) {
+        BignumInt ai = a[len - 1 - i];
+        carry = 0;
+        for (j = i + 1; j < len; j++) {
+            BignumInt *cp = c + 2*len - 1 - i - j;
+            BignumMULADD2(carry, *cp, ai, a[len - 1 - j], *cp, carry);
+        }
+        c[len - 1 - i] = carry;
+    }
 
-        /* And add that to the large coefficient, leaving the result in c. */
-        internal_add(scratch, scratch + 2*toplen + botlen - toplen,
-                     c, toplen);
+    /* Double them */
+    top = 0;
+    for (i = 2*len - 1; i >= 0; i--) {
+        BignumInt t = c[i] >> (BIGNUM_INT_BITS - 1);
+        c[i] = (c[i] << 1) | top;
+        top = t;
+    }
 
-    } else {
-        int i;
-        BignumInt carry;
-        const BignumInt *ap, *bp;
-        BignumInt *cp, *cps;
+    /* And add the squares a_i a_i */
+    cc = 0;
+    for (i = 0; i < len; i++) {
+        BignumMUL(hi, lo, a[len - 1 - i], a[len - 1 - i]);
+        BignumADC(c[2*len - 1 - 2*i], cc, c[2*len - 1 - 2*i], lo, cc);
+        BignumADC(c[2*len - 2 - 2*i], cc, c[2*len - 2 - 2*i], hi, cc);
+    }
+}
 
-        /*
-         * Multiply in the ordinary O(N^2) way.
-         */
+/*
+ * Subtracts n from x if the carry is set or x >= n. Both are
+ * big-endian arrays of 'len' BignumInts, the carry is an extra bit
+ * on top of x. Used to bring values below 2n back into range.
+ */
+static void internal_sub_if_ge(BignumInt *x, const BignumInt *n,
+                               BignumCarry carry, int len)
+{
+    int i = 0;
 
+    if (!carry) {
         for (i = 0; i < len; i++)
-            c[i] = 0;
+            if (x[i] != n[i])
+                break;
+    }
+    if (carry || i >= len || x[i] > n[i])
+        internal_sub(x, n, x, len);
+}
 
-        for (cps = c + len, ap = a + len; ap-- > a; cps--) {
-            carry = 0;
-            for (cp = cps, bp = b + len; bp--, cp-- > c ;)
-                BignumMULADD2(carry, *cp, *ap, *bp, *cp, carry);
-        }
+/*
+ * Compute the inverse of -n modulo 2^BIGNUM_INT_BITS, for odd n. Only
+ * the least significant word of n matters.
+ */
+static BignumInt monty_mninv(BignumInt n0)
+{
+    BignumInt inv, t, unused;
+    int bits;
+
+    /*
+     * Any odd n0 is its own inverse modulo 8. Each Newton step
+     * inv = inv * (2 - n0 * inv) doubles the number of correct bits.
+     */
+    inv = n0;
+    for (bits = 3; bits < BIGNUM_INT_BITS; bits *= 2) {
+        BignumMUL(unused, t, n0, inv);
+        t = 2 - t;
+        BignumMUL(unused, inv, inv, t);
     }
+    (void)unused;
+
+    return 0 - inv;
 }
 
 /*
  * Montgomery reduction. Expects x to be a big-endian array of 2*len
  * BignumInts whose value satisfies 0 <= x < rn (where r = 2^(len *
- * BIGNUM_INT_BITS) is the Montgomery base). Returns in the same array
- * a value x' which is congruent to xr^{-1} mod n, and satisfies 0 <=
- * x' < n.
+ * BIGNUM_INT_BITS) is the Montgomery base). Returns in the least
+ * significant half of the same array a value x' which is congruent
+ * to xr^{-1} mod n, and satisfies 0 <= x' < n. The most significant
+ * half is zeroed.
  *
- * 'n' and 'mninv' should be big-endian arrays of 'len' BignumInts
- * each, containing respectively n and the multiplicative inverse of
- * -n mod r.
+ * 'n' should be a big-endian array of 'len' BignumInts containing n,
+ * and 'mninv' the inverse of -n mod 2^BIGNUM_INT_BITS, as returned by
+ * monty_mninv.
  *
- * 'tmp' is an array of BignumInt used as scratch space, of length at
- * least 3*len + mul_compute_scratch(len).
+ * This works a word at a time: multiplying the least significant
+ * word of x by mninv gives the multiple of n which, added to x,
+ * makes that word zero. After 'len' such steps x is an exact multiple
+ * of r and the division is a matter of taking the top half. Doing it
+ * this way needs len^2 multiplications, less than the two separate
+ * multiplications of a reduction with a full-length inverse of n.
  */
 static void monty_reduce(BignumInt *x, const BignumInt *n,
-                         const BignumInt *mninv, BignumInt *tmp, int len)
+                         BignumInt mninv, int len)
 {
-    int i;
-    BignumInt carry;
+    int i, j;
+    BignumInt m, unused, carry;
+    BignumCarry topcarry = 0;
 
-    /*
-     * Multiply x by (-n)^{-1} mod r. This gives us a value m such
-     * that mn is congruent to -x mod r. Hence, mn+x is an exact
-     * multiple of r, and is also (obviously) congruent to x mod n.
-     */
-    internal_mul_low(x + len, mninv, tmp, len, tmp + 3*len);
+    for (i = 2*len - 1; i >= len; i--) {
+        BignumMUL(unused, m, x[i], mninv);
+
+        carry = 0;
+        for (j = len - 1; j >= 0; j--) {
+            BignumInt *xp = x + i - (len - 1 - j);
+            BignumMULADD2(carry, *xp, m, n[j], *xp, carry);
+        }
+
+        /*
+         * The carry goes into the word above the ones we just added
+         * to. Anything carried out of that word is left for the next
+         * step, which adds into the word above it.
+         */
+        BignumADC(x[i - len], topcarry, x[i - len], carry, topcarry);
+    }
+    (void)unused;
 
-    /*
-     * Compute t = (mn+x)/r in ordinary, non-modular, integer
-     * arithmetic. By construction this is exact, and is congruent mod
-     * n to x * r^{-1}, i.e. the answer we want.
-     *
-     * The following multiply leaves that answer in the _most_
-     * significant half of the 'x' array, so then we must shift it
-     * down.
-     */
-    internal_mul(tmp, n, tmp+len, len, tmp + 3*len);
-    carry = internal_add(x, tmp+len, x, 2*len);
     for (i = 0; i < len; i++)
         x[len + i] = x[i], x[i] = 0;
 
     /*
-     * Reduce t mod n. This doesn't require a full-on division by n,
-     * but merely a test and single optional subtraction, since we can
-     * show that 0 <= t < 2n.
+     * The words we multiplied n by make up a number m, and we now
+     * have t = (mn+x)/r. Reduce t mod n. This doesn't require a
+     * full-on division by n, but merely a test and single optional
+     * subtraction, since we can show that 0 <= t < 2n.
      *
      * Proof:
-     *  + we computed m mod r, so 0 <= m < r.
+     *  + m has len words, so 0 <= m < r.
      *  + so 0 <= mn < rn, obviously
      *  + hence we only need 0 <= x < rn to guarantee that 0 <= mn+x < 2rn
      *  + yielding 0 <= (mn+x)/r < 2n as required.
      */
-    if (!carry) {
-        for (i = 0; i < len; i++)
-            if (x[len + i] != n[i])
-                break;
+    internal_sub_if_ge(x + len, n, topcarry, len);
+}
+
+/*
+ * Montgomery multiplication. Computes x y r^{-1} mod n, leaving it in
+ * the least significant half of 'out', a big-endian array of 2*len
+ * BignumInts. 'x' and 'y' have 'len' words each and may be the same
+ * array, in which case the cheaper squaring is used. 'scratch' needs
+ * mul_compute_scratch(len) words.
+ */
+static void monty_mul(BignumInt *out, const BignumInt *x, const BignumInt *y,
+                      const BignumInt *n, BignumInt mninv, int len,
+                      BignumInt *scratch)
+{
+    if (x == y)
+        internal_sqr(x, out, len, scratch);
+    else
+        internal_mul(x, y, out, len, scratch);
+    monty_reduce(out, n, mninv, len);
+}
+
+/*
+ * Sets x = 2x mod n, for 0 <= x < n. Both are big-endian arrays of
+ * 'len' BignumInts. Doubling is the same in Montgomery representation.
+ */
+static void internal_double_mod(BignumInt *x, const BignumInt *n, int len)
+{
+    int i;
+    BignumInt top = 0;
+
+    for (i = len - 1; i >= 0; i--) {
+        BignumInt t = x[i] >> (BIGNUM_INT_BITS - 1);
+        x[i] = (x[i] << 1) | top;
+        top = t;
     }
-    if (carry || i >= len || x[len + i] > n[i])
-        internal_sub(x+len, n, x+len, len);
+    internal_sub_if_ge(x, n, (BignumCarry)top, len);
 }
 
 static void internal_add_shifted(BignumInt *number,
@@ -1051,15 +1086,25 @@ Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
     return result;
 }
 
+/*
+ * Exponents longer than this are processed in windows of
+ * MODPOW_WINDOW bits, using a table of the first 2^MODPOW_WINDOW
+ * powers of the base. Shorter ones, like the public exponents of RSA,
+ * would not make up for the cost of the table.
+ */
+#define MODPOW_WINDOW 4
+#define MODPOW_WINDOW_MIN_BITS 64
+
 /*
  * Compute (base ^ exp) % mod. Uses the Montgomery multiplication
  * technique where possible, falling back to modpow_simple otherwise.
  */
 Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
 {
-    BignumInt *a, *b, *x, *n, *mninv, *scratch;
-    int len, scratchlen, i, j;
-    Bignum base, base2, r, rn, inv, result;
+    BignumInt *a, *b, *t, *n, *table, *scratch;
+    BignumInt mninv;
+    int len, scratchlen, ebits, window, tablesize, w, i, j;
+    Bignum base, base2, r, rn, result;
 
     /*
      * The most significant word of mod needs to be non-zero. It
@@ -1080,23 +1125,13 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
      */
     base = bigmod(base_in, mod);
 
-    /*
-     * Compute the inverse of n mod r, for monty_reduce. (In fact we
-     * want the inverse of _minus_ n mod r, but we'll sort that out
-     * below.)
-     */
-    len = mod[0];
-    r = bn_power_2(BIGNUM_INT_BITS * len);
-    inv = modinv(mod, r);
-    assert(inv); /* cannot fail, since mod is odd and r is a power of 2 */
-
     /*
      * Multiply the base by r mod n, to get it into Montgomery
      * representation.
      */
+    len = mod[0];
+    r = bn_power_2(BIGNUM_INT_BITS * len);
     base2 = modmul(base, r, mod);
-    freebn(base);
-    base = base2;
 
     rn = bigmod(r, mod);               /* r mod n, i.e. Montgomerified 1 */
 
@@ -1104,74 +1139,100 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
 
     /*
      * Set up internal arrays of the right lengths, in big-endian
-     * format, containing the base, the modulus, and the modulus's
-     * inverse.
+     * format, containing the modulus and the powers of the base.
+     * For monty_reduce we need the inverse of -n modulo a single
+     * word.
      */
     n = snewn(len, BignumInt);
     for (j = 0; j < len; j++)
 	n[len - 1 - j] = mod[j + 1];
+    mninv = monty_mninv(n[len - 1]);
 
-    mninv = snewn(len, BignumInt);
-    for (j = 0; j < len; j++)
-	mninv[len - 1 - j] = (j < (int)inv[0] ? inv[j + 1] : 0);
-    freebn(inv);         /* we don't need this copy of it any more */
-    /* Now negate mninv mod r, so it's the inverse of -n rather than +n. */
-    x = snewn(len, BignumInt);
-    for (j = 0; j < len; j++)
-        x[j] = 0;
-    internal_sub(x, mninv, mninv, len);
+    ebits = bignum_bitcount(exp);
+    window = ebits > MODPOW_WINDOW_MIN_BITS ? MODPOW_WINDOW : 1;
 
-    /* x = snewn(len, BignumInt); */ /* already done above */
-    for (j = 0; j < len; j++)
-	x[len - 1 - j] = (j < (int)base[0] ? base[j + 1] : 0);
-    freebn(base);        /* we don't need this copy of it any more */
+    /*
+     * Diffie-Hellman groups use 2 as generator. Multiplying by 2 is
+     * a matter of a shift and a subtraction, so instead of using a
+     * table, double after each squaring for the bits which are set.
+     */
+    if (window > 1 && base[0] == 1 && base[1] == 2)
+        window = 0;
+    freebn(base);
+
+    tablesize = window ? 1 << window : 2;
+    table = snewn(tablesize * len, BignumInt);
+    for (j = 0; j < len; j++) {
+	table[len - 1 - j] = (j < (int)rn[0] ? rn[j + 1] : 0);
+	table[2*len - 1 - j] = (j < (int)base2[0] ? base2[j + 1] : 0);
+    }
+    freebn(rn);
+    freebn(base2);
 
     a = snewn(2*len, BignumInt);
     b = snewn(2*len, BignumInt);
-    for (j = 0; j < len; j++)
-	a[2*len - 1 - j] = (j < (int)rn[0] ? rn[j + 1] : 0);
-    freebn(rn);
+    for (j = 0; j < 2*len; j++)
+        a[j] = 0;
 
     /* Scratch space for multiplies */
-    scratchlen = 3*len + mul_compute_scratch(len);
+    scratchlen = mul_compute_scratch(len);
     scratch = snewn(scratchlen, BignumInt);
 
-    /* Skip leading zero bits of exp. */
-    i = 0;
-    j = BIGNUM_INT_BITS-1;
-    while (i < (int)exp[0] && (exp[exp[0] - i] & ((BignumInt)1 << j)) == 0) {
-	j--;
-	if (j < 0) {
-	    i++;
-	    j = BIGNUM_INT_BITS-1;
-	}
+    /* The rest of the table: base^i = base^(i-1) * base */
+    for (i = 2; i < tablesize; i++) {
+        monty_mul(b, table + (i-1) * len, table + len, n, mninv, len,
+                  scratch);
+        for (j = 0; j < len; j++)
+            table[i * len + j] = b[len + j];
     }
 
     /* Main computation */
-    while (i < (int)exp[0]) {
-	while (j >= 0) {
-	    internal_mul(a + len, a + len, b, len, scratch);
-            monty_reduce(b, n, mninv, scratch, len);
-	    if ((exp[exp[0] - i] & ((BignumInt)1 << j)) != 0) {
-                internal_mul(b + len, x, a, len,  scratch);
-                monty_reduce(a, n, mninv, scratch, len);
-	    } else {
-		BignumInt *t;
-		t = a;
-		a = b;
-		b = t;
-	    }
-	    j--;
-	}
-	i++;
-	j = BIGNUM_INT_BITS-1;
+    if (ebits == 0) {
+        /* Anything to the power of zero is one */
+        for (j = 0; j < len; j++)
+            a[len + j] = table[j];
+    } else if (!window) {
+        /* Start with the base for the most significant bit */
+        for (j = 0; j < len; j++)
+            a[len + j] = table[len + j];
+        for (i = ebits - 2; i >= 0; i--) {
+            monty_mul(b, a + len, a + len, n, mninv, len, scratch);
+            t = a, a = b, b = t;
+            if (bignum_bit(exp, i))
+                internal_double_mod(a + len, n, len);
+        }
+    } else {
+        /*
+         * Windows are aligned to multiples of the window size from
+         * the least significant bit, so the most significant one can
+         * be shorter. It is never zero, start with its power.
+         */
+        i = ebits - 1 - (ebits - 1) % window;
+        for (w = 0, j = ebits - 1; j >= i; j--)
+            w = (w << 1) | bignum_bit(exp, j);
+        for (j = 0; j < len; j++)
+            a[len + j] = table[w * len + j];
+
+        while (i > 0) {
+            i -= window;
+            for (w = 0, j = i + window - 1; j >= i; j--) {
+                monty_mul(b, a + len, a + len, n, mninv, len, scratch);
+                t = a, a = b, b = t;
+                w = (w << 1) | bignum_bit(exp, j);
+            }
+            if (w) {
+                monty_mul(b, a + len, table + w * len, n, mninv, len,
+                          scratch);
+                t = a, a = b, b = t;
+            }
+        }
     }
 
     /*
      * Final monty_reduce to get back from the adjusted Montgomery
      * representation.
      */
-    monty_reduce(a, n, mninv, scratch, len);
+    monty_reduce(a, n, mninv, len);
 
     /* Copy result to buffer */
     result = newbn(mod[0]);
@@ -1187,12 +1248,10 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
     sfree(a);
     smemclr(b, 2 * len * sizeof(*b));
     sfree(b);
-    smemclr(mninv, len * sizeof(*mninv));
-    sfree(mninv);
+    smemclr(table, tablesize * len * sizeof(*table));
+    sfree(table);
     smemclr(n, len * sizeof(*n));
     sfree(n);
-    smemclr(x, len * sizeof(*x));
-    sfree(x);
 
     return result;
 }
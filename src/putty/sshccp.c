@@ -32,6 +32,17 @@
 #include "ssh.h"
 #include "sshbn.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CCP_X86 1
+#define CCP_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define CCP_X86 1
+#define CCP_TARGET(isa)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
 #ifndef INLINE
 #define INLINE
 #endif
@@ -155,8 +166,298 @@ static void chacha20_iv(struct chacha20 *ctx, const unsigned char *iv)
     ctx->currentIndex = 64;
 }
 
+/* Moves the block counter on after generating blocks outside of
+ * chacha20_round */
+static INLINE void chacha20_advance(struct chacha20 *ctx, uint32 blocks)
+{
+    uint32 old = ctx->state[12];
+    ctx->state[12] += blocks;
+    if (ctx->state[12] < old) {
+        ++ctx->state[13];
+    }
+}
+
+/*
+ * SIMD versions generating several blocks at once, each vector holding
+ * the same word of 4 (SSE2) or 8 (AVX2) consecutive blocks. The keystream
+ * is xored straight into the data, which has to consist of a multiple of
+ * that many whole blocks.
+ */
+
+#if CCP_X86
+
+/* The block counters of consecutive blocks, carrying into the high word */
+static void chacha20_counters(const struct chacha20 *ctx, int n,
+                              uint32 *lo, uint32 *hi)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        lo[i] = ctx->state[12] + i;
+        hi[i] = ctx->state[13] + (lo[i] < ctx->state[12]);
+    }
+}
+
+#define rotl128(x, n) _mm_or_si128(_mm_slli_epi32(x, n), \
+                                   _mm_srli_epi32(x, 32 - (n)))
+#define qrop128(a, b, c, d)                     \
+    x[a] = _mm_add_epi32(x[a], x[b]);           \
+    x[c] = _mm_xor_si128(x[c], x[a]);           \
+    x[c] = rotl128(x[c], d)
+#define quarter128(a, b, c, d)                  \
+    qrop128(a, b, d, 16);                       \
+    qrop128(c, d, b, 12);                       \
+    qrop128(a, b, d, 8);                        \
+    qrop128(c, d, b, 7)
+
+/* Turns words w..w+3 of 4 blocks into 16 bytes of each block */
+#define transpose128(a, b, c, d) do {           \
+        __m128i t0 = _mm_unpacklo_epi32(a, b);  \
+        __m128i t1 = _mm_unpacklo_epi32(c, d);  \
+        __m128i t2 = _mm_unpackhi_epi32(a, b);  \
+        __m128i t3 = _mm_unpackhi_epi32(c, d);  \
+        a = _mm_unpacklo_epi64(t0, t1);         \
+        b = _mm_unpackhi_epi64(t0, t1);         \
+        c = _mm_unpacklo_epi64(t2, t3);         \
+        d = _mm_unpackhi_epi64(t2, t3);         \
+    } while (0)
+
+#define xor128(p, v) _mm_storeu_si128((__m128i *)(p), _mm_xor_si128( \
+            _mm_loadu_si128((const __m128i *)(p)), v))
+
+CCP_TARGET("sse2")
+static void chacha20_blocks_sse2(struct chacha20 *ctx,
+                                 unsigned char *blk, int blocks)
+{
+    __m128i s[16], x[16];
+    uint32 lo[4], hi[4];
+    int i, w;
+
+    for (; blocks >= 4; blocks -= 4, blk += 4 * 64) {
+        for (i = 0; i < 16; i++) {
+            s[i] = _mm_set1_epi32((int)ctx->state[i]);
+        }
+        chacha20_counters(ctx, 4, lo, hi);
+        s[12] = _mm_set_epi32((int)lo[3], (int)lo[2], (int)lo[1], (int)lo[0]);
+        s[13] = _mm_set_epi32((int)hi[3], (int)hi[2], (int)hi[1], (int)hi[0]);
+        memcpy(x, s, sizeof(x));
+
+        for (i = 0; i < 20; i += 2) {
+            quarter128(0, 4, 8, 12);
+            quarter128(1, 5, 9, 13);
+            quarter128(2, 6, 10, 14);
+            quarter128(3, 7, 11, 15);
+            quarter128(0, 5, 10, 15);
+            quarter128(1, 6, 11, 12);
+            quarter128(2, 7, 8, 13);
+            quarter128(3, 4, 9, 14);
+        }
+
+        for (w = 0; w < 16; w += 4) {
+            x[w] = _mm_add_epi32(x[w], s[w]);
+            x[w + 1] = _mm_add_epi32(x[w + 1], s[w + 1]);
+            x[w + 2] = _mm_add_epi32(x[w + 2], s[w + 2]);
+            x[w + 3] = _mm_add_epi32(x[w + 3], s[w + 3]);
+            transpose128(x[w], x[w + 1], x[w + 2], x[w + 3]);
+            xor128(blk + w * 4, x[w]);
+            xor128(blk + 64 + w * 4, x[w + 1]);
+            xor128(blk + 128 + w * 4, x[w + 2]);
+            xor128(blk + 192 + w * 4, x[w + 3]);
+        }
+
+        chacha20_advance(ctx, 4);
+    }
+
+    smemclr(s, sizeof(s));
+    smemclr(x, sizeof(x));
+}
+
+#undef rotl128
+#undef qrop128
+#undef quarter128
+
+/* AVX2 can rotate by whole bytes with a shuffle */
+#define rotl256(x, n)                                                   \
+    ((n) == 16 ? _mm256_shuffle_epi8(x, rot16) :                        \
+     (n) == 8 ? _mm256_shuffle_epi8(x, rot8) :                          \
+     _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n))))
+#define qrop256(a, b, c, d)                     \
+    x[a] = _mm256_add_epi32(x[a], x[b]);        \
+    x[c] = _mm256_xor_si256(x[c], x[a]);        \
+    x[c] = rotl256(x[c], d)
+#define quarter256(a, b, c, d)                  \
+    qrop256(a, b, d, 16);                       \
+    qrop256(c, d, b, 12);                       \
+    qrop256(a, b, d, 8);                        \
+    qrop256(c, d, b, 7)
+
+/* Same as transpose128, for blocks n and n+4 in the two halves */
+#define transpose256(a, b, c, d) do {                   \
+        __m256i t0 = _mm256_unpacklo_epi32(a, b);       \
+        __m256i t1 = _mm256_unpacklo_epi32(c, d);       \
+        __m256i t2 = _mm256_unpackhi_epi32(a, b);       \
+        __m256i t3 = _mm256_unpackhi_epi32(c, d);       \
+        a = _mm256_unpacklo_epi64(t0, t1);              \
+        b = _mm256_unpackhi_epi64(t0, t1);              \
+        c = _mm256_unpacklo_epi64(t2, t3);              \
+        d = _mm256_unpackhi_epi64(t2, t3);              \
+    } while (0)
+
+#define xor256(p, v) _mm256_storeu_si256((__m256i *)(p), _mm256_xor_si256( \
+            _mm256_loadu_si256((const __m256i *)(p)), v))
+
+CCP_TARGET("avx2")
+static void chacha20_blocks_avx2(struct chacha20 *ctx,
+                                 unsigned char *blk, int blocks)
+{
+    const __m256i rot16 = _mm256_set_epi8(
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+    __m256i s[16], x[16];
+    uint32 lo[8], hi[8];
+    int i, w, b;
+
+    for (; blocks >= 8; blocks -= 8, blk += 8 * 64) {
+        for (i = 0; i < 16; i++) {
+            s[i] = _mm256_set1_epi32((int)ctx->state[i]);
+        }
+        chacha20_counters(ctx, 8, lo, hi);
+        s[12] = _mm256_set_epi32((int)lo[7], (int)lo[6], (int)lo[5],
+                                 (int)lo[4], (int)lo[3], (int)lo[2],
+                                 (int)lo[1], (int)lo[0]);
+        s[13] = _mm256_set_epi32((int)hi[7], (int)hi[6], (int)hi[5],
+                                 (int)hi[4], (int)hi[3], (int)hi[2],
+                                 (int)hi[1], (int)hi[0]);
+        memcpy(x, s, sizeof(x));
+
+        for (i = 0; i < 20; i += 2) {
+            quarter256(0, 4, 8, 12);
+            quarter256(1, 5, 9, 13);
+            quarter256(2, 6, 10, 14);
+            quarter256(3, 7, 11, 15);
+            quarter256(0, 5, 10, 15);
+            quarter256(1, 6, 11, 12);
+            quarter256(2, 7, 8, 13);
+            quarter256(3, 4, 9, 14);
+        }
+
+        for (i = 0; i < 16; i++) {
+            x[i] = _mm256_add_epi32(x[i], s[i]);
+        }
+        for (w = 0; w < 16; w += 4) {
+            transpose256(x[w], x[w + 1], x[w + 2], x[w + 3]);
+        }
+
+        /* Words 0-7 of a block from the first two groups, 8-15 from the
+         * other two */
+        for (w = 0; w < 16; w += 8) {
+            for (b = 0; b < 4; b++) {
+                xor256(blk + b * 64 + w * 4,
+                       _mm256_permute2x128_si256(x[w + b], x[w + 4 + b], 0x20));
+                xor256(blk + (b + 4) * 64 + w * 4,
+                       _mm256_permute2x128_si256(x[w + b], x[w + 4 + b], 0x31));
+            }
+        }
+
+        chacha20_advance(ctx, 8);
+    }
+
+    smemclr(s, sizeof(s));
+    smemclr(x, sizeof(x));
+}
+
+#undef rotl256
+#undef qrop256
+#undef quarter256
+
+static int chacha20_cpu_has_avx2(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return FALSE;
+    __cpuid(info, 1);
+    /* The OS has to save the AVX registers as well */
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) ||
+        (_xgetbv(0) & 6) != 6)
+        return FALSE;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static int chacha20_cpu_has_sse2(void)
+{
+#if defined(_MSC_VER) || defined(__x86_64__)
+    return TRUE;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif
+
+static int ccp_simd = -1;
+
+int ccp_limit_simd(int level)
+{
+    int supported = CCP_SIMD_NONE;
+
+#if CCP_X86
+    if (chacha20_cpu_has_avx2())
+        supported = CCP_SIMD_AVX2;
+    else if (chacha20_cpu_has_sse2())
+        supported = CCP_SIMD_SSE2;
+#endif
+
+    ccp_simd = level < supported ? level : supported;
+    return ccp_simd;
+}
+
+/* Returns how many of the given whole blocks got encrypted */
+static int chacha20_simd_blocks(struct chacha20 *ctx,
+                                unsigned char *blk, int blocks)
+{
+    int done = 0;
+
+    if (ccp_simd < 0)
+        ccp_limit_simd(CCP_SIMD_AVX2);
+
+#if CCP_X86
+    if (ccp_simd >= CCP_SIMD_AVX2 && blocks >= 8) {
+        done = blocks & ~7;
+        chacha20_blocks_avx2(ctx, blk, done);
+    }
+    if (ccp_simd >= CCP_SIMD_SSE2 && blocks - done >= 4) {
+        int n = (blocks - done) & ~3;
+        chacha20_blocks_sse2(ctx, blk + done * 64, n);
+        done += n;
+    }
+#endif
+
+    return done;
+}
+
 static void chacha20_encrypt(struct chacha20 *ctx, unsigned char *blk, int len)
 {
+    int done;
+
+    /* Use up what's left of the current block first */
+    while (ctx->currentIndex < 64 && len) {
+        *blk++ ^= ctx->current[ctx->currentIndex++];
+        --len;
+    }
+
+    /* Whole blocks several at a time, that's the bulk of a packet */
+    done = chacha20_simd_blocks(ctx, blk, len / 64) * 64;
+    blk += done;
+    len -= done;
+
     while (len) {
         /* If we don't have any state left, then cycle to the next */
         if (ctx->currentIndex >= 64) {
@@ -180,6 +481,225 @@ static INLINE void chacha20_decrypt(struct chacha20 *ctx,
 
 /* Poly1305 implementation (no AES, nonce is not encrypted) */
 
+#if BIGNUM_INT_BITS == 64
+
+/*
+ * With 64-bit words, r and h are kept in three limbs of 44, 44 and 42
+ * bits. The products of a whole block then fit into three double words
+ * without carrying between limbs, and reducing mod p = 2^130-5 is folded
+ * into the multiplication by premultiplying the top limbs of r by 5 * 4.
+ */
+
+#define POLY_MASK44 (((BignumInt)1 << 44) - 1)
+#define POLY_MASK42 (((BignumInt)1 << 42) - 1)
+
+/*
+ * Double word accumulators for the products. Where there is a native
+ * double word type, the compiler does best with it, otherwise they are
+ * kept as two words.
+ */
+#ifdef DEFINE_BIGNUMDBLINT
+DEFINE_BIGNUMDBLINT;
+typedef BignumDblInt poly_acc;
+#define POLY_MUL(acc, a, b) ((acc) = (BignumDblInt)(a) * (b))
+#define POLY_MULADD(acc, a, b) ((acc) += (BignumDblInt)(a) * (b))
+#define POLY_ADD(acc, w) ((acc) += (w))
+/* Shifts right by n bits, 0 < n < 64, truncating to a word */
+#define POLY_SHR(acc, n) ((BignumInt)((acc) >> (n)))
+#define POLY_LO(acc) ((BignumInt)(acc))
+#else
+typedef struct { BignumInt hi, lo; } poly_acc;
+#define POLY_MUL(acc, a, b) BignumMUL((acc).hi, (acc).lo, a, b)
+#define POLY_MULADD(acc, a, b) do {                     \
+        BignumInt MA_hi, MA_lo;                         \
+        BignumCarry MA_c;                               \
+        BignumMUL(MA_hi, MA_lo, a, b);                  \
+        BignumADC((acc).lo, MA_c, (acc).lo, MA_lo, 0);  \
+        (acc).hi += MA_hi + MA_c;                       \
+    } while (0)
+#define POLY_ADD(acc, w) do {                           \
+        BignumCarry MA_c;                               \
+        BignumADC((acc).lo, MA_c, (acc).lo, w, 0);      \
+        (acc).hi += MA_c;                               \
+    } while (0)
+#define POLY_SHR(acc, n) (((acc).lo >> (n)) | ((acc).hi << (64 - (n))))
+#define POLY_LO(acc) ((acc).lo)
+#endif
+
+struct poly1305 {
+    unsigned char nonce[16];
+    BignumInt r[3];
+    BignumInt s[2];     /* r[1] and r[2] multiplied by 5 * 4 */
+    BignumInt h[3];
+
+    /* Buffer in case we get less that a multiple of 16 bytes */
+    unsigned char buffer[16];
+    int bufferIndex;
+};
+
+static INLINE BignumInt poly1305_get_le64(const unsigned char *p)
+{
+    return (BignumInt)GET_32BIT_LSB_FIRST(p) |
+        ((BignumInt)GET_32BIT_LSB_FIRST(p + 4) << 32);
+}
+
+static void poly1305_init(struct poly1305 *ctx)
+{
+    memset(ctx->nonce, 0, 16);
+    ctx->bufferIndex = 0;
+    ctx->h[0] = ctx->h[1] = ctx->h[2] = 0;
+}
+
+/* Takes a 256 bit key */
+static void poly1305_key(struct poly1305 *ctx, const unsigned char *key)
+{
+    BignumInt t0 = poly1305_get_le64(key);
+    BignumInt t1 = poly1305_get_le64(key + 8);
+
+    /* Split into limbs, clamping r as required by the spec */
+    ctx->r[0] = t0 & 0xffc0fffffffULL;
+    ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    ctx->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+    ctx->s[0] = ctx->r[1] * (5 << 2);
+    ctx->s[1] = ctx->r[2] * (5 << 2);
+
+    /* Use second 128 bits are the nonce */
+    memcpy(ctx->nonce, key+16, 16);
+}
+
+/* Processes 16 byte blocks, hibit is the 1 bit appended to each */
+static void poly1305_blocks(struct poly1305 *ctx,
+                            const unsigned char *buf, int blocks,
+                            BignumInt hibit)
+{
+    BignumInt r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2];
+    BignumInt s1 = ctx->s[0], s2 = ctx->s[1];
+    BignumInt h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+    BignumInt t0, t1, c;
+    poly_acc d0, d1, d2;
+
+    for (; blocks; blocks--, buf += 16) {
+        t0 = poly1305_get_le64(buf);
+        t1 = poly1305_get_le64(buf + 8);
+
+        h0 += t0 & POLY_MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & POLY_MASK44;
+        h2 += ((t1 >> 24) & POLY_MASK42) | hibit;
+
+        /* h *= r */
+        POLY_MUL(d0, h0, r0);
+        POLY_MULADD(d0, h1, s2);
+        POLY_MULADD(d0, h2, s1);
+        POLY_MUL(d1, h0, r1);
+        POLY_MULADD(d1, h1, r0);
+        POLY_MULADD(d1, h2, s2);
+        POLY_MUL(d2, h0, r2);
+        POLY_MULADD(d2, h1, r1);
+        POLY_MULADD(d2, h2, r0);
+
+        /* Partial reduction mod p */
+        c = POLY_SHR(d0, 44);
+        h0 = POLY_LO(d0) & POLY_MASK44;
+        POLY_ADD(d1, c);
+        c = POLY_SHR(d1, 44);
+        h1 = POLY_LO(d1) & POLY_MASK44;
+        POLY_ADD(d2, c);
+        c = POLY_SHR(d2, 42);
+        h2 = POLY_LO(d2) & POLY_MASK42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= POLY_MASK44;
+        h1 += c;
+    }
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+}
+
+/* Feed whole 16 byte chunks */
+static void poly1305_feed_blocks(struct poly1305 *ctx,
+                                 const unsigned char *buf, int blocks)
+{
+    poly1305_blocks(ctx, buf, blocks, (BignumInt)1 << 40);
+}
+
+/* Feed up to 16 bytes (should only be less for the last chunk) */
+static void poly1305_feed_chunk(struct poly1305 *ctx,
+                                const unsigned char *chunk, int len)
+{
+    unsigned char block[16];
+
+    if (len == 16) {
+        poly1305_feed_blocks(ctx, chunk, 1);
+        return;
+    }
+
+    /* A partial chunk has its 1 bit right after the data */
+    memcpy(block, chunk, len);
+    block[len] = 1;
+    memset(block + len + 1, 0, 15 - len);
+    poly1305_blocks(ctx, block, 1, 0);
+    smemclr(block, sizeof(block));
+}
+
+/* Finalise and populate buffer with 16 byte with MAC */
+static void poly1305_finalise(struct poly1305 *ctx, unsigned char *mac)
+{
+    BignumInt h0, h1, h2, g0, g1, g2, c, mask, t0, t1;
+    int i;
+
+    if (ctx->bufferIndex) {
+        poly1305_feed_chunk(ctx, ctx->buffer, ctx->bufferIndex);
+    }
+
+    /* Fully carry h */
+    h0 = ctx->h[0];
+    h1 = ctx->h[1];
+    h2 = ctx->h[2];
+    c = h1 >> 44; h1 &= POLY_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+    h1 += c; c = h1 >> 44; h1 &= POLY_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+    h1 += c;
+
+    /* Compute h - p and take it instead of h if it did not underflow,
+     * without branching on secret data */
+    g0 = h0 + 5; c = g0 >> 44; g0 &= POLY_MASK44;
+    g1 = h1 + c; c = g1 >> 44; g1 &= POLY_MASK44;
+    g2 = h2 + c - ((BignumInt)1 << 42);
+    mask = (g2 >> 63) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+
+    /* Add the nonce mod 2^128 */
+    t0 = poly1305_get_le64(ctx->nonce);
+    t1 = poly1305_get_le64(ctx->nonce + 8);
+    h0 += t0 & POLY_MASK44; c = h0 >> 44; h0 &= POLY_MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & POLY_MASK44) + c;
+    c = h1 >> 44; h1 &= POLY_MASK44;
+    h2 += ((t1 >> 24) & POLY_MASK42) + c;
+
+    h0 = h0 | (h1 << 44);
+    h1 = (h1 >> 20) | (h2 << 24);
+    for (i = 0; i < 8; i++) {
+        mac[i] = (unsigned char)(h0 >> (8 * i));
+        mac[i + 8] = (unsigned char)(h1 >> (8 * i));
+    }
+}
+
+#undef POLY_MUL
+#undef POLY_MULADD
+#undef POLY_ADD
+#undef POLY_SHR
+#undef POLY_LO
+
+#else
+
+
 #define NWORDS ((130 + BIGNUM_INT_BITS-1) / BIGNUM_INT_BITS)
 typedef struct bigval {
     BignumInt w[NWORDS];
@@ -807,6 +1327,31 @@ static void poly1305_feed_chunk(struct poly1305 *ctx,
     bigval_mul_mod_p(&ctx->h, &c, &ctx->r);
 }
 
+/* Feed whole 16 byte chunks */
+static void poly1305_feed_blocks(struct poly1305 *ctx,
+                                 const unsigned char *buf, int blocks)
+{
+    for (; blocks; blocks--, buf += 16)
+        poly1305_feed_chunk(ctx, buf, 16);
+}
+
+/* Finalise and populate buffer with 16 byte with MAC */
+static void poly1305_finalise(struct poly1305 *ctx, unsigned char *mac)
+{
+    bigval tmp;
+
+    if (ctx->bufferIndex) {
+        poly1305_feed_chunk(ctx, ctx->buffer, ctx->bufferIndex);
+    }
+
+    bigval_import_le(&tmp, ctx->nonce, 16);
+    bigval_final_reduce(&ctx->h);
+    bigval_add(&tmp, &tmp, &ctx->h);
+    bigval_export_le(&tmp, mac, 16);
+}
+
+#endif
+
 static void poly1305_feed(struct poly1305 *ctx,
                           const unsigned char *buf, int len)
 {
@@ -824,10 +1369,10 @@ static void poly1305_feed(struct poly1305 *ctx,
     }
 
     /* Process 16 byte whole chunks */
-    while (len >= 16) {
-        poly1305_feed_chunk(ctx, buf, 16);
-        len -= 16;
-        buf += 16;
+    if (len >= 16) {
+        poly1305_feed_blocks(ctx, buf, len / 16);
+        buf += len & ~15;
+        len &= 15;
     }
 
     /* Cache stuff that's left over */
@@ -837,21 +1382,6 @@ static void poly1305_feed(struct poly1305 *ctx,
     }
 }
 
-/* Finalise and populate buffer with 16 byte with MAC */
-static void poly1305_finalise(struct poly1305 *ctx, unsigned char *mac)
-{
-    bigval tmp;
-
-    if (ctx->bufferIndex) {
-        poly1305_feed_chunk(ctx, ctx->buffer, ctx->bufferIndex);
-    }
-
-    bigval_import_le(&tmp, ctx->nonce, 16);
-    bigval_final_reduce(&ctx->h);
-    bigval_add(&tmp, &tmp, &ctx->h);
-    bigval_export_le(&tmp, mac, 16);
-}
-
 /* SSH-2 wrapper */
 
 struct ccp_context {
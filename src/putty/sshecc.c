@@ -8,6 +8,10 @@
  *       Montgomery form curves are supported for DH. (Curve25519)
  *
  *       Edwards form curves are supported for DSA. (Ed25519)
+ *
+ *       Curve25519 key exchange and Ed25519 signature verification,
+ *       the parts needed on every connection, use Nettle's much faster
+ *       implementation instead of the generic maths.
  */
 
 /*
@@ -36,6 +40,8 @@
 #include <assert.h>
 
 #include "ssh.h"
+#include <nettle/curve25519.h>
+#include <nettle/eddsa.h>
 
 /* ----------------------------------------------------------------------
  * Elliptic curve definitions
@@ -2270,8 +2276,8 @@ static int ecdsa_verifysig(void *key, const char *sig, int siglen,
     getstring(&sig, &siglen, &p, &slen);
     if (!p) return 0;
     if (ec->publicKey.curve->type == EC_EDWARDS) {
-        struct ec_point *r;
-        Bignum s, h;
+        unsigned char pub[ED25519_KEY_SIZE];
+        int i;
 
         /* Check that the signature is two times the length of a point */
         if (slen != (ec->publicKey.curve->fieldBits / 8) * 2) {
@@ -2283,90 +2289,15 @@ static int ecdsa_verifysig(void *key, const char *sig, int siglen,
             return 0;
         }
 
-        /* Get the signature */
-        r = ec_point_new(ec->publicKey.curve, NULL, NULL, NULL, 0);
-        if (!r) {
-            return 0;
-        }
-        if (!decodepoint(p, ec->publicKey.curve->fieldBits / 8, r)) {
-            ec_point_free(r);
-            return 0;
+        /* Encode pk: y, with the first bit of x in place of its last bit */
+        for (i = 0; i < ED25519_KEY_SIZE - 1; ++i) {
+            pub[i] = bignum_byte(ec->publicKey.y, i);
         }
-        s = bignum_from_bytes_le((unsigned char*)p + (ec->publicKey.curve->fieldBits / 8),
-                                 ec->publicKey.curve->fieldBits / 8);
+        pub[i] = bignum_byte(ec->publicKey.y, i) & 0x7f;
+        pub[i] |= bignum_bit(ec->publicKey.x, 0) << 7;
 
-        /* Get the hash of the encoded value of R + encoded value of pk + message */
-        {
-            int i, pointlen;
-            unsigned char b;
-            unsigned char digest[512 / 8];
-            SHA512_State hs;
-            SHA512_Init(&hs);
-
-            /* Add encoded r (no need to encode it again, it was in the signature) */
-            SHA512_Bytes(&hs, p, ec->publicKey.curve->fieldBits / 8);
-
-            /* Encode pk and add it */
-            pointlen = ec->publicKey.curve->fieldBits / 8;
-            for (i = 0; i < pointlen - 1; ++i) {
-                b = bignum_byte(ec->publicKey.y, i);
-                SHA512_Bytes(&hs, &b, 1);
-            }
-            /* Unset last bit of y and set first bit of x in its place */
-            b = bignum_byte(ec->publicKey.y, i) & 0x7f;
-            b |= bignum_bit(ec->publicKey.x, 0) << 7;
-            SHA512_Bytes(&hs, &b, 1);
-
-            /* Add the message itself */
-            SHA512_Bytes(&hs, data, datalen);
-
-            /* Get the hash */
-            SHA512_Final(&hs, digest);
-
-            /* Convert to Bignum */
-            h = bignum_from_bytes_le(digest, sizeof(digest));
-        }
-
-        /* Verify sB == r + h*publicKey */
-        {
-            struct ec_point *lhs, *rhs, *tmp;
-
-            /* lhs = sB */
-            lhs = ecp_mul(&ec->publicKey.curve->e.B, s);
-            freebn(s);
-            if (!lhs) {
-                ec_point_free(r);
-                freebn(h);
-                return 0;
-            }
-
-            /* rhs = r + h*publicKey */
-            tmp = ecp_mul(&ec->publicKey, h);
-            freebn(h);
-            if (!tmp) {
-                ec_point_free(lhs);
-                ec_point_free(r);
-                return 0;
-            }
-            rhs = ecp_add(r, tmp, 0);
-            ec_point_free(r);
-            ec_point_free(tmp);
-            if (!rhs) {
-                ec_point_free(lhs);
-                return 0;
-            }
-
-            /* Check the point is the same */
-            ret = !bignum_cmp(lhs->x, rhs->x);
-            if (ret) {
-                ret = !bignum_cmp(lhs->y, rhs->y);
-                if (ret) {
-                    ret = 1;
-                }
-            }
-            ec_point_free(lhs);
-            ec_point_free(rhs);
-        }
+        ret = ed25519_sha512_verify(pub, datalen, (const uint8_t *)data,
+                                    (const uint8_t *)p);
     } else {
         Bignum r, s;
         unsigned char digest[512 / 8];
@@ -2696,35 +2627,49 @@ static Bignum ecdh_calculate(const Bignum private,
     ret = p->x;
     p->x = NULL;
 
-    if (p->curve->type == EC_MONTGOMERY) {
-        /*
-         * Endianness-swap. The Curve25519 algorithm definition
-         * assumes you were doing your computation in arrays of 32
-         * little-endian bytes, and now specifies that you take your
-         * final one of those and convert it into a bignum in
-         * _network_ byte order, i.e. big-endian.
-         *
-         * In particular, the spec says, you convert the _whole_ 32
-         * bytes into a bignum. That is, on the rare occasions that
-         * p->x has come out with the most significant 8 bits zero, we
-         * have to imagine that being represented by a 32-byte string
-         * with the last byte being zero, so that has to be converted
-         * into an SSH-2 bignum with the _low_ byte zero, i.e. a
-         * multiple of 256.
-         */
-        int i;
-        int bytes = (p->curve->fieldBits+7) / 8;
-        unsigned char *byteorder = snewn(bytes, unsigned char);
-        for (i = 0; i < bytes; ++i) {
-            byteorder[i] = bignum_byte(ret, i);
-        }
-        freebn(ret);
-        ret = bignum_from_bytes(byteorder, bytes);
-        smemclr(byteorder, bytes);
-        sfree(byteorder);
+    ec_point_free(p);
+    return ret;
+}
+
+/*
+ * Curve25519, the only Montgomery curve, is done by Nettle. The
+ * private key is kept as a Bignum, Nettle works on arrays of 32
+ * little-endian bytes.
+ */
+static Bignum curve25519_calculate(const Bignum private,
+                                   const unsigned char *public)
+{
+    unsigned char priv[CURVE25519_SIZE], shared[CURVE25519_SIZE];
+    unsigned char any = 0;
+    Bignum ret;
+    int i;
+
+    for (i = 0; i < CURVE25519_SIZE; ++i) {
+        priv[i] = bignum_byte(private, i);
     }
+    curve25519_mul(shared, priv, public);
+    smemclr(priv, sizeof(priv));
 
-    ec_point_free(p);
+    /* Points of small order give zero, reject them like the point at infinity */
+    for (i = 0; i < CURVE25519_SIZE; ++i) {
+        any |= shared[i];
+    }
+
+    /*
+     * The Curve25519 algorithm definition assumes you were doing your
+     * computation in arrays of 32 little-endian bytes, and now
+     * specifies that you take your final one of those and convert it
+     * into a bignum in _network_ byte order, i.e. big-endian.
+     *
+     * In particular, the spec says, you convert the _whole_ 32 bytes
+     * into a bignum. That is, on the rare occasions that the result
+     * has come out with the most significant 8 bits zero, we have to
+     * imagine that being represented by a 32-byte string with the last
+     * byte being zero, so that has to be converted into an SSH-2
+     * bignum with the _low_ byte zero, i.e. a multiple of 256.
+     */
+    ret = any ? bignum_from_bytes(shared, sizeof(shared)) : NULL;
+    smemclr(shared, sizeof(shared));
     return ret;
 }
 
@@ -2750,7 +2695,8 @@ void *ssh_ecdhkex_newkey(const struct ssh_kex *kex)
     key->publicKey.curve = curve;
 
     if (curve->type == EC_MONTGOMERY) {
-        unsigned char bytes[32] = {0};
+        unsigned char bytes[CURVE25519_SIZE] = {0};
+        unsigned char pub[CURVE25519_SIZE];
         int i;
 
         for (i = 0; i < sizeof(bytes); ++i)
@@ -2761,21 +2707,17 @@ void *ssh_ecdhkex_newkey(const struct ssh_kex *kex)
         bytes[31] &= 127;
         bytes[31] |= 64;
         key->privateKey = bignum_from_bytes_le(bytes, sizeof(bytes));
-        smemclr(bytes, sizeof(bytes));
         if (!key->privateKey) {
+            smemclr(bytes, sizeof(bytes));
             sfree(key);
             return NULL;
         }
-        publicKey = ecp_mul(&key->publicKey.curve->m.G, key->privateKey);
-        if (!publicKey) {
-            freebn(key->privateKey);
-            sfree(key);
-            return NULL;
-        }
-        key->publicKey.x = publicKey->x;
-        key->publicKey.y = publicKey->y;
+        /* The base point is fixed, Nettle has that case covered */
+        curve25519_mul_g(pub, bytes);
+        smemclr(bytes, sizeof(bytes));
+        key->publicKey.x = bignum_from_bytes_le(pub, sizeof(pub));
+        key->publicKey.y = NULL;
         key->publicKey.z = NULL;
-        sfree(publicKey);
     } else {
         key->privateKey = bignum_random_in_range(One, key->publicKey.curve->w.n);
         if (!key->privateKey) {
@@ -2848,11 +2790,8 @@ Bignum ssh_ecdhkex_getkey(void *key, char *remoteKey, int remoteKeyLen)
             return NULL;
         }
 
-        remote.curve = ec->publicKey.curve;
-        remote.infinity = 0;
-        remote.x = bignum_from_bytes_le((unsigned char*)remoteKey, remoteKeyLen);
-        remote.y = NULL;
-        remote.z = NULL;
+        return curve25519_calculate(ec->privateKey,
+                                    (const unsigned char *)remoteKey);
     }
 
     ret = ecdh_calculate(ec->privateKey, &remote);
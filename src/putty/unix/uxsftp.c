@@ -200,7 +200,8 @@ WFile *open_existing_wfile(const char *name, uint64 *size)
     int fd;
     WFile *ret;
 
-    fd = open(name, O_APPEND | O_WRONLY);
+    /* Not O_APPEND, that would make positioned writes append as well */
+    fd = open(name, O_WRONLY);
     if (fd < 0)
 	return NULL;
 
@@ -245,6 +246,30 @@ int write_to_file(WFile *f, void *buffer, int length)
     return so_far;
 }
 
+int write_to_file_at(WFile *f, uint64 offset, void *buffer, int length)
+{
+    char *p = (char *)buffer;
+    off_t fileofft = (((off_t) offset.hi << 16) << 16) + offset.lo;
+    int so_far = 0;
+
+    while (length > 0) {
+	int ret = pwrite(f->fd, p, length, fileofft);
+
+	if (ret < 0)
+	    return ret;
+
+	if (ret == 0)
+	    break;
+
+	p += ret;
+	length -= ret;
+	so_far += ret;
+	fileofft += ret;
+    }
+
+    return so_far;
+}
+
 void set_file_times(WFile *f, unsigned long mtime, unsigned long atime)
 {
     struct utimbuf ut;
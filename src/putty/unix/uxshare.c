@@ -20,7 +20,10 @@
 #include "proxy.h"
 #include "ssh.h"
 
-#define CONNSHARE_SOCKETDIR_PREFIX "/tmp/putty-connshare"
+/* FZ: Keep fzsftp's shared connections apart from PuTTY's. Their
+ * upstream goes away with the engine that started it, so no PuTTY
+ * session should attach to one. */
+#define CONNSHARE_SOCKETDIR_PREFIX "/tmp/fzsftp-connshare"
 #define SALT_FILENAME "salt"
 #define SALT_SIZE 64
 #ifndef PIPE_BUF
@@ -224,6 +224,22 @@ int write_to_file(WFile *f, void *buffer, int length)
 	return (int)written;
 }
 
+int write_to_file_at(WFile *f, uint64 offset, void *buffer, int length)
+{
+    int ret;
+    DWORD written;
+    OVERLAPPED ov;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = offset.lo;
+    ov.OffsetHigh = offset.hi;
+    ret = WriteFile(f->h, buffer, length, &written, &ov);
+    if (!ret)
+	return -1;		       /* error */
+    else
+	return (int)written;
+}
+
 void set_file_times(WFile *f, unsigned long mtime, unsigned long atime)
 {
     FILETIME actime, wrtime;
@@ -33,8 +33,9 @@
 #endif
 #endif
 
-#define CONNSHARE_PIPE_PREFIX "\\\\.\\pipe\\putty-connshare"
-#define CONNSHARE_MUTEX_PREFIX "Local\\putty-connshare-mutex"
+/* FZ: Keep fzsftp's shared connections apart from PuTTY's, see uxshare.c */
+#define CONNSHARE_PIPE_PREFIX "\\\\.\\pipe\\fzsftp-connshare"
+#define CONNSHARE_MUTEX_PREFIX "Local\\fzsftp-connshare-mutex"
 
 static char *obfuscate_name(const char *realname)
 {
@@ -20,7 +20,12 @@ enum class storjEvent {
 	count
 };
 
-#define FZSTORJ_PROTOCOL_VERSION 1
+#define FZSTORJ_PROTOCOL_VERSION 2
+
+// With -framed, events are sent as binary frames, laid out as described in
+// src/putty/fzprintf.h. Listing entries carry four text fields, transfer
+// progress a single integer.
+#define FZSTORJ_FRAME_MARKER 0x01
 
 #endif
 
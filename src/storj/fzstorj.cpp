@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "events.hpp"
 
@@ -9,12 +10,54 @@
 
 #include <map>
 
+#ifdef FZ_WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 fz::mutex output_mutex;
 
+bool framed{};
+
+namespace {
+void append_uint(std::string & frame, uint64_t v, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		frame += static_cast<char>(v & 0xff);
+		v >>= 8;
+	}
+}
+
+std::string frame_header(storjEvent event)
+{
+	std::string frame;
+	frame += static_cast<char>(FZSTORJ_FRAME_MARKER);
+	frame += static_cast<char>(event);
+	append_uint(frame, 0, 4);
+	return frame;
+}
+
+void send_frame(std::string & frame)
+{
+	std::string length;
+	append_uint(length, frame.size() - 6, 4);
+	frame.replace(2, 4, length);
+
+	fwrite(frame.c_str(), frame.size(), 1, stdout);
+	fflush(stdout);
+}
+}
+
 void fzprintf(storjEvent event)
 {
 	fz::scoped_lock l(output_mutex);
 
+	if (framed) {
+		std::string frame = frame_header(event);
+		send_frame(frame);
+		return;
+	}
+
 	fputc('0' + static_cast<int>(event), stdout);
 
 	fflush(stdout);
@@ -25,15 +68,48 @@ void fzprintf(storjEvent event, Args &&... args)
 {
 	fz::scoped_lock l(output_mutex);
 
+	std::string s = fz::sprintf(std::forward<Args>(args)...);
+
+	if (framed) {
+		// One text field per line, including empty ones
+		std::string frame = frame_header(event);
+		size_t start = 0;
+		while (true) {
+			size_t const pos = s.find('\n', start);
+			size_t const len = (pos == std::string::npos) ? s.size() - start : pos - start;
+			append_uint(frame, len, 4);
+			frame.append(s, start, len);
+			if (pos == std::string::npos) {
+				break;
+			}
+			start = pos + 1;
+		}
+		send_frame(frame);
+		return;
+	}
+
 	fputc('0' + static_cast<int>(event), stdout);
 
-	std::string s = fz::sprintf(std::forward<Args>(args)...);
 	fwrite(s.c_str(), s.size(), 1, stdout);
 
 	fputc('\n', stdout);
 	fflush(stdout);
 }
 
+void fztransfer(uint64_t bytes)
+{
+	if (!framed) {
+		fzprintf(storjEvent::Transfer, "%u", bytes);
+		return;
+	}
+
+	fz::scoped_lock l(output_mutex);
+
+	std::string frame = frame_header(storjEvent::Transfer);
+	append_uint(frame, bytes, 8);
+	send_frame(frame);
+}
+
 bool getLine(std::string & line)
 {
 	line.clear();
@@ -266,7 +342,7 @@ extern "C" void download_file_progress(double progress,
 {
 	uint64_t & lastProgress = *static_cast<uint64_t*>(handle);
 	if (downloaded_bytes > lastProgress) {
-		fzprintf(storjEvent::Transfer, "%u", downloaded_bytes - lastProgress);
+		fztransfer(downloaded_bytes - lastProgress);
 		lastProgress = downloaded_bytes;
 	}
 }
@@ -370,8 +446,18 @@ extern "C" void delete_bucket_callback(uv_work_t *work_req, int status)
 }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-framed")) {
+#ifdef FZ_WINDOWS
+			// Frames must not be subjected to linebreak conversion
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			framed = true;
+		}
+	}
+
 	fzprintf(storjEvent::Reply, "fzStorj started, protocol_version=%d", FZSTORJ_PROTOCOL_VERSION);
 
 	std::string host;
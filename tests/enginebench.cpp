@@ -0,0 +1,619 @@
+/*
+ * Engine throughput benchmark, run it through `make bench`.
+ *
+ * Uploads and downloads a file through CFileZillaEngine and reports the
+ * throughput as well as the CPU time spent per GiB of data, both for this
+ * process and any child processes like fzsftp. Local file contents are
+ * synthetic, see OPTION_IO_SYNTHETIC, so the disk does not skew the results.
+ *
+ * Plain FTP runs against a minimal stand-in server on the loopback
+ * interface. It runs in a separate process so that its CPU time is not
+ * accounted for. FTPS and SFTP need a real server, e.g. a local vsftpd or
+ * sshd, passed through the environment:
+ *
+ *   FZ_BENCH_FTPS=user:password@host:port/path   (explicit FTP over TLS)
+ *   FZ_BENCH_SFTP=user:password@host:port/path
+ *
+ * Other environment variables:
+ *
+ *   FZ_BENCH_SIZE    Size of the transferred file in MiB, default 1024
+ *   FZ_BENCH_FZSFTP  Path to the fzsftp executable
+ *   FZ_BENCH_VERBOSE If set, the engine's log messages are printed
+ */
+
+#include <libfilezilla_engine.h>
+#include <engine_context.h>
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/format.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef FZ_WINDOWS
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::wstring const bench_file = L"fzbench.dat";
+
+class BenchOptions final : public COptionsBase
+{
+public:
+	BenchOptions()
+	{
+		// Defaults as in src/interface/Options.cpp for all numeric options
+		// where zero would change the behavior of the engine.
+		numbers_[OPTION_USEPASV] = 1;
+		numbers_[OPTION_LIMITPORTS_LOW] = 6000;
+		numbers_[OPTION_LIMITPORTS_HIGH] = 7000;
+		numbers_[OPTION_NOEXTERNALONLOCAL] = 1;
+		numbers_[OPTION_TIMEOUT] = 20;
+		numbers_[OPTION_ALLOW_TRANSFERMODEFALLBACK] = 1;
+		numbers_[OPTION_SPEEDLIMIT_INBOUND] = 1000;
+		numbers_[OPTION_SPEEDLIMIT_OUTBOUND] = 100;
+		numbers_[OPTION_SOCKET_BUFFERSIZE_RECV] = 4194304;
+		numbers_[OPTION_SOCKET_BUFFERSIZE_SEND] = 262144;
+		numbers_[OPTION_LOGGING_FILE_SIZELIMIT] = 10;
+		numbers_[OPTION_SIZE_USETHOUSANDSEP] = 1;
+		numbers_[OPTION_SIZE_DECIMALPLACES] = 1;
+		numbers_[OPTION_TCP_KEEPALIVE_INTERVAL] = 15;
+		numbers_[OPTION_CACHE_TTL] = 600;
+		numbers_[OPTION_IO_BUFFERCOUNT_MIN] = 4;
+		numbers_[OPTION_IO_BUFFERCOUNT_MAX] = 32;
+		numbers_[OPTION_IO_BUFFERSIZE_MIN] = 65536;
+		numbers_[OPTION_IO_BUFFERSIZE_MAX] = 4194304;
+		numbers_[OPTION_IO_URING] = 1;
+		numbers_[OPTION_FTP_ZEROCOPY] = 1;
+
+		numbers_[OPTION_IO_SYNTHETIC] = 1;
+		numbers_[OPTION_RECONNECTCOUNT] = 0;
+	}
+
+	virtual int GetOptionVal(unsigned int nID) override
+	{
+		auto it = numbers_.find(nID);
+		return it != numbers_.end() ? it->second : 0;
+	}
+
+	virtual std::wstring GetOption(unsigned int nID) override
+	{
+		auto it = strings_.find(nID);
+		return it != strings_.end() ? it->second : std::wstring();
+	}
+
+	virtual std::unique_ptr<pugi::xml_document> GetOptionXml(unsigned int) override
+	{
+		return nullptr;
+	}
+
+	virtual bool SetOption(unsigned int nID, int value) override
+	{
+		numbers_[nID] = value;
+		return true;
+	}
+
+	virtual bool SetOption(unsigned int nID, std::wstring const& value) override
+	{
+		strings_[nID] = value;
+		return true;
+	}
+
+	virtual bool SetOptionXml(unsigned int, std::unique_ptr<pugi::xml_document> const&) override
+	{
+		return false;
+	}
+
+private:
+	// Only modified before the engine context gets created
+	std::map<unsigned int, int> numbers_;
+	std::map<unsigned int, std::wstring> strings_;
+};
+
+class BenchEncodingConverter final : public CustomEncodingConverterBase
+{
+public:
+	virtual std::wstring toLocal(std::wstring const&, char const* buffer, size_t len) const override
+	{
+		return fz::to_wstring_from_utf8(std::string(buffer, len));
+	}
+
+	virtual std::string toServer(std::wstring const&, wchar_t const* buffer, size_t len) const override
+	{
+		return fz::to_utf8(std::wstring(buffer, len));
+	}
+};
+
+class BenchNotificationHandler final : public EngineNotificationHandler
+{
+public:
+	virtual void OnEngineEvent(CFileZillaEngine*) override
+	{
+		fz::scoped_lock l(mutex_);
+		condition_.signal(l);
+	}
+
+	void Wait()
+	{
+		fz::scoped_lock l(mutex_);
+		condition_.wait(l);
+	}
+
+private:
+	fz::mutex mutex_;
+	fz::condition condition_;
+};
+
+bool verbose{};
+
+void ReplyToRequest(CFileZillaEngine & engine, std::unique_ptr<CAsyncRequestNotification> && request)
+{
+	switch (request->GetRequestID()) {
+	case reqId_fileexists:
+		static_cast<CFileExistsNotification&>(*request).overwriteAction = CFileExistsNotification::overwrite;
+		break;
+	case reqId_hostkey:
+	case reqId_hostkeyChanged:
+		static_cast<CHostKeyNotification&>(*request).m_trust = true;
+		break;
+	case reqId_certificate:
+		static_cast<CCertificateNotification&>(*request).m_trusted = true;
+		break;
+	default:
+		break;
+	}
+	engine.SetAsyncRequestReply(std::move(request));
+}
+
+// Executes the command and waits for it to finish, returns the reply code
+int Run(CFileZillaEngine & engine, BenchNotificationHandler & handler, CCommand const& command)
+{
+	int res = engine.Execute(command);
+	if (res != FZ_REPLY_WOULDBLOCK) {
+		return res;
+	}
+
+	bool done = false;
+	while (!done) {
+		handler.Wait();
+
+		// Always drain the queue, there are no further events otherwise
+		while (auto notification = engine.GetNextNotification()) {
+			switch (notification->GetID()) {
+			case nId_operation:
+				res = static_cast<COperationNotification&>(*notification).nReplyCode;
+				done = true;
+				break;
+			case nId_asyncrequest:
+				ReplyToRequest(engine, std::unique_ptr<CAsyncRequestNotification>(static_cast<CAsyncRequestNotification*>(notification.release())));
+				break;
+			case nId_logmsg:
+				if (verbose) {
+					std::wcerr << static_cast<CLogmsgNotification&>(*notification).msg << std::endl;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	return res;
+}
+
+struct Target final
+{
+	std::wstring name;
+	CServer server;
+	Credentials credentials;
+	CServerPath path;
+};
+
+// Parses user:password@host:port/path
+bool ParseTarget(Target & target, ServerProtocol protocol, std::string const& spec)
+{
+	auto at = spec.rfind('@');
+	if (at == std::string::npos) {
+		return false;
+	}
+	auto colon = spec.find(':');
+	if (colon == std::string::npos || colon > at) {
+		return false;
+	}
+	auto slash = spec.find('/', at);
+	std::string hostport = spec.substr(at + 1, slash == std::string::npos ? std::string::npos : slash - at - 1);
+	auto portpos = hostport.rfind(':');
+	if (portpos == std::string::npos) {
+		return false;
+	}
+
+	target.server = CServer(protocol, DEFAULT, fz::to_wstring_from_utf8(hostport.substr(0, portpos)), static_cast<unsigned int>(fz::to_integral<int>(hostport.substr(portpos + 1))));
+	target.server.SetUser(fz::to_wstring_from_utf8(spec.substr(0, colon)));
+	target.credentials.logonType_ = LogonType::normal;
+	target.credentials.SetPass(fz::to_wstring_from_utf8(spec.substr(colon + 1, at - colon - 1)));
+	target.path = CServerPath(slash == std::string::npos ? L"/" : fz::to_wstring_from_utf8(spec.substr(slash)));
+	return true;
+}
+
+#ifndef FZ_WINDOWS
+
+// Minimal FTP server, just enough for the engine to transfer a single file.
+// Downloads yield size bytes of zeros, uploads get discarded.
+class StandInServer final
+{
+public:
+	~StandInServer()
+	{
+		if (pid_ > 0) {
+			kill(pid_, SIGTERM);
+			waitpid(pid_, nullptr, 0);
+		}
+	}
+
+	// Must be called before any threads get started
+	bool Start(int64_t size)
+	{
+		size_ = size;
+
+		int fd = Listen(port_);
+		if (fd == -1) {
+			return false;
+		}
+
+		pid_ = fork();
+		if (pid_ < 0) {
+			close(fd);
+			return false;
+		}
+		if (!pid_) {
+			for (;;) {
+				int control = accept(fd, nullptr, nullptr);
+				if (control != -1) {
+					Serve(control);
+					close(control);
+				}
+			}
+		}
+
+		close(fd);
+		return true;
+	}
+
+	int Port() const { return port_; }
+
+private:
+	static int Listen(int & port)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd == -1) {
+			return -1;
+		}
+
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) || listen(fd, 1) ||
+			getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len))
+		{
+			close(fd);
+			return -1;
+		}
+
+		port = ntohs(addr.sin_port);
+		return fd;
+	}
+
+	static bool Send(int fd, std::string const& reply)
+	{
+		std::string const line = reply + "\r\n";
+		return write(fd, line.c_str(), line.size()) == static_cast<ssize_t>(line.size());
+	}
+
+	void Serve(int control)
+	{
+		std::string buffer;
+		int pasv = -1;
+
+		Send(control, "220 FileZilla benchmark stand-in server");
+		for (;;) {
+			size_t pos;
+			while ((pos = buffer.find("\r\n")) == std::string::npos) {
+				char tmp[1024];
+				ssize_t r = read(control, tmp, sizeof(tmp));
+				if (r <= 0) {
+					if (pasv != -1) {
+						close(pasv);
+					}
+					return;
+				}
+				buffer.append(tmp, static_cast<size_t>(r));
+			}
+			std::string const line = buffer.substr(0, pos);
+			buffer.erase(0, pos + 2);
+
+			std::string cmd = line.substr(0, line.find(' '));
+			for (auto & c : cmd) {
+				c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+			}
+
+			if (cmd == "USER") {
+				Send(control, "331 Password required");
+			}
+			else if (cmd == "PASS") {
+				Send(control, "230 Logged on");
+			}
+			else if (cmd == "SYST") {
+				Send(control, "215 UNIX emulated by FileZilla");
+			}
+			else if (cmd == "FEAT") {
+				Send(control, "211-Features:\r\n EPSV\r\n REST STREAM\r\n SIZE\r\n211 End");
+			}
+			else if (cmd == "PWD") {
+				Send(control, "257 \"/\" is current directory.");
+			}
+			else if (cmd == "CWD" || cmd == "TYPE" || cmd == "OPTS" || cmd == "NOOP") {
+				Send(control, "200 OK");
+			}
+			else if (cmd == "REST") {
+				Send(control, "350 Restarting");
+			}
+			else if (cmd == "SIZE") {
+				Send(control, fz::sprintf("213 %d", size_));
+			}
+			else if (cmd == "PASV" || cmd == "EPSV") {
+				if (pasv != -1) {
+					close(pasv);
+				}
+				int port;
+				pasv = Listen(port);
+				if (pasv == -1) {
+					Send(control, "421 Could not create socket");
+				}
+				else if (cmd == "PASV") {
+					Send(control, fz::sprintf("227 Entering Passive Mode (127,0,0,1,%d,%d)", port / 256, port % 256));
+				}
+				else {
+					Send(control, fz::sprintf("229 Entering Extended Passive Mode (|||%d|)", port));
+				}
+			}
+			else if (cmd == "LIST" || cmd == "RETR" || cmd == "STOR") {
+				if (pasv == -1) {
+					Send(control, "425 Use PASV first");
+					continue;
+				}
+				Send(control, "150 Opening data channel");
+				int data = accept(pasv, nullptr, nullptr);
+				close(pasv);
+				pasv = -1;
+				if (data == -1) {
+					Send(control, "425 Can't open data connection");
+					continue;
+				}
+
+				bool ok;
+				if (cmd == "LIST") {
+					ok = Send(data, fz::sprintf("-rw-r--r-- 1 fz fz %d Jan 01 00:00 %s", size_, fz::to_utf8(bench_file)));
+				}
+				else if (cmd == "RETR") {
+					ok = Produce(data);
+				}
+				else {
+					ok = Consume(data);
+				}
+				close(data);
+				Send(control, ok ? "226 Transfer complete" : "426 Transfer aborted");
+			}
+			else if (cmd == "QUIT") {
+				Send(control, "221 Goodbye");
+				return;
+			}
+			else {
+				Send(control, "502 Command not implemented");
+			}
+		}
+	}
+
+	bool Produce(int data)
+	{
+		static char const buffer[256 * 1024]{};
+		int64_t left = size_;
+		while (left > 0) {
+			size_t chunk = static_cast<size_t>(std::min<int64_t>(left, sizeof(buffer)));
+			ssize_t written = write(data, buffer, chunk);
+			if (written <= 0) {
+				return false;
+			}
+			left -= written;
+		}
+		return true;
+	}
+
+	bool Consume(int data)
+	{
+		static char buffer[256 * 1024];
+		for (;;) {
+			ssize_t r = read(data, buffer, sizeof(buffer));
+			if (r <= 0) {
+				return !r;
+			}
+		}
+	}
+
+	pid_t pid_{-1};
+	int port_{};
+	int64_t size_{};
+};
+
+// CPU time of this process and its terminated children, in seconds
+double CpuTime()
+{
+	double ret = 0;
+	for (int who : {RUSAGE_SELF, RUSAGE_CHILDREN}) {
+		rusage usage{};
+		getrusage(who, &usage);
+		ret += usage.ru_utime.tv_sec + usage.ru_stime.tv_sec;
+		ret += (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+	}
+	return ret;
+}
+
+std::string GetEnv(char const* name)
+{
+	char const* v = getenv(name);
+	return v ? v : "";
+}
+
+#endif
+}
+
+int main(int, char*[])
+{
+#ifdef FZ_WINDOWS
+	std::cerr << "The engine benchmark is not supported on this platform" << std::endl;
+	return 0;
+#else
+	int64_t const mib = fz::to_integral<int64_t>(GetEnv("FZ_BENCH_SIZE"), 1024);
+	int64_t const size = mib * 1024 * 1024;
+	verbose = !GetEnv("FZ_BENCH_VERBOSE").empty();
+
+	StandInServer standin;
+	if (!standin.Start(size)) {
+		std::cerr << "Could not start stand-in server" << std::endl;
+		return 1;
+	}
+
+	std::vector<Target> targets;
+	{
+		Target t;
+		t.name = L"FTP";
+		t.server = CServer(INSECURE_FTP, DEFAULT, L"127.0.0.1", static_cast<unsigned int>(standin.Port()));
+		t.server.SetUser(L"bench");
+		t.credentials.logonType_ = LogonType::normal;
+		t.credentials.SetPass(L"bench");
+		t.path = CServerPath(L"/");
+		targets.push_back(t);
+	}
+	std::string spec = GetEnv("FZ_BENCH_FTPS");
+	if (!spec.empty()) {
+		Target t;
+		t.name = L"FTPS";
+		if (ParseTarget(t, FTPES, spec)) {
+			targets.push_back(t);
+		}
+		else {
+			std::cerr << "Ignoring malformed FZ_BENCH_FTPS" << std::endl;
+		}
+	}
+	spec = GetEnv("FZ_BENCH_SFTP");
+	if (!spec.empty()) {
+		Target t;
+		t.name = L"SFTP";
+		if (ParseTarget(t, SFTP, spec)) {
+			targets.push_back(t);
+		}
+		else {
+			std::cerr << "Ignoring malformed FZ_BENCH_SFTP" << std::endl;
+		}
+	}
+
+	std::string tmpl = GetEnv("TMPDIR");
+	tmpl = (tmpl.empty() ? std::string("/tmp") : tmpl) + "/fzbench.XXXXXX";
+	if (!mkdtemp(&tmpl[0])) {
+		std::cerr << "Could not create temporary directory" << std::endl;
+		return 1;
+	}
+	std::wstring const dir = fz::to_wstring(tmpl);
+	std::wstring const source = dir + L"/" + bench_file;
+	std::wstring const sink = dir + L"/download.dat";
+
+	// Sparse, reading it does not hit the disk. fzsftp reads it as-is as
+	// synthetic I/O only applies to file access inside the engine.
+	{
+		fz::file f(fz::to_native(source), fz::file::writing, fz::file::empty);
+		if (!f.opened() || f.seek(size, fz::file::begin) != size || !f.truncate()) {
+			std::cerr << "Could not create source file" << std::endl;
+			return 1;
+		}
+	}
+
+	BenchOptions options;
+	std::string const fzsftp = GetEnv("FZ_BENCH_FZSFTP");
+	if (!fzsftp.empty()) {
+		options.SetOption(OPTION_FZSFTP_EXECUTABLE, fz::to_wstring(fzsftp));
+	}
+
+	BenchEncodingConverter converter;
+	CFileZillaEngineContext context(options, converter);
+
+	std::wcout << std::left << std::setw(16) << L"" << std::right << std::setw(10) << L"MiB/s" << std::setw(14) << L"CPU ms/GiB" << std::endl;
+
+	int ret = 0;
+	for (auto const& target : targets) {
+		for (bool download : {false, true}) {
+			BenchNotificationHandler handler;
+			double wall{};
+			double cpu{};
+			int res;
+			{
+				CFileZillaEngine engine(context, handler);
+
+				res = Run(engine, handler, CConnectCommand(target.server, target.credentials, false));
+				if (res == FZ_REPLY_OK) {
+					CFileTransferCommand::t_transferSettings settings;
+					settings.binary = true;
+
+					// fzsftp accesses the local file on its own, discard downloaded data there
+					std::wstring local = download ? sink : source;
+					if (download && target.server.GetProtocol() == SFTP) {
+						local = L"/dev/null";
+					}
+
+					cpu = -CpuTime();
+					auto const start = fz::monotonic_clock::now();
+					res = Run(engine, handler, CFileTransferCommand(local, target.path, bench_file, download, settings));
+					wall = (fz::monotonic_clock::now() - start).get_milliseconds() / 1000.0;
+
+					Run(engine, handler, CDisconnectCommand());
+				}
+			}
+			// The engine has been destroyed and fzsftp, if any, reaped
+			cpu += CpuTime();
+
+			std::wcout << std::left << std::setw(7) << target.name << std::setw(9) << (download ? L"download" : L"upload");
+			if (res != FZ_REPLY_OK) {
+				std::wcout << L" failed with reply code " << res << std::endl;
+				ret = 1;
+				continue;
+			}
+
+			double const gib = static_cast<double>(size) / (1024 * 1024 * 1024);
+			std::wcout << std::right << std::fixed << std::setprecision(1)
+				<< std::setw(10) << (wall > 0 ? static_cast<double>(mib) / wall : 0.0)
+				<< std::setw(14) << (cpu / gib * 1000) << std::endl;
+		}
+	}
+
+	fz::remove_file(fz::to_native(source));
+	fz::remove_file(fz::to_native(sink));
+	rmdir(tmpl.c_str());
+
+	return ret;
+#endif
+}
@@ -0,0 +1,97 @@
+#include <libfilezilla_engine.h>
+#include <lineendings.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Microbenchmark for the line ending conversion of ASCII mode transfers.
+ * Converts generated text with lines of about 80 characters using each
+ * kernel supported by the CPU, in buffers of the size used by CIOThread.
+ */
+
+namespace {
+size_t const bufferSize = 256 * 1024;
+size_t const totalSize = 512 * 1024 * 1024;
+
+char const* name(LineEndingKernel kernel)
+{
+	switch (kernel) {
+	case LineEndingKernel::avx2:
+		return "avx2";
+	case LineEndingKernel::sse2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+std::vector<char> generate(bool crlf)
+{
+	std::mt19937 rng(42);
+
+	std::vector<char> ret;
+	ret.reserve(bufferSize);
+	while (ret.size() < bufferSize) {
+		size_t const line = 60 + rng() % 40;
+		for (size_t i = 0; i < line && ret.size() < bufferSize; ++i) {
+			ret.push_back(static_cast<char>(' ' + rng() % 95));
+		}
+		if (crlf && ret.size() < bufferSize) {
+			ret.push_back('\r');
+		}
+		if (ret.size() < bufferSize) {
+			ret.push_back('\n');
+		}
+	}
+	return ret;
+}
+
+template<typename F>
+void run(char const* direction, LineEndingKernel kernel, F const& f)
+{
+	auto const start = std::chrono::steady_clock::now();
+	for (size_t done = 0; done < totalSize; done += bufferSize) {
+		f();
+	}
+	auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%s %-6s %8.1f MB/s\n", direction, name(kernel), totalSize / elapsed / 1000000);
+}
+}
+
+int main()
+{
+	std::vector<LineEndingKernel> kernels{LineEndingKernel::scalar};
+	if (GetLineEndingKernel() >= LineEndingKernel::sse2) {
+		kernels.push_back(LineEndingKernel::sse2);
+	}
+	if (GetLineEndingKernel() >= LineEndingKernel::avx2) {
+		kernels.push_back(LineEndingKernel::avx2);
+	}
+
+	std::vector<char> const lf = generate(false);
+	std::vector<char> const crlf = generate(true);
+
+	std::vector<char> buffer(bufferSize * 2);
+	for (auto kernel : kernels) {
+		run("LF -> CRLF", kernel, [&]() {
+			bool wasCR{};
+			memcpy(buffer.data() + bufferSize, lf.data(), bufferSize);
+			ConvertLFToCRLF(buffer.data() + bufferSize, bufferSize, buffer.data(), wasCR, kernel);
+		});
+	}
+	for (auto kernel : kernels) {
+		run("CRLF -> LF", kernel, [&]() {
+			bool pendingCR{};
+			memcpy(buffer.data(), crlf.data(), bufferSize);
+			ConvertCRLFToLF(buffer.data(), bufferSize, pendingCR, kernel);
+		});
+	}
+
+	return 0;
+}
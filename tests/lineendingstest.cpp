@@ -0,0 +1,186 @@
+#include <libfilezilla_engine.h>
+#include <lineendings.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+/*
+ * This testsuite asserts the correctness of the line ending conversion
+ * used for ASCII mode transfers. All kernels supported by the CPU must
+ * produce the same output as the scalar one, independent of how the
+ * data is split into buffers.
+ */
+
+class CLineEndingsTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CLineEndingsTest);
+	CPPUNIT_TEST(testLFToCRLF);
+	CPPUNIT_TEST(testCRLFToLF);
+	CPPUNIT_TEST(testCarry);
+	CPPUNIT_TEST(testKernels);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testLFToCRLF();
+	void testCRLFToLF();
+	void testCarry();
+	void testKernels();
+
+private:
+	std::vector<LineEndingKernel> Kernels();
+
+	// Converts the data in chunks of the given sizes, the same way CIOThread does
+	std::string ToCRLF(std::string const& data, std::vector<size_t> const& chunks, LineEndingKernel kernel);
+	std::string ToLF(std::string const& data, std::vector<size_t> const& chunks, LineEndingKernel kernel);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CLineEndingsTest);
+
+std::vector<LineEndingKernel> CLineEndingsTest::Kernels()
+{
+	std::vector<LineEndingKernel> ret{LineEndingKernel::scalar};
+	if (GetLineEndingKernel() >= LineEndingKernel::sse2) {
+		ret.push_back(LineEndingKernel::sse2);
+	}
+	if (GetLineEndingKernel() >= LineEndingKernel::avx2) {
+		ret.push_back(LineEndingKernel::avx2);
+	}
+	return ret;
+}
+
+std::string CLineEndingsTest::ToCRLF(std::string const& data, std::vector<size_t> const& chunks, LineEndingKernel kernel)
+{
+	std::string ret;
+	bool wasCR{};
+
+	size_t pos = 0;
+	for (size_t i = 0; pos < data.size(); ++i) {
+		size_t const len = std::min(chunks[i % chunks.size()], data.size() - pos);
+
+		// Input at the end of a buffer twice its size, as in CIOThread::ReadFromFile
+		std::vector<char> buffer(len * 2);
+		memcpy(buffer.data() + len, data.data() + pos, len);
+		size_t const written = ConvertLFToCRLF(buffer.data() + len, len, buffer.data(), wasCR, kernel);
+		ret.append(buffer.data(), written);
+
+		pos += len;
+	}
+
+	return ret;
+}
+
+std::string CLineEndingsTest::ToLF(std::string const& data, std::vector<size_t> const& chunks, LineEndingKernel kernel)
+{
+	std::string ret;
+	bool pendingCR{};
+
+	size_t pos = 0;
+	for (size_t i = 0; pos < data.size(); ++i) {
+		size_t const len = std::min(chunks[i % chunks.size()], data.size() - pos);
+
+		std::vector<char> buffer(data.begin() + pos, data.begin() + pos + len);
+
+		// As in CIOThread::WriteToFile
+		if (pendingCR && buffer[0] != '\n' && buffer[0] != '\r') {
+			pendingCR = false;
+			ret += '\r';
+		}
+		size_t const written = ConvertCRLFToLF(buffer.data(), len, pendingCR, kernel);
+		ret.append(buffer.data(), written);
+
+		pos += len;
+	}
+
+	// As in CIOThread::Finalize
+	if (pendingCR) {
+		ret += '\r';
+	}
+
+	return ret;
+}
+
+void CLineEndingsTest::testLFToCRLF()
+{
+	for (auto kernel : Kernels()) {
+		CPPUNIT_ASSERT_EQUAL(std::string(), ToCRLF("", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo"), ToCRLF("foo", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\r\nbar\r\n"), ToCRLF("foo\nbar\n", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\r\nbar"), ToCRLF("foo\r\nbar", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("\r\n\r\n"), ToCRLF("\n\n", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("\r\r\n"), ToCRLF("\r\n", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("a\rb"), ToCRLF("a\rb", {16}, kernel));
+	}
+}
+
+void CLineEndingsTest::testCRLFToLF()
+{
+	for (auto kernel : Kernels()) {
+		CPPUNIT_ASSERT_EQUAL(std::string(), ToLF("", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo"), ToLF("foo", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\nbar\n"), ToLF("foo\r\nbar\r\n", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\nbar"), ToLF("foo\nbar", {16}, kernel));
+
+		// Stand-alone CRs are kept, runs of them collapsed
+		CPPUNIT_ASSERT_EQUAL(std::string("a\rb"), ToLF("a\rb", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("a\rb"), ToLF("a\r\r\rb", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("a\nb"), ToLF("a\r\r\nb", {16}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("a\r"), ToLF("a\r", {16}, kernel));
+	}
+}
+
+void CLineEndingsTest::testCarry()
+{
+	for (auto kernel : Kernels()) {
+		// Line endings split across buffers
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\r\nbar"), ToCRLF("foo\r\nbar", {4}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\r\nbar"), ToCRLF("foo\nbar", {3}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\nbar"), ToLF("foo\r\nbar", {4}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\rbar"), ToLF("foo\rbar", {4}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("foo\nbar"), ToLF("foo\r\r\nbar", {4, 1}, kernel));
+
+		// Previously, a CR at the end of one buffer followed by a buffer
+		// starting with LF and not containing any CR was written back out
+		// in front of the next buffer.
+		CPPUNIT_ASSERT_EQUAL(std::string("a\nbc"), ToLF("a\r\nbc", {2, 1}, kernel));
+
+		// Byte by byte
+		CPPUNIT_ASSERT_EQUAL(std::string("a\r\nb\r\n\rc"), ToCRLF("a\nb\r\n\rc", {1}, kernel));
+		CPPUNIT_ASSERT_EQUAL(std::string("a\nb\rc\r"), ToLF("a\r\nb\r\rc\r", {1}, kernel));
+	}
+}
+
+void CLineEndingsTest::testKernels()
+{
+	std::mt19937 rng(42);
+
+	for (int i = 0; i < 200; ++i) {
+		// Mostly long lines so that the vectorized kernels hit their fast path
+		std::string data(rng() % 4096, 0);
+		for (auto & c : data) {
+			unsigned int const r = rng() % 64;
+			c = (r == 0) ? '\r' : ((r == 1) ? '\n' : static_cast<char>('a' + r % 26));
+		}
+
+		std::vector<size_t> chunks;
+		for (int j = 0; j < 8; ++j) {
+			chunks.push_back(1 + rng() % 200);
+		}
+
+		std::string const crlf = ToCRLF(data, {data.size() + 1}, LineEndingKernel::scalar);
+		std::string const lf = ToLF(data, {data.size() + 1}, LineEndingKernel::scalar);
+
+		for (auto kernel : Kernels()) {
+			CPPUNIT_ASSERT(ToCRLF(data, chunks, kernel) == crlf);
+			CPPUNIT_ASSERT(ToLF(data, chunks, kernel) == lf);
+		}
+	}
+}